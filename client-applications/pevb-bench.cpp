@@ -0,0 +1,810 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * pevb-bench: DMA throughput benchmark.
+ *
+ * Sweeps transfer direction, memory kind, transfer size, and buffer alignment.
+ * Each combination is run for a number of un-timed warm-up iterations, then
+ * a number of timed repetitions, and the distribution of per-transfer times
+ * is reported along with the CPU cost per GB transferred.
+ *
+ * When built by nvcc (PEVB_BENCH_CUDA), CUDA memory kinds are available.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <exception>
+#include <string>
+#include <vector>
+#ifdef PEVB_BENCH_CUDA
+#include "picoevb-cuda.hpp"
+#else
+#include "picoevb.hpp"
+#endif
+
+enum Direction {
+	DIR_H2C,
+	DIR_C2H,
+	DIR_H2C2H,
+	DIR_COUNT
+};
+
+static const char * const direction_names[DIR_COUNT] = {
+	"h2c",
+	"c2h",
+	"h2c2h",
+};
+
+enum Memory {
+	MEM_MALLOC,
+	MEM_HUGEPAGE,
+	MEM_HUGEPAGE_1G,
+	MEM_MEMFD_HUGEPAGE,
+	MEM_MEMFD_HUGEPAGE_1G,
+	MEM_CUDA_HOST,
+	MEM_CUDA_DEVICE,
+	MEM_COUNT
+};
+
+static const char * const memory_names[MEM_COUNT] = {
+	"malloc",
+	"hugepage",
+	"hugepage-1g",
+	"memfd-hugepage",
+	"memfd-hugepage-1g",
+	"cuda-host",
+	"cuda-device",
+};
+
+enum Format {
+	FMT_TABLE,
+	FMT_CSV,
+	FMT_JSON,
+};
+
+struct Config {
+	std::vector<int> directions;
+	std::vector<int> memories;
+	bool memories_explicit;
+	std::vector<uint64_t> sizes;
+	std::vector<uint64_t> aligns;
+	unsigned int warmup;
+	unsigned int reps;
+	Format format;
+	const char *output;
+};
+
+struct Result {
+	int direction;
+	int memory;
+	uint64_t size;
+	uint64_t align;
+	/* Wall-clock time of each ioctl, in ns, sorted */
+	std::vector<uint64_t> wall_ns;
+	/* The driver's dma_time_ns of each transfer */
+	std::vector<uint64_t> dma_ns;
+	/* The driver's per-phase timing, summed over all transfers */
+	struct picoevb_rdma_dma_timing phases;
+	bool have_cycles;
+	uint64_t cycles;
+	uint64_t cpu_ns;
+};
+
+static uint64_t now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Counts CPU cycles (user and kernel) consumed by this thread. Counting kernel
+ * cycles requires perf_event_paranoid <= 1 or CAP_PERFMON; if unavailable,
+ * only thread CPU time is measured.
+ */
+class CpuCounter {
+public:
+	CpuCounter() : fd_(-1), cycles_(0), cpu_ns_(0), cpu_start_(0)
+	{
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = PERF_COUNT_HW_CPU_CYCLES;
+		attr.disabled = 1;
+		attr.exclude_hv = 1;
+		fd_ = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+
+	~CpuCounter()
+	{
+		if (fd_ >= 0)
+			close(fd_);
+	}
+
+	CpuCounter(const CpuCounter &) = delete;
+	CpuCounter &operator=(const CpuCounter &) = delete;
+
+	bool have_cycles() const { return fd_ >= 0; }
+	uint64_t cycles() const { return cycles_; }
+	uint64_t cpu_ns() const { return cpu_ns_; }
+
+	void start()
+	{
+		if (fd_ >= 0) {
+			ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+		}
+		cpu_start_ = now_ns(CLOCK_THREAD_CPUTIME_ID);
+	}
+
+	void stop()
+	{
+		cpu_ns_ = now_ns(CLOCK_THREAD_CPUTIME_ID) - cpu_start_;
+		if (fd_ >= 0) {
+			ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+			if (read(fd_, &cycles_, sizeof(cycles_)) !=
+					sizeof(cycles_))
+				cycles_ = 0;
+		}
+	}
+
+private:
+	int fd_;
+	uint64_t cycles_;
+	uint64_t cpu_ns_;
+	uint64_t cpu_start_;
+};
+
+#ifdef PEVB_BENCH_CUDA
+/* cudaHostAlloc() memory, used as ordinary host memory */
+class CudaHostAllocation {
+public:
+	explicit CudaHostAllocation(size_t size) : data_(nullptr), size_(size)
+	{
+		cudaError_t ce;
+
+		ce = cudaHostAlloc(&data_, size, cudaHostAllocDefault);
+		if (ce != cudaSuccess)
+			throw picoevb::CudaError(ce, "cudaHostAlloc()");
+	}
+
+	~CudaHostAllocation()
+	{
+		cudaFreeHost(data_);
+	}
+
+	CudaHostAllocation(const CudaHostAllocation &) = delete;
+	CudaHostAllocation &operator=(const CudaHostAllocation &) = delete;
+
+	picoevb::HostRef ref() { return picoevb::HostRef(data_, size_); }
+
+private:
+	void *data_;
+	size_t size_;
+};
+#endif
+
+template <class Buf>
+static uint64_t transfer(picoevb::Device &dev, int direction, Buf &a, Buf &b,
+	uint64_t align, uint64_t size,
+	struct picoevb_rdma_dma_timing *timing = nullptr)
+{
+	switch (direction) {
+	case DIR_H2C:
+		return dev.h2c(a, align, 0, size, timing);
+	case DIR_C2H:
+		return dev.c2h(0, a, align, size, timing);
+	default:
+		return dev.h2c2h(a, align, b, align, size, timing);
+	}
+}
+
+static void add_phases(struct picoevb_rdma_dma_timing &total,
+	const struct picoevb_rdma_dma_timing &t)
+{
+	total.pin_ns += t.pin_ns;
+	total.map_ns += t.map_ns;
+	total.queue_wait_ns += t.queue_wait_ns;
+	total.hw_ns += t.hw_ns;
+	total.irq_to_wake_ns += t.irq_to_wake_ns;
+	total.unmap_ns += t.unmap_ns;
+	total.descs += t.descs;
+}
+
+template <class Buf>
+static void bench_memory(picoevb::Device &dev, const Config &cfg, int memory,
+	Buf &a, Buf &b, std::vector<Result> &results)
+{
+	CpuCounter counter;
+	struct picoevb_rdma_dma_timing timing;
+	size_t di, si, ai;
+	unsigned int i;
+	uint64_t ts, dma_ns;
+
+	for (di = 0; di < cfg.directions.size(); di++) {
+		int direction = cfg.directions[di];
+
+		for (si = 0; si < cfg.sizes.size(); si++) {
+			uint64_t size = cfg.sizes[si];
+
+			/* h2c2h is chunked; the others must fit in RAM */
+			if (direction != DIR_H2C2H &&
+					size > dev.fpga_ram_size())
+				continue;
+
+			for (ai = 0; ai < cfg.aligns.size(); ai++) {
+				uint64_t align = cfg.aligns[ai];
+				Result r;
+
+				r.direction = direction;
+				r.memory = memory;
+				r.size = size;
+				r.align = align;
+				r.wall_ns.reserve(cfg.reps);
+				r.dma_ns.reserve(cfg.reps);
+				memset(&r.phases, 0, sizeof(r.phases));
+
+				for (i = 0; i < cfg.warmup; i++)
+					transfer(dev, direction, a, b, align,
+						size);
+
+				counter.start();
+				for (i = 0; i < cfg.reps; i++) {
+					ts = now_ns(CLOCK_MONOTONIC);
+					dma_ns = transfer(dev, direction, a, b,
+						align, size, &timing);
+					r.wall_ns.push_back(
+						now_ns(CLOCK_MONOTONIC) - ts);
+					r.dma_ns.push_back(dma_ns);
+					add_phases(r.phases, timing);
+				}
+				counter.stop();
+
+				r.have_cycles = counter.have_cycles();
+				r.cycles = counter.cycles();
+				r.cpu_ns = counter.cpu_ns();
+				std::sort(r.wall_ns.begin(), r.wall_ns.end());
+				results.push_back(std::move(r));
+			}
+		}
+	}
+}
+
+static uint64_t buffer_size(const Config &cfg)
+{
+	return *std::max_element(cfg.sizes.begin(), cfg.sizes.end()) +
+		*std::max_element(cfg.aligns.begin(), cfg.aligns.end());
+}
+
+static void bench_host(picoevb::Device &dev, const Config &cfg, int memory,
+	picoevb::HostBuffer::Backing backing, std::vector<Result> &results)
+{
+	picoevb::HostBuffer a(buffer_size(cfg), backing);
+	picoevb::HostBuffer b(buffer_size(cfg), backing);
+
+	memset(a.data(), 0, a.size());
+	memset(b.data(), 0, b.size());
+	bench_memory(dev, cfg, memory, a, b, results);
+}
+
+/* Returns false if memory isn't supported in this build */
+static bool bench(picoevb::Device &dev, const Config &cfg, int memory,
+	std::vector<Result> &results)
+{
+	switch (memory) {
+	case MEM_MALLOC:
+		bench_host(dev, cfg, memory, picoevb::HostBuffer::Backing::PAGES,
+			results);
+		return true;
+	case MEM_HUGEPAGE:
+		bench_host(dev, cfg, memory,
+			picoevb::HostBuffer::Backing::HUGE_PAGES, results);
+		return true;
+	case MEM_HUGEPAGE_1G:
+		bench_host(dev, cfg, memory,
+			picoevb::HostBuffer::Backing::HUGE_PAGES_1G, results);
+		return true;
+	case MEM_MEMFD_HUGEPAGE:
+		bench_host(dev, cfg, memory,
+			picoevb::HostBuffer::Backing::MEMFD_HUGE_PAGES,
+			results);
+		return true;
+	case MEM_MEMFD_HUGEPAGE_1G:
+		bench_host(dev, cfg, memory,
+			picoevb::HostBuffer::Backing::MEMFD_HUGE_PAGES_1G,
+			results);
+		return true;
+#ifdef PEVB_BENCH_CUDA
+#ifdef NV_BUILD_DGPU
+	case MEM_CUDA_HOST: {
+		/* dGPU can't RDMA to cudaHostAlloc(); it's just host memory */
+		CudaHostAllocation a_alloc(buffer_size(cfg));
+		CudaHostAllocation b_alloc(buffer_size(cfg));
+		picoevb::HostRef a = a_alloc.ref();
+		picoevb::HostRef b = b_alloc.ref();
+
+		bench_memory(dev, cfg, memory, a, b, results);
+		return true;
+	}
+	case MEM_CUDA_DEVICE:
+#else
+	case MEM_CUDA_HOST:
+#endif
+	{
+		/* PinnedCudaBuffer allocates whichever kind supports RDMA */
+		picoevb::PinnedCudaBuffer a(dev, buffer_size(cfg));
+		picoevb::PinnedCudaBuffer b(dev, buffer_size(cfg));
+
+		bench_memory(dev, cfg, memory, a, b, results);
+		return true;
+	}
+#endif
+	default:
+		return false;
+	}
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	size_t rank;
+
+	if (sorted.empty())
+		return 0;
+	rank = (size_t)ceil(p / 100.0 * sorted.size());
+	if (rank < 1)
+		rank = 1;
+
+	return sorted[rank - 1];
+}
+
+static double mean(const std::vector<uint64_t> &samples)
+{
+	double total = 0;
+	size_t i;
+
+	if (samples.empty())
+		return 0;
+	for (i = 0; i < samples.size(); i++)
+		total += samples[i];
+
+	return total / samples.size();
+}
+
+/* Bytes per microsecond, i.e. MB/s */
+static double mbps(uint64_t size, double ns)
+{
+	return ns > 0 ? size * 1000.0 / ns : 0;
+}
+
+/* Returns a negative value if unavailable */
+static double per_gb(const Result &r, uint64_t count)
+{
+	double bytes = (double)r.size * r.wall_ns.size();
+
+	return bytes > 0 ? count * 1e9 / bytes : -1;
+}
+
+static double phase_mean(const Result &r, uint64_t total)
+{
+	return r.wall_ns.empty() ? 0 : (double)total / r.wall_ns.size();
+}
+
+static void print_table(FILE *f, const std::vector<Result> &results)
+{
+	size_t i;
+
+	fprintf(f, "%-6s %-17s %10s %6s %12s %12s %12s %10s %10s %10s %8s "
+		"%14s\n",
+		"dir", "memory", "size", "align", "mean_us", "median_us",
+		"p99_us", "mean_MB/s", "med_MB/s", "p99_MB/s", "descs",
+		"cycles/GB");
+	for (i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		double m = mean(r.wall_ns);
+		uint64_t med = percentile(r.wall_ns, 50);
+		uint64_t p99 = percentile(r.wall_ns, 99);
+		char cycles[32];
+
+		if (r.have_cycles)
+			snprintf(cycles, sizeof(cycles), "%.0f",
+				per_gb(r, r.cycles));
+		else
+			snprintf(cycles, sizeof(cycles), "n/a");
+
+		fprintf(f, "%-6s %-17s %10" PRIu64 " %6" PRIu64
+			" %12.1f %12.1f %12.1f %10.1f %10.1f %10.1f %8.1f"
+			" %14s\n",
+			direction_names[r.direction], memory_names[r.memory],
+			r.size, r.align, m / 1000.0, med / 1000.0,
+			p99 / 1000.0, mbps(r.size, m), mbps(r.size, med),
+			mbps(r.size, p99), phase_mean(r, r.phases.descs),
+			cycles);
+	}
+}
+
+static void print_csv(FILE *f, const std::vector<Result> &results)
+{
+	size_t i;
+
+	fprintf(f, "direction,memory,size,align,reps,mean_ns,median_ns,p99_ns,"
+		"min_ns,max_ns,dma_mean_ns,mean_mbps,median_mbps,p99_mbps,"
+		"cycles_per_gb,cpu_ns_per_gb,pin_mean_ns,map_mean_ns,"
+		"queue_wait_mean_ns,hw_mean_ns,irq_to_wake_mean_ns,"
+		"unmap_mean_ns,descs_mean\n");
+	for (i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		double m = mean(r.wall_ns);
+		uint64_t med = percentile(r.wall_ns, 50);
+		uint64_t p99 = percentile(r.wall_ns, 99);
+
+		fprintf(f, "%s,%s,%" PRIu64 ",%" PRIu64 ",%zu,%.1f,%" PRIu64
+			",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%.1f,%.3f,%.3f,"
+			"%.3f,",
+			direction_names[r.direction], memory_names[r.memory],
+			r.size, r.align, r.wall_ns.size(), m, med, p99,
+			percentile(r.wall_ns, 0), percentile(r.wall_ns, 100),
+			mean(r.dma_ns), mbps(r.size, m), mbps(r.size, med),
+			mbps(r.size, p99));
+		if (r.have_cycles)
+			fprintf(f, "%.0f", per_gb(r, r.cycles));
+		fprintf(f, ",%.0f", per_gb(r, r.cpu_ns));
+		fprintf(f, ",%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n",
+			phase_mean(r, r.phases.pin_ns),
+			phase_mean(r, r.phases.map_ns),
+			phase_mean(r, r.phases.queue_wait_ns),
+			phase_mean(r, r.phases.hw_ns),
+			phase_mean(r, r.phases.irq_to_wake_ns),
+			phase_mean(r, r.phases.unmap_ns),
+			phase_mean(r, r.phases.descs));
+	}
+}
+
+static void print_json(FILE *f, const picoevb::Device &dev,
+	const std::vector<Result> &results)
+{
+	size_t i, j;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"tool\": \"pevb-bench\",\n");
+	fprintf(f, "  \"fpga_ram_size\": %" PRIu64 ",\n", dev.fpga_ram_size());
+	fprintf(f, "  \"results\": [\n");
+	for (i = 0; i < results.size(); i++) {
+		const Result &r = results[i];
+		double m = mean(r.wall_ns);
+		uint64_t med = percentile(r.wall_ns, 50);
+		uint64_t p99 = percentile(r.wall_ns, 99);
+
+		fprintf(f, "    {\n");
+		fprintf(f, "      \"direction\": \"%s\",\n",
+			direction_names[r.direction]);
+		fprintf(f, "      \"memory\": \"%s\",\n",
+			memory_names[r.memory]);
+		fprintf(f, "      \"size\": %" PRIu64 ",\n", r.size);
+		fprintf(f, "      \"align\": %" PRIu64 ",\n", r.align);
+		fprintf(f, "      \"reps\": %zu,\n", r.wall_ns.size());
+		fprintf(f, "      \"mean_ns\": %.1f,\n", m);
+		fprintf(f, "      \"median_ns\": %" PRIu64 ",\n", med);
+		fprintf(f, "      \"p99_ns\": %" PRIu64 ",\n", p99);
+		fprintf(f, "      \"min_ns\": %" PRIu64 ",\n",
+			percentile(r.wall_ns, 0));
+		fprintf(f, "      \"max_ns\": %" PRIu64 ",\n",
+			percentile(r.wall_ns, 100));
+		fprintf(f, "      \"dma_mean_ns\": %.1f,\n", mean(r.dma_ns));
+		fprintf(f, "      \"mean_mbps\": %.3f,\n", mbps(r.size, m));
+		fprintf(f, "      \"median_mbps\": %.3f,\n",
+			mbps(r.size, med));
+		fprintf(f, "      \"p99_mbps\": %.3f,\n", mbps(r.size, p99));
+		if (r.have_cycles)
+			fprintf(f, "      \"cycles_per_gb\": %.0f,\n",
+				per_gb(r, r.cycles));
+		else
+			fprintf(f, "      \"cycles_per_gb\": null,\n");
+		fprintf(f, "      \"cpu_ns_per_gb\": %.0f,\n",
+			per_gb(r, r.cpu_ns));
+		fprintf(f, "      \"phases_mean_ns\": {\n");
+		fprintf(f, "        \"pin\": %.1f,\n",
+			phase_mean(r, r.phases.pin_ns));
+		fprintf(f, "        \"map\": %.1f,\n",
+			phase_mean(r, r.phases.map_ns));
+		fprintf(f, "        \"queue_wait\": %.1f,\n",
+			phase_mean(r, r.phases.queue_wait_ns));
+		fprintf(f, "        \"hw\": %.1f,\n",
+			phase_mean(r, r.phases.hw_ns));
+		fprintf(f, "        \"irq_to_wake\": %.1f,\n",
+			phase_mean(r, r.phases.irq_to_wake_ns));
+		fprintf(f, "        \"unmap\": %.1f\n",
+			phase_mean(r, r.phases.unmap_ns));
+		fprintf(f, "      },\n");
+		fprintf(f, "      \"descs_mean\": %.1f,\n",
+			phase_mean(r, r.phases.descs));
+		fprintf(f, "      \"samples_ns\": [");
+		for (j = 0; j < r.wall_ns.size(); j++)
+			fprintf(f, "%s%" PRIu64, j ? ", " : "", r.wall_ns[j]);
+		fprintf(f, "]\n");
+		fprintf(f, "    }%s\n", i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+}
+
+static void usage(FILE *f)
+{
+	fprintf(f,
+		"usage: pevb-bench [options]\n"
+		"  -d, --direction LIST  h2c,c2h,h2c2h (default: all)\n"
+		"  -m, --memory LIST     malloc,hugepage,hugepage-1g,\n"
+		"                        memfd-hugepage,memfd-hugepage-1g,\n"
+		"                        cuda-host,cuda-device\n"
+		"                        (default: all supported by this build)\n"
+		"  -s, --sizes LIST      transfer sizes, with optional K/M/G\n"
+		"                        suffix (default: 4K,16K,...,64M)\n"
+		"  -a, --align LIST      buffer offsets in bytes (default: 0)\n"
+		"  -w, --warmup N        un-timed iterations (default: 10)\n"
+		"  -n, --reps N          timed iterations (default: 100)\n"
+		"  -f, --format FMT      table, csv, or json (default: table)\n"
+		"  -o, --output FILE     write results to FILE\n"
+		"  -h, --help\n");
+}
+
+static bool parse_u64(const char *s, uint64_t *val)
+{
+	char *end;
+	unsigned long long v;
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (errno || end == s)
+		return false;
+	switch (*end) {
+	case 'G':
+	case 'g':
+		v <<= 10;
+		/* fall-through */
+	case 'M':
+	case 'm':
+		v <<= 10;
+		/* fall-through */
+	case 'K':
+	case 'k':
+		v <<= 10;
+		end++;
+		break;
+	}
+	if (*end)
+		return false;
+	*val = v;
+
+	return true;
+}
+
+/* Parse a comma-separated list of names into indices */
+static bool parse_names(const char *arg, const char * const *names,
+	int count, std::vector<int> &out)
+{
+	std::string list(arg);
+	size_t start = 0, end;
+	int i;
+
+	out.clear();
+	while (start <= list.size()) {
+		end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		std::string item = list.substr(start, end - start);
+		for (i = 0; i < count; i++)
+			if (item == names[i])
+				break;
+		if (i == count) {
+			fprintf(stderr, "unknown value: %s\n", item.c_str());
+			return false;
+		}
+		out.push_back(i);
+		start = end + 1;
+	}
+
+	return true;
+}
+
+static bool parse_u64s(const char *arg, std::vector<uint64_t> &out)
+{
+	std::string list(arg);
+	size_t start = 0, end;
+	uint64_t v;
+
+	out.clear();
+	while (start <= list.size()) {
+		end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		if (!parse_u64(list.substr(start, end - start).c_str(), &v)) {
+			fprintf(stderr, "invalid number in: %s\n", arg);
+			return false;
+		}
+		out.push_back(v);
+		start = end + 1;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "direction",	required_argument,	0, 'd' },
+		{ "memory",	required_argument,	0, 'm' },
+		{ "sizes",	required_argument,	0, 's' },
+		{ "align",	required_argument,	0, 'a' },
+		{ "warmup",	required_argument,	0, 'w' },
+		{ "reps",	required_argument,	0, 'n' },
+		{ "format",	required_argument,	0, 'f' },
+		{ "output",	required_argument,	0, 'o' },
+		{ "help",	no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	static const char * const format_names[] = { "table", "csv", "json" };
+	Config cfg;
+	std::vector<int> formats;
+	std::vector<Result> results;
+	uint64_t v;
+	size_t i;
+	int opt;
+	FILE *f;
+
+	for (i = 0; i < DIR_COUNT; i++)
+		cfg.directions.push_back(i);
+	for (i = 0; i < MEM_COUNT; i++)
+		cfg.memories.push_back(i);
+	cfg.memories_explicit = false;
+	for (v = 4096; v <= 64 * 1024 * 1024; v *= 4)
+		cfg.sizes.push_back(v);
+	cfg.aligns.push_back(0);
+	cfg.warmup = 10;
+	cfg.reps = 100;
+	cfg.format = FMT_TABLE;
+	cfg.output = NULL;
+
+	while ((opt = getopt_long(argc, argv, "d:m:s:a:w:n:f:o:h", long_opts,
+			NULL)) != -1) {
+		switch (opt) {
+		case 'd':
+			if (!parse_names(optarg, direction_names, DIR_COUNT,
+					cfg.directions))
+				return 1;
+			break;
+		case 'm':
+			if (!parse_names(optarg, memory_names, MEM_COUNT,
+					cfg.memories))
+				return 1;
+			cfg.memories_explicit = true;
+			break;
+		case 's':
+			if (!parse_u64s(optarg, cfg.sizes))
+				return 1;
+			break;
+		case 'a':
+			if (!parse_u64s(optarg, cfg.aligns))
+				return 1;
+			break;
+		case 'w':
+			if (!parse_u64(optarg, &v))
+				return 1;
+			cfg.warmup = v;
+			break;
+		case 'n':
+			if (!parse_u64(optarg, &v) || !v)
+				return 1;
+			cfg.reps = v;
+			break;
+		case 'f':
+			if (!parse_names(optarg, format_names, 3, formats) ||
+					formats.size() != 1)
+				return 1;
+			cfg.format = (Format)formats[0];
+			break;
+		case 'o':
+			cfg.output = optarg;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		usage(stderr);
+		return 1;
+	}
+
+	try {
+		picoevb::Device dev;
+
+		for (i = 0; i < cfg.memories.size(); i++) {
+			int memory = cfg.memories[i];
+
+			try {
+				if (!bench(dev, cfg, memory, results) &&
+						cfg.memories_explicit) {
+					fprintf(stderr,
+						"%s memory is not supported by this build\n",
+						memory_names[memory]);
+					return 1;
+				}
+			} catch (const std::exception &e) {
+				/* e.g. no huge pages reserved */
+				if (cfg.memories_explicit)
+					throw;
+				fprintf(stderr, "skipping %s memory: %s\n",
+					memory_names[memory], e.what());
+			}
+		}
+
+		f = stdout;
+		if (cfg.output) {
+			f = fopen(cfg.output, "w");
+			if (!f) {
+				perror("fopen() failed");
+				return 1;
+			}
+		}
+		switch (cfg.format) {
+		case FMT_TABLE:
+			print_table(f, results);
+			break;
+		case FMT_CSV:
+			print_csv(f, results);
+			break;
+		case FMT_JSON:
+			print_json(f, dev, results);
+			break;
+		}
+		if (f != stdout && fclose(f)) {
+			perror("fclose() failed");
+			return 1;
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
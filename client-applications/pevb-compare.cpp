@@ -0,0 +1,749 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * pevb-compare: performance regression gate.
+ *
+ * Compares the JSON results of pevb-bench, pevb-latency, pevb-scale or
+ * pevb-replay with a baseline from the same tool. Results are matched by
+ * their identifying fields, e.g. direction and size. Each result's latency
+ * samples are compared with a one-sided Mann-Whitney U test, which makes no
+ * assumption about their distribution. A result has regressed only if it is
+ * both significantly slower and its median is slower by more than a
+ * threshold, so that neither noise nor tiny, real differences fail the gate.
+ * Throughput and fairness, which are single values, are compared by threshold
+ * alone.
+ *
+ * Exits with 0 if nothing regressed, 1 if something did, or 2 on error.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+/* Fields that identify a result, besides any with string values */
+static const char * const identity_numbers[] = {
+	"size",
+	"align",
+	"period_ns",
+	"clients",
+	"fpga_ram_size",
+	"speed",
+	"repeat",
+};
+
+/* Single-valued metrics, compared by relative change alone */
+static const struct {
+	const char *name;
+	const char *label;
+	const char *unit;
+	bool higher_is_better;
+} scalar_metrics[] = {
+	{ "mbps", "throughput", "MB/s", true },
+	{ "jain", "fairness", "", true },
+};
+
+struct Config {
+	/* Significance level of the Mann-Whitney U test */
+	double alpha;
+	/* Regression thresholds, in percent */
+	double threshold;
+	double scalar_threshold;
+	/* Fewer samples than this aren't tested */
+	size_t min_samples;
+	bool allow_missing;
+	bool quiet;
+};
+
+class Json {
+public:
+	enum Type {
+		NUL,
+		BOOLEAN,
+		NUMBER,
+		STRING,
+		ARRAY,
+		OBJECT,
+	};
+
+	Json() : type(NUL), number(0) {}
+
+	const Json *get(const char *key) const
+	{
+		size_t i;
+
+		for (i = 0; i < members.size(); i++)
+			if (members[i].first == key)
+				return &members[i].second;
+		return NULL;
+	}
+
+	Type type;
+	double number;
+	/* A string's value, or the text of any other scalar */
+	std::string text;
+	std::vector<Json> elements;
+	std::vector<std::pair<std::string, Json> > members;
+};
+
+/* Enough JSON for the benchmarks' output; \u escapes must be ASCII */
+class JsonParser {
+public:
+	explicit JsonParser(const std::string &s) : s_(s), pos_(0) {}
+
+	void parse(Json &out)
+	{
+		value(out);
+		skip_space();
+		if (pos_ != s_.size())
+			fail("trailing data");
+	}
+
+private:
+	void fail(const char *what)
+	{
+		char msg[128];
+
+		snprintf(msg, sizeof(msg), "%s at offset %zu", what, pos_);
+		throw std::runtime_error(msg);
+	}
+
+	void skip_space()
+	{
+		while (pos_ < s_.size() && strchr(" \t\r\n", s_[pos_]))
+			pos_++;
+	}
+
+	bool accept(char c)
+	{
+		skip_space();
+		if (pos_ < s_.size() && s_[pos_] == c) {
+			pos_++;
+			return true;
+		}
+		return false;
+	}
+
+	void expect(char c)
+	{
+		if (!accept(c)) {
+			char what[32];
+
+			snprintf(what, sizeof(what), "expected '%c'", c);
+			fail(what);
+		}
+	}
+
+	void string(std::string &out)
+	{
+		char c;
+
+		expect('"');
+		out.clear();
+		for (;;) {
+			if (pos_ >= s_.size())
+				fail("unterminated string");
+			c = s_[pos_++];
+			if (c == '"')
+				return;
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (pos_ >= s_.size())
+				fail("unterminated string");
+			c = s_[pos_++];
+			switch (c) {
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+				if (pos_ + 4 > s_.size())
+					fail("invalid escape");
+				out += (char)strtoul(s_.substr(pos_, 4).c_str(),
+					NULL, 16);
+				pos_ += 4;
+				break;
+			default:
+				out += c;
+				break;
+			}
+		}
+	}
+
+	bool keyword(const char *word)
+	{
+		size_t len = strlen(word);
+
+		if (s_.compare(pos_, len, word))
+			return false;
+		pos_ += len;
+		return true;
+	}
+
+	void value(Json &out)
+	{
+		const char *start;
+		char *end;
+
+		skip_space();
+		if (pos_ >= s_.size())
+			fail("unexpected end");
+
+		switch (s_[pos_]) {
+		case '{':
+			out.type = Json::OBJECT;
+			pos_++;
+			if (accept('}'))
+				return;
+			do {
+				out.members.push_back(
+					std::make_pair(std::string(), Json()));
+				skip_space();
+				string(out.members.back().first);
+				expect(':');
+				value(out.members.back().second);
+			} while (accept(','));
+			expect('}');
+			return;
+		case '[':
+			out.type = Json::ARRAY;
+			pos_++;
+			if (accept(']'))
+				return;
+			do {
+				out.elements.push_back(Json());
+				value(out.elements.back());
+			} while (accept(','));
+			expect(']');
+			return;
+		case '"':
+			out.type = Json::STRING;
+			string(out.text);
+			return;
+		}
+
+		start = s_.c_str() + pos_;
+		if (keyword("null")) {
+			out.type = Json::NUL;
+		} else if (keyword("true")) {
+			out.type = Json::BOOLEAN;
+			out.number = 1;
+		} else if (keyword("false")) {
+			out.type = Json::BOOLEAN;
+		} else {
+			out.type = Json::NUMBER;
+			out.number = strtod(start, &end);
+			if (end == start)
+				fail("invalid value");
+			pos_ += end - start;
+		}
+		out.text.assign(start, s_.c_str() + pos_);
+	}
+
+	const std::string &s_;
+	size_t pos_;
+};
+
+static void load(const char *path, Json &out)
+{
+	std::string data;
+	char buf[65536];
+	size_t n;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f)
+		throw std::runtime_error(std::string(path) + ": " +
+			strerror(errno));
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		data.append(buf, n);
+	fclose(f);
+
+	try {
+		JsonParser(data).parse(out);
+	} catch (const std::exception &e) {
+		throw std::runtime_error(std::string(path) + ": " + e.what());
+	}
+	if (out.type != Json::OBJECT || !out.get("tool") ||
+			!out.get("results") ||
+			out.get("results")->type != Json::ARRAY)
+		throw std::runtime_error(std::string(path) +
+			": not benchmark results");
+}
+
+static bool is_identity(const std::string &name, const Json &value)
+{
+	size_t i;
+
+	if (value.type == Json::STRING)
+		return true;
+	for (i = 0; i < sizeof(identity_numbers) / sizeof(*identity_numbers);
+			i++)
+		if (name == identity_numbers[i])
+			return true;
+	return false;
+}
+
+/* e.g. "direction=h2c memory=malloc size=4096 align=0" */
+static std::string identity(const Json &obj)
+{
+	std::string id;
+	size_t i;
+
+	for (i = 0; i < obj.members.size(); i++) {
+		const std::string &name = obj.members[i].first;
+		const Json &value = obj.members[i].second;
+
+		if (!is_identity(name, value))
+			continue;
+		if (!id.empty())
+			id += ' ';
+		id += name + "=" + value.text;
+	}
+
+	return id;
+}
+
+static std::vector<double> samples(const Json &result)
+{
+	const Json *array = result.get("samples_ns");
+	std::vector<double> out;
+	size_t i;
+
+	if (!array || array->type != Json::ARRAY)
+		return out;
+	for (i = 0; i < array->elements.size(); i++)
+		if (array->elements[i].type == Json::NUMBER)
+			out.push_back(array->elements[i].number);
+	std::sort(out.begin(), out.end());
+
+	return out;
+}
+
+/* Nearest-rank percentile of sorted samples */
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	size_t rank;
+
+	if (sorted.empty())
+		return 0;
+	rank = (size_t)ceil(p / 100.0 * sorted.size() - 1e-6);
+	if (rank < 1)
+		rank = 1;
+
+	return sorted[rank - 1];
+}
+
+/*
+ * One-sided Mann-Whitney U tests of whether current tends to be larger, or
+ * smaller, than baseline. Uses the normal approximation with tie and
+ * continuity corrections, which is accurate beyond about 20 samples each.
+ */
+static void mann_whitney(const std::vector<double> &baseline,
+	const std::vector<double> &current, double *p_greater, double *p_less)
+{
+	std::vector<std::pair<double, bool> > all;
+	double n1 = current.size(), n2 = baseline.size(), n = n1 + n2;
+	double rank_sum = 0, ties = 0, t, rank, u, mean, var, sd;
+	size_t i, j, k;
+
+	for (i = 0; i < baseline.size(); i++)
+		all.push_back(std::make_pair(baseline[i], false));
+	for (i = 0; i < current.size(); i++)
+		all.push_back(std::make_pair(current[i], true));
+	std::sort(all.begin(), all.end());
+
+	/* Tied values share the mean of their ranks */
+	for (i = 0; i < all.size(); i = j) {
+		for (j = i + 1; j < all.size() && all[j].first == all[i].first;
+				j++)
+			;
+		t = j - i;
+		rank = (i + 1 + j) / 2.0;
+		for (k = i; k < j; k++)
+			if (all[k].second)
+				rank_sum += rank;
+		ties += t * t * t - t;
+	}
+
+	u = rank_sum - n1 * (n1 + 1) / 2;
+	mean = n1 * n2 / 2;
+	var = n1 * n2 / 12 * ((n + 1) - ties / (n * (n - 1)));
+	if (var <= 0) {
+		/* Every sample is equal */
+		*p_greater = 1;
+		*p_less = 1;
+		return;
+	}
+	sd = sqrt(var);
+	*p_greater = 0.5 * erfc((u - mean - 0.5) / sd / M_SQRT2);
+	*p_less = 0.5 * erfc((mean - u - 0.5) / sd / M_SQRT2);
+}
+
+enum Verdict {
+	V_OK,
+	V_IMPROVED,
+	V_REGRESSED,
+	V_UNTESTED,
+};
+
+static const char * const verdict_names[] = {
+	"ok",
+	"improved",
+	"REGRESSED",
+	"untested",
+};
+
+struct Counts {
+	unsigned int compared;
+	unsigned int regressed;
+	unsigned int improved;
+	unsigned int missing;
+};
+
+struct Line {
+	std::string metric;
+	std::string baseline;
+	std::string current;
+	double change;
+	/* Negative if not tested */
+	double p;
+	Verdict verdict;
+};
+
+static std::string format(double value, const char *unit)
+{
+	char buf[64];
+
+	snprintf(buf, sizeof(buf), "%.*f%s%s", value < 10 ? 3 : 1, value,
+		*unit ? " " : "", unit);
+
+	return buf;
+}
+
+static double change(double baseline, double current)
+{
+	return baseline ? (current - baseline) * 100 / baseline : 0;
+}
+
+static void compare_samples(const Config &cfg, const Json &baseline,
+	const Json &current, std::vector<Line> &lines)
+{
+	std::vector<double> a = samples(baseline), b = samples(current);
+	double p_greater, p_less;
+	Line line;
+
+	if (a.empty() || b.empty())
+		return;
+
+	line.metric = "median";
+	line.baseline = format(percentile(a, 50) / 1000, "us");
+	line.current = format(percentile(b, 50) / 1000, "us");
+	line.change = change(percentile(a, 50), percentile(b, 50));
+	line.p = -1;
+	line.verdict = V_UNTESTED;
+	if (a.size() >= cfg.min_samples && b.size() >= cfg.min_samples) {
+		mann_whitney(a, b, &p_greater, &p_less);
+		line.verdict = V_OK;
+		line.p = std::min(p_greater, p_less);
+		if (p_greater < cfg.alpha && line.change > cfg.threshold)
+			line.verdict = V_REGRESSED;
+		else if (p_less < cfg.alpha && line.change < -cfg.threshold)
+			line.verdict = V_IMPROVED;
+	}
+	lines.push_back(line);
+
+	/* The tail, for information; a single run's tail is too noisy */
+	line.metric = "p99";
+	line.baseline = format(percentile(a, 99) / 1000, "us");
+	line.current = format(percentile(b, 99) / 1000, "us");
+	line.change = change(percentile(a, 99), percentile(b, 99));
+	line.p = -1;
+	line.verdict = V_UNTESTED;
+	lines.push_back(line);
+}
+
+static void compare_scalars(const Config &cfg, const Json &baseline,
+	const Json &current, std::vector<Line> &lines)
+{
+	const Json *a, *b;
+	double worse;
+	Line line;
+	size_t i;
+
+	for (i = 0; i < sizeof(scalar_metrics) / sizeof(*scalar_metrics);
+			i++) {
+		a = baseline.get(scalar_metrics[i].name);
+		b = current.get(scalar_metrics[i].name);
+		if (!a || !b || a->type != Json::NUMBER ||
+				b->type != Json::NUMBER)
+			continue;
+
+		line.metric = scalar_metrics[i].label;
+		line.baseline = format(a->number, scalar_metrics[i].unit);
+		line.current = format(b->number, scalar_metrics[i].unit);
+		line.change = change(a->number, b->number);
+		line.p = -1;
+		worse = scalar_metrics[i].higher_is_better ?
+			-line.change : line.change;
+		if (worse > cfg.scalar_threshold)
+			line.verdict = V_REGRESSED;
+		else if (worse < -cfg.scalar_threshold)
+			line.verdict = V_IMPROVED;
+		else
+			line.verdict = V_OK;
+		lines.push_back(line);
+	}
+}
+
+static void print_result(FILE *f, const std::string &id,
+	const std::vector<Line> &lines)
+{
+	char p[32];
+	size_t i;
+
+	fprintf(f, "%s\n", id.empty() ? "(result)" : id.c_str());
+	for (i = 0; i < lines.size(); i++) {
+		const Line &l = lines[i];
+
+		if (l.p >= 0)
+			snprintf(p, sizeof(p), "%.2g", l.p);
+		else
+			snprintf(p, sizeof(p), "-");
+		fprintf(f, "  %-11s %14s %14s %+8.1f%% %9s  %s\n",
+			l.metric.c_str(), l.baseline.c_str(),
+			l.current.c_str(), l.change, p,
+			verdict_names[l.verdict]);
+	}
+}
+
+/* Returns false if the files can't be compared */
+static bool check_compatible(const Json &baseline, const Json &current)
+{
+	size_t i;
+
+	for (i = 0; i < baseline.members.size(); i++) {
+		const std::string &name = baseline.members[i].first;
+		const Json &value = baseline.members[i].second;
+		const Json *other = current.get(name.c_str());
+
+		if (!is_identity(name, value))
+			continue;
+		if (!other || other->text != value.text) {
+			fprintf(stderr, "baseline has %s=%s, but results have "
+				"%s=%s\n", name.c_str(), value.text.c_str(),
+				name.c_str(), other ? other->text.c_str() :
+				"(none)");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void compare(FILE *f, const Config &cfg, const Json &baseline,
+	const Json &current, Counts &counts)
+{
+	const std::vector<Json> &a = baseline.get("results")->elements;
+	const std::vector<Json> &b = current.get("results")->elements;
+	/* Unmatched current results, by identity, in order */
+	std::map<std::string, std::vector<size_t> > unmatched;
+	std::vector<Line> lines;
+	bool regressed, improved;
+	size_t i, j;
+
+	for (j = 0; j < b.size(); j++)
+		unmatched[identity(b[j])].push_back(j);
+
+	for (i = 0; i < a.size(); i++) {
+		std::string id = identity(a[i]);
+		std::vector<size_t> &matches = unmatched[id];
+
+		if (matches.empty()) {
+			counts.missing++;
+			fprintf(f, "%s\n  missing from results\n",
+				id.empty() ? "(result)" : id.c_str());
+			continue;
+		}
+		j = matches.front();
+		matches.erase(matches.begin());
+
+		lines.clear();
+		compare_samples(cfg, a[i], b[j], lines);
+		compare_scalars(cfg, a[i], b[j], lines);
+
+		regressed = improved = false;
+		for (j = 0; j < lines.size(); j++) {
+			regressed = regressed ||
+				lines[j].verdict == V_REGRESSED;
+			improved = improved || lines[j].verdict == V_IMPROVED;
+		}
+		counts.compared++;
+		counts.regressed += regressed;
+		counts.improved += improved && !regressed;
+		if (!cfg.quiet || regressed)
+			print_result(f, id, lines);
+	}
+}
+
+static void usage(FILE *f)
+{
+	fprintf(f,
+		"usage: pevb-compare [options] BASELINE RESULTS\n"
+		"  -a, --alpha P         significance level of the\n"
+		"                        Mann-Whitney U test (default: 0.01)\n"
+		"  -t, --threshold PCT   slowdown of the median latency that\n"
+		"                        is a regression (default: 5)\n"
+		"  -T, --scalar-threshold PCT\n"
+		"                        drop in throughput or fairness that\n"
+		"                        is a regression (default: 10)\n"
+		"  -n, --min-samples N   don't test results with fewer\n"
+		"                        samples (default: 20)\n"
+		"  -m, --allow-missing   don't fail if a baseline result is\n"
+		"                        missing from RESULTS\n"
+		"  -q, --quiet           only show regressions\n"
+		"  -h, --help\n");
+}
+
+static bool parse_double(const char *s, double *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtod(s, &end);
+
+	return !errno && end != s && !*end && *val >= 0;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "alpha",		required_argument,	0, 'a' },
+		{ "threshold",		required_argument,	0, 't' },
+		{ "scalar-threshold",	required_argument,	0, 'T' },
+		{ "min-samples",	required_argument,	0, 'n' },
+		{ "allow-missing",	no_argument,		0, 'm' },
+		{ "quiet",		no_argument,		0, 'q' },
+		{ "help",		no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	Config cfg;
+	Counts counts;
+	Json baseline, current;
+	double v;
+	int opt;
+
+	cfg.alpha = 0.01;
+	cfg.threshold = 5;
+	cfg.scalar_threshold = 10;
+	cfg.min_samples = 20;
+	cfg.allow_missing = false;
+	cfg.quiet = false;
+
+	while ((opt = getopt_long(argc, argv, "a:t:T:n:mqh", long_opts,
+			NULL)) != -1) {
+		switch (opt) {
+		case 'a':
+			if (!parse_double(optarg, &cfg.alpha) ||
+					cfg.alpha > 1) {
+				fprintf(stderr, "invalid alpha: %s\n", optarg);
+				return 2;
+			}
+			break;
+		case 't':
+			if (!parse_double(optarg, &cfg.threshold)) {
+				fprintf(stderr, "invalid threshold: %s\n",
+					optarg);
+				return 2;
+			}
+			break;
+		case 'T':
+			if (!parse_double(optarg, &cfg.scalar_threshold)) {
+				fprintf(stderr, "invalid threshold: %s\n",
+					optarg);
+				return 2;
+			}
+			break;
+		case 'n':
+			if (!parse_double(optarg, &v)) {
+				fprintf(stderr, "invalid count: %s\n", optarg);
+				return 2;
+			}
+			cfg.min_samples = v;
+			break;
+		case 'm':
+			cfg.allow_missing = true;
+			break;
+		case 'q':
+			cfg.quiet = true;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 2;
+		}
+	}
+	if (optind + 2 != argc) {
+		usage(stderr);
+		return 2;
+	}
+
+	try {
+		load(argv[optind], baseline);
+		load(argv[optind + 1], current);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+	if (!check_compatible(baseline, current))
+		return 2;
+
+	memset(&counts, 0, sizeof(counts));
+	printf("  %-11s %14s %14s %9s %9s  %s\n", "metric", "baseline",
+		"results", "change", "p", "verdict");
+	compare(stdout, cfg, baseline, current, counts);
+
+	printf("\n%s: %u results compared, %u regressed, %u improved, "
+		"%u missing\n", baseline.get("tool")->text.c_str(),
+		counts.compared, counts.regressed, counts.improved,
+		counts.missing);
+
+	if (counts.regressed || (counts.missing && !cfg.allow_missing))
+		return 1;
+
+	return 0;
+}
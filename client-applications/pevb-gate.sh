@@ -0,0 +1,96 @@
+#!/bin/sh
+
+# Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in
+# all copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+# DEALINGS IN THE SOFTWARE.
+
+# Run the benchmarks, and compare their results with a baseline recorded by an
+# earlier run with --record. Works with a card, or with the simulated XDMA
+# (see build-for-any-xdma-sim-native.sh); a baseline is only compared with
+# results from the same kernel and card, or the same simulation parameters.
+#
+# usage: pevb-gate.sh [--record] BASELINE_DIR [pevb-compare options]
+#
+# Exits with 0 if nothing regressed, 1 if something did, or 2 on error.
+
+set -e
+
+record=
+if [ "$1" = "--record" ]; then
+	record=1
+	shift
+fi
+if [ $# -lt 1 ]; then
+	echo "usage: $0 [--record] BASELINE_DIR [pevb-compare options]" >&2
+	exit 2
+fi
+baseline=$1
+shift
+
+bindir=$(dirname "$0")
+results=$(mktemp -d) || exit 2
+trap 'rm -rf "${results}"' EXIT
+
+describe_system() {
+	params=/sys/module/picoevb_rdma/parameters
+	uname -srm
+	if [ -e "${params}/sim_bw_mbps" ]; then
+		for p in sim_ram_size sim_bw_mbps sim_latency_ns sim_desc_ns; do
+			echo "${p}=$(cat "${params}/${p}")"
+		done
+	else
+		echo "hardware"
+	fi
+}
+
+# The benchmarks exit with 1 on error, which must not read as a regression
+describe_system > "${results}/system" || exit 2
+"${bindir}/pevb-bench" -m malloc -s 4K,64K,1M -n 200 -f json \
+	-o "${results}/pevb-bench.json" || exit 2
+"${bindir}/pevb-latency" -n 100000 -w 1000 -f json \
+	-o "${results}/pevb-latency.json" || exit 2
+"${bindir}/pevb-scale" -n 1,4 -t 2 -f json \
+	-o "${results}/pevb-scale.json" || exit 2
+
+if [ -n "${record}" ]; then
+	mkdir -p "${baseline}" || exit 2
+	cp "${results}"/* "${baseline}/" || exit 2
+	echo "Recorded baseline in ${baseline}"
+	exit 0
+fi
+
+if ! cmp -s "${baseline}/system" "${results}/system"; then
+	echo "The baseline was recorded on a different system:" >&2
+	diff "${baseline}/system" "${results}/system" >&2 || true
+	exit 2
+fi
+
+status=0
+for tool in pevb-bench pevb-latency pevb-scale; do
+	echo "== ${tool}"
+	ret=0
+	"${bindir}/pevb-compare" "$@" "${baseline}/${tool}.json" \
+		"${results}/${tool}.json" || ret=$?
+	if [ ${ret} -gt ${status} ]; then
+		status=${ret}
+	fi
+	echo
+done
+
+exit ${status}
@@ -0,0 +1,680 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * pevb-latency: round-trip latency and jitter benchmark.
+ *
+ * Each iteration copies a small buffer to FPGA RAM and back again (H2C then
+ * C2H of the same region), and times the pair. Iterations run back to back,
+ * or paced at a fixed period like a control loop. The thread may be pinned to
+ * a CPU, run under SCHED_FIFO, and have its memory locked, to separate the
+ * driver's latency from the scheduler's.
+ *
+ * The full latency distribution is printed in HdrHistogram's percentile
+ * format. Per-iteration counts of interrupts taken and CPU migrations are
+ * used to show how much of the tail they explain.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <linux/perf_event.h>
+#include <math.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <exception>
+#include <string>
+#include <vector>
+#include "picoevb.hpp"
+
+enum {
+	EV_HARDIRQ,
+	EV_SOFTIRQ,
+	EV_MIGRATION,
+	EV_COUNT,
+};
+
+static const char * const event_names[EV_COUNT] = {
+	"hardirq",
+	"softirq",
+	"migration",
+};
+
+enum Format {
+	FMT_TABLE,
+	FMT_JSON,
+};
+
+struct Config {
+	uint64_t size;
+	uint64_t iterations;
+	uint64_t warmup;
+	/* -1 to leave unpinned */
+	int cpu;
+	/* 0 to leave the scheduling policy alone */
+	int fifo_prio;
+	bool mlock;
+	/* 0 for back to back */
+	uint64_t period_ns;
+	bool busy_wait;
+	/* PICOEVB_PRIO_* */
+	uint32_t dma_prio;
+	/* 0 to use the 99.9th percentile */
+	uint64_t outlier_ns;
+	Format format;
+	const char *output;
+};
+
+/* One iteration; 8 bytes, so that millions fit in memory */
+struct Sample {
+	uint32_t latency_ns;
+	/* Indexed by EV_*; saturating */
+	uint8_t events[EV_COUNT];
+	uint8_t cpu_changed;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * Counts, for this thread only, the hard and soft interrupts that ran while it
+ * was on a CPU, and its CPU migrations. The interrupt counts use tracepoints,
+ * which need tracefs and CAP_PERFMON (or root); migrations need only
+ * perf_event_paranoid <= 2. Events that can't be counted are reported as
+ * unavailable.
+ */
+class EventCounter {
+public:
+	EventCounter() : leader_(-1), n_(0)
+	{
+		int i;
+
+		for (i = 0; i < EV_COUNT; i++) {
+			index_[i] = -1;
+			last_[i] = 0;
+		}
+		/* The leader must be a software event, always available */
+		open(EV_MIGRATION, PERF_TYPE_SOFTWARE,
+			PERF_COUNT_SW_CPU_MIGRATIONS);
+		if (leader_ < 0)
+			return;
+		open_tracepoint(EV_HARDIRQ, "irq/irq_handler_entry");
+		open_tracepoint(EV_SOFTIRQ, "irq/softirq_entry");
+		ioctl(leader_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		read_deltas(NULL);
+	}
+
+	~EventCounter()
+	{
+		for (int fd : fds_)
+			close(fd);
+	}
+
+	EventCounter(const EventCounter &) = delete;
+	EventCounter &operator=(const EventCounter &) = delete;
+
+	bool available(int ev) const { return index_[ev] >= 0; }
+
+	/* Counts since the last call, with one read() of the whole group */
+	void read_deltas(uint8_t *deltas)
+	{
+		uint64_t buf[1 + EV_COUNT];
+		int i;
+
+		if (leader_ < 0 ||
+				read(leader_, buf, sizeof(buf)) < (ssize_t)
+				((1 + n_) * sizeof(uint64_t)))
+			return;
+		for (i = 0; i < EV_COUNT; i++) {
+			if (index_[i] < 0)
+				continue;
+			uint64_t v = buf[1 + index_[i]];
+			if (deltas)
+				deltas[i] = std::min<uint64_t>(v - last_[i],
+					UINT8_MAX);
+			last_[i] = v;
+		}
+	}
+
+private:
+	void open(int ev, uint32_t type, uint64_t config)
+	{
+		struct perf_event_attr attr;
+		int fd;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = type;
+		attr.config = config;
+		attr.disabled = leader_ < 0;
+		attr.read_format = PERF_FORMAT_GROUP;
+		fd = syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0);
+		if (fd < 0)
+			return;
+		if (leader_ < 0)
+			leader_ = fd;
+		fds_.push_back(fd);
+		index_[ev] = n_++;
+	}
+
+	void open_tracepoint(int ev, const char *name)
+	{
+		static const char * const roots[] = {
+			"/sys/kernel/tracing/events/",
+			"/sys/kernel/debug/tracing/events/",
+		};
+		unsigned long long id;
+		FILE *f;
+
+		for (const char *root : roots) {
+			std::string path = std::string(root) + name + "/id";
+			f = fopen(path.c_str(), "r");
+			if (!f)
+				continue;
+			if (fscanf(f, "%llu", &id) == 1)
+				open(ev, PERF_TYPE_TRACEPOINT, id);
+			fclose(f);
+			return;
+		}
+	}
+
+	int leader_;
+	std::vector<int> fds_;
+	/* Position of each event in the group's read() */
+	int index_[EV_COUNT];
+	int n_;
+	uint64_t last_[EV_COUNT];
+};
+
+static bool setup_thread(const Config &cfg)
+{
+	if (cfg.mlock && mlockall(MCL_CURRENT | MCL_FUTURE)) {
+		perror("mlockall()");
+		return false;
+	}
+	if (cfg.cpu >= 0) {
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cfg.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			perror("sched_setaffinity()");
+			return false;
+		}
+	}
+	if (cfg.fifo_prio) {
+		struct sched_param param = {};
+
+		param.sched_priority = cfg.fifo_prio;
+		if (sched_setscheduler(0, SCHED_FIFO, &param)) {
+			perror("sched_setscheduler(SCHED_FIFO)");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* Wait until t, by sleeping or spinning */
+static void wait_until(uint64_t t, bool busy_wait)
+{
+	struct timespec ts;
+
+	if (busy_wait) {
+		while (now_ns() < t)
+			;
+		return;
+	}
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+			EINTR)
+		;
+}
+
+/* Returns the number of iterations that overran the period */
+static uint64_t run(const Config &cfg, picoevb::Device &dev,
+	EventCounter &events, std::vector<Sample> &samples)
+{
+	picoevb::RamRegion region(dev, cfg.size);
+	picoevb::HostBuffer src(cfg.size), dst(cfg.size);
+	uint64_t i, t0, t1, next = 0, overruns = 0;
+	int cpu0;
+
+	memset(src.data(), 0xa5, cfg.size);
+	samples.reserve(cfg.iterations);
+	for (i = 0; i < cfg.warmup + cfg.iterations; i++) {
+		if (cfg.period_ns) {
+			if (!next)
+				next = now_ns();
+			wait_until(next, cfg.busy_wait);
+			next += cfg.period_ns;
+		}
+
+		cpu0 = sched_getcpu();
+		t0 = now_ns();
+		dev.h2c(src, 0, region, 0, cfg.size);
+		dev.c2h(region, 0, dst, 0, cfg.size);
+		t1 = now_ns();
+
+		Sample s = {};
+		events.read_deltas(s.events);
+		if (i < cfg.warmup)
+			continue;
+		s.latency_ns = std::min<uint64_t>(t1 - t0, UINT32_MAX);
+		s.cpu_changed = sched_getcpu() != cpu0;
+		samples.push_back(s);
+		if (cfg.period_ns && t1 > next)
+			overruns++;
+	}
+
+	return overruns;
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const std::vector<uint32_t> &sorted, double p)
+{
+	size_t rank;
+
+	if (sorted.empty())
+		return 0;
+	rank = (size_t)ceil(p / 100.0 * sorted.size());
+	if (rank < 1)
+		rank = 1;
+
+	return sorted[rank - 1];
+}
+
+/*
+ * HdrHistogram's percentile distribution format, in microseconds, as printed
+ * by HistogramLogProcessor and accepted by its plotter. Percentiles are
+ * reported at 5 ticks per halving of the distance to 100%.
+ */
+static void print_distribution(FILE *f, const std::vector<uint32_t> &sorted,
+	double mean, double stddev)
+{
+	double p = 0;
+	size_t rank;
+
+	fprintf(f, "%12s %14s %10s %14s\n\n", "Value", "Percentile",
+		"TotalCount", "1/(1-Percentile)");
+	for (;;) {
+		/* Less a little, so that rounding can't add one */
+		rank = std::max<size_t>(1,
+			(size_t)ceil(p / 100.0 * sorted.size() - 1e-6));
+		if (p < 100)
+			fprintf(f, "%12.3f %14.12f %10zu %14.2f\n",
+				sorted[rank - 1] / 1000.0, p / 100, rank,
+				1 / (1 - p / 100));
+		else
+			fprintf(f, "%12.3f %14.12f %10zu\n",
+				sorted[rank - 1] / 1000.0, 1.0, rank);
+		if (p >= 100 || rank == sorted.size())
+			break;
+		double ticks = 5 * pow(2, floor(log2(100 / (100 - p))) + 1);
+		p = std::min(100.0, p + 100 / ticks);
+	}
+	fprintf(f, "#[Mean    = %12.3f, StdDeviation   = %12.3f]\n",
+		mean / 1000, stddev / 1000);
+	fprintf(f, "#[Max     = %12.3f, Total count    = %12zu]\n",
+		sorted.back() / 1000.0, sorted.size());
+}
+
+static void print_summary(FILE *f, const std::vector<uint32_t> &sorted,
+	double mean, double stddev)
+{
+	static const double ps[] = { 50, 90, 99, 99.9, 99.99, 99.999, 100 };
+	static const char * const names[] = {
+		"p50", "p90", "p99", "p99.9", "p99.99", "p99.999", "max",
+	};
+	size_t i;
+
+	fprintf(f, "%-8s %12.3f us\n", "min", sorted[0] / 1000.0);
+	for (i = 0; i < sizeof(ps) / sizeof(ps[0]); i++)
+		fprintf(f, "%-8s %12.3f us\n", names[i],
+			percentile(sorted, ps[i]) / 1000.0);
+	fprintf(f, "%-8s %12.3f us\n", "mean", mean / 1000);
+	fprintf(f, "%-8s %12.3f us\n", "stddev", stddev / 1000);
+}
+
+/*
+ * For each event, the fraction of all iterations and of outliers during which
+ * it occurred. An event that explains the tail is far more common among
+ * outliers.
+ */
+static void print_outliers(FILE *f, const EventCounter &events,
+	const std::vector<Sample> &samples, uint64_t threshold)
+{
+	uint64_t all[EV_COUNT] = {}, out[EV_COUNT] = {};
+	uint64_t n_out = 0, unexplained = 0;
+	int ev;
+
+	for (const Sample &s : samples) {
+		bool outlier = s.latency_ns > threshold, any = false;
+
+		n_out += outlier;
+		for (ev = 0; ev < EV_COUNT; ev++) {
+			bool hit = s.events[ev] ||
+				(ev == EV_MIGRATION && s.cpu_changed);
+			all[ev] += hit;
+			out[ev] += hit && outlier;
+			any |= hit;
+		}
+		unexplained += outlier && !any;
+	}
+
+	fprintf(f, "\noutliers: %" PRIu64 " of %zu iterations over %.3f us\n",
+		n_out, samples.size(), threshold / 1000.0);
+	fprintf(f, "%-10s %16s %16s\n", "event", "% of all", "% of outliers");
+	for (ev = 0; ev < EV_COUNT; ev++) {
+		if (!events.available(ev) && ev != EV_MIGRATION) {
+			fprintf(f, "%-10s %16s %16s\n", event_names[ev], "n/a",
+				"n/a");
+			continue;
+		}
+		fprintf(f, "%-10s %16.3f %16.3f\n", event_names[ev],
+			100.0 * all[ev] / samples.size(),
+			n_out ? 100.0 * out[ev] / n_out : 0);
+	}
+	fprintf(f, "%-10s %16s %16.3f\n", "none", "",
+		n_out ? 100.0 * unexplained / n_out : 0);
+}
+
+static void print_json(FILE *f, const Config &cfg,
+	const std::vector<Sample> &samples, const std::vector<uint32_t> &sorted,
+	double mean, double stddev)
+{
+	/* Enough for statistical comparison, without a huge file */
+	const size_t max_samples = 100000;
+	size_t i, step = (samples.size() + max_samples - 1) / max_samples;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"tool\": \"pevb-latency\",\n");
+	fprintf(f, "  \"results\": [\n");
+	fprintf(f, "    {\n");
+	fprintf(f, "      \"direction\": \"h2c+c2h\",\n");
+	fprintf(f, "      \"size\": %" PRIu64 ",\n", cfg.size);
+	fprintf(f, "      \"period_ns\": %" PRIu64 ",\n", cfg.period_ns);
+	fprintf(f, "      \"reps\": %zu,\n", sorted.size());
+	fprintf(f, "      \"mean_ns\": %.1f,\n", mean);
+	fprintf(f, "      \"stddev_ns\": %.1f,\n", stddev);
+	fprintf(f, "      \"median_ns\": %" PRIu64 ",\n",
+		percentile(sorted, 50));
+	fprintf(f, "      \"p99_ns\": %" PRIu64 ",\n", percentile(sorted, 99));
+	fprintf(f, "      \"p999_ns\": %" PRIu64 ",\n",
+		percentile(sorted, 99.9));
+	fprintf(f, "      \"p9999_ns\": %" PRIu64 ",\n",
+		percentile(sorted, 99.99));
+	fprintf(f, "      \"p99999_ns\": %" PRIu64 ",\n",
+		percentile(sorted, 99.999));
+	fprintf(f, "      \"max_ns\": %" PRIu64 ",\n",
+		percentile(sorted, 100));
+	/* Every step'th iteration, in the order they ran */
+	fprintf(f, "      \"samples_ns\": [");
+	for (i = 0; i < samples.size(); i += step)
+		fprintf(f, "%s%" PRIu32, i ? ", " : "", samples[i].latency_ns);
+	fprintf(f, "]\n");
+	fprintf(f, "    }\n");
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+}
+
+static void usage(FILE *f)
+{
+	fprintf(f,
+		"usage: pevb-latency [options]\n"
+		"  -s, --size N          bytes per transfer, with optional\n"
+		"                        K/M suffix (default: 64)\n"
+		"  -n, --iterations N    timed round trips (default: 1000000)\n"
+		"  -w, --warmup N        un-timed round trips\n"
+		"                        (default: 10000)\n"
+		"  -i, --interval US     start a round trip every US\n"
+		"                        microseconds (default: back to back)\n"
+		"  -b, --busy-wait       spin, rather than sleep, between\n"
+		"                        round trips\n"
+		"  -c, --cpu N           pin to CPU N\n"
+		"  -F, --fifo PRIO       run under SCHED_FIFO at PRIO\n"
+		"  -l, --mlock           lock all memory with mlockall()\n"
+		"  -P, --dma-prio CLASS  bulk, normal, or realtime DMA engine\n"
+		"                        class (default: normal)\n"
+		"  -t, --outlier US      outlier threshold (default: p99.9)\n"
+		"  -f, --format FMT      table or json (default: table)\n"
+		"  -o, --output FILE     write results to FILE\n"
+		"  -h, --help\n");
+}
+
+static bool parse_u64(const char *s, uint64_t *val)
+{
+	char *end;
+	unsigned long long v;
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (errno || end == s)
+		return false;
+	switch (*end) {
+	case 'M':
+	case 'm':
+		v <<= 10;
+		/* fall-through */
+	case 'K':
+	case 'k':
+		v <<= 10;
+		end++;
+		break;
+	}
+	if (*end)
+		return false;
+	*val = v;
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "size",	required_argument,	0, 's' },
+		{ "iterations",	required_argument,	0, 'n' },
+		{ "warmup",	required_argument,	0, 'w' },
+		{ "interval",	required_argument,	0, 'i' },
+		{ "busy-wait",	no_argument,		0, 'b' },
+		{ "cpu",	required_argument,	0, 'c' },
+		{ "fifo",	required_argument,	0, 'F' },
+		{ "mlock",	no_argument,		0, 'l' },
+		{ "dma-prio",	required_argument,	0, 'P' },
+		{ "outlier",	required_argument,	0, 't' },
+		{ "format",	required_argument,	0, 'f' },
+		{ "output",	required_argument,	0, 'o' },
+		{ "help",	no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	static const char * const prio_names[PICOEVB_PRIO_COUNT] = {
+		"bulk", "normal", "realtime",
+	};
+	std::vector<Sample> samples;
+	std::vector<uint32_t> sorted;
+	double mean = 0, stddev = 0;
+	uint64_t v, overruns;
+	Config cfg;
+	int opt, i;
+	FILE *f;
+
+	cfg.size = 64;
+	cfg.iterations = 1000000;
+	cfg.warmup = 10000;
+	cfg.cpu = -1;
+	cfg.fifo_prio = 0;
+	cfg.mlock = false;
+	cfg.period_ns = 0;
+	cfg.busy_wait = false;
+	cfg.dma_prio = PICOEVB_PRIO_NORMAL;
+	cfg.outlier_ns = 0;
+	cfg.format = FMT_TABLE;
+	cfg.output = NULL;
+
+	while ((opt = getopt_long(argc, argv, "s:n:w:i:bc:F:lP:t:f:o:h",
+			long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			if (!parse_u64(optarg, &cfg.size) || !cfg.size)
+				return 1;
+			break;
+		case 'n':
+			if (!parse_u64(optarg, &cfg.iterations) ||
+					!cfg.iterations)
+				return 1;
+			break;
+		case 'w':
+			if (!parse_u64(optarg, &cfg.warmup))
+				return 1;
+			break;
+		case 'i':
+			if (!parse_u64(optarg, &v))
+				return 1;
+			cfg.period_ns = v * 1000;
+			break;
+		case 'b':
+			cfg.busy_wait = true;
+			break;
+		case 'c':
+			if (!parse_u64(optarg, &v))
+				return 1;
+			cfg.cpu = v;
+			break;
+		case 'F':
+			if (!parse_u64(optarg, &v) || !v)
+				return 1;
+			cfg.fifo_prio = v;
+			break;
+		case 'l':
+			cfg.mlock = true;
+			break;
+		case 'P':
+			for (i = 0; i < PICOEVB_PRIO_COUNT; i++)
+				if (!strcmp(optarg, prio_names[i]))
+					break;
+			if (i == PICOEVB_PRIO_COUNT) {
+				fprintf(stderr, "unknown value: %s\n", optarg);
+				return 1;
+			}
+			cfg.dma_prio = i;
+			break;
+		case 't':
+			if (!parse_u64(optarg, &v))
+				return 1;
+			cfg.outlier_ns = v * 1000;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "table")) {
+				cfg.format = FMT_TABLE;
+			} else if (!strcmp(optarg, "json")) {
+				cfg.format = FMT_JSON;
+			} else {
+				fprintf(stderr, "unknown format: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'o':
+			cfg.output = optarg;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		usage(stderr);
+		return 1;
+	}
+
+	if (!setup_thread(cfg))
+		return 1;
+
+	try {
+		picoevb::Device dev;
+		EventCounter events;
+
+		if (cfg.dma_prio != PICOEVB_PRIO_NORMAL)
+			dev.set_sched(cfg.dma_prio);
+		overruns = run(cfg, dev, events, samples);
+
+		for (const Sample &s : samples) {
+			sorted.push_back(s.latency_ns);
+			mean += s.latency_ns;
+		}
+		mean /= samples.size();
+		for (const Sample &s : samples)
+			stddev += (s.latency_ns - mean) * (s.latency_ns - mean);
+		stddev = sqrt(stddev / samples.size());
+		std::sort(sorted.begin(), sorted.end());
+
+		f = stdout;
+		if (cfg.output) {
+			f = fopen(cfg.output, "w");
+			if (!f) {
+				perror(cfg.output);
+				return 1;
+			}
+		}
+		if (cfg.format == FMT_JSON) {
+			print_json(f, cfg, samples, sorted, mean, stddev);
+		} else {
+			fprintf(f, "%" PRIu64 " byte round trips:\n\n",
+				cfg.size);
+			print_distribution(f, sorted, mean, stddev);
+			fprintf(f, "\n");
+			print_summary(f, sorted, mean, stddev);
+			print_outliers(f, events, samples, cfg.outlier_ns ?
+				cfg.outlier_ns : percentile(sorted, 99.9));
+			if (cfg.period_ns)
+				fprintf(f, "\n%" PRIu64 " round trips overran "
+					"the %.3f us period\n", overruns,
+					cfg.period_ns / 1000.0);
+		}
+		if (f != stdout)
+			fclose(f);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
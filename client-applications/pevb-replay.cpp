@@ -0,0 +1,718 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * pevb-replay: re-issues the DMA requests in a trace from libpevb-trace.so.
+ *
+ * Each thread in the trace is replayed by its own thread, and each device
+ * file by its own Device, so that requests contend for the DMA engine as they
+ * did when recorded. Requests are issued at their recorded times, optionally
+ * sped up, or each thread issues its requests back to back. Ring transfers are
+ * replayed through a Ring, in the batches that the recorded doorbells ran.
+ *
+ * Transfers use the recorded sizes, FPGA RAM offsets, and host buffer offsets
+ * within a page. All host memory is replayed as malloc()ed pages, including
+ * memory that was CUDA memory when recorded. Requests that failed when
+ * recorded are skipped.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "picoevb.hpp"
+#include "pevb-trace.hpp"
+
+static const char * const op_names[PEVB_TRACE_OP_COUNT] = {
+	"h2c",
+	"c2h",
+	"h2c2h",
+};
+
+enum Format {
+	FMT_TABLE,
+	FMT_JSON,
+};
+
+struct Config {
+	const char *trace;
+	const char *device;
+	/* Multiple of the recorded rate; 0 for as fast as possible */
+	double speed;
+	unsigned int repeat;
+	Format format;
+	const char *output;
+};
+
+/* Requests issued together: one ioctl, or one doorbell's ring transfers */
+struct Batch {
+	size_t first;
+	size_t count;
+};
+
+/* One recorded thread's requests */
+struct ThreadTrace {
+	uint32_t tid;
+	std::vector<Batch> batches;
+	/* Host buffer space needed by its requests */
+	uint64_t src_size;
+	uint64_t dst_size;
+};
+
+/* One recorded device file */
+struct File {
+	File() : ring_entries(0), windows(), win_sizes() {}
+
+	std::unique_ptr<picoevb::Device> dev;
+	/* Serializes use of ring, as the recorded program must have */
+	std::mutex ring_lock;
+	std::unique_ptr<picoevb::Ring> ring;
+	uint32_t ring_entries;
+	/* Windows over win_bufs, indexed by c2h */
+	std::unique_ptr<picoevb::HostBuffer> win_bufs[2];
+	uint32_t windows[2];
+	uint64_t win_sizes[2];
+};
+
+struct OpResult {
+	OpResult() : transfers(0), errors(0), bytes(0) {}
+
+	uint64_t transfers;
+	uint64_t errors;
+	uint64_t bytes;
+	/* Latency of each replayed and recorded request, in ns */
+	std::vector<uint64_t> latency_ns;
+	std::vector<uint64_t> recorded_ns;
+};
+
+struct Replay {
+	std::vector<struct pevb_trace_record> records;
+	std::vector<ThreadTrace> threads;
+	std::map<int, File> files;
+	/* Recorded time from the first request to the end of the last */
+	uint64_t duration_ns;
+	uint64_t skipped;
+	uint64_t substituted;
+
+	std::mutex lock;
+	OpResult results[PEVB_TRACE_OP_COUNT];
+	/* How far the furthest-behind request was issued after its time */
+	uint64_t max_lag_ns;
+	std::exception_ptr error;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(uint64_t t)
+{
+	struct timespec ts;
+
+	ts.tv_sec = t / 1000000000ULL;
+	ts.tv_nsec = t % 1000000000ULL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+			EINTR)
+		;
+}
+
+static bool is_ring(const struct pevb_trace_record &rec)
+{
+	int mem = rec.op == PEVB_TRACE_OP_C2H ? rec.mem >> 4 : rec.mem & 0xf;
+
+	return mem == PEVB_TRACE_MEM_WINDOW;
+}
+
+/* Bytes of host memory touched by one side of a transfer */
+static uint64_t host_extent(const struct pevb_trace_record &rec, int side)
+{
+	uint64_t len = rec.width;
+
+	if (rec.height > 1)
+		len += (uint64_t)(rec.height - 1) * rec.host_pitch;
+
+	return rec.align[side] + len;
+}
+
+static bool load_trace(const char *path, Replay &replay)
+{
+	struct pevb_trace_header hdr;
+	std::vector<char> rec(sizeof(struct pevb_trace_record));
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		perror(path);
+		return false;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+			strcmp(hdr.magic, PEVB_TRACE_MAGIC) ||
+			hdr.version != PEVB_TRACE_VERSION ||
+			hdr.record_size < sizeof(struct pevb_trace_record)) {
+		fprintf(stderr, "%s: not a pevb trace\n", path);
+		fclose(f);
+		return false;
+	}
+	/* Later versions may append fields to each record */
+	rec.resize(hdr.record_size);
+	while (fread(rec.data(), hdr.record_size, 1, f) == 1) {
+		struct pevb_trace_record r;
+
+		memcpy(&r, rec.data(), sizeof(r));
+		if (r.result || r.op >= PEVB_TRACE_OP_COUNT || !r.height) {
+			replay.skipped++;
+			continue;
+		}
+		if ((r.mem & 0xf) == PEVB_TRACE_MEM_CUDA ||
+				(r.mem & 0xf) == PEVB_TRACE_MEM_CUDA_VA ||
+				(r.mem >> 4) == PEVB_TRACE_MEM_CUDA ||
+				(r.mem >> 4) == PEVB_TRACE_MEM_CUDA_VA)
+			replay.substituted++;
+		replay.records.push_back(r);
+	}
+	fclose(f);
+
+	return true;
+}
+
+/* Split the records by thread, and into batches, and size the buffers */
+static void plan(Replay &replay)
+{
+	std::map<uint32_t, size_t> thread_index;
+	uint64_t first_ns = UINT64_MAX, end_ns = 0;
+	size_t i;
+
+	for (i = 0; i < replay.records.size(); i++) {
+		const struct pevb_trace_record &rec = replay.records[i];
+		bool c2h = rec.op == PEVB_TRACE_OP_C2H;
+
+		auto it = thread_index.find(rec.tid);
+		if (it == thread_index.end()) {
+			ThreadTrace t = ThreadTrace();
+			t.tid = rec.tid;
+			it = thread_index.insert(std::make_pair(rec.tid,
+				replay.threads.size())).first;
+			replay.threads.push_back(t);
+		}
+		ThreadTrace &t = replay.threads[it->second];
+		File &file = replay.files[rec.fd];
+
+		if (is_ring(rec)) {
+			file.win_sizes[c2h] = std::max(file.win_sizes[c2h],
+				host_extent(rec, c2h));
+		} else {
+			if (rec.op != PEVB_TRACE_OP_C2H)
+				t.src_size = std::max(t.src_size,
+					host_extent(rec, 0));
+			if (rec.op != PEVB_TRACE_OP_H2C)
+				t.dst_size = std::max(t.dst_size,
+					host_extent(rec, 1));
+		}
+
+		/* A doorbell's records are consecutive, at the same time */
+		if (is_ring(rec) && !t.batches.empty()) {
+			Batch &last = t.batches.back();
+			const struct pevb_trace_record &prev =
+				replay.records[last.first];
+			if (is_ring(prev) && prev.fd == rec.fd &&
+					prev.time_ns == rec.time_ns &&
+					last.first + last.count == i) {
+				last.count++;
+				file.ring_entries = std::max<uint32_t>(
+					file.ring_entries, last.count);
+				continue;
+			}
+		}
+		t.batches.push_back(Batch{ i, 1 });
+		if (is_ring(rec))
+			file.ring_entries = std::max<uint32_t>(
+				file.ring_entries, 1);
+
+		first_ns = std::min(first_ns, rec.time_ns);
+		end_ns = std::max(end_ns, rec.time_ns + rec.latency_ns);
+	}
+	replay.duration_ns = end_ns > first_ns ? end_ns - first_ns : 0;
+
+	/* Make times relative to the first request */
+	for (auto &rec : replay.records)
+		rec.time_ns -= first_ns;
+}
+
+static void open_files(const Config &cfg, Replay &replay)
+{
+	uint32_t entries;
+	int c2h;
+
+	for (auto &it : replay.files) {
+		File &file = it.second;
+
+		file.dev.reset(new picoevb::Device(cfg.device));
+		if (!file.ring_entries)
+			continue;
+		for (entries = 1; entries < file.ring_entries; entries <<= 1)
+			;
+		file.ring.reset(new picoevb::Ring(*file.dev, entries));
+		for (c2h = 0; c2h < 2; c2h++) {
+			if (!file.win_sizes[c2h])
+				continue;
+			file.win_bufs[c2h].reset(
+				new picoevb::HostBuffer(file.win_sizes[c2h]));
+			file.windows[c2h] = file.dev->register_window(
+				file.win_bufs[c2h]->data(),
+				file.win_bufs[c2h]->size(),
+				c2h ? PICOEVB_WINDOW_FLAG_C2H : 0);
+		}
+	}
+}
+
+static void issue(picoevb::Device &dev, const struct pevb_trace_record &rec,
+	picoevb::HostBuffer &src, picoevb::HostBuffer &dst)
+{
+	switch (rec.op) {
+	case PEVB_TRACE_OP_H2C:
+		if (rec.height > 1)
+			dev.h2c_2d(src, rec.align[0], rec.host_pitch,
+				rec.fpga_offset, rec.fpga_pitch, rec.width,
+				rec.height);
+		else
+			dev.h2c(src, rec.align[0], rec.fpga_offset, rec.width);
+		break;
+	case PEVB_TRACE_OP_C2H:
+		if (rec.height > 1)
+			dev.c2h_2d(rec.fpga_offset, rec.fpga_pitch, dst,
+				rec.align[1], rec.host_pitch, rec.width,
+				rec.height);
+		else
+			dev.c2h(rec.fpga_offset, dst, rec.align[1], rec.width);
+		break;
+	case PEVB_TRACE_OP_H2C2H:
+		dev.h2c2h(src, rec.align[0], dst, rec.align[1], rec.width);
+		break;
+	}
+}
+
+/* Run a doorbell's transfers; returns the number that failed */
+static unsigned int issue_ring(File &file,
+	const struct pevb_trace_record *recs, size_t count)
+{
+	std::lock_guard<std::mutex> guard(file.ring_lock);
+	struct picoevb_rdma_cqe cqe;
+	unsigned int errors = 0;
+	size_t i, done = 0;
+
+	for (i = 0; i < count; i++) {
+		const struct pevb_trace_record &rec = recs[i];
+		bool c2h = rec.op == PEVB_TRACE_OP_C2H;
+		struct picoevb_rdma_sqe sqe = {};
+
+		sqe.user_data = i;
+		sqe.opcode = c2h ? PICOEVB_RING_OP_C2H : PICOEVB_RING_OP_H2C;
+		sqe.window = file.windows[c2h];
+		sqe.window_offset = rec.align[c2h];
+		sqe.ram_offset = rec.fpga_offset;
+		sqe.len = rec.width;
+		file.ring->submit(sqe);
+	}
+	while (done < count) {
+		file.ring->doorbell();
+		while (file.ring->reap(&cqe)) {
+			if (cqe.result)
+				errors++;
+			done++;
+		}
+	}
+
+	return errors;
+}
+
+static void replay_thread(const Config &cfg, Replay &replay,
+	const ThreadTrace &t, uint64_t start_ns)
+{
+	picoevb::HostBuffer src(std::max<uint64_t>(t.src_size, 1));
+	picoevb::HostBuffer dst(std::max<uint64_t>(t.dst_size, 1));
+	OpResult results[PEVB_TRACE_OP_COUNT];
+	uint64_t max_lag_ns = 0, t0, lat;
+	unsigned int rep;
+	size_t i;
+	int op;
+
+	for (rep = 0; rep < cfg.repeat; rep++) {
+		for (const Batch &b : t.batches) {
+			const struct pevb_trace_record *recs =
+				&replay.records[b.first];
+			File &file = replay.files.at(recs[0].fd);
+			unsigned int errors = 0;
+
+			if (cfg.speed > 0) {
+				uint64_t due = start_ns + (uint64_t)
+					((rep * replay.duration_ns +
+					recs[0].time_ns) / cfg.speed);
+				sleep_until_ns(due);
+				max_lag_ns = std::max(max_lag_ns,
+					now_ns() - due);
+			}
+
+			t0 = now_ns();
+			if (is_ring(recs[0])) {
+				errors = issue_ring(file, recs, b.count);
+			} else {
+				try {
+					issue(*file.dev, recs[0], src, dst);
+				} catch (const picoevb::Error &) {
+					errors = 1;
+				}
+			}
+			lat = now_ns() - t0;
+
+			for (i = 0; i < b.count; i++) {
+				OpResult &r = results[recs[i].op];
+
+				r.latency_ns.push_back(lat);
+				r.recorded_ns.push_back(recs[i].latency_ns);
+				r.transfers++;
+				r.bytes += recs[i].width * recs[i].height;
+			}
+			results[recs[0].op].errors += errors;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard(replay.lock);
+	for (op = 0; op < PEVB_TRACE_OP_COUNT; op++) {
+		OpResult &total = replay.results[op];
+		OpResult &r = results[op];
+
+		total.transfers += r.transfers;
+		total.errors += r.errors;
+		total.bytes += r.bytes;
+		total.latency_ns.insert(total.latency_ns.end(),
+			r.latency_ns.begin(), r.latency_ns.end());
+		total.recorded_ns.insert(total.recorded_ns.end(),
+			r.recorded_ns.begin(), r.recorded_ns.end());
+	}
+	replay.max_lag_ns = std::max(replay.max_lag_ns, max_lag_ns);
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	size_t rank;
+
+	if (sorted.empty())
+		return 0;
+	rank = (size_t)ceil(p / 100.0 * sorted.size());
+	if (rank < 1)
+		rank = 1;
+
+	return sorted[rank - 1];
+}
+
+/* Bytes per microsecond, i.e. MB/s */
+static double mbps(uint64_t size, double ns)
+{
+	return ns > 0 ? size * 1000.0 / ns : 0;
+}
+
+static void print_table(FILE *f, const Config &cfg, const Replay &replay,
+	uint64_t elapsed_ns)
+{
+	uint64_t transfers = 0, bytes = 0;
+	int op;
+
+	fprintf(f, "%-6s %10s %7s %12s %10s %10s %10s %10s %10s %10s "
+		"%10s %10s\n",
+		"op", "transfers", "errors", "bytes", "MB/s", "rec_p50_us",
+		"rec_p99_us", "p50_us", "p90_us", "p99_us", "p99.9_us",
+		"max_us");
+	for (op = 0; op < PEVB_TRACE_OP_COUNT; op++) {
+		const OpResult &r = replay.results[op];
+
+		if (!r.transfers)
+			continue;
+		transfers += r.transfers;
+		bytes += r.bytes;
+		fprintf(f, "%-6s %10" PRIu64 " %7" PRIu64 " %12" PRIu64
+			" %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f %10.1f"
+			" %10.1f\n",
+			op_names[op], r.transfers, r.errors, r.bytes,
+			mbps(r.bytes, elapsed_ns),
+			percentile(r.recorded_ns, 50) / 1000.0,
+			percentile(r.recorded_ns, 99) / 1000.0,
+			percentile(r.latency_ns, 50) / 1000.0,
+			percentile(r.latency_ns, 90) / 1000.0,
+			percentile(r.latency_ns, 99) / 1000.0,
+			percentile(r.latency_ns, 99.9) / 1000.0,
+			percentile(r.latency_ns, 100) / 1000.0);
+	}
+
+	fprintf(f, "\n%" PRIu64 " transfers, %" PRIu64 " bytes in %.3f s: "
+		"%.1f MB/s, %.0f transfers/s\n",
+		transfers, bytes, elapsed_ns / 1e9, mbps(bytes, elapsed_ns),
+		elapsed_ns ? transfers * 1e9 / elapsed_ns : 0);
+	if (cfg.speed > 0)
+		fprintf(f, "recorded duration %.3f s at %gx speed; furthest "
+			"behind schedule %.1f us\n",
+			replay.duration_ns * cfg.repeat / 1e9, cfg.speed,
+			replay.max_lag_ns / 1000.0);
+	if (replay.skipped)
+		fprintf(f, "skipped %" PRIu64 " requests that failed when "
+			"recorded\n", replay.skipped);
+	if (replay.substituted)
+		fprintf(f, "replayed %" PRIu64 " CUDA memory requests with "
+			"host memory\n", replay.substituted);
+}
+
+static void print_json(FILE *f, const Config &cfg, const Replay &replay,
+	uint64_t elapsed_ns)
+{
+	bool first = true;
+	size_t j;
+	int op;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"tool\": \"pevb-replay\",\n");
+	fprintf(f, "  \"trace\": \"%s\",\n", cfg.trace);
+	if (cfg.speed > 0)
+		fprintf(f, "  \"speed\": %g,\n", cfg.speed);
+	else
+		fprintf(f, "  \"speed\": null,\n");
+	fprintf(f, "  \"repeat\": %u,\n", cfg.repeat);
+	fprintf(f, "  \"elapsed_ns\": %" PRIu64 ",\n", elapsed_ns);
+	fprintf(f, "  \"max_lag_ns\": %" PRIu64 ",\n", replay.max_lag_ns);
+	fprintf(f, "  \"skipped\": %" PRIu64 ",\n", replay.skipped);
+	fprintf(f, "  \"substituted\": %" PRIu64 ",\n", replay.substituted);
+	fprintf(f, "  \"results\": [\n");
+	for (op = 0; op < PEVB_TRACE_OP_COUNT; op++) {
+		const OpResult &r = replay.results[op];
+
+		if (!r.transfers)
+			continue;
+		fprintf(f, "%s    {\n", first ? "" : ",\n");
+		first = false;
+		fprintf(f, "      \"op\": \"%s\",\n", op_names[op]);
+		fprintf(f, "      \"transfers\": %" PRIu64 ",\n", r.transfers);
+		fprintf(f, "      \"errors\": %" PRIu64 ",\n", r.errors);
+		fprintf(f, "      \"bytes\": %" PRIu64 ",\n", r.bytes);
+		fprintf(f, "      \"mbps\": %.3f,\n",
+			mbps(r.bytes, elapsed_ns));
+		fprintf(f, "      \"recorded_median_ns\": %" PRIu64 ",\n",
+			percentile(r.recorded_ns, 50));
+		fprintf(f, "      \"recorded_p99_ns\": %" PRIu64 ",\n",
+			percentile(r.recorded_ns, 99));
+		fprintf(f, "      \"median_ns\": %" PRIu64 ",\n",
+			percentile(r.latency_ns, 50));
+		fprintf(f, "      \"p90_ns\": %" PRIu64 ",\n",
+			percentile(r.latency_ns, 90));
+		fprintf(f, "      \"p99_ns\": %" PRIu64 ",\n",
+			percentile(r.latency_ns, 99));
+		fprintf(f, "      \"p999_ns\": %" PRIu64 ",\n",
+			percentile(r.latency_ns, 99.9));
+		fprintf(f, "      \"max_ns\": %" PRIu64 ",\n",
+			percentile(r.latency_ns, 100));
+		fprintf(f, "      \"samples_ns\": [");
+		for (j = 0; j < r.latency_ns.size(); j++)
+			fprintf(f, "%s%" PRIu64, j ? ", " : "",
+				r.latency_ns[j]);
+		fprintf(f, "]\n");
+		fprintf(f, "    }");
+	}
+	fprintf(f, "\n  ]\n");
+	fprintf(f, "}\n");
+}
+
+static void usage(FILE *f)
+{
+	fprintf(f,
+		"usage: pevb-replay [options] TRACE\n"
+		"  -s, --speed X         issue requests at X times their\n"
+		"                        recorded rate (default: 1)\n"
+		"  -a, --afap            issue each thread's requests as fast\n"
+		"                        as possible\n"
+		"  -r, --repeat N        replay the trace N times\n"
+		"                        (default: 1)\n"
+		"  -d, --device PATH     device file (default: /dev/picoevb)\n"
+		"  -f, --format FMT      table or json (default: table)\n"
+		"  -o, --output FILE     write results to FILE\n"
+		"  -h, --help\n");
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "speed",	required_argument,	0, 's' },
+		{ "afap",	no_argument,		0, 'a' },
+		{ "repeat",	required_argument,	0, 'r' },
+		{ "device",	required_argument,	0, 'd' },
+		{ "format",	required_argument,	0, 'f' },
+		{ "output",	required_argument,	0, 'o' },
+		{ "help",	no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	std::vector<std::thread> threads;
+	Config cfg;
+	Replay replay;
+	uint64_t start_ns, elapsed_ns;
+	char *end;
+	int opt;
+	FILE *f;
+
+	cfg.device = "/dev/picoevb";
+	cfg.speed = 1;
+	cfg.repeat = 1;
+	cfg.format = FMT_TABLE;
+	cfg.output = NULL;
+	replay.skipped = 0;
+	replay.substituted = 0;
+	replay.max_lag_ns = 0;
+
+	while ((opt = getopt_long(argc, argv, "s:ar:d:f:o:h", long_opts,
+			NULL)) != -1) {
+		switch (opt) {
+		case 's':
+			cfg.speed = strtod(optarg, &end);
+			if (*end || !(cfg.speed > 0)) {
+				fprintf(stderr, "invalid speed: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'a':
+			cfg.speed = 0;
+			break;
+		case 'r':
+			cfg.repeat = strtoul(optarg, &end, 0);
+			if (*end || !cfg.repeat) {
+				fprintf(stderr, "invalid repeat: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'd':
+			cfg.device = optarg;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "table")) {
+				cfg.format = FMT_TABLE;
+			} else if (!strcmp(optarg, "json")) {
+				cfg.format = FMT_JSON;
+			} else {
+				fprintf(stderr, "unknown format: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'o':
+			cfg.output = optarg;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(stderr);
+		return 1;
+	}
+	cfg.trace = argv[optind];
+
+	if (!load_trace(cfg.trace, replay))
+		return 1;
+	if (replay.records.empty()) {
+		fprintf(stderr, "%s: no requests to replay\n", cfg.trace);
+		return 1;
+	}
+	plan(replay);
+
+	try {
+		open_files(cfg, replay);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	/* Leave time for every thread to start before the first request */
+	start_ns = now_ns();
+	if (cfg.speed > 0)
+		start_ns += 10000000;
+	for (const ThreadTrace &t : replay.threads) {
+		threads.emplace_back([&cfg, &replay, &t, start_ns] {
+			try {
+				replay_thread(cfg, replay, t, start_ns);
+			} catch (...) {
+				std::lock_guard<std::mutex> guard(replay.lock);
+				replay.error = std::current_exception();
+			}
+		});
+	}
+	for (auto &thread : threads)
+		thread.join();
+	elapsed_ns = now_ns() - start_ns;
+
+	if (replay.error) {
+		try {
+			std::rethrow_exception(replay.error);
+		} catch (const std::exception &e) {
+			fprintf(stderr, "%s\n", e.what());
+			return 1;
+		}
+	}
+
+	for (auto &r : replay.results) {
+		std::sort(r.latency_ns.begin(), r.latency_ns.end());
+		std::sort(r.recorded_ns.begin(), r.recorded_ns.end());
+	}
+
+	f = stdout;
+	if (cfg.output) {
+		f = fopen(cfg.output, "w");
+		if (!f) {
+			perror(cfg.output);
+			return 1;
+		}
+	}
+	if (cfg.format == FMT_JSON)
+		print_json(f, cfg, replay, elapsed_ns);
+	else
+		print_table(f, cfg, replay, elapsed_ns);
+	if (f != stdout)
+		fclose(f);
+
+	return 0;
+}
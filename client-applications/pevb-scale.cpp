@@ -0,0 +1,1079 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * pevb-scale: concurrency scalability benchmark.
+ *
+ * Runs a random mix of transfers from a growing number of concurrent clients,
+ * each a thread or a process, on one shared device file or on a file each.
+ * For each client count, reports aggregate and per-client throughput, the
+ * fairness between clients (Jain's index), the time spent waiting for the DMA
+ * engine, and latency percentiles. Finally, shows where throughput stops
+ * scaling, and which part of each transfer's time grew to cause it.
+ *
+ * Waiting for the DMA engine is measured by the driver (queue_wait_ns). Time
+ * outside all of the driver's timed phases is reported separately: it is
+ * system call overhead, plus waiting for the per-file lock, so grows with
+ * contention when clients share a file.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+#include "picoevb.hpp"
+
+#define SYSFS_CLASS "/sys/class/picoevb"
+
+enum Op {
+	OP_H2C,
+	OP_C2H,
+	OP_H2C2H,
+	OP_COUNT
+};
+
+static const char * const op_names[OP_COUNT] = {
+	"h2c",
+	"c2h",
+	"h2c2h",
+};
+
+enum Format {
+	FMT_TABLE,
+	FMT_JSON,
+};
+
+struct Config {
+	std::vector<uint64_t> clients;
+	bool processes;
+	bool shared_fd;
+	/* Relative frequency of each op */
+	unsigned int mix[OP_COUNT];
+	std::string mix_arg;
+	/* Each transfer's size is picked from these at random */
+	std::vector<uint64_t> sizes;
+	std::string sizes_arg;
+	uint64_t seconds;
+	unsigned int warmup;
+	bool verbose;
+	Format format;
+	const char *device;
+	const char *output;
+};
+
+/* Latency samples kept per client; see merge_samples() */
+static const size_t sample_cap = 20000;
+
+/*
+ * One client's results. Lives in memory shared with the benchmark's other
+ * processes, followed by sample_cap latency samples.
+ */
+struct ClientResult {
+	uint64_t ops[OP_COUNT];
+	uint64_t bytes;
+	uint64_t errors;
+	/* From the start of the run until the client's last transfer ended */
+	uint64_t elapsed_ns;
+	/* Summed over all transfers */
+	uint64_t wall_ns;
+	uint64_t queue_wait_ns;
+	/* Pinning, mapping and unmapping */
+	uint64_t setup_ns;
+	/* The DMA engine running, and waking the task on completion */
+	uint64_t engine_ns;
+	/* Wall time outside all of the driver's timed phases */
+	uint64_t other_ns;
+	/* Samples kept, at most sample_cap */
+	uint64_t n_samples;
+	/* Set if the client failed */
+	char error[128];
+};
+
+/* Synchronises the clients' start and end; in shared memory */
+struct Control {
+	/* Clients that have finished setting up, or failed to */
+	std::atomic<unsigned int> ready;
+	std::atomic<unsigned int> failed;
+	std::atomic<bool> go;
+	/* Valid once go is set */
+	uint64_t start_ns;
+	uint64_t stop_ns;
+};
+
+/* Anonymous shared memory, inherited by forked clients */
+class SharedArena {
+public:
+	explicit SharedArena(unsigned int clients)
+	{
+		size_ = client_offset(clients);
+		mem_ = mmap(NULL, size_, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (mem_ == MAP_FAILED)
+			throw picoevb::Error(errno, "mmap() failed");
+		/* mmap() zeroes the memory */
+		new (mem_) Control();
+	}
+
+	~SharedArena()
+	{
+		control().~Control();
+		munmap(mem_, size_);
+	}
+
+	SharedArena(const SharedArena &) = delete;
+	SharedArena &operator=(const SharedArena &) = delete;
+
+	Control &control() { return *static_cast<Control *>(mem_); }
+
+	ClientResult &client(unsigned int i)
+	{
+		return *reinterpret_cast<ClientResult *>(
+			static_cast<char *>(mem_) + client_offset(i));
+	}
+
+	uint64_t *samples(unsigned int i)
+	{
+		return reinterpret_cast<uint64_t *>(&client(i) + 1);
+	}
+
+private:
+	static size_t client_offset(unsigned int i)
+	{
+		size_t control_size = (sizeof(Control) + 63) & ~(size_t)63;
+
+		return control_size + i * (sizeof(ClientResult) +
+			sample_cap * sizeof(uint64_t));
+	}
+
+	size_t size_;
+	void *mem_;
+};
+
+struct Step {
+	unsigned int clients;
+	/* The run's duration, until the last client stopped */
+	uint64_t elapsed_ns;
+	std::vector<ClientResult> results;
+	/* Totals over all clients */
+	ClientResult total;
+	/* Latency of a representative sample of transfers, sorted */
+	std::vector<uint64_t> wall_ns;
+	/* Fraction of the run the DMA engine was busy, or negative */
+	double busy;
+	/* The scheduler's counts, for all users of the card */
+	uint64_t sched_dispatched;
+	uint64_t sched_wait_ns;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* xorshift64*; each client has its own, so runs are repeatable */
+class Random {
+public:
+	explicit Random(uint64_t seed) : state_(seed * 2654435761ULL + 1) {}
+
+	uint64_t next()
+	{
+		state_ ^= state_ >> 12;
+		state_ ^= state_ << 25;
+		state_ ^= state_ >> 27;
+
+		return state_ * 2685821657736338717ULL;
+	}
+
+	uint64_t below(uint64_t n) { return next() % n; }
+
+private:
+	uint64_t state_;
+};
+
+static uint64_t transfer(picoevb::Device &dev, int op, picoevb::HostBuffer &a,
+	picoevb::HostBuffer &b, uint64_t size,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	switch (op) {
+	case OP_H2C:
+		return dev.h2c(a, 0, 0, size, timing);
+	case OP_C2H:
+		return dev.c2h(0, a, 0, size, timing);
+	default:
+		return dev.h2c2h(a, 0, b, 0, size, timing);
+	}
+}
+
+static int pick_op(const Config &cfg, Random &rng)
+{
+	unsigned int total = 0, r;
+	int op;
+
+	for (op = 0; op < OP_COUNT; op++)
+		total += cfg.mix[op];
+	r = rng.below(total);
+	for (op = 0; op < OP_COUNT - 1; op++) {
+		if (r < cfg.mix[op])
+			break;
+		r -= cfg.mix[op];
+	}
+
+	return op;
+}
+
+static void account(ClientResult &r, uint64_t *samples, Random &rng,
+	uint64_t wall_ns, const struct picoevb_rdma_dma_timing &t)
+{
+	uint64_t timed = t.pin_ns + t.map_ns + t.unmap_ns + t.queue_wait_ns +
+		t.hw_ns + t.irq_to_wake_ns;
+	uint64_t seen = r.ops[OP_H2C] + r.ops[OP_C2H] + r.ops[OP_H2C2H];
+	uint64_t i;
+
+	r.wall_ns += wall_ns;
+	r.queue_wait_ns += t.queue_wait_ns;
+	r.setup_ns += t.pin_ns + t.map_ns + t.unmap_ns;
+	r.engine_ns += t.hw_ns + t.irq_to_wake_ns;
+	if (wall_ns > timed)
+		r.other_ns += wall_ns - timed;
+
+	/* Reservoir sampling; seen excludes this transfer */
+	if (r.n_samples < sample_cap) {
+		samples[r.n_samples++] = wall_ns;
+	} else {
+		i = rng.below(seen + 1);
+		if (i < sample_cap)
+			samples[i] = wall_ns;
+	}
+}
+
+static void run_client(const Config &cfg, picoevb::Device &dev,
+	SharedArena &arena, unsigned int index, bool &ready)
+{
+	Control &ctl = arena.control();
+	ClientResult &r = arena.client(index);
+	uint64_t *samples = arena.samples(index);
+	uint64_t max_size = *std::max_element(cfg.sizes.begin(),
+		cfg.sizes.end());
+	picoevb::HostBuffer a(max_size);
+	picoevb::HostBuffer b(max_size);
+	struct picoevb_rdma_dma_timing timing;
+	Random rng(index);
+	uint64_t ts, size, end;
+	unsigned int i;
+	int op;
+
+	memset(a.data(), 0, a.size());
+	memset(b.data(), 0, b.size());
+	for (i = 0; i < cfg.warmup; i++)
+		transfer(dev, pick_op(cfg, rng), a, b,
+			cfg.sizes[rng.below(cfg.sizes.size())], NULL);
+
+	ready = true;
+	ctl.ready++;
+	while (!ctl.go.load(std::memory_order_acquire))
+		usleep(100);
+
+	end = ctl.start_ns;
+	while (end < ctl.stop_ns) {
+		op = pick_op(cfg, rng);
+		size = cfg.sizes[rng.below(cfg.sizes.size())];
+		memset(&timing, 0, sizeof(timing));
+		ts = now_ns();
+		try {
+			transfer(dev, op, a, b, size, &timing);
+		} catch (const picoevb::Error &) {
+			r.errors++;
+			end = now_ns();
+			continue;
+		}
+		end = now_ns();
+		account(r, samples, rng, end - ts, timing);
+		r.ops[op]++;
+		r.bytes += size;
+	}
+	r.elapsed_ns = end - ctl.start_ns;
+}
+
+/* Runs one client, recording any failure in its results */
+static bool client_main(const Config &cfg, picoevb::Device *shared_dev,
+	SharedArena &arena, unsigned int index)
+{
+	Control &ctl = arena.control();
+	bool ready = false;
+
+	try {
+		if (shared_dev) {
+			run_client(cfg, *shared_dev, arena, index, ready);
+		} else {
+			picoevb::Device dev(cfg.device);
+
+			run_client(cfg, dev, arena, index, ready);
+		}
+		return true;
+	} catch (const std::exception &e) {
+		snprintf(arena.client(index).error,
+			sizeof(arena.client(index).error), "%s", e.what());
+		ctl.failed++;
+		if (!ready)
+			ctl.ready++;
+		return false;
+	}
+}
+
+/* The sum of both channels' busy time, or false if unavailable */
+static bool read_busy_ns(const Config &cfg, uint64_t *busy_ns)
+{
+	const char *card = strrchr(cfg.device, '/');
+	const char * const chans[] = { "h2c", "c2h" };
+	unsigned long long v;
+	size_t i;
+	FILE *f;
+	int n;
+
+	card = card ? card + 1 : cfg.device;
+	*busy_ns = 0;
+	for (i = 0; i < 2; i++) {
+		std::string path = std::string(SYSFS_CLASS "/") + card +
+			"/stats/" + chans[i] + "_busy_ns";
+
+		f = fopen(path.c_str(), "r");
+		if (!f)
+			return false;
+		n = fscanf(f, "%llu", &v);
+		fclose(f);
+		if (n != 1)
+			return false;
+		*busy_ns += v;
+	}
+
+	return true;
+}
+
+static void sched_totals(picoevb::Device &dev, uint64_t *dispatched,
+	uint64_t *wait_ns)
+{
+	struct picoevb_rdma_sched_stats stats = dev.sched_stats();
+	int prio;
+
+	*dispatched = 0;
+	*wait_ns = 0;
+	for (prio = 0; prio < PICOEVB_PRIO_COUNT; prio++) {
+		*dispatched += stats.classes[prio].dispatched;
+		*wait_ns += stats.classes[prio].total_wait_ns;
+	}
+}
+
+/*
+ * Combine the clients' reservoirs so that each kept sample stands for the
+ * same number of transfers, whichever client made them.
+ */
+static void merge_samples(Step &step, SharedArena &arena)
+{
+	double per_sample = 1;
+	uint64_t ops, take, j;
+	unsigned int i;
+	int op;
+
+	for (i = 0; i < step.clients; i++) {
+		const ClientResult &r = step.results[i];
+
+		ops = 0;
+		for (op = 0; op < OP_COUNT; op++)
+			ops += r.ops[op];
+		if (r.n_samples)
+			per_sample = std::max(per_sample,
+				(double)ops / r.n_samples);
+	}
+	for (i = 0; i < step.clients; i++) {
+		const ClientResult &r = step.results[i];
+		const uint64_t *samples = arena.samples(i);
+
+		ops = 0;
+		for (op = 0; op < OP_COUNT; op++)
+			ops += r.ops[op];
+		take = std::min(r.n_samples, (uint64_t)(ops / per_sample));
+		for (j = 0; j < take; j++)
+			step.wall_ns.push_back(samples[j * r.n_samples / take]);
+	}
+	std::sort(step.wall_ns.begin(), step.wall_ns.end());
+}
+
+static void sum_results(ClientResult &total, const ClientResult &r)
+{
+	int op;
+
+	for (op = 0; op < OP_COUNT; op++)
+		total.ops[op] += r.ops[op];
+	total.bytes += r.bytes;
+	total.errors += r.errors;
+	total.elapsed_ns = std::max(total.elapsed_ns, r.elapsed_ns);
+	total.wall_ns += r.wall_ns;
+	total.queue_wait_ns += r.queue_wait_ns;
+	total.setup_ns += r.setup_ns;
+	total.engine_ns += r.engine_ns;
+	total.other_ns += r.other_ns;
+}
+
+static bool run_step(const Config &cfg, picoevb::Device &dev,
+	unsigned int clients, Step &step)
+{
+	SharedArena arena(clients);
+	Control &ctl = arena.control();
+	picoevb::Device *shared_dev = cfg.shared_fd ? &dev : NULL;
+	std::vector<std::thread> threads;
+	std::vector<pid_t> pids;
+	uint64_t busy_start = 0, busy_end = 0, dispatched, wait_ns;
+	bool have_busy, ok = true;
+	unsigned int i;
+	int status;
+	pid_t pid;
+
+	/* Don't let forked clients flush the parent's buffered output */
+	fflush(NULL);
+	for (i = 0; i < clients; i++) {
+		if (!cfg.processes) {
+			threads.emplace_back(client_main, std::cref(cfg),
+				shared_dev, std::ref(arena), i);
+			continue;
+		}
+		pid = fork();
+		if (pid < 0) {
+			perror("fork() failed");
+			ctl.failed++;
+			break;
+		}
+		if (!pid)
+			_exit(client_main(cfg, shared_dev, arena, i) ? 0 : 1);
+		pids.push_back(pid);
+	}
+
+	while (ctl.ready.load() < threads.size() + pids.size())
+		usleep(1000);
+
+	have_busy = read_busy_ns(cfg, &busy_start);
+	sched_totals(dev, &step.sched_dispatched, &step.sched_wait_ns);
+	ctl.start_ns = now_ns();
+	/* If any client failed to start, stop the others straight away */
+	ctl.stop_ns = ctl.start_ns + (ctl.failed.load() ? 0 :
+		cfg.seconds * 1000000000ULL);
+	ctl.go.store(true, std::memory_order_release);
+
+	for (i = 0; i < threads.size(); i++)
+		threads[i].join();
+	for (i = 0; i < pids.size(); i++) {
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status))
+			ok = false;
+	}
+
+	have_busy = read_busy_ns(cfg, &busy_end) && have_busy;
+	sched_totals(dev, &dispatched, &wait_ns);
+	step.sched_dispatched = dispatched - step.sched_dispatched;
+	step.sched_wait_ns = wait_ns - step.sched_wait_ns;
+
+	for (i = 0; i < clients; i++) {
+		if (arena.client(i).error[0]) {
+			fprintf(stderr, "client %u: %s\n", i,
+				arena.client(i).error);
+			ok = false;
+		}
+	}
+	if (!ok || ctl.failed.load())
+		return false;
+
+	step.clients = clients;
+	memset(&step.total, 0, sizeof(step.total));
+	for (i = 0; i < clients; i++) {
+		step.results.push_back(arena.client(i));
+		sum_results(step.total, arena.client(i));
+	}
+	step.elapsed_ns = step.total.elapsed_ns;
+	step.busy = have_busy && step.elapsed_ns ?
+		(double)(busy_end - busy_start) / step.elapsed_ns : -1;
+	merge_samples(step, arena);
+
+	return true;
+}
+
+/* Nearest-rank percentile of sorted samples */
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+	size_t rank;
+
+	if (sorted.empty())
+		return 0;
+	rank = (size_t)ceil(p / 100.0 * sorted.size() - 1e-6);
+	if (rank < 1)
+		rank = 1;
+
+	return sorted[rank - 1];
+}
+
+/* Bytes per microsecond, i.e. MB/s */
+static double mbps(uint64_t bytes, uint64_t ns)
+{
+	return ns ? bytes * 1000.0 / ns : 0;
+}
+
+static uint64_t transfers(const ClientResult &r)
+{
+	return r.ops[OP_H2C] + r.ops[OP_C2H] + r.ops[OP_H2C2H];
+}
+
+static double client_mbps(const ClientResult &r)
+{
+	return mbps(r.bytes, r.elapsed_ns);
+}
+
+/* Jain's fairness index: 1 if all clients are equal, 1/n if one has all */
+static double jain(const Step &step)
+{
+	double sum = 0, sum_sq = 0, x;
+	size_t i;
+
+	for (i = 0; i < step.results.size(); i++) {
+		x = client_mbps(step.results[i]);
+		sum += x;
+		sum_sq += x * x;
+	}
+
+	return sum_sq > 0 ? sum * sum / (step.results.size() * sum_sq) : 1;
+}
+
+/* Mean of a per-transfer total, in microseconds */
+static double mean_us(const Step &step, uint64_t total_ns)
+{
+	uint64_t n = transfers(step.total);
+
+	return n ? total_ns / 1000.0 / n : 0;
+}
+
+static double share(const Step &step, uint64_t total_ns)
+{
+	return step.total.wall_ns ? 100.0 * total_ns / step.total.wall_ns : 0;
+}
+
+static void print_steps(FILE *f, const std::vector<Step> &steps)
+{
+	double base = 0;
+	char busy[16];
+	size_t i;
+
+	fprintf(f, "%7s %10s %6s %10s %10s %6s %6s %9s %9s %9s %9s %9s\n",
+		"clients", "MB/s", "eff%", "min_MB/s", "max_MB/s", "jain",
+		"busy%", "wait_us", "other_us", "p50_us", "p99_us",
+		"p99.9_us");
+	for (i = 0; i < steps.size(); i++) {
+		const Step &s = steps[i];
+		double total = mbps(s.total.bytes, s.elapsed_ns);
+		double lo = INFINITY, hi = 0;
+		size_t c;
+
+		for (c = 0; c < s.results.size(); c++) {
+			lo = std::min(lo, client_mbps(s.results[c]));
+			hi = std::max(hi, client_mbps(s.results[c]));
+		}
+		/* Scaling efficiency, relative to the first step */
+		if (!i)
+			base = total / s.clients;
+		if (s.busy >= 0)
+			snprintf(busy, sizeof(busy), "%.1f", s.busy * 100);
+		else
+			snprintf(busy, sizeof(busy), "n/a");
+
+		fprintf(f, "%7u %10.1f %6.1f %10.1f %10.1f %6.3f %6s %9.1f "
+			"%9.1f %9.1f %9.1f %9.1f\n",
+			s.clients, total,
+			base > 0 ? 100.0 * total / (base * s.clients) : 0,
+			lo, hi, jain(s), busy,
+			mean_us(s, s.total.queue_wait_ns),
+			mean_us(s, s.total.other_ns),
+			percentile(s.wall_ns, 50) / 1000.0,
+			percentile(s.wall_ns, 99) / 1000.0,
+			percentile(s.wall_ns, 99.9) / 1000.0);
+	}
+}
+
+static void print_clients(FILE *f, const Step &step)
+{
+	size_t i;
+
+	fprintf(f, "\n%u clients:\n", step.clients);
+	fprintf(f, "%7s %10s %10s %10s %10s %8s %10s\n", "client", "h2c",
+		"c2h", "h2c2h", "MB/s", "errors", "wait_us");
+	for (i = 0; i < step.results.size(); i++) {
+		const ClientResult &r = step.results[i];
+		uint64_t n = transfers(r);
+
+		fprintf(f, "%7zu %10" PRIu64 " %10" PRIu64 " %10" PRIu64
+			" %10.1f %8" PRIu64 " %10.1f\n",
+			i, r.ops[OP_H2C], r.ops[OP_C2H], r.ops[OP_H2C2H],
+			client_mbps(r), r.errors,
+			n ? r.queue_wait_ns / 1000.0 / n : 0);
+	}
+}
+
+/*
+ * Find the first step that gained less than a quarter of the throughput its
+ * extra clients would ideally add, and explain it from the transfers' time.
+ */
+static void print_ceiling(FILE *f, const Config &cfg,
+	const std::vector<Step> &steps)
+{
+	const Step *knee = NULL, *prev = NULL;
+	double gain, ideal, wait, other, setup, engine;
+	size_t i;
+
+	for (i = 1; i < steps.size() && !knee; i++) {
+		prev = &steps[i - 1];
+		gain = mbps(steps[i].total.bytes, steps[i].elapsed_ns) /
+			mbps(prev->total.bytes, prev->elapsed_ns);
+		ideal = (double)steps[i].clients / prev->clients;
+		if (gain - 1 < (ideal - 1) / 4)
+			knee = &steps[i];
+	}
+
+	fprintf(f, "\n");
+	if (!knee) {
+		fprintf(f, "Throughput scaled up to %u clients; no ceiling "
+			"was reached.\n", steps.back().clients);
+		return;
+	}
+
+	fprintf(f, "Throughput stops scaling at %u clients: %+.1f%% for "
+		"%.1fx the clients of %u.\n", knee->clients, (gain - 1) * 100,
+		ideal, prev->clients);
+
+	wait = share(*knee, knee->total.queue_wait_ns);
+	other = share(*knee, knee->total.other_ns);
+	setup = share(*knee, knee->total.setup_ns);
+	engine = share(*knee, knee->total.engine_ns);
+	fprintf(f, "Transfer time: %.1f%% waiting for the DMA engine, "
+		"%.1f%% DMA and completion,\n", wait, engine);
+	fprintf(f, "%.1f%% pinning and mapping, %.1f%% outside the driver's "
+		"timed phases.\n", setup, other);
+
+	if (knee->busy >= 0.9) {
+		fprintf(f, "The DMA engine was busy %.1f%% of the time: the "
+			"ceiling is the hardware.\n", knee->busy * 100);
+	} else if (wait >= std::max(other, setup)) {
+		fprintf(f, "The ceiling is DMA engine ownership: transfers "
+			"queue for the engine, which\n"
+			"is owned by one transfer at a time, while it is ");
+		if (knee->busy >= 0)
+			fprintf(f, "only busy %.1f%% of the time.\n",
+				knee->busy * 100);
+		else
+			fprintf(f, "idle between descriptor chains.\n");
+	} else if (other >= setup) {
+		fprintf(f, "The ceiling is outside the DMA path: system calls, "
+			"and %s.\n", cfg.shared_fd ?
+			"waiting for the shared file's lock" :
+			"CPU contention between clients");
+	} else {
+		fprintf(f, "The ceiling is pinning and mapping memory, which "
+			"is CPU-bound.\n");
+	}
+}
+
+static void print_json(FILE *f, const Config &cfg, picoevb::Device &dev,
+	const std::vector<Step> &steps)
+{
+	/* Enough for statistical comparison, without a huge file */
+	const size_t max_samples = 100000;
+	size_t i, j, stride;
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"tool\": \"pevb-scale\",\n");
+	fprintf(f, "  \"fpga_ram_size\": %" PRIu64 ",\n", dev.fpga_ram_size());
+	fprintf(f, "  \"results\": [\n");
+	for (i = 0; i < steps.size(); i++) {
+		const Step &s = steps[i];
+
+		fprintf(f, "    {\n");
+		fprintf(f, "      \"clients\": %u,\n", s.clients);
+		fprintf(f, "      \"mode\": \"%s\",\n",
+			cfg.processes ? "process" : "thread");
+		fprintf(f, "      \"fds\": \"%s\",\n",
+			cfg.shared_fd ? "shared" : "separate");
+		fprintf(f, "      \"mix\": \"%s\",\n", cfg.mix_arg.c_str());
+		fprintf(f, "      \"sizes\": \"%s\",\n", cfg.sizes_arg.c_str());
+		fprintf(f, "      \"elapsed_ns\": %" PRIu64 ",\n",
+			s.elapsed_ns);
+		fprintf(f, "      \"reps\": %" PRIu64 ",\n",
+			transfers(s.total));
+		fprintf(f, "      \"errors\": %" PRIu64 ",\n", s.total.errors);
+		fprintf(f, "      \"mbps\": %.3f,\n",
+			mbps(s.total.bytes, s.elapsed_ns));
+		fprintf(f, "      \"client_mbps\": [");
+		for (j = 0; j < s.results.size(); j++)
+			fprintf(f, "%s%.3f", j ? ", " : "",
+				client_mbps(s.results[j]));
+		fprintf(f, "],\n");
+		fprintf(f, "      \"jain\": %.4f,\n", jain(s));
+		if (s.busy >= 0)
+			fprintf(f, "      \"engine_busy\": %.4f,\n", s.busy);
+		else
+			fprintf(f, "      \"engine_busy\": null,\n");
+		fprintf(f, "      \"queue_wait_mean_ns\": %.1f,\n",
+			mean_us(s, s.total.queue_wait_ns) * 1000);
+		fprintf(f, "      \"setup_mean_ns\": %.1f,\n",
+			mean_us(s, s.total.setup_ns) * 1000);
+		fprintf(f, "      \"engine_mean_ns\": %.1f,\n",
+			mean_us(s, s.total.engine_ns) * 1000);
+		fprintf(f, "      \"other_mean_ns\": %.1f,\n",
+			mean_us(s, s.total.other_ns) * 1000);
+		fprintf(f, "      \"sched_dispatched\": %" PRIu64 ",\n",
+			s.sched_dispatched);
+		fprintf(f, "      \"sched_wait_ns\": %" PRIu64 ",\n",
+			s.sched_wait_ns);
+		fprintf(f, "      \"median_ns\": %" PRIu64 ",\n",
+			percentile(s.wall_ns, 50));
+		fprintf(f, "      \"p99_ns\": %" PRIu64 ",\n",
+			percentile(s.wall_ns, 99));
+		fprintf(f, "      \"p999_ns\": %" PRIu64 ",\n",
+			percentile(s.wall_ns, 99.9));
+		/* Sorted; every stride'th of the merged samples */
+		stride = (s.wall_ns.size() + max_samples - 1) / max_samples;
+		fprintf(f, "      \"samples_ns\": [");
+		for (j = 0; j < s.wall_ns.size(); j += stride)
+			fprintf(f, "%s%" PRIu64, j ? ", " : "", s.wall_ns[j]);
+		fprintf(f, "]\n");
+		fprintf(f, "    }%s\n", i + 1 < steps.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+}
+
+static void usage(FILE *f)
+{
+	fprintf(f,
+		"usage: pevb-scale [options]\n"
+		"  -n, --clients LIST    client counts to run\n"
+		"                        (default: 1,2,4,8)\n"
+		"  -p, --processes       clients are processes, rather than\n"
+		"                        threads\n"
+		"  -S, --shared-fd       clients share one open file, rather\n"
+		"                        than each opening the device\n"
+		"  -x, --mix LIST        op[:weight],... of h2c, c2h, h2c2h\n"
+		"                        (default: h2c,c2h,h2c2h)\n"
+		"  -s, --sizes LIST      transfer sizes, with optional K/M/G\n"
+		"                        suffix, picked at random\n"
+		"                        (default: 64K)\n"
+		"  -t, --time SECS       seconds per client count\n"
+		"                        (default: 5)\n"
+		"  -w, --warmup N        un-timed transfers per client\n"
+		"                        (default: 10)\n"
+		"  -v, --verbose         show each client's results\n"
+		"  -d, --device PATH     device to open\n"
+		"                        (default: /dev/picoevb)\n"
+		"  -f, --format FMT      table or json (default: table)\n"
+		"  -o, --output FILE     write results to FILE\n"
+		"  -h, --help\n");
+}
+
+static bool parse_u64(const char *s, uint64_t *val)
+{
+	char *end;
+	unsigned long long v;
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (errno || end == s)
+		return false;
+	switch (*end) {
+	case 'G':
+	case 'g':
+		v <<= 10;
+		/* fall-through */
+	case 'M':
+	case 'm':
+		v <<= 10;
+		/* fall-through */
+	case 'K':
+	case 'k':
+		v <<= 10;
+		end++;
+		break;
+	}
+	if (*end)
+		return false;
+	*val = v;
+
+	return true;
+}
+
+static bool parse_u64s(const char *arg, std::vector<uint64_t> &out)
+{
+	std::string list(arg);
+	size_t start = 0, end;
+	uint64_t v;
+
+	out.clear();
+	while (start <= list.size()) {
+		end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		if (!parse_u64(list.substr(start, end - start).c_str(), &v) ||
+				!v) {
+			fprintf(stderr, "invalid number in: %s\n", arg);
+			return false;
+		}
+		out.push_back(v);
+		start = end + 1;
+	}
+
+	return true;
+}
+
+/* Parse e.g. "h2c:3,c2h"; unlisted ops aren't run */
+static bool parse_mix(const char *arg, unsigned int *mix)
+{
+	std::string list(arg);
+	size_t start = 0, end, colon;
+	uint64_t weight;
+	bool any = false;
+	int op;
+
+	memset(mix, 0, OP_COUNT * sizeof(*mix));
+	while (start <= list.size()) {
+		end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		std::string item = list.substr(start, end - start);
+		weight = 1;
+		colon = item.find(':');
+		if (colon != std::string::npos) {
+			if (!parse_u64(item.c_str() + colon + 1, &weight) ||
+					weight > 1000000) {
+				fprintf(stderr, "invalid weight: %s\n",
+					item.c_str());
+				return false;
+			}
+			item.resize(colon);
+		}
+		for (op = 0; op < OP_COUNT; op++)
+			if (item == op_names[op])
+				break;
+		if (op == OP_COUNT) {
+			fprintf(stderr, "unknown op: %s\n", item.c_str());
+			return false;
+		}
+		mix[op] = weight;
+		any = any || weight;
+		start = end + 1;
+	}
+	if (!any) {
+		fprintf(stderr, "the mix has no ops\n");
+		return false;
+	}
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "clients",	required_argument,	0, 'n' },
+		{ "processes",	no_argument,		0, 'p' },
+		{ "shared-fd",	no_argument,		0, 'S' },
+		{ "mix",	required_argument,	0, 'x' },
+		{ "sizes",	required_argument,	0, 's' },
+		{ "time",	required_argument,	0, 't' },
+		{ "warmup",	required_argument,	0, 'w' },
+		{ "verbose",	no_argument,		0, 'v' },
+		{ "device",	required_argument,	0, 'd' },
+		{ "format",	required_argument,	0, 'f' },
+		{ "output",	required_argument,	0, 'o' },
+		{ "help",	no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	Config cfg;
+	std::vector<Step> steps;
+	uint64_t v;
+	size_t i;
+	int opt;
+	FILE *f;
+
+	cfg.clients = { 1, 2, 4, 8 };
+	cfg.processes = false;
+	cfg.shared_fd = false;
+	cfg.mix_arg = "h2c,c2h,h2c2h";
+	parse_mix(cfg.mix_arg.c_str(), cfg.mix);
+	cfg.sizes_arg = "64K";
+	cfg.sizes.push_back(64 * 1024);
+	cfg.seconds = 5;
+	cfg.warmup = 10;
+	cfg.verbose = false;
+	cfg.format = FMT_TABLE;
+	cfg.device = "/dev/picoevb";
+	cfg.output = NULL;
+
+	while ((opt = getopt_long(argc, argv, "n:pSx:s:t:w:vd:f:o:h",
+			long_opts, NULL)) != -1) {
+		switch (opt) {
+		case 'n':
+			if (!parse_u64s(optarg, cfg.clients))
+				return 1;
+			break;
+		case 'p':
+			cfg.processes = true;
+			break;
+		case 'S':
+			cfg.shared_fd = true;
+			break;
+		case 'x':
+			if (!parse_mix(optarg, cfg.mix))
+				return 1;
+			cfg.mix_arg = optarg;
+			break;
+		case 's':
+			if (!parse_u64s(optarg, cfg.sizes))
+				return 1;
+			cfg.sizes_arg = optarg;
+			break;
+		case 't':
+			if (!parse_u64(optarg, &v) || !v)
+				return 1;
+			cfg.seconds = v;
+			break;
+		case 'w':
+			if (!parse_u64(optarg, &v))
+				return 1;
+			cfg.warmup = v;
+			break;
+		case 'v':
+			cfg.verbose = true;
+			break;
+		case 'd':
+			cfg.device = optarg;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "table")) {
+				cfg.format = FMT_TABLE;
+			} else if (!strcmp(optarg, "json")) {
+				cfg.format = FMT_JSON;
+			} else {
+				fprintf(stderr, "unknown format: %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'o':
+			cfg.output = optarg;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		usage(stderr);
+		return 1;
+	}
+	for (i = 0; i < cfg.clients.size(); i++) {
+		if (cfg.clients[i] > 4096) {
+			fprintf(stderr, "too many clients: %" PRIu64 "\n",
+				cfg.clients[i]);
+			return 1;
+		}
+	}
+
+	try {
+		picoevb::Device dev(cfg.device);
+
+		/* h2c2h is chunked; the others must fit in RAM */
+		for (i = 0; i < cfg.sizes.size(); i++) {
+			if ((cfg.mix[OP_H2C] || cfg.mix[OP_C2H]) &&
+					cfg.sizes[i] > dev.fpga_ram_size()) {
+				fprintf(stderr, "h2c and c2h sizes must fit in "
+					"FPGA RAM (%" PRIu64 " bytes)\n",
+					dev.fpga_ram_size());
+				return 1;
+			}
+		}
+
+		for (i = 0; i < cfg.clients.size(); i++) {
+			Step step;
+
+			if (cfg.format == FMT_TABLE)
+				fprintf(stderr, "running %" PRIu64
+					" clients...\n", cfg.clients[i]);
+			if (!run_step(cfg, dev, cfg.clients[i], step))
+				return 1;
+			steps.push_back(std::move(step));
+		}
+
+		f = stdout;
+		if (cfg.output) {
+			f = fopen(cfg.output, "w");
+			if (!f) {
+				perror("fopen() failed");
+				return 1;
+			}
+		}
+		if (cfg.format == FMT_JSON) {
+			print_json(f, cfg, dev, steps);
+		} else {
+			fprintf(f, "%s, %s, mix %s, sizes %s, %" PRIu64
+				" s per step\n\n",
+				cfg.processes ? "processes" : "threads",
+				cfg.shared_fd ? "one shared file" :
+				"a file per client", cfg.mix_arg.c_str(),
+				cfg.sizes_arg.c_str(), cfg.seconds);
+			print_steps(f, steps);
+			if (cfg.verbose)
+				for (i = 0; i < steps.size(); i++)
+					print_clients(f, steps[i]);
+			print_ceiling(f, cfg, steps);
+		}
+		if (f != stdout && fclose(f)) {
+			perror("fclose() failed");
+			return 1;
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return 0;
+}
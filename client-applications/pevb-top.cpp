@@ -0,0 +1,613 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * pevb-top: live view of DMA activity.
+ *
+ * Samples the card's counters in /sys/class/picoevb/<card>/stats, and the
+ * counters of each process's open files in /proc/<pid>/fdinfo, at a fixed
+ * interval. Shows the throughput and utilisation of each channel over the
+ * last interval, and the processes moving the most data.
+ *
+ * Optionally writes the counters to a file in Prometheus text format, e.g.
+ * for node_exporter's textfile collector. The file is replaced atomically
+ * after each interval.
+ *
+ * Other users' processes are only listed when run as root.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#define SYSFS_CLASS "/sys/class/picoevb"
+
+enum {
+	CHAN_H2C,
+	CHAN_C2H,
+	CHAN_COUNT,
+};
+
+static const char * const chan_names[CHAN_COUNT] = {
+	"h2c",
+	"c2h",
+};
+
+enum {
+	STAT_TRANSFERS,
+	STAT_BYTES,
+	STAT_ERRORS,
+	STAT_PIN_NS,
+	STAT_MAP_NS,
+	STAT_BUSY_NS,
+	STAT_COUNT,
+};
+
+/* The names of each counter in sysfs, fdinfo and Prometheus */
+static const struct {
+	const char *sysfs;
+	const char *fdinfo;
+	const char *metric;
+	const char *help;
+	/* Exported in seconds rather than ns */
+	bool ns;
+} stat_names[STAT_COUNT] = {
+	{ "transfers", "transfers", "transfers_total",
+		"DMA transfers completed", false },
+	{ "bytes", "bytes", "bytes_total",
+		"Bytes transferred", false },
+	{ "errors", "errors", "errors_total",
+		"DMA transfers that failed", false },
+	{ "pin_ns", "pin", "pin_seconds_total",
+		"Time spent pinning or bouncing host memory", true },
+	{ "map_ns", "map", "map_seconds_total",
+		"Time spent mapping memory for DMA", true },
+	{ "busy_ns", "busy", "busy_seconds_total",
+		"Time the DMA engine spent executing transfers", true },
+};
+
+struct Counters {
+	uint64_t stat[CHAN_COUNT][STAT_COUNT];
+};
+
+struct Process {
+	std::string comm;
+	/* Open files of the card */
+	unsigned int files;
+	Counters counters;
+};
+
+struct Sample {
+	uint64_t time_ns;
+	Counters card;
+	std::map<int, Process> procs;
+};
+
+/* A process's rates over one interval */
+struct ProcessRates {
+	int pid;
+	const Process *proc;
+	double mbps[CHAN_COUNT];
+	double transfers_per_s;
+	double busy;
+	uint64_t errors;
+};
+
+struct Config {
+	std::string card;
+	double interval;
+	/* 0 for unlimited */
+	uint64_t iterations;
+	unsigned int top;
+	bool batch;
+	const char *prometheus;
+};
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool read_line(const std::string &path, std::string &line)
+{
+	char buf[256];
+	FILE *f;
+	bool ok;
+
+	f = fopen(path.c_str(), "r");
+	if (!f)
+		return false;
+	ok = fgets(buf, sizeof(buf), f) != NULL;
+	fclose(f);
+	if (!ok)
+		return false;
+	line = buf;
+	while (!line.empty() && isspace((unsigned char)line.back()))
+		line.pop_back();
+
+	return true;
+}
+
+static bool read_card_dev(const Config &cfg, dev_t *devt)
+{
+	std::string line;
+	unsigned int major_num, minor_num;
+
+	if (!read_line(SYSFS_CLASS "/" + cfg.card + "/dev", line))
+		return false;
+	if (sscanf(line.c_str(), "%u:%u", &major_num, &minor_num) != 2)
+		return false;
+	*devt = makedev(major_num, minor_num);
+
+	return true;
+}
+
+static bool read_card(const Config &cfg, Counters &counters)
+{
+	std::string dir = SYSFS_CLASS "/" + cfg.card + "/stats/";
+	std::string line;
+	int c, s;
+
+	for (c = 0; c < CHAN_COUNT; c++) {
+		for (s = 0; s < STAT_COUNT; s++) {
+			std::string name = std::string(chan_names[c]) + "_" +
+				stat_names[s].sysfs;
+			if (!read_line(dir + name, line))
+				return false;
+			counters.stat[c][s] = strtoull(line.c_str(), NULL, 10);
+		}
+	}
+
+	return true;
+}
+
+/* Add the counters in an fdinfo file, e.g. "picoevb-h2c-busy:\t123 ns" */
+static void read_fdinfo(const std::string &path, Counters &counters)
+{
+	char line[256], key[64];
+	unsigned long long v;
+	FILE *f;
+	int c, s;
+
+	f = fopen(path.c_str(), "r");
+	if (!f)
+		return;
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "picoevb-%63[^:]:%llu", key, &v) != 2)
+			continue;
+		for (c = 0; c < CHAN_COUNT; c++) {
+			size_t len = strlen(chan_names[c]);
+			if (strncmp(key, chan_names[c], len) || key[len] != '-')
+				continue;
+			const char *stat = key + len + 1;
+			for (s = 0; s < STAT_COUNT; s++)
+				if (!strcmp(stat, stat_names[s].fdinfo))
+					counters.stat[c][s] += v;
+		}
+	}
+	fclose(f);
+}
+
+/* Find every open file of the card, and sum its counters by process */
+static void read_procs(dev_t devt, std::map<int, Process> &procs)
+{
+	struct dirent *de, *fde;
+	struct stat st;
+	DIR *proc_dir, *fd_dir;
+
+	proc_dir = opendir("/proc");
+	if (!proc_dir)
+		return;
+	while ((de = readdir(proc_dir))) {
+		if (!isdigit((unsigned char)de->d_name[0]))
+			continue;
+		std::string pid_dir = std::string("/proc/") + de->d_name;
+		/* Fails for other users' processes unless root */
+		fd_dir = opendir((pid_dir + "/fd").c_str());
+		if (!fd_dir)
+			continue;
+		Process *proc = NULL;
+		while ((fde = readdir(fd_dir))) {
+			if (fde->d_name[0] == '.')
+				continue;
+			std::string fd = fde->d_name;
+			/* Follows the link to the file itself */
+			if (stat((pid_dir + "/fd/" + fd).c_str(), &st))
+				continue;
+			if (!S_ISCHR(st.st_mode) || st.st_rdev != devt)
+				continue;
+			if (!proc) {
+				proc = &procs[atoi(de->d_name)];
+				if (!read_line(pid_dir + "/comm", proc->comm))
+					proc->comm = "?";
+			}
+			proc->files++;
+			read_fdinfo(pid_dir + "/fdinfo/" + fd, proc->counters);
+		}
+		closedir(fd_dir);
+	}
+	closedir(proc_dir);
+}
+
+static bool take_sample(const Config &cfg, dev_t devt, Sample &sample)
+{
+	sample.time_ns = now_ns();
+	sample.card = Counters();
+	sample.procs.clear();
+	if (!read_card(cfg, sample.card))
+		return false;
+	read_procs(devt, sample.procs);
+
+	return true;
+}
+
+/* Counters can go backwards when a process closes one of several files */
+static uint64_t delta(uint64_t cur, uint64_t prev)
+{
+	return cur > prev ? cur - prev : 0;
+}
+
+static ProcessRates process_rates(int pid, const Process &proc,
+	const Sample &prev, double secs)
+{
+	static const Counters zero = Counters();
+	const Counters *before = &zero;
+	ProcessRates r;
+	uint64_t transfers = 0, busy_ns = 0;
+	int c;
+
+	/* A process not in the previous sample opened the card since */
+	auto it = prev.procs.find(pid);
+	if (it != prev.procs.end())
+		before = &it->second.counters;
+
+	r.pid = pid;
+	r.proc = &proc;
+	r.errors = 0;
+	for (c = 0; c < CHAN_COUNT; c++) {
+		const uint64_t *cur = proc.counters.stat[c];
+		const uint64_t *old = before->stat[c];
+		r.mbps[c] = delta(cur[STAT_BYTES], old[STAT_BYTES]) /
+			secs / 1e6;
+		transfers += delta(cur[STAT_TRANSFERS], old[STAT_TRANSFERS]);
+		busy_ns += delta(cur[STAT_BUSY_NS], old[STAT_BUSY_NS]);
+		r.errors += delta(cur[STAT_ERRORS], old[STAT_ERRORS]);
+	}
+	r.transfers_per_s = transfers / secs;
+	r.busy = busy_ns / (secs * 1e9);
+
+	return r;
+}
+
+static void print_top(FILE *f, const Config &cfg, const Sample &prev,
+	const Sample &cur)
+{
+	double secs = (cur.time_ns - prev.time_ns) / 1e9;
+	std::vector<ProcessRates> rates;
+	uint64_t busy_ns = 0;
+	unsigned int i;
+	int c;
+
+	for (c = 0; c < CHAN_COUNT; c++)
+		busy_ns += delta(cur.card.stat[c][STAT_BUSY_NS],
+			prev.card.stat[c][STAT_BUSY_NS]);
+
+	if (!cfg.batch)
+		fputs("\033[H\033[2J", f);
+	fprintf(f, "%s: %.1f s interval, %.1f %% utilised\n\n",
+		cfg.card.c_str(), secs, busy_ns * 100 / (secs * 1e9));
+	fprintf(f, "chan      MB/s  transfers/s  errors  pin us/xfer  "
+		"map us/xfer  busy %%\n");
+	for (c = 0; c < CHAN_COUNT; c++) {
+		uint64_t d[STAT_COUNT];
+		int s;
+
+		for (s = 0; s < STAT_COUNT; s++)
+			d[s] = delta(cur.card.stat[c][s], prev.card.stat[c][s]);
+		double n = d[STAT_TRANSFERS] ? d[STAT_TRANSFERS] : 1;
+		fprintf(f, "%-4s %9.1f  %11.1f  %6" PRIu64 "  %11.1f  "
+			"%11.1f  %6.1f\n",
+			chan_names[c], d[STAT_BYTES] / secs / 1e6,
+			d[STAT_TRANSFERS] / secs, d[STAT_ERRORS],
+			d[STAT_PIN_NS] / n / 1e3, d[STAT_MAP_NS] / n / 1e3,
+			d[STAT_BUSY_NS] * 100 / (secs * 1e9));
+	}
+
+	for (auto &p : cur.procs)
+		rates.push_back(process_rates(p.first, p.second, prev, secs));
+	std::sort(rates.begin(), rates.end(),
+		[](const ProcessRates &a, const ProcessRates &b) {
+			return a.mbps[CHAN_H2C] + a.mbps[CHAN_C2H] >
+				b.mbps[CHAN_H2C] + b.mbps[CHAN_C2H];
+		});
+
+	fprintf(f, "\n%7s  %-16s %5s  %9s  %9s  %11s  %6s  %6s\n", "PID",
+		"COMMAND", "FILES", "H2C MB/s", "C2H MB/s", "transfers/s",
+		"busy %", "errors");
+	for (i = 0; i < rates.size() && i < cfg.top; i++) {
+		const ProcessRates &r = rates[i];
+		fprintf(f, "%7d  %-16s %5u  %9.1f  %9.1f  %11.1f  %6.1f  "
+			"%6" PRIu64 "\n",
+			r.pid, r.proc->comm.c_str(), r.proc->files,
+			r.mbps[CHAN_H2C], r.mbps[CHAN_C2H], r.transfers_per_s,
+			r.busy * 100, r.errors);
+	}
+	if (cfg.batch)
+		fputc('\n', f);
+	fflush(f);
+}
+
+static std::string prometheus_escape(const std::string &s)
+{
+	std::string out;
+
+	for (char ch : s) {
+		if (ch == '\\' || ch == '"')
+			out += '\\';
+		if (ch == '\n')
+			out += "\\n";
+		else
+			out += ch;
+	}
+
+	return out;
+}
+
+static void print_prometheus_stat(FILE *f, const char *metric, int s,
+	const std::string &labels, const Counters &counters)
+{
+	int c;
+
+	for (c = 0; c < CHAN_COUNT; c++) {
+		uint64_t v = counters.stat[c][s];
+		fprintf(f, "%s{%schannel=\"%s\"} ", metric, labels.c_str(),
+			chan_names[c]);
+		if (stat_names[s].ns)
+			fprintf(f, "%.9f\n", v / 1e9);
+		else
+			fprintf(f, "%" PRIu64 "\n", v);
+	}
+}
+
+/*
+ * The card's and each process's counters, and the card's utilisation over the
+ * last interval. Process counters start from 0 when the process opens the card.
+ */
+static void print_prometheus(FILE *f, const Config &cfg, const Sample &prev,
+	const Sample &cur)
+{
+	std::string card = "card=\"" + prometheus_escape(cfg.card) + "\",";
+	double secs = (cur.time_ns - prev.time_ns) / 1e9;
+	uint64_t busy_ns = 0;
+	int c, s;
+
+	for (s = 0; s < STAT_COUNT; s++) {
+		std::string metric = std::string("picoevb_") +
+			stat_names[s].metric;
+		fprintf(f, "# HELP %s %s.\n", metric.c_str(),
+			stat_names[s].help);
+		fprintf(f, "# TYPE %s counter\n", metric.c_str());
+		print_prometheus_stat(f, metric.c_str(), s, card, cur.card);
+	}
+
+	for (c = 0; c < CHAN_COUNT; c++)
+		busy_ns += delta(cur.card.stat[c][STAT_BUSY_NS],
+			prev.card.stat[c][STAT_BUSY_NS]);
+	fprintf(f, "# HELP picoevb_utilisation Fraction of the last "
+		"interval the DMA engine was busy.\n");
+	fprintf(f, "# TYPE picoevb_utilisation gauge\n");
+	fprintf(f, "picoevb_utilisation{card=\"%s\"} %.4f\n",
+		prometheus_escape(cfg.card).c_str(), busy_ns / (secs * 1e9));
+
+	for (s = 0; s < STAT_COUNT; s++) {
+		std::string metric = std::string("picoevb_process_") +
+			stat_names[s].metric;
+		fprintf(f, "# HELP %s %s, by process.\n", metric.c_str(),
+			stat_names[s].help);
+		fprintf(f, "# TYPE %s counter\n", metric.c_str());
+		for (auto &p : cur.procs) {
+			std::string labels = card + "pid=\"" +
+				std::to_string(p.first) + "\",comm=\"" +
+				prometheus_escape(p.second.comm) + "\",";
+			print_prometheus_stat(f, metric.c_str(), s, labels,
+				p.second.counters);
+		}
+	}
+}
+
+/* Write to a temporary file and rename, so readers never see a partial file */
+static bool write_prometheus(const Config &cfg, const Sample &prev,
+	const Sample &cur)
+{
+	std::string tmp = std::string(cfg.prometheus) + ".tmp";
+	FILE *f;
+
+	f = fopen(tmp.c_str(), "w");
+	if (!f) {
+		perror(tmp.c_str());
+		return false;
+	}
+	print_prometheus(f, cfg, prev, cur);
+	if (fclose(f)) {
+		perror(tmp.c_str());
+		unlink(tmp.c_str());
+		return false;
+	}
+	if (rename(tmp.c_str(), cfg.prometheus)) {
+		perror(cfg.prometheus);
+		unlink(tmp.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+static void usage(FILE *f)
+{
+	fprintf(f,
+		"usage: pevb-top [options]\n"
+		"  -c, --card NAME        card in " SYSFS_CLASS "\n"
+		"                         (default: picoevb)\n"
+		"  -i, --interval SECS    sampling interval (default: 1)\n"
+		"  -n, --iterations N     exit after N intervals\n"
+		"                         (default: run until killed)\n"
+		"  -t, --top N            processes to show (default: 10)\n"
+		"  -b, --batch            append each interval to stdout,\n"
+		"                         without clearing the screen\n"
+		"  -p, --prometheus FILE  after each interval, write counters\n"
+		"                         to FILE in Prometheus text format\n"
+		"  -q, --quiet            don't print to stdout\n"
+		"  -h, --help\n");
+}
+
+static bool parse_u64(const char *s, uint64_t *val)
+{
+	char *end;
+	unsigned long long v;
+
+	errno = 0;
+	v = strtoull(s, &end, 0);
+	if (errno || end == s || *end)
+		return false;
+	*val = v;
+
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	static const struct option long_opts[] = {
+		{ "card",	required_argument,	0, 'c' },
+		{ "interval",	required_argument,	0, 'i' },
+		{ "iterations",	required_argument,	0, 'n' },
+		{ "top",	required_argument,	0, 't' },
+		{ "batch",	no_argument,		0, 'b' },
+		{ "prometheus",	required_argument,	0, 'p' },
+		{ "quiet",	no_argument,		0, 'q' },
+		{ "help",	no_argument,		0, 'h' },
+		{ 0, 0, 0, 0 }
+	};
+	Config cfg;
+	Sample samples[2];
+	struct timespec ts;
+	bool quiet = false;
+	uint64_t v, i;
+	dev_t devt;
+	char *end;
+	int opt;
+
+	cfg.card = "picoevb";
+	cfg.interval = 1;
+	cfg.iterations = 0;
+	cfg.top = 10;
+	cfg.batch = !isatty(STDOUT_FILENO);
+	cfg.prometheus = NULL;
+
+	while ((opt = getopt_long(argc, argv, "c:i:n:t:bp:qh", long_opts,
+			NULL)) != -1) {
+		switch (opt) {
+		case 'c':
+			cfg.card = optarg;
+			break;
+		case 'i':
+			cfg.interval = strtod(optarg, &end);
+			if (*end || !(cfg.interval > 0)) {
+				fprintf(stderr, "invalid interval: %s\n",
+					optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			if (!parse_u64(optarg, &cfg.iterations))
+				return 1;
+			break;
+		case 't':
+			if (!parse_u64(optarg, &v))
+				return 1;
+			cfg.top = v;
+			break;
+		case 'b':
+			cfg.batch = true;
+			break;
+		case 'p':
+			cfg.prometheus = optarg;
+			break;
+		case 'q':
+			quiet = true;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind != argc) {
+		usage(stderr);
+		return 1;
+	}
+
+	if (!read_card_dev(cfg, &devt) || !take_sample(cfg, devt, samples[0])) {
+		fprintf(stderr, "%s: no statistics in " SYSFS_CLASS "/%s\n",
+			cfg.card.c_str(), cfg.card.c_str());
+		return 1;
+	}
+
+	ts.tv_sec = (time_t)cfg.interval;
+	ts.tv_nsec = (long)((cfg.interval - ts.tv_sec) * 1e9);
+	for (i = 0; !cfg.iterations || i < cfg.iterations; i++) {
+		const Sample &prev = samples[i % 2];
+		Sample &cur = samples[(i + 1) % 2];
+
+		nanosleep(&ts, NULL);
+		if (!take_sample(cfg, devt, cur)) {
+			fprintf(stderr, "%s: card removed\n", cfg.card.c_str());
+			return 1;
+		}
+		if (!quiet)
+			print_top(stdout, cfg, prev, cur);
+		if (cfg.prometheus && !write_prometheus(cfg, prev, cur))
+			return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,556 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * libpevb-trace.so: records a process's DMA requests, for pevb-replay.
+ *
+ * Loaded with LD_PRELOAD, it wraps ioctl() and mmap(). Every DMA ioctl, and
+ * every transfer run by a ring doorbell, is timed and appended to a trace file
+ * (see pevb-trace.hpp). To turn region handles and ring windows back into
+ * FPGA offsets and host addresses, it also follows the ioctls that create and
+ * free them.
+ *
+ * The trace is written to $PEVB_TRACE_FILE, default "pevb-%p.trace", where %p
+ * is replaced by the process ID; a child process started by fork() writes its
+ * own trace. Records are buffered, and written when the buffer fills and at
+ * exit, so a process killed by a signal, or that exits with _exit(), loses
+ * its last records.
+ *
+ * Device files are recognised by their ioctl numbers alone.
+ */
+
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "../kernel-module/picoevb-rdma-ioctl.h"
+#include "pevb-trace.hpp"
+
+namespace {
+
+/* Records buffered before writing */
+const size_t FLUSH_RECORDS = 4096;
+
+typedef int (*IoctlFn)(int fd, unsigned long request, void *arg);
+typedef void *(*MmapFn)(void *addr, size_t len, int prot, int flags, int fd,
+	off_t offset);
+
+struct RingState {
+	uint32_t entries;
+	uint64_t sq_offset;
+	uint64_t cq_offset;
+	/* Where the ring is mapped, once mmap()ed */
+	uint8_t *base;
+};
+
+/* What is known about one device file */
+struct FileState {
+	FileState() : ring() {}
+
+	/* RAM region handle to FPGA RAM offset */
+	std::unordered_map<uint32_t, uint64_t> regions;
+	/* Window to host address */
+	std::unordered_map<uint32_t, uint64_t> windows;
+	RingState ring;
+};
+
+/* Never freed, so still usable by threads running during exit */
+struct Tracer {
+	std::mutex lock;
+	std::unordered_map<int, FileState> files;
+	std::vector<struct pevb_trace_record> records;
+	/* -1 until the first record; -2 if the trace can't be written */
+	int out_fd;
+	uint64_t start_ns;
+	uint32_t page_size;
+};
+
+IoctlFn real_ioctl;
+MmapFn real_mmap;
+
+uint64_t now_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	clock_gettime(clock, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void fork_prepare();
+void fork_parent();
+void fork_child();
+
+Tracer *tracer()
+{
+	static Tracer *t = [] {
+		Tracer *t = new Tracer();
+
+		t->out_fd = -1;
+		t->start_ns = now_ns(CLOCK_MONOTONIC);
+		t->page_size = sysconf(_SC_PAGESIZE);
+		t->records.reserve(FLUSH_RECORDS);
+		pthread_atfork(fork_prepare, fork_parent, fork_child);
+		return t;
+	}();
+
+	return t;
+}
+
+void fork_prepare()
+{
+	tracer()->lock.lock();
+}
+
+void fork_parent()
+{
+	tracer()->lock.unlock();
+}
+
+/* The child's requests go to a new trace, without the parent's records */
+void fork_child()
+{
+	Tracer *t = tracer();
+
+	if (t->out_fd >= 0)
+		close(t->out_fd);
+	t->out_fd = -1;
+	t->records.clear();
+	t->start_ns = now_ns(CLOCK_MONOTONIC);
+	t->lock.unlock();
+}
+
+/* Called with the lock held */
+bool open_trace(Tracer *t)
+{
+	const char *pattern = getenv("PEVB_TRACE_FILE");
+	struct pevb_trace_header hdr;
+	std::string path;
+	const char *p;
+
+	if (!pattern || !*pattern)
+		pattern = "pevb-%p.trace";
+	for (p = pattern; *p; p++) {
+		if (p[0] == '%' && p[1] == 'p') {
+			path += std::to_string(getpid());
+			p++;
+		} else {
+			path += *p;
+		}
+	}
+
+	t->out_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		0644);
+	if (t->out_fd < 0) {
+		perror(path.c_str());
+		t->out_fd = -2;
+		return false;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	strcpy(hdr.magic, PEVB_TRACE_MAGIC);
+	hdr.version = PEVB_TRACE_VERSION;
+	hdr.record_size = sizeof(struct pevb_trace_record);
+	hdr.start_ns = now_ns(CLOCK_REALTIME) -
+		(now_ns(CLOCK_MONOTONIC) - t->start_ns);
+	hdr.pid = getpid();
+	hdr.page_size = t->page_size;
+	if (write(t->out_fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		perror(path.c_str());
+		close(t->out_fd);
+		t->out_fd = -2;
+		return false;
+	}
+
+	return true;
+}
+
+/* Called with the lock held */
+void flush(Tracer *t)
+{
+	const char *p = (const char *)t->records.data();
+	size_t left = t->records.size() * sizeof(t->records[0]);
+	ssize_t n;
+
+	if (t->records.empty())
+		return;
+	if (t->out_fd == -1)
+		open_trace(t);
+	while (t->out_fd >= 0 && left) {
+		n = write(t->out_fd, p, left);
+		if (n < 0) {
+			perror("pevb-trace");
+			close(t->out_fd);
+			t->out_fd = -2;
+			break;
+		}
+		p += n;
+		left -= n;
+	}
+	t->records.clear();
+}
+
+/* Called with the lock held */
+void append(Tracer *t, const struct pevb_trace_record &rec)
+{
+	t->records.push_back(rec);
+	if (t->records.size() >= FLUSH_RECORDS)
+		flush(t);
+}
+
+__attribute__((destructor)) void flush_at_exit()
+{
+	Tracer *t = tracer();
+	std::lock_guard<std::mutex> guard(t->lock);
+
+	flush(t);
+}
+
+uint16_t page_align(Tracer *t, uint64_t addr, bool is_cuda)
+{
+	/* The offset encoded in a CUDA handle is from the surface's start */
+	return is_cuda ? 0 : addr & (t->page_size - 1);
+}
+
+uint8_t mem_kind(bool is_cuda, bool is_cuda_va)
+{
+	if (is_cuda)
+		return PEVB_TRACE_MEM_CUDA;
+	if (is_cuda_va)
+		return PEVB_TRACE_MEM_CUDA_VA;
+	return PEVB_TRACE_MEM_HOST;
+}
+
+uint64_t fpga_offset(FileState &file, uint64_t ram, bool is_region)
+{
+	if (!is_region)
+		return ram;
+	auto it = file.regions.find(ram & PICOEVB_RAM_HANDLE_MASK);
+	return (it == file.regions.end() ? 0 : it->second) +
+		(ram >> PICOEVB_RAM_HANDLE_BITS);
+}
+
+/*
+ * Describe a DMA ioctl's transfer in rec, and return true, or return false if
+ * request isn't a DMA ioctl. Called with the lock held, after the ioctl.
+ */
+bool describe_dma(Tracer *t, FileState &file, unsigned long request,
+	const void *arg, struct pevb_trace_record &rec)
+{
+	switch (request) {
+	case PICOEVB_IOC_H2C_DMA: {
+		auto p = (const struct picoevb_rdma_h2c_dma *)arg;
+		bool cuda = p->flags & PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA;
+		bool cuda_va = p->flags & PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA_VA;
+
+		rec.op = PEVB_TRACE_OP_H2C;
+		rec.fpga_offset = fpga_offset(file, p->dst,
+			p->flags & PICOEVB_H2C_DMA_FLAG_DST_IS_RAM);
+		rec.width = p->len;
+		rec.align[0] = page_align(t, p->src, cuda);
+		rec.mem = mem_kind(cuda, cuda_va);
+		return true;
+	}
+	case PICOEVB_IOC_C2H_DMA: {
+		auto p = (const struct picoevb_rdma_c2h_dma *)arg;
+		bool cuda = p->flags & PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA;
+		bool cuda_va = p->flags & PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA_VA;
+
+		rec.op = PEVB_TRACE_OP_C2H;
+		rec.fpga_offset = fpga_offset(file, p->src,
+			p->flags & PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM);
+		rec.width = p->len;
+		rec.align[1] = page_align(t, p->dst, cuda);
+		rec.mem = mem_kind(cuda, cuda_va) << 4;
+		return true;
+	}
+	case PICOEVB_IOC_H2C2H_DMA: {
+		auto p = (const struct picoevb_rdma_h2c2h_dma *)arg;
+		uint64_t flags = p->flags;
+		bool src_cuda = flags & PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA;
+		bool dst_cuda = flags & PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA;
+		bool src_va = flags & PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA_VA;
+		bool dst_va = flags & PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA_VA;
+
+		rec.op = PEVB_TRACE_OP_H2C2H;
+		rec.width = p->len;
+		rec.align[0] = page_align(t, p->src, src_cuda);
+		rec.align[1] = page_align(t, p->dst, dst_cuda);
+		rec.mem = mem_kind(src_cuda, src_va) |
+			mem_kind(dst_cuda, dst_va) << 4;
+		return true;
+	}
+	case PICOEVB_IOC_H2C_2D_DMA: {
+		auto p = (const struct picoevb_rdma_h2c_2d_dma *)arg;
+		bool cuda = p->flags & PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA;
+		bool cuda_va = p->flags & PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA_VA;
+
+		rec.op = PEVB_TRACE_OP_H2C;
+		rec.fpga_offset = fpga_offset(file, p->dst,
+			p->flags & PICOEVB_H2C_DMA_FLAG_DST_IS_RAM);
+		rec.width = p->width;
+		rec.height = p->height;
+		rec.host_pitch = p->src_pitch;
+		rec.fpga_pitch = p->dst_pitch;
+		rec.align[0] = page_align(t, p->src, cuda);
+		rec.mem = mem_kind(cuda, cuda_va);
+		return true;
+	}
+	case PICOEVB_IOC_C2H_2D_DMA: {
+		auto p = (const struct picoevb_rdma_c2h_2d_dma *)arg;
+		bool cuda = p->flags & PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA;
+		bool cuda_va = p->flags & PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA_VA;
+
+		rec.op = PEVB_TRACE_OP_C2H;
+		rec.fpga_offset = fpga_offset(file, p->src,
+			p->flags & PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM);
+		rec.width = p->width;
+		rec.height = p->height;
+		rec.host_pitch = p->dst_pitch;
+		rec.fpga_pitch = p->src_pitch;
+		rec.align[1] = page_align(t, p->dst, cuda);
+		rec.mem = mem_kind(cuda, cuda_va) << 4;
+		return true;
+	}
+	default:
+		return false;
+	}
+}
+
+/* Follow the handles needed to describe later transfers */
+void track_handles(FileState &file, unsigned long request, const void *arg)
+{
+	switch (request) {
+	case PICOEVB_IOC_RAM_ALLOC: {
+		auto p = (const struct picoevb_rdma_ram_alloc *)arg;
+		file.regions[p->handle] = p->offset;
+		break;
+	}
+	case PICOEVB_IOC_RAM_OPEN: {
+		auto p = (const struct picoevb_rdma_ram_open *)arg;
+		file.regions[p->handle] = p->offset;
+		break;
+	}
+	case PICOEVB_IOC_RAM_FREE:
+		file.regions.erase(
+			((const struct picoevb_rdma_ram_free *)arg)->handle);
+		break;
+	case PICOEVB_IOC_REGISTER_WINDOW: {
+		auto p = (const struct picoevb_rdma_register_window *)arg;
+		file.windows[p->window] = p->addr;
+		break;
+	}
+	case PICOEVB_IOC_UNREGISTER_WINDOW:
+		file.windows.erase(
+			((const struct picoevb_rdma_unregister_window *)arg)
+				->window);
+		break;
+	case PICOEVB_IOC_RING_SETUP: {
+		auto p = (const struct picoevb_rdma_ring_setup *)arg;
+		file.ring.entries = p->entries;
+		file.ring.sq_offset = p->sq_offset;
+		file.ring.cq_offset = p->cq_offset;
+		file.ring.base = NULL;
+		break;
+	}
+	}
+}
+
+bool is_traced(unsigned long request)
+{
+	switch (request) {
+	case PICOEVB_IOC_H2C_DMA:
+	case PICOEVB_IOC_C2H_DMA:
+	case PICOEVB_IOC_H2C2H_DMA:
+	case PICOEVB_IOC_H2C_2D_DMA:
+	case PICOEVB_IOC_C2H_2D_DMA:
+	case PICOEVB_IOC_RAM_ALLOC:
+	case PICOEVB_IOC_RAM_OPEN:
+	case PICOEVB_IOC_RAM_FREE:
+	case PICOEVB_IOC_REGISTER_WINDOW:
+	case PICOEVB_IOC_UNREGISTER_WINDOW:
+	case PICOEVB_IOC_RING_SETUP:
+	case PICOEVB_IOC_DOORBELL:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/*
+ * Run a doorbell, recording each transfer it ran. SQEs are copied before the
+ * doorbell, since user-space may reuse their slots as soon as they are
+ * consumed.
+ */
+int doorbell(Tracer *t, int fd, unsigned long request, void *arg)
+{
+	std::vector<struct picoevb_rdma_sqe> sqes;
+	std::vector<uint64_t> window_addrs;
+	struct picoevb_rdma_ring_header *hdr;
+	struct picoevb_rdma_cqe *cqes;
+	struct pevb_trace_record rec;
+	uint32_t sq_head, sq_tail, cq_tail, mask, i, n;
+	uint64_t t0, t1;
+	RingState ring;
+	int ret, err;
+
+	{
+		std::lock_guard<std::mutex> guard(t->lock);
+		FileState &file = t->files[fd];
+		ring = file.ring;
+		if (!ring.base)
+			return real_ioctl(fd, request, arg);
+		hdr = (struct picoevb_rdma_ring_header *)ring.base;
+		mask = ring.entries - 1;
+		sq_head = __atomic_load_n(&hdr->sq_head, __ATOMIC_ACQUIRE);
+		sq_tail = __atomic_load_n(&hdr->sq_tail, __ATOMIC_ACQUIRE);
+		if (sq_tail - sq_head > ring.entries)
+			return real_ioctl(fd, request, arg);
+		auto *ring_sqes = (const struct picoevb_rdma_sqe *)
+			(ring.base + ring.sq_offset);
+		for (i = sq_head; i != sq_tail; i++) {
+			const struct picoevb_rdma_sqe &sqe =
+				ring_sqes[i & mask];
+			auto it = file.windows.find(sqe.window);
+			sqes.push_back(sqe);
+			window_addrs.push_back(it == file.windows.end() ? 0 :
+				it->second + sqe.window_offset);
+		}
+	}
+
+	cq_tail = __atomic_load_n(&hdr->cq_tail, __ATOMIC_ACQUIRE);
+	t0 = now_ns(CLOCK_MONOTONIC);
+	ret = real_ioctl(fd, request, arg);
+	t1 = now_ns(CLOCK_MONOTONIC);
+	err = errno;
+	n = __atomic_load_n(&hdr->sq_head, __ATOMIC_ACQUIRE) - sq_head;
+	cqes = (struct picoevb_rdma_cqe *)(ring.base + ring.cq_offset);
+
+	t->lock.lock();
+	FileState &file = t->files[fd];
+	for (i = 0; i < n && i < sqes.size(); i++) {
+		const struct picoevb_rdma_sqe &sqe = sqes[i];
+		bool c2h = sqe.opcode == PICOEVB_RING_OP_C2H;
+
+		memset(&rec, 0, sizeof(rec));
+		rec.time_ns = t0 - t->start_ns;
+		rec.latency_ns = t1 - t0;
+		rec.fpga_offset = fpga_offset(file, sqe.ram_offset,
+			sqe.flags & PICOEVB_RING_FLAG_IS_RAM);
+		rec.width = sqe.len;
+		rec.height = 1;
+		rec.tid = syscall(SYS_gettid);
+		rec.fd = fd;
+		rec.result = cqes[(cq_tail + i) & mask].result;
+		rec.align[c2h] = page_align(t, window_addrs[i], false);
+		rec.op = c2h ? PEVB_TRACE_OP_C2H : PEVB_TRACE_OP_H2C;
+		rec.mem = PEVB_TRACE_MEM_WINDOW << (c2h ? 4 : 0);
+		append(t, rec);
+	}
+	t->lock.unlock();
+	errno = err;
+
+	return ret;
+}
+
+}
+
+extern "C" int ioctl(int fd, unsigned long request, ...) __THROW
+{
+	struct pevb_trace_record rec;
+	uint64_t t0, t1;
+	va_list ap;
+	void *arg;
+	int ret, err;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (!real_ioctl)
+		real_ioctl = (IoctlFn)dlsym(RTLD_NEXT, "ioctl");
+	if (!is_traced(request))
+		return real_ioctl(fd, request, arg);
+
+	Tracer *t = tracer();
+	if (request == PICOEVB_IOC_DOORBELL)
+		return doorbell(t, fd, request, arg);
+
+	t0 = now_ns(CLOCK_MONOTONIC);
+	ret = real_ioctl(fd, request, arg);
+	t1 = now_ns(CLOCK_MONOTONIC);
+	err = errno;
+
+	{
+		std::lock_guard<std::mutex> guard(t->lock);
+		FileState &file = t->files[fd];
+		if (!ret)
+			track_handles(file, request, arg);
+		memset(&rec, 0, sizeof(rec));
+		rec.height = 1;
+		if (describe_dma(t, file, request, arg, rec)) {
+			rec.time_ns = t0 - t->start_ns;
+			rec.latency_ns = t1 - t0;
+			rec.tid = syscall(SYS_gettid);
+			rec.fd = fd;
+			rec.result = ret ? -err : 0;
+			append(t, rec);
+		}
+	}
+	/* For the caller, as if only the ioctl had run */
+	errno = err;
+
+	return ret;
+}
+
+/* Find where each ring is mapped */
+extern "C" void *mmap(void *addr, size_t len, int prot, int flags, int fd,
+	off_t offset) __THROW
+{
+	void *ret;
+
+	if (!real_mmap)
+		real_mmap = (MmapFn)dlsym(RTLD_NEXT, "mmap");
+	ret = real_mmap(addr, len, prot, flags, fd, offset);
+	if (ret == MAP_FAILED || fd < 0 || offset)
+		return ret;
+
+	Tracer *t = tracer();
+	std::lock_guard<std::mutex> guard(t->lock);
+	auto it = t->files.find(fd);
+	if (it != t->files.end() && it->second.ring.entries)
+		it->second.ring.base = (uint8_t *)ret;
+
+	return ret;
+}
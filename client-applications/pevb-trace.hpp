@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * DMA trace file format, written by libpevb-trace.so and read by pevb-replay.
+ *
+ * A trace is a struct pevb_trace_header, followed by one struct
+ * pevb_trace_record per DMA request, in the order the requests completed.
+ * Records are in host byte order.
+ *
+ * Each transfer run by a ring doorbell has its own record. A doorbell's
+ * records are consecutive, and share time_ns, latency_ns, fd and tid.
+ */
+
+#ifndef PEVB_TRACE_HPP
+#define PEVB_TRACE_HPP
+
+#include <stdint.h>
+
+#define PEVB_TRACE_MAGIC	"PEVBTRC"
+#define PEVB_TRACE_VERSION	1
+
+struct pevb_trace_header {
+	/* PEVB_TRACE_MAGIC, NUL-terminated */
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+	/* CLOCK_REALTIME when the trace started, in ns */
+	uint64_t start_ns;
+	int32_t pid;
+	uint32_t page_size;
+};
+
+#define PEVB_TRACE_OP_H2C	0
+#define PEVB_TRACE_OP_C2H	1
+#define PEVB_TRACE_OP_H2C2H	2
+#define PEVB_TRACE_OP_COUNT	3
+
+/* Host memory, as passed to the driver */
+#define PEVB_TRACE_MEM_HOST	0
+/* A handle from PICOEVB_IOC_PIN_CUDA */
+#define PEVB_TRACE_MEM_CUDA	1
+/* A raw CUDA pointer */
+#define PEVB_TRACE_MEM_CUDA_VA	2
+/* A ring window */
+#define PEVB_TRACE_MEM_WINDOW	3
+
+struct pevb_trace_record {
+	/* When the request was made, in ns since the trace started */
+	uint64_t time_ns;
+	/* How long the ioctl took */
+	uint64_t latency_ns;
+	/* Absolute FPGA RAM offset, after resolving any region; 0 for H2C2H */
+	uint64_t fpga_offset;
+	/* Bytes per row; the length of a 1D transfer */
+	uint64_t width;
+	/* 1 for a 1D transfer */
+	uint32_t height;
+	/* Distances between rows of a 2D transfer */
+	uint32_t host_pitch;
+	uint32_t fpga_pitch;
+	/* The calling thread */
+	uint32_t tid;
+	/* The device file the request was made on */
+	int32_t fd;
+	/* 0, or a negative errno value */
+	int32_t result;
+	/*
+	 * Offset of each host buffer (source, destination) within its page.
+	 * The FPGA side of a transfer has 0.
+	 */
+	uint16_t align[2];
+	/* PEVB_TRACE_OP_* */
+	uint8_t op;
+	/* PEVB_TRACE_MEM_* of the source in bits 0-3, destination in 4-7 */
+	uint8_t mem;
+	uint16_t reserved;
+};
+
+#endif
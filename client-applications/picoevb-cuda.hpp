@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * libpicoevb CUDA buffer types. Header-only, since libpicoevb.a itself is
+ * built without CUDA; include this only from code compiled by nvcc.
+ */
+
+#ifndef PICOEVB_CUDA_HPP
+#define PICOEVB_CUDA_HPP
+
+#include <cuda.h>
+#include <cuda_runtime_api.h>
+#include <string>
+#include "picoevb.hpp"
+
+namespace picoevb {
+
+/* A failed CUDA API call */
+class CudaError : public std::runtime_error {
+public:
+	CudaError(int err, const char *what) :
+		std::runtime_error(std::string(what) + " failed: " +
+			std::to_string(err)),
+		err_(err) {}
+
+	int code() const { return err_; }
+
+private:
+	int err_;
+};
+
+/*
+ * CUDA memory suitable for RDMA, allocated and pinned for use by a Device.
+ * On dGPU this is device memory, on iGPU pinned host memory. The Device must
+ * outlive the buffer, and must not be moved while the buffer exists.
+ */
+class PinnedCudaBuffer {
+public:
+	PinnedCudaBuffer(Device &dev, size_t size) :
+		dev_(&dev),
+		data_(nullptr),
+		size_(size),
+		handle_(0)
+	{
+		cudaError_t ce;
+		CUresult cr;
+		unsigned int flag = 1;
+
+#ifdef NV_BUILD_DGPU
+		ce = cudaMalloc(&data_, size);
+#else
+		ce = cudaHostAlloc(&data_, size, cudaHostAllocDefault);
+#endif
+		if (ce != cudaSuccess)
+			throw CudaError(ce, "CUDA allocation");
+
+		cr = cuPointerSetAttribute(&flag,
+			CU_POINTER_ATTRIBUTE_SYNC_MEMOPS, (CUdeviceptr)data_);
+		if (cr != CUDA_SUCCESS) {
+			free_cuda();
+			throw CudaError(cr, "cuPointerSetAttribute()");
+		}
+
+		try {
+			handle_ = dev.pin_cuda((uintptr_t)data_, size);
+		} catch (...) {
+			free_cuda();
+			throw;
+		}
+	}
+
+	~PinnedCudaBuffer()
+	{
+		release();
+	}
+
+	PinnedCudaBuffer(PinnedCudaBuffer &&other) noexcept :
+		dev_(other.dev_),
+		data_(other.data_),
+		size_(other.size_),
+		handle_(other.handle_)
+	{
+		other.data_ = nullptr;
+		other.size_ = 0;
+	}
+
+	PinnedCudaBuffer &operator=(PinnedCudaBuffer &&other) noexcept
+	{
+		if (this != &other) {
+			release();
+			dev_ = other.dev_;
+			data_ = other.data_;
+			size_ = other.size_;
+			handle_ = other.handle_;
+			other.data_ = nullptr;
+			other.size_ = 0;
+		}
+
+		return *this;
+	}
+
+	PinnedCudaBuffer(const PinnedCudaBuffer &) = delete;
+	PinnedCudaBuffer &operator=(const PinnedCudaBuffer &) = delete;
+
+	void *data() { return data_; }
+	const void *data() const { return data_; }
+	size_t size() const { return size_; }
+	uint32_t handle() const { return handle_; }
+
+	template <class T> T *as() { return static_cast<T *>(data_); }
+	template <class T> const T *as() const
+	{
+		return static_cast<const T *>(data_);
+	}
+
+private:
+	void free_cuda() noexcept
+	{
+#ifdef NV_BUILD_DGPU
+		cudaFree(data_);
+#else
+		cudaFreeHost(data_);
+#endif
+		data_ = nullptr;
+	}
+
+	void release() noexcept
+	{
+		if (!data_)
+			return;
+		try {
+			dev_->unpin_cuda(handle_);
+		} catch (...) {
+			/* Closing the device unpins everything anyway */
+		}
+		free_cuda();
+	}
+
+	Device *dev_;
+	void *data_;
+	size_t size_;
+	uint32_t handle_;
+};
+
+template <> struct BufferTraits<PinnedCudaBuffer> {
+	static const __u64 h2c_src_flags = PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA;
+	static const __u64 c2h_dst_flags = PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA;
+	static const __u64 h2c2h_src_flags =
+		PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA;
+	static const __u64 h2c2h_dst_flags =
+		PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA;
+
+	static __u64 dma_addr(const PinnedCudaBuffer &buf, uint64_t offset)
+	{
+		return PICOEVB_CUDA_HANDLE_OFFSET(buf.handle(), offset);
+	}
+};
+
+}
+
+#endif
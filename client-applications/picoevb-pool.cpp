@@ -0,0 +1,478 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <mutex>
+#include <new>
+#include <vector>
+#include "picoevb-pool.hpp"
+
+namespace picoevb {
+
+namespace detail {
+
+/* Size classes are 4KiB, 8KiB, 16KiB, ... */
+static const unsigned POOL_MIN_SHIFT = 12;
+static const unsigned POOL_NUM_CLASSES = 40;
+/* Freed buffers each thread keeps per class, before using the free list */
+static const size_t POOL_CACHE_MAX = 8;
+
+static size_t pool_class_size(unsigned cls)
+{
+	return (size_t)1 << (POOL_MIN_SHIFT + cls);
+}
+
+static unsigned pool_class(size_t size)
+{
+	unsigned cls = 0;
+
+	while (pool_class_size(cls) < size)
+		cls++;
+
+	return cls;
+}
+
+struct PoolBlock {
+	void *data;
+	unsigned cls;
+	uint32_t h2c_window;
+	uint32_t c2h_window;
+	uint64_t window_offset;
+	/* Next in a FreeList */
+	std::atomic<PoolBlock *> next;
+};
+
+/*
+ * A lock-free stack of blocks. head_ holds a pointer in its low bits and a
+ * tag in its top bits, which changes on every update so that a pop can't
+ * succeed against a head that was popped and pushed back meanwhile (ABA).
+ * Blocks are never freed while the pool exists, so reading a stale block's
+ * next pointer is safe.
+ */
+class FreeList {
+public:
+	FreeList() : head_(0) {}
+
+	void push(PoolBlock *block)
+	{
+		uint64_t old = head_.load(std::memory_order_relaxed);
+		uint64_t next;
+
+		do {
+			block->next.store(ptr(old), std::memory_order_relaxed);
+			next = pack(block, tag(old) + 1);
+		} while (!head_.compare_exchange_weak(old, next,
+			std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	PoolBlock *pop()
+	{
+		uint64_t old = head_.load(std::memory_order_acquire);
+		uint64_t next;
+		PoolBlock *block;
+
+		do {
+			block = ptr(old);
+			if (!block)
+				return nullptr;
+			next = pack(block->next.load(std::memory_order_relaxed),
+				tag(old) + 1);
+		} while (!head_.compare_exchange_weak(old, next,
+			std::memory_order_acquire, std::memory_order_acquire));
+
+		return block;
+	}
+
+private:
+	/* User-space pointers fit in 48 bits on all supported platforms */
+	static const unsigned TAG_SHIFT = 48;
+	static const uint64_t PTR_MASK = (1ULL << TAG_SHIFT) - 1;
+	static_assert(sizeof(void *) == 8, "FreeList requires 64-bit pointers");
+
+	static PoolBlock *ptr(uint64_t v)
+	{
+		return reinterpret_cast<PoolBlock *>(v & PTR_MASK);
+	}
+	static uint64_t tag(uint64_t v) { return v >> TAG_SHIFT; }
+	static uint64_t pack(PoolBlock *block, uint64_t tag)
+	{
+		return (uint64_t)(uintptr_t)block | (tag << TAG_SHIFT);
+	}
+
+	std::atomic<uint64_t> head_;
+};
+
+struct PoolSlab {
+	PoolSlab(const BufferPool::Options &opts);
+	~PoolSlab();
+
+	HostBuffer buf;
+	size_t used;
+	bool locked;
+	Device *dev;
+	uint32_t h2c_window;
+	uint32_t c2h_window;
+};
+
+PoolSlab::PoolSlab(const BufferPool::Options &opts) :
+	buf(opts.slab_size, opts.backing),
+	used(0),
+	locked(false),
+	dev(nullptr),
+	h2c_window(0),
+	c2h_window(0)
+{
+	/* Fault in every page now, rather than during transfers */
+	memset(buf.data(), 0, buf.size());
+
+	if (opts.lock) {
+		if (mlock(buf.data(), buf.size()) != 0)
+			throw Error(errno, "mlock()");
+		locked = true;
+	}
+
+	if (opts.dev) {
+		h2c_window = opts.dev->register_window(buf.data(), buf.size(),
+			0);
+		try {
+			c2h_window = opts.dev->register_window(buf.data(),
+				buf.size(), PICOEVB_WINDOW_FLAG_C2H);
+		} catch (...) {
+			opts.dev->unregister_window(h2c_window);
+			if (locked)
+				munlock(buf.data(), buf.size());
+			throw;
+		}
+		dev = opts.dev;
+	}
+}
+
+PoolSlab::~PoolSlab()
+{
+	if (dev) {
+		try {
+			dev->unregister_window(c2h_window);
+			dev->unregister_window(h2c_window);
+		} catch (...) {
+			/* Closing the device unregisters everything anyway */
+		}
+	}
+	if (locked)
+		munlock(buf.data(), buf.size());
+}
+
+struct PoolCore : std::enable_shared_from_this<PoolCore> {
+	explicit PoolCore(const BufferPool::Options &opts);
+
+	PoolBlock *alloc(size_t size);
+	void free(PoolBlock *block) noexcept;
+
+	/* Called with lock held */
+	PoolBlock *carve(unsigned cls);
+
+	const BufferPool::Options opts;
+	/* Distinguishes pools in thread caches, even if an address is reused */
+	const uint64_t id;
+
+	std::mutex lock;
+	/* Protected by lock */
+	std::vector<std::unique_ptr<PoolSlab>> slabs;
+	std::vector<std::unique_ptr<PoolBlock>> blocks;
+
+	FreeList free_lists[POOL_NUM_CLASSES];
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> slab_count;
+	std::atomic<uint64_t> footprint_bytes;
+	std::atomic<uint64_t> in_use_bytes;
+};
+
+static std::atomic<uint64_t> pool_next_id(1);
+
+/* One thread's cache of freed blocks for one pool */
+struct ThreadCache {
+	ThreadCache(const std::shared_ptr<PoolCore> &core) :
+		core(core),
+		id(core->id) {}
+
+	~ThreadCache()
+	{
+		std::shared_ptr<PoolCore> c = core.lock();
+		unsigned cls;
+
+		/* If the pool is gone, so are the blocks */
+		if (!c)
+			return;
+		for (cls = 0; cls < POOL_NUM_CLASSES; cls++) {
+			for (PoolBlock *block : lists[cls])
+				c->free_lists[cls].push(block);
+		}
+	}
+
+	std::weak_ptr<PoolCore> core;
+	uint64_t id;
+	std::vector<PoolBlock *> lists[POOL_NUM_CLASSES];
+};
+
+struct ThreadCaches {
+	~ThreadCaches();
+
+	std::vector<std::unique_ptr<ThreadCache>> caches;
+};
+
+static thread_local ThreadCaches thread_caches;
+/* Set once thread_caches is destroyed, during thread exit */
+static thread_local bool thread_caches_gone;
+
+ThreadCaches::~ThreadCaches()
+{
+	thread_caches_gone = true;
+}
+
+static ThreadCache *thread_cache(PoolCore *core)
+{
+	std::vector<std::unique_ptr<ThreadCache>> &caches =
+		thread_caches.caches;
+	size_t i;
+
+	if (thread_caches_gone)
+		return nullptr;
+
+	for (i = 0; i < caches.size(); ) {
+		if (caches[i]->id == core->id)
+			return caches[i].get();
+		if (caches[i]->core.expired()) {
+			caches[i] = std::move(caches.back());
+			caches.pop_back();
+			continue;
+		}
+		i++;
+	}
+
+	return nullptr;
+}
+
+PoolCore::PoolCore(const BufferPool::Options &opts) :
+	opts(opts),
+	id(pool_next_id++),
+	hits(0),
+	misses(0),
+	slab_count(0),
+	footprint_bytes(0),
+	in_use_bytes(0)
+{
+	if (opts.slab_size < pool_class_size(0))
+		throw std::invalid_argument("BufferPool slab_size too small");
+}
+
+PoolBlock *PoolCore::alloc(size_t size)
+{
+	unsigned cls = pool_class(size ? size : 1);
+	ThreadCache *cache = thread_cache(this);
+	PoolBlock *block = nullptr;
+
+	if (pool_class_size(cls) > opts.slab_size)
+		throw std::invalid_argument("BufferPool buffer too large");
+
+	if (cache && !cache->lists[cls].empty()) {
+		block = cache->lists[cls].back();
+		cache->lists[cls].pop_back();
+	}
+	if (!block)
+		block = free_lists[cls].pop();
+	if (block) {
+		hits++;
+	} else {
+		std::lock_guard<std::mutex> guard(lock);
+
+		block = carve(cls);
+		misses++;
+	}
+	in_use_bytes += pool_class_size(cls);
+
+	return block;
+}
+
+PoolBlock *PoolCore::carve(unsigned cls)
+{
+	size_t block_size = pool_class_size(cls);
+	std::unique_ptr<PoolBlock> block(new PoolBlock());
+	PoolSlab *slab = nullptr;
+
+	for (std::unique_ptr<PoolSlab> &s : slabs) {
+		if (s->buf.size() - s->used >= block_size) {
+			slab = s.get();
+			break;
+		}
+	}
+	if (!slab) {
+		if (opts.max_slabs && slabs.size() >= opts.max_slabs)
+			throw std::bad_alloc();
+		slabs.emplace_back(new PoolSlab(opts));
+		slab = slabs.back().get();
+		slab_count++;
+		footprint_bytes += slab->buf.size();
+	}
+
+	block->data = slab->buf.as<char>() + slab->used;
+	block->cls = cls;
+	block->h2c_window = slab->h2c_window;
+	block->c2h_window = slab->c2h_window;
+	block->window_offset = slab->used;
+	block->next = nullptr;
+	slab->used += block_size;
+
+	blocks.push_back(std::move(block));
+
+	return blocks.back().get();
+}
+
+void PoolCore::free(PoolBlock *block) noexcept
+{
+	ThreadCache *cache = thread_cache(this);
+
+	in_use_bytes -= pool_class_size(block->cls);
+
+	if (!cache && !thread_caches_gone) {
+		try {
+			thread_caches.caches.emplace_back(
+				new ThreadCache(shared_from_this()));
+			cache = thread_caches.caches.back().get();
+		} catch (...) {
+			cache = nullptr;
+		}
+	}
+	if (cache && cache->lists[block->cls].size() < POOL_CACHE_MAX) {
+		try {
+			cache->lists[block->cls].push_back(block);
+			return;
+		} catch (...) {
+			/* Fall back to the free list */
+		}
+	}
+	free_lists[block->cls].push(block);
+}
+
+}
+
+PoolBuffer::~PoolBuffer()
+{
+	release();
+}
+
+void PoolBuffer::release() noexcept
+{
+	if (!block_)
+		return;
+	core_->free(block_);
+	block_ = nullptr;
+	size_ = 0;
+	core_.reset();
+}
+
+PoolBuffer::PoolBuffer(PoolBuffer &&other) noexcept :
+	core_(std::move(other.core_)),
+	block_(other.block_),
+	size_(other.size_)
+{
+	other.block_ = nullptr;
+	other.size_ = 0;
+}
+
+PoolBuffer &PoolBuffer::operator=(PoolBuffer &&other) noexcept
+{
+	if (this != &other) {
+		release();
+		core_ = std::move(other.core_);
+		block_ = other.block_;
+		size_ = other.size_;
+		other.block_ = nullptr;
+		other.size_ = 0;
+	}
+
+	return *this;
+}
+
+void *PoolBuffer::data()
+{
+	return block_ ? block_->data : nullptr;
+}
+
+const void *PoolBuffer::data() const
+{
+	return block_ ? block_->data : nullptr;
+}
+
+size_t PoolBuffer::capacity() const
+{
+	return block_ ? detail::pool_class_size(block_->cls) : 0;
+}
+
+uint32_t PoolBuffer::h2c_window() const
+{
+	return block_->h2c_window;
+}
+
+uint32_t PoolBuffer::c2h_window() const
+{
+	return block_->c2h_window;
+}
+
+uint64_t PoolBuffer::window_offset() const
+{
+	return block_->window_offset;
+}
+
+BufferPool::BufferPool(const Options &opts) :
+	core_(std::make_shared<detail::PoolCore>(opts))
+{
+}
+
+BufferPool::~BufferPool()
+{
+}
+
+PoolBuffer BufferPool::alloc(size_t size)
+{
+	detail::PoolBlock *block = core_->alloc(size);
+
+	return PoolBuffer(core_, block, size);
+}
+
+BufferPool::Stats BufferPool::stats() const
+{
+	Stats stats;
+
+	stats.hits = core_->hits;
+	stats.misses = core_->misses;
+	stats.slabs = core_->slab_count;
+	stats.footprint_bytes = core_->footprint_bytes;
+	stats.in_use_bytes = core_->in_use_bytes;
+
+	return stats;
+}
+
+}
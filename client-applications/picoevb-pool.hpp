@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * libpicoevb host buffer pool, for clients that would otherwise allocate and
+ * free transfer buffers per frame.
+ *
+ * Buffers are carved from a few large slabs, which are faulted in and locked
+ * into memory when allocated, so the driver never waits for page faults when
+ * pinning them. If the pool is given a Device, each slab is also registered
+ * as a pair of Ring windows, so pool buffers can be used by Ring transfers.
+ *
+ * Buffers are rounded up to power-of-2 size classes. Freed buffers go to a
+ * small per-thread cache, and beyond that to a per-class lock-free free list,
+ * so a buffer may be freed by any thread without taking a lock. Only carving
+ * new buffers from a slab takes the pool's lock.
+ */
+
+#ifndef PICOEVB_POOL_HPP
+#define PICOEVB_POOL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include "picoevb.hpp"
+
+namespace picoevb {
+
+namespace detail {
+struct PoolCore;
+struct PoolBlock;
+}
+
+class BufferPool;
+
+/*
+ * A buffer from a BufferPool, returned to the pool on destruction. Keeps the
+ * pool's memory alive, so may outlive the BufferPool object itself.
+ */
+class PoolBuffer {
+public:
+	PoolBuffer() : block_(nullptr), size_(0) {}
+	~PoolBuffer();
+	PoolBuffer(PoolBuffer &&other) noexcept;
+	PoolBuffer &operator=(PoolBuffer &&other) noexcept;
+	PoolBuffer(const PoolBuffer &) = delete;
+	PoolBuffer &operator=(const PoolBuffer &) = delete;
+
+	void *data();
+	const void *data() const;
+	/* The requested size; capacity() is the size class */
+	size_t size() const { return size_; }
+	size_t capacity() const;
+
+	template <class T> T *as() { return static_cast<T *>(data()); }
+	template <class T> const T *as() const
+	{
+		return static_cast<const T *>(data());
+	}
+
+	/*
+	 * For Ring SQEs; only valid if the pool was given a Device. The window
+	 * covers the buffer's slab, so SQEs must add window_offset().
+	 */
+	uint32_t h2c_window() const;
+	uint32_t c2h_window() const;
+	uint64_t window_offset() const;
+
+private:
+	friend class BufferPool;
+	PoolBuffer(std::shared_ptr<detail::PoolCore> core,
+		detail::PoolBlock *block, size_t size) :
+		core_(std::move(core)), block_(block), size_(size) {}
+	void release() noexcept;
+
+	std::shared_ptr<detail::PoolCore> core_;
+	detail::PoolBlock *block_;
+	size_t size_;
+};
+
+class BufferPool {
+public:
+	struct Options {
+		Options() :
+			slab_size(64UL * 1024 * 1024),
+			max_slabs(16),
+			backing(HostBuffer::Backing::PAGES),
+			lock(true),
+			dev(nullptr) {}
+
+		/* Also the largest buffer the pool can allocate */
+		size_t slab_size;
+		/* 0 for unlimited */
+		size_t max_slabs;
+		HostBuffer::Backing backing;
+		/* mlock() slabs; subject to RLIMIT_MEMLOCK */
+		bool lock;
+		/* If set, register slabs as Ring windows; must outlive the pool */
+		Device *dev;
+	};
+
+	struct Stats {
+		/* Allocations served by a previously freed buffer */
+		uint64_t hits;
+		/* Allocations that carved a new buffer from a slab */
+		uint64_t misses;
+		uint64_t slabs;
+		/* Total size of all slabs */
+		uint64_t footprint_bytes;
+		/* Total capacity of buffers currently allocated */
+		uint64_t in_use_bytes;
+	};
+
+	explicit BufferPool(const Options &opts = Options());
+	~BufferPool();
+	BufferPool(BufferPool &&other) noexcept = default;
+	BufferPool &operator=(BufferPool &&other) noexcept = default;
+	BufferPool(const BufferPool &) = delete;
+	BufferPool &operator=(const BufferPool &) = delete;
+
+	/* Throws std::bad_alloc if all slabs are in use */
+	PoolBuffer alloc(size_t size);
+	Stats stats() const;
+
+private:
+	std::shared_ptr<detail::PoolCore> core_;
+};
+
+template <> struct BufferTraits<PoolBuffer> :
+	HostMemoryTraits<PoolBuffer> {};
+
+}
+
+#endif
@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include "picoevb-stream.hpp"
+
+namespace picoevb {
+
+namespace detail {
+
+static uint64_t elapsed_ns(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+StreamBase::StreamBase(Device &dev, const RamRegion &window,
+	const StreamOptions &opts) :
+	dev_(dev),
+	window_(window),
+	buffer_size_(opts.buffer_size),
+	window_slots_(0),
+	client_seq_(0),
+	dma_seq_(0),
+	stopping_(false),
+	holding_(false),
+	stats_()
+{
+	if (!opts.buffer_size || !opts.buffers)
+		throw std::invalid_argument("stream buffer size or count is 0");
+	if (window.size() < opts.buffer_size)
+		throw std::invalid_argument("stream window is too small");
+	window_slots_ = window.size() / opts.buffer_size;
+
+	buffers_.reserve(opts.buffers);
+	for (unsigned i = 0; i < opts.buffers; i++)
+		buffers_.emplace_back(opts.buffer_size, opts.backing);
+	lens_.resize(opts.buffers);
+}
+
+StreamBase::~StreamBase()
+{
+	stop();
+}
+
+void StreamBase::start()
+{
+	thread_ = std::thread([this] {
+		try {
+			run();
+		} catch (...) {
+			std::lock_guard<std::mutex> guard(lock_);
+			error_ = std::current_exception();
+			dma_cond_.notify_all();
+		}
+	});
+}
+
+void StreamBase::stop() noexcept
+{
+	{
+		std::lock_guard<std::mutex> guard(lock_);
+		stopping_ = true;
+		client_cond_.notify_all();
+	}
+	if (thread_.joinable())
+		thread_.join();
+}
+
+void StreamBase::check_error()
+{
+	if (error_)
+		std::rethrow_exception(error_);
+}
+
+uint64_t StreamBase::slot_offset(uint64_t seq) const
+{
+	return (seq % window_slots_) * buffer_size_;
+}
+
+StreamStats StreamBase::get_stats()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+
+	return stats_;
+}
+
+}
+
+StreamWriter::StreamWriter(Device &dev, const RamRegion &window,
+	const StreamOptions &opts) :
+	StreamBase(dev, window, opts),
+	partial_(nullptr),
+	partial_len_(0)
+{
+}
+
+StreamWriter::~StreamWriter()
+{
+	if (partial_) {
+		partial_ = nullptr;
+		try {
+			commit(partial_len_);
+		} catch (...) {
+		}
+	}
+	/* Must stop here, while run() may still be called */
+	stop();
+}
+
+void *StreamWriter::acquire()
+{
+	std::unique_lock<std::mutex> guard(lock_);
+	auto t0 = std::chrono::steady_clock::now();
+
+	check_error();
+	if (stopping_)
+		throw std::logic_error("StreamWriter is closed");
+	if (!holding_) {
+		dma_cond_.wait(guard, [this] {
+			return error_ ||
+				client_seq_ - dma_seq_ < buffers_.size();
+		});
+		check_error();
+		stats_.client_wait_ns += detail::elapsed_ns(t0);
+		holding_ = true;
+	}
+
+	return buffers_[client_seq_ % buffers_.size()].data();
+}
+
+void StreamWriter::commit(size_t len)
+{
+	std::lock_guard<std::mutex> guard(lock_);
+
+	check_error();
+	if (!holding_)
+		throw std::logic_error("StreamWriter: no buffer acquired");
+	if (len > buffer_size_)
+		throw std::out_of_range("StreamWriter::commit() len");
+	holding_ = false;
+	if (!len)
+		return;
+	lens_[client_seq_ % buffers_.size()] = len;
+	client_seq_++;
+	if (!thread_.joinable())
+		start();
+	client_cond_.notify_all();
+}
+
+void StreamWriter::write(const void *data, size_t len)
+{
+	const char *p = static_cast<const char *>(data);
+
+	while (len) {
+		if (!partial_) {
+			partial_ = acquire();
+			partial_len_ = 0;
+		}
+		size_t n = std::min(len, buffer_size_ - partial_len_);
+		memcpy(static_cast<char *>(partial_) + partial_len_, p, n);
+		partial_len_ += n;
+		p += n;
+		len -= n;
+		if (partial_len_ == buffer_size_) {
+			partial_ = nullptr;
+			commit(buffer_size_);
+		}
+	}
+}
+
+void StreamWriter::flush()
+{
+	if (partial_) {
+		partial_ = nullptr;
+		commit(partial_len_);
+	}
+
+	std::unique_lock<std::mutex> guard(lock_);
+	dma_cond_.wait(guard, [this] {
+		return error_ || dma_seq_ == client_seq_;
+	});
+	check_error();
+}
+
+void StreamWriter::close()
+{
+	flush();
+	stop();
+}
+
+void StreamWriter::run()
+{
+	std::unique_lock<std::mutex> guard(lock_);
+
+	for (;;) {
+		auto t0 = std::chrono::steady_clock::now();
+		client_cond_.wait(guard, [this] {
+			return stopping_ || dma_seq_ < client_seq_;
+		});
+		stats_.dma_idle_ns += detail::elapsed_ns(t0);
+		if (dma_seq_ == client_seq_)
+			return;
+
+		uint64_t seq = dma_seq_;
+		const HostBuffer &buf = buffers_[seq % buffers_.size()];
+		size_t len = lens_[seq % buffers_.size()];
+		uint64_t offset = slot_offset(seq);
+		guard.unlock();
+
+		t0 = std::chrono::steady_clock::now();
+		dev_.h2c(buf, 0, window_, offset, len);
+		uint64_t dma_ns = detail::elapsed_ns(t0);
+		if (on_written)
+			on_written(offset, len);
+
+		guard.lock();
+		stats_.chunks++;
+		stats_.bytes += len;
+		stats_.dma_ns += dma_ns;
+		dma_seq_++;
+		dma_cond_.notify_all();
+	}
+}
+
+StreamReader::StreamReader(Device &dev, const RamRegion &window,
+	uint64_t len, const StreamOptions &opts) :
+	StreamBase(dev, window, opts),
+	len_(len),
+	started_(false),
+	eof_(false),
+	read_offset_(0),
+	read_len_(0)
+{
+}
+
+StreamReader::~StreamReader()
+{
+	stop();
+}
+
+const void *StreamReader::acquire(size_t *len)
+{
+	std::unique_lock<std::mutex> guard(lock_);
+	auto t0 = std::chrono::steady_clock::now();
+
+	if (!started_) {
+		started_ = true;
+		start();
+	}
+	dma_cond_.wait(guard, [this] {
+		return error_ || stopping_ || eof_ || client_seq_ < dma_seq_;
+	});
+	stats_.client_wait_ns += detail::elapsed_ns(t0);
+	if (stopping_)
+		return nullptr;
+	/* Deliver chunks read before an error or the end of the stream */
+	if (client_seq_ == dma_seq_) {
+		check_error();
+		return nullptr;
+	}
+
+	holding_ = true;
+	*len = lens_[client_seq_ % buffers_.size()];
+
+	return buffers_[client_seq_ % buffers_.size()].data();
+}
+
+void StreamReader::release()
+{
+	std::lock_guard<std::mutex> guard(lock_);
+
+	if (!holding_)
+		throw std::logic_error("StreamReader: no chunk acquired");
+	holding_ = false;
+	read_len_ = 0;
+	client_seq_++;
+	client_cond_.notify_all();
+}
+
+size_t StreamReader::read(void *data, size_t len)
+{
+	size_t total = 0;
+
+	while (total < len) {
+		if (!read_len_) {
+			const char *chunk = static_cast<const char *>(
+				acquire(&read_len_));
+			if (!chunk)
+				break;
+			read_offset_ = 0;
+		}
+		const char *src = buffers_[client_seq_ % buffers_.size()]
+			.as<char>() + read_offset_;
+		size_t n = std::min(len - total, read_len_);
+		memcpy(static_cast<char *>(data) + total, src, n);
+		read_offset_ += n;
+		read_len_ -= n;
+		total += n;
+		if (!read_len_)
+			release();
+	}
+
+	return total;
+}
+
+void StreamReader::close()
+{
+	stop();
+	std::lock_guard<std::mutex> guard(lock_);
+	dma_cond_.notify_all();
+}
+
+void StreamReader::run()
+{
+	std::unique_lock<std::mutex> guard(lock_);
+
+	for (;;) {
+		auto t0 = std::chrono::steady_clock::now();
+		client_cond_.wait(guard, [this] {
+			return stopping_ ||
+				dma_seq_ - client_seq_ < buffers_.size();
+		});
+		stats_.dma_idle_ns += detail::elapsed_ns(t0);
+		if (stopping_)
+			return;
+
+		uint64_t seq = dma_seq_;
+		HostBuffer &buf = buffers_[seq % buffers_.size()];
+		uint64_t offset = slot_offset(seq);
+		size_t len = buffer_size_;
+		if (len_) {
+			uint64_t left = len_ - stats_.bytes;
+			if (left < len)
+				len = left;
+		}
+		guard.unlock();
+
+		if (!len || (on_ready && !on_ready(offset, len))) {
+			guard.lock();
+			eof_ = true;
+			dma_cond_.notify_all();
+			return;
+		}
+
+		t0 = std::chrono::steady_clock::now();
+		dev_.c2h(window_, offset, buf, 0, len);
+		uint64_t dma_ns = detail::elapsed_ns(t0);
+
+		guard.lock();
+		stats_.chunks++;
+		stats_.bytes += len;
+		stats_.dma_ns += dma_ns;
+		lens_[seq % buffers_.size()] = len;
+		dma_seq_++;
+		dma_cond_.notify_all();
+	}
+}
+
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * libpicoevb streaming transfers, which overlap a client's CPU work with DMA.
+ *
+ * A StreamWriter owns a few host buffers. The producer fills one while a
+ * submission thread copies previously filled buffers to FPGA RAM, so neither
+ * waits for the other until all buffers are in flight. A StreamReader works
+ * the other way round: the submission thread reads ahead into free buffers
+ * while the consumer processes earlier ones.
+ *
+ * Consecutive chunks are transferred to (or from) consecutive slots of a
+ * RamRegion, wrapping around at its end. Each slot is buffer_size bytes.
+ *
+ * Errors from the submission thread are rethrown by the next call made by the
+ * producer or consumer. The Device and RamRegion must outlive the stream.
+ */
+
+#ifndef PICOEVB_STREAM_HPP
+#define PICOEVB_STREAM_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "picoevb.hpp"
+
+namespace picoevb {
+
+struct StreamOptions {
+	StreamOptions() :
+		buffer_size(4UL * 1024 * 1024),
+		buffers(3),
+		backing(HostBuffer::Backing::PAGES) {}
+
+	/* Also the size of each slot in the RamRegion */
+	size_t buffer_size;
+	/* At least 2 for any overlap */
+	unsigned buffers;
+	HostBuffer::Backing backing;
+};
+
+struct StreamStats {
+	uint64_t chunks;
+	uint64_t bytes;
+	/* Time the submission thread spent in DMA ioctls */
+	uint64_t dma_ns;
+	/* Time the submission thread waited for the client */
+	uint64_t dma_idle_ns;
+	/* Time the client waited in acquire() for a buffer */
+	uint64_t client_wait_ns;
+};
+
+namespace detail {
+
+/*
+ * Buffers are used in order. client_seq counts buffers passed from the
+ * client to the submission thread, and dma_seq buffers passed back, so each
+ * is at most buffers.size() ahead of the other.
+ */
+class StreamBase {
+protected:
+	StreamBase(Device &dev, const RamRegion &window,
+		const StreamOptions &opts);
+	~StreamBase();
+
+	void start();
+	/* Signal the submission thread to exit, and wait for it */
+	void stop() noexcept;
+	/* Rethrow an error from the submission thread; call with lock_ held */
+	void check_error();
+	uint64_t slot_offset(uint64_t seq) const;
+	StreamStats get_stats();
+	virtual void run() = 0;
+
+	Device &dev_;
+	const RamRegion &window_;
+	size_t buffer_size_;
+	uint64_t window_slots_;
+	std::vector<HostBuffer> buffers_;
+	std::vector<size_t> lens_;
+
+	std::mutex lock_;
+	/* Signalled when client_seq_ advances, or on stop */
+	std::condition_variable client_cond_;
+	/* Signalled when dma_seq_ advances, or on error */
+	std::condition_variable dma_cond_;
+	uint64_t client_seq_;
+	uint64_t dma_seq_;
+	bool stopping_;
+	bool holding_;
+	std::exception_ptr error_;
+	StreamStats stats_;
+	std::thread thread_;
+};
+
+}
+
+class StreamWriter : private detail::StreamBase {
+public:
+	StreamWriter(Device &dev, const RamRegion &window,
+		const StreamOptions &opts = StreamOptions());
+	/* Waits for queued buffers; errors are discarded, so prefer close() */
+	~StreamWriter();
+	StreamWriter(const StreamWriter &) = delete;
+	StreamWriter &operator=(const StreamWriter &) = delete;
+
+	size_t buffer_size() const { return buffer_size_; }
+
+	/*
+	 * Returns a buffer of buffer_size() bytes to fill, blocking while all
+	 * buffers are in flight. The buffer belongs to the caller until
+	 * commit().
+	 */
+	void *acquire();
+	/* Queue the first len bytes of the acquired buffer for transfer */
+	void commit(size_t len);
+	/* Copy len bytes into the stream, in as many chunks as needed */
+	void write(const void *data, size_t len);
+	/* Wait until every committed buffer has been transferred */
+	void flush();
+	/* flush(), then stop the submission thread */
+	void close();
+
+	/*
+	 * Called on the submission thread after each chunk has been written,
+	 * with its offset in the RamRegion, e.g. to notify FPGA logic. Set
+	 * before the first commit().
+	 */
+	std::function<void(uint64_t region_offset, size_t len)> on_written;
+
+	StreamStats stats() { return get_stats(); }
+
+private:
+	void run() override;
+
+	/* A partially filled buffer from write() */
+	void *partial_;
+	size_t partial_len_;
+};
+
+class StreamReader : private detail::StreamBase {
+public:
+	/*
+	 * Reads len bytes, or until close() if len is 0. The last chunk may be
+	 * short.
+	 */
+	StreamReader(Device &dev, const RamRegion &window, uint64_t len = 0,
+		const StreamOptions &opts = StreamOptions());
+	~StreamReader();
+	StreamReader(const StreamReader &) = delete;
+	StreamReader &operator=(const StreamReader &) = delete;
+
+	size_t buffer_size() const { return buffer_size_; }
+
+	/*
+	 * Returns the next chunk and sets *len to its length, blocking until it
+	 * has been read. Returns nullptr at the end of the stream. The chunk
+	 * belongs to the caller until release().
+	 */
+	const void *acquire(size_t *len);
+	void release();
+	/* Copy up to len bytes out of the stream; returns 0 at its end */
+	size_t read(void *data, size_t len);
+	/* Stop reading ahead; acquire() then returns nullptr */
+	void close();
+
+	/*
+	 * Called on the submission thread before each chunk is read, with its
+	 * offset in the RamRegion. May block until the FPGA has produced the
+	 * data, and returns false to end the stream. Set before the first
+	 * acquire().
+	 */
+	std::function<bool(uint64_t region_offset, size_t len)> on_ready;
+
+	StreamStats stats() { return get_stats(); }
+
+private:
+	void run() override;
+
+	uint64_t len_;
+	bool started_;
+	bool eof_;
+	/* The part of the acquired chunk not yet consumed by read() */
+	size_t read_offset_;
+	size_t read_len_;
+};
+
+}
+
+#endif
@@ -0,0 +1,483 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <utility>
+#include "picoevb.hpp"
+
+namespace picoevb {
+
+Device::Device(const char *path) :
+	fd_(-1),
+	fpga_ram_size_(0)
+{
+	struct picoevb_rdma_card_info card_info = {};
+
+	fd_ = open(path, O_RDWR | O_CLOEXEC);
+	if (fd_ < 0)
+		throw Error(errno, "open()");
+
+	try {
+		ioctl_checked(PICOEVB_IOC_CARD_INFO, &card_info,
+			"ioctl(CARD_INFO)");
+	} catch (...) {
+		close_fd();
+		throw;
+	}
+	fpga_ram_size_ = card_info.fpga_ram_size;
+}
+
+Device::~Device()
+{
+	close_fd();
+}
+
+Device::Device(Device &&other) noexcept :
+	fd_(other.fd_),
+	fpga_ram_size_(other.fpga_ram_size_)
+{
+	other.fd_ = -1;
+}
+
+Device &Device::operator=(Device &&other) noexcept
+{
+	if (this != &other) {
+		close_fd();
+		fd_ = other.fd_;
+		fpga_ram_size_ = other.fpga_ram_size_;
+		other.fd_ = -1;
+	}
+
+	return *this;
+}
+
+void Device::close_fd() noexcept
+{
+	if (fd_ >= 0)
+		close(fd_);
+	fd_ = -1;
+}
+
+void Device::ioctl_checked(unsigned long request, void *arg, const char *what)
+{
+	if (ioctl(fd_, request, arg) != 0)
+		throw Error(errno, what);
+}
+
+void Device::set_leds(uint32_t value)
+{
+	/* PICOEVB_IOC_LED takes its argument by value */
+	if (ioctl(fd_, PICOEVB_IOC_LED, (unsigned long)value) != 0)
+		throw Error(errno, "ioctl(LED)");
+}
+
+void Device::set_sched(uint32_t prio, uint32_t weight)
+{
+	struct picoevb_rdma_set_sched params = {};
+
+	params.prio = prio;
+	params.weight = weight;
+	ioctl_checked(PICOEVB_IOC_SET_SCHED, &params, "ioctl(SET_SCHED)");
+}
+
+struct picoevb_rdma_sched_stats Device::sched_stats()
+{
+	struct picoevb_rdma_sched_stats params = {};
+
+	ioctl_checked(PICOEVB_IOC_SCHED_STATS, &params, "ioctl(SCHED_STATS)");
+
+	return params;
+}
+
+struct picoevb_rdma_pin_cache_stats Device::pin_cache_stats()
+{
+	struct picoevb_rdma_pin_cache_stats params = {};
+
+	ioctl_checked(PICOEVB_IOC_PIN_CACHE_STATS, &params,
+		"ioctl(PIN_CACHE_STATS)");
+
+	return params;
+}
+
+struct picoevb_rdma_perf_counters Device::perf_counters(bool arm)
+{
+	struct picoevb_rdma_perf_counters params = {};
+
+	if (arm)
+		params.flags = PICOEVB_PERF_FLAG_ARM;
+	ioctl_checked(PICOEVB_IOC_PERF_COUNTERS, &params,
+		"ioctl(PERF_COUNTERS)");
+
+	return params;
+}
+
+uint32_t Device::pin_cuda(uint64_t va, uint64_t size)
+{
+	struct picoevb_rdma_pin_cuda params = {};
+
+	params.va = va;
+	params.size = size;
+	ioctl_checked(PICOEVB_IOC_PIN_CUDA, &params, "ioctl(PIN_CUDA)");
+
+	return params.handle;
+}
+
+void Device::unpin_cuda(uint32_t handle)
+{
+	struct picoevb_rdma_unpin_cuda params = {};
+
+	params.handle = handle;
+	ioctl_checked(PICOEVB_IOC_UNPIN_CUDA, &params, "ioctl(UNPIN_CUDA)");
+}
+
+uint32_t Device::register_window(const void *data, uint64_t len,
+	uint32_t flags)
+{
+	struct picoevb_rdma_register_window params = {};
+
+	params.addr = (__u64)(uintptr_t)data;
+	params.len = len;
+	params.flags = flags;
+	ioctl_checked(PICOEVB_IOC_REGISTER_WINDOW, &params,
+		"ioctl(REGISTER_WINDOW)");
+
+	return params.window;
+}
+
+void Device::unregister_window(uint32_t window)
+{
+	struct picoevb_rdma_unregister_window params = {};
+
+	params.window = window;
+	ioctl_checked(PICOEVB_IOC_UNREGISTER_WINDOW, &params,
+		"ioctl(UNREGISTER_WINDOW)");
+}
+
+struct picoevb_rdma_ram_alloc Device::ram_alloc(uint64_t len,
+	const char *name)
+{
+	struct picoevb_rdma_ram_alloc params = {};
+
+	params.len = len;
+	if (strlen(name) >= sizeof(params.name))
+		throw std::invalid_argument("RAM region name too long");
+	strcpy(params.name, name);
+	ioctl_checked(PICOEVB_IOC_RAM_ALLOC, &params, "ioctl(RAM_ALLOC)");
+
+	return params;
+}
+
+struct picoevb_rdma_ram_open Device::ram_open(const char *name)
+{
+	struct picoevb_rdma_ram_open params = {};
+
+	if (strlen(name) >= sizeof(params.name))
+		throw std::invalid_argument("RAM region name too long");
+	strcpy(params.name, name);
+	ioctl_checked(PICOEVB_IOC_RAM_OPEN, &params, "ioctl(RAM_OPEN)");
+
+	return params;
+}
+
+void Device::ram_free(uint32_t handle)
+{
+	struct picoevb_rdma_ram_free params = {};
+
+	params.handle = handle;
+	ioctl_checked(PICOEVB_IOC_RAM_FREE, &params, "ioctl(RAM_FREE)");
+}
+
+RamRegion::RamRegion(Device &dev, uint64_t len, const char *name) :
+	dev_(&dev)
+{
+	struct picoevb_rdma_ram_alloc params = dev.ram_alloc(len, name);
+
+	handle_ = params.handle;
+	offset_ = params.offset;
+	size_ = params.size;
+}
+
+RamRegion RamRegion::open(Device &dev, const char *name)
+{
+	struct picoevb_rdma_ram_open params = dev.ram_open(name);
+
+	return RamRegion(dev, params.handle, params.offset, params.size);
+}
+
+RamRegion::~RamRegion()
+{
+	release();
+}
+
+void RamRegion::release() noexcept
+{
+	if (!dev_)
+		return;
+	try {
+		dev_->ram_free(handle_);
+	} catch (...) {
+		/* Closing the device frees everything anyway */
+	}
+	dev_ = nullptr;
+}
+
+RamRegion::RamRegion(RamRegion &&other) noexcept :
+	dev_(other.dev_),
+	handle_(other.handle_),
+	offset_(other.offset_),
+	size_(other.size_)
+{
+	other.dev_ = nullptr;
+	other.size_ = 0;
+}
+
+RamRegion &RamRegion::operator=(RamRegion &&other) noexcept
+{
+	if (this != &other) {
+		release();
+		dev_ = other.dev_;
+		handle_ = other.handle_;
+		offset_ = other.offset_;
+		size_ = other.size_;
+		other.dev_ = nullptr;
+		other.size_ = 0;
+	}
+
+	return *this;
+}
+
+Ring::Ring(Device &dev, uint32_t entries) :
+	dev_(dev),
+	entries_(entries)
+{
+	struct picoevb_rdma_ring_setup params = {};
+	char *p;
+
+	params.entries = entries;
+	if (ioctl(dev.fd(), PICOEVB_IOC_RING_SETUP, &params) != 0)
+		throw Error(errno, "ioctl(RING_SETUP)");
+
+	mmap_size_ = params.mmap_size;
+	mem_ = mmap(nullptr, mmap_size_, PROT_READ | PROT_WRITE, MAP_SHARED,
+		dev.fd(), 0);
+	if (mem_ == MAP_FAILED)
+		throw Error(errno, "mmap(ring)");
+
+	p = static_cast<char *>(mem_);
+	header_ = reinterpret_cast<struct picoevb_rdma_ring_header *>(p);
+	sqes_ = reinterpret_cast<struct picoevb_rdma_sqe *>(p +
+		params.sq_offset);
+	cqes_ = reinterpret_cast<struct picoevb_rdma_cqe *>(p +
+		params.cq_offset);
+}
+
+Ring::~Ring()
+{
+	munmap(mem_, mmap_size_);
+}
+
+bool Ring::submit(const struct picoevb_rdma_sqe &sqe)
+{
+	uint32_t tail = header_->sq_tail;
+	uint32_t head = __atomic_load_n(&header_->sq_head, __ATOMIC_ACQUIRE);
+
+	if (tail - head >= entries_)
+		return false;
+	sqes_[tail & (entries_ - 1)] = sqe;
+	__atomic_store_n(&header_->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+unsigned Ring::doorbell()
+{
+	int ret = ioctl(dev_.fd(), PICOEVB_IOC_DOORBELL);
+
+	if (ret < 0)
+		throw Error(errno, "ioctl(DOORBELL)");
+
+	return ret;
+}
+
+bool Ring::reap(struct picoevb_rdma_cqe *cqe)
+{
+	uint32_t head = header_->cq_head;
+	uint32_t tail = __atomic_load_n(&header_->cq_tail, __ATOMIC_ACQUIRE);
+
+	if (head == tail)
+		return false;
+	*cqe = cqes_[head & (entries_ - 1)];
+	__atomic_store_n(&header_->cq_head, head + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
+
+/* The default huge page size on all supported platforms */
+#define HUGE_PAGE_SIZE		(2UL * 1024 * 1024)
+#define HUGE_PAGE_SIZE_1G	(1024UL * 1024 * 1024)
+
+/* Missing from older C library headers */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT	26
+#endif
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB	(30 << MAP_HUGE_SHIFT)
+#endif
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC	0x0001U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB	0x0004U
+#endif
+#ifndef MFD_HUGE_1GB
+#define MFD_HUGE_1GB	(30U << MAP_HUGE_SHIFT)
+#endif
+
+HostBuffer::HostBuffer(size_t size, Backing backing) :
+	data_(nullptr),
+	size_(size),
+	alloc_size_(size ? size : 1),
+	backing_(backing),
+	fd_(-1)
+{
+	bool gb = backing == Backing::HUGE_PAGES_1G ||
+		backing == Backing::MEMFD_HUGE_PAGES_1G;
+	size_t page_size = gb ? HUGE_PAGE_SIZE_1G : HUGE_PAGE_SIZE;
+	void *p;
+	int ret;
+
+	switch (backing) {
+	case Backing::PAGES:
+		ret = posix_memalign(&data_, sysconf(_SC_PAGESIZE),
+			alloc_size_);
+		if (ret)
+			throw Error(ret, "posix_memalign()");
+		break;
+	case Backing::HUGE_PAGES:
+	case Backing::HUGE_PAGES_1G:
+		alloc_size_ = (alloc_size_ + page_size - 1) & ~(page_size - 1);
+		p = mmap(nullptr, alloc_size_, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+			(gb ? MAP_HUGE_1GB : 0), -1, 0);
+		if (p == MAP_FAILED)
+			throw Error(errno, "mmap(MAP_HUGETLB)");
+		data_ = p;
+		break;
+	case Backing::MEMFD_HUGE_PAGES:
+	case Backing::MEMFD_HUGE_PAGES_1G:
+		alloc_size_ = (alloc_size_ + page_size - 1) & ~(page_size - 1);
+		/* Via syscall(), since glibc < 2.27 lacks memfd_create() */
+		fd_ = syscall(SYS_memfd_create, "picoevb",
+			MFD_CLOEXEC | MFD_HUGETLB | (gb ? MFD_HUGE_1GB : 0));
+		if (fd_ < 0)
+			throw Error(errno, "memfd_create(MFD_HUGETLB)");
+		p = MAP_FAILED;
+		if (!ftruncate(fd_, alloc_size_))
+			p = mmap(nullptr, alloc_size_, PROT_READ | PROT_WRITE,
+				MAP_SHARED, fd_, 0);
+		if (p == MAP_FAILED) {
+			ret = errno;
+			close(fd_);
+			throw Error(ret, "mmap(memfd)");
+		}
+		data_ = p;
+		break;
+	}
+}
+
+HostBuffer::~HostBuffer()
+{
+	release();
+}
+
+void HostBuffer::release() noexcept
+{
+	if (!data_)
+		return;
+
+	if (backing_ == Backing::PAGES)
+		free(data_);
+	else
+		munmap(data_, alloc_size_);
+	if (fd_ >= 0)
+		close(fd_);
+	data_ = nullptr;
+	fd_ = -1;
+}
+
+HostBuffer::HostBuffer(HostBuffer &&other) noexcept :
+	data_(other.data_),
+	size_(other.size_),
+	alloc_size_(other.alloc_size_),
+	backing_(other.backing_),
+	fd_(other.fd_)
+{
+	other.data_ = nullptr;
+	other.size_ = 0;
+	other.fd_ = -1;
+}
+
+HostBuffer &HostBuffer::operator=(HostBuffer &&other) noexcept
+{
+	std::swap(data_, other.data_);
+	std::swap(size_, other.size_);
+	std::swap(alloc_size_, other.alloc_size_);
+	std::swap(backing_, other.backing_);
+	std::swap(fd_, other.fd_);
+
+	return *this;
+}
+
+namespace detail {
+
+void check_range(uint64_t size, uint64_t offset, uint64_t len,
+	const char *what)
+{
+	if (offset > size || len > size - offset)
+		throw std::out_of_range(what);
+}
+
+void check_range_2d(uint64_t size, uint64_t offset, uint64_t pitch,
+	uint64_t width, uint64_t height, const char *what)
+{
+	uint64_t extent;
+
+	if (!height)
+		return;
+	if (pitch < width)
+		throw std::out_of_range(what);
+	if (pitch && height - 1 > (UINT64_MAX - width) / pitch)
+		throw std::out_of_range(what);
+	extent = (height - 1) * pitch + width;
+	check_range(size, offset, extent, what);
+}
+
+}
+
+}
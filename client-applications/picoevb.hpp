@@ -0,0 +1,635 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+/*
+ * libpicoevb: C++ wrapper around the picoevb-rdma driver's ioctl interface.
+ *
+ * All objects are move-only, and release their resources on destruction.
+ * Errors are reported by throwing picoevb::Error (for failed system calls) or
+ * std::out_of_range (for transfers outside a buffer or FPGA RAM).
+ *
+ * Transfers are templates over the buffer type, so the memory kind (host
+ * memory or a pinned CUDA surface) and hence the ioctl flags are determined at
+ * compile time. A transfer performs no heap allocation.
+ *
+ * CUDA buffer types are in picoevb-cuda.hpp, which may only be used from code
+ * compiled by nvcc.
+ */
+
+#ifndef PICOEVB_HPP
+#define PICOEVB_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <stdexcept>
+#include <system_error>
+#include "../kernel-module/picoevb-rdma-ioctl.h"
+
+namespace picoevb {
+
+/* A failed system call; code() holds the errno value */
+class Error : public std::system_error {
+public:
+	Error(int err, const char *what) :
+		std::system_error(err, std::generic_category(), what) {}
+};
+
+/*
+ * Specialized for each buffer type, to describe how the driver accesses it:
+ *
+ * struct BufferTraits<Buffer> {
+ *	// Flags to set for each transfer direction
+ *	static const __u64 h2c_src_flags;
+ *	static const __u64 c2h_dst_flags;
+ *	static const __u64 h2c2h_src_flags;
+ *	static const __u64 h2c2h_dst_flags;
+ *	// Value for the ioctl's src/dst field, for offset bytes into buf
+ *	static __u64 dma_addr(const Buffer &buf, uint64_t offset);
+ * };
+ *
+ * Buffer types must also implement size().
+ */
+template <class Buffer> struct BufferTraits;
+
+class RamRegion;
+
+class Device {
+public:
+	explicit Device(const char *path = "/dev/picoevb");
+	~Device();
+	Device(Device &&other) noexcept;
+	Device &operator=(Device &&other) noexcept;
+	Device(const Device &) = delete;
+	Device &operator=(const Device &) = delete;
+
+	int fd() const { return fd_; }
+	uint64_t fpga_ram_size() const { return fpga_ram_size_; }
+
+	void set_leds(uint32_t value);
+	/* prio is PICOEVB_PRIO_* */
+	void set_sched(uint32_t prio,
+		uint32_t weight = PICOEVB_SCHED_WEIGHT_DEFAULT);
+	struct picoevb_rdma_sched_stats sched_stats();
+	struct picoevb_rdma_pin_cache_stats pin_cache_stats();
+	/*
+	 * Counts from the most recent armed transfer on each channel. If arm
+	 * is set, also arms the counters for each channel's next transfer.
+	 */
+	struct picoevb_rdma_perf_counters perf_counters(bool arm = false);
+
+	/* Prefer PinnedCudaBuffer, which manages the handle */
+	uint32_t pin_cuda(uint64_t va, uint64_t size);
+	void unpin_cuda(uint32_t handle);
+
+	/*
+	 * Register host memory for use by a Ring. flags is
+	 * PICOEVB_WINDOW_FLAG_*. The memory stays pinned until the window is
+	 * unregistered, or the Device is closed.
+	 */
+	uint32_t register_window(const void *data, uint64_t len,
+		uint32_t flags);
+	void unregister_window(uint32_t window);
+
+	/* Prefer RamRegion, which manages the handle */
+	struct picoevb_rdma_ram_alloc ram_alloc(uint64_t len,
+		const char *name = "");
+	struct picoevb_rdma_ram_open ram_open(const char *name);
+	void ram_free(uint32_t handle);
+
+	/*
+	 * Each transfer returns the time the driver spent performing it, in
+	 * nanoseconds. If timing is non-null, it receives a breakdown of the
+	 * whole ioctl's time by phase.
+	 */
+
+	/* Buffer to FPGA RAM */
+	template <class Src>
+	uint64_t h2c(const Src &src, uint64_t src_offset, uint64_t fpga_offset,
+		uint64_t len, struct picoevb_rdma_dma_timing *timing = nullptr);
+	/* FPGA RAM to buffer */
+	template <class Dst>
+	uint64_t c2h(uint64_t fpga_offset, Dst &dst, uint64_t dst_offset,
+		uint64_t len, struct picoevb_rdma_dma_timing *timing = nullptr);
+	/* As above, addressing FPGA RAM by an offset into a region */
+	template <class Src>
+	uint64_t h2c(const Src &src, uint64_t src_offset,
+		const RamRegion &region, uint64_t region_offset, uint64_t len,
+		struct picoevb_rdma_dma_timing *timing = nullptr);
+	template <class Dst>
+	uint64_t c2h(const RamRegion &region, uint64_t region_offset, Dst &dst,
+		uint64_t dst_offset, uint64_t len,
+		struct picoevb_rdma_dma_timing *timing = nullptr);
+	/* Buffer to buffer, via FPGA RAM */
+	template <class Src, class Dst>
+	uint64_t h2c2h(const Src &src, uint64_t src_offset, Dst &dst,
+		uint64_t dst_offset, uint64_t len,
+		struct picoevb_rdma_dma_timing *timing = nullptr);
+
+	/*
+	 * 2D transfers of height rows of width bytes. Each pitch is the
+	 * distance between the starts of consecutive rows.
+	 */
+	template <class Src>
+	uint64_t h2c_2d(const Src &src, uint64_t src_offset,
+		uint64_t src_pitch, uint64_t fpga_offset, uint64_t fpga_pitch,
+		uint64_t width, uint64_t height,
+		struct picoevb_rdma_dma_timing *timing = nullptr);
+	template <class Dst>
+	uint64_t c2h_2d(uint64_t fpga_offset, uint64_t fpga_pitch, Dst &dst,
+		uint64_t dst_offset, uint64_t dst_pitch, uint64_t width,
+		uint64_t height,
+		struct picoevb_rdma_dma_timing *timing = nullptr);
+	/* As above, addressing FPGA RAM by an offset into a region */
+	template <class Src>
+	uint64_t h2c_2d(const Src &src, uint64_t src_offset,
+		uint64_t src_pitch, const RamRegion &region,
+		uint64_t region_offset, uint64_t region_pitch, uint64_t width,
+		uint64_t height,
+		struct picoevb_rdma_dma_timing *timing = nullptr);
+	template <class Dst>
+	uint64_t c2h_2d(const RamRegion &region, uint64_t region_offset,
+		uint64_t region_pitch, Dst &dst, uint64_t dst_offset,
+		uint64_t dst_pitch, uint64_t width, uint64_t height,
+		struct picoevb_rdma_dma_timing *timing = nullptr);
+
+private:
+	void ioctl_checked(unsigned long request, void *arg, const char *what);
+	void close_fd() noexcept;
+
+	/*
+	 * ram is the ioctl's FPGA RAM address, and ram_flags any flags it
+	 * requires. ram_size and ram_offset are only used for range checks.
+	 */
+	template <class Src>
+	uint64_t h2c_ram(const Src &src, uint64_t src_offset, __u64 ram,
+		__u64 ram_flags, uint64_t ram_size, uint64_t ram_offset,
+		uint64_t len, struct picoevb_rdma_dma_timing *timing);
+	template <class Dst>
+	uint64_t c2h_ram(__u64 ram, __u64 ram_flags, uint64_t ram_size,
+		uint64_t ram_offset, Dst &dst, uint64_t dst_offset,
+		uint64_t len, struct picoevb_rdma_dma_timing *timing);
+	template <class Src>
+	uint64_t h2c_2d_ram(const Src &src, uint64_t src_offset,
+		uint64_t src_pitch, __u64 ram, __u64 ram_flags,
+		uint64_t ram_size, uint64_t ram_offset, uint64_t ram_pitch,
+		uint64_t width, uint64_t height,
+		struct picoevb_rdma_dma_timing *timing);
+	template <class Dst>
+	uint64_t c2h_2d_ram(__u64 ram, __u64 ram_flags, uint64_t ram_size,
+		uint64_t ram_offset, uint64_t ram_pitch, Dst &dst,
+		uint64_t dst_offset, uint64_t dst_pitch, uint64_t width,
+		uint64_t height, struct picoevb_rdma_dma_timing *timing);
+
+	int fd_;
+	uint64_t fpga_ram_size_;
+};
+
+/*
+ * A region of FPGA RAM allocated by the driver, so that it isn't used by
+ * other clients. A named region may be opened by other processes, and is
+ * freed once every RamRegion referring to it has been destroyed. The Device
+ * must outlive the region, and must not be moved while the region exists.
+ */
+class RamRegion {
+public:
+	/* Allocate len bytes; name may be empty */
+	RamRegion(Device &dev, uint64_t len, const char *name = "");
+	/* Open a region allocated with a name, perhaps by another process */
+	static RamRegion open(Device &dev, const char *name);
+	~RamRegion();
+	RamRegion(RamRegion &&other) noexcept;
+	RamRegion &operator=(RamRegion &&other) noexcept;
+	RamRegion(const RamRegion &) = delete;
+	RamRegion &operator=(const RamRegion &) = delete;
+
+	uint32_t handle() const { return handle_; }
+	/* The region's location in FPGA RAM, e.g. for FPGA logic */
+	uint64_t offset() const { return offset_; }
+	uint64_t size() const { return size_; }
+
+private:
+	RamRegion(Device &dev, uint32_t handle, uint64_t offset,
+		uint64_t size) :
+		dev_(&dev), handle_(handle), offset_(offset), size_(size) {}
+	void release() noexcept;
+
+	Device *dev_;
+	uint32_t handle_;
+	uint64_t offset_;
+	uint64_t size_;
+};
+
+/*
+ * Submission and completion rings mapped from the driver. Transfers are
+ * queued with submit() without entering the kernel, and executed by
+ * doorbell(), which runs as many as fit in the completion ring.
+ */
+class Ring {
+public:
+	/* entries is a power of 2, at most PICOEVB_RING_ENTRIES_MAX */
+	Ring(Device &dev, uint32_t entries);
+	~Ring();
+	Ring(const Ring &) = delete;
+	Ring &operator=(const Ring &) = delete;
+
+	uint32_t entries() const { return entries_; }
+
+	/* Returns false if the submission ring is full */
+	bool submit(const struct picoevb_rdma_sqe &sqe);
+	/* Returns the number of SQEs executed */
+	unsigned doorbell();
+	/* Returns false if there are no completions */
+	bool reap(struct picoevb_rdma_cqe *cqe);
+
+private:
+	Device &dev_;
+	uint32_t entries_;
+	size_t mmap_size_;
+	void *mem_;
+	struct picoevb_rdma_ring_header *header_;
+	struct picoevb_rdma_sqe *sqes_;
+	struct picoevb_rdma_cqe *cqes_;
+};
+
+/* Page-aligned host memory */
+class HostBuffer {
+public:
+	enum class Backing {
+		/* Regular pages, via posix_memalign() */
+		PAGES,
+		/*
+		 * Huge pages, via mmap(MAP_HUGETLB); size is rounded up to a
+		 * whole number of pages. Each huge page is physically
+		 * contiguous, so needs only one DMA descriptor.
+		 */
+		HUGE_PAGES,
+		/* As HUGE_PAGES, but 1 GB pages */
+		HUGE_PAGES_1G,
+		/*
+		 * As HUGE_PAGES, but backed by a memfd, so the buffer may be
+		 * shared with another process by passing it fd()
+		 */
+		MEMFD_HUGE_PAGES,
+		MEMFD_HUGE_PAGES_1G,
+	};
+
+	explicit HostBuffer(size_t size, Backing backing = Backing::PAGES);
+	~HostBuffer();
+	HostBuffer(HostBuffer &&other) noexcept;
+	HostBuffer &operator=(HostBuffer &&other) noexcept;
+	HostBuffer(const HostBuffer &) = delete;
+	HostBuffer &operator=(const HostBuffer &) = delete;
+
+	void *data() { return data_; }
+	const void *data() const { return data_; }
+	size_t size() const { return size_; }
+
+	template <class T> T *as() { return static_cast<T *>(data_); }
+	template <class T> const T *as() const
+	{
+		return static_cast<const T *>(data_);
+	}
+
+	Backing backing() const { return backing_; }
+	/* The memfd backing the buffer, or -1 */
+	int fd() const { return fd_; }
+
+private:
+	void release() noexcept;
+
+	void *data_;
+	size_t size_;
+	size_t alloc_size_;
+	Backing backing_;
+	int fd_;
+};
+
+/* Host memory owned elsewhere, e.g. by another allocator */
+class HostRef {
+public:
+	HostRef(void *data, size_t size) : data_(data), size_(size) {}
+
+	void *data() { return data_; }
+	const void *data() const { return data_; }
+	size_t size() const { return size_; }
+
+	template <class T> T *as() { return static_cast<T *>(data_); }
+	template <class T> const T *as() const
+	{
+		return static_cast<const T *>(data_);
+	}
+
+private:
+	void *data_;
+	size_t size_;
+};
+
+template <class Buffer> struct HostMemoryTraits {
+	static const __u64 h2c_src_flags = 0;
+	static const __u64 c2h_dst_flags = 0;
+	static const __u64 h2c2h_src_flags = 0;
+	static const __u64 h2c2h_dst_flags = 0;
+
+	static __u64 dma_addr(const Buffer &buf, uint64_t offset)
+	{
+		return (__u64)(uintptr_t)buf.data() + offset;
+	}
+};
+
+template <> struct BufferTraits<HostBuffer> :
+	HostMemoryTraits<HostBuffer> {};
+template <> struct BufferTraits<HostRef> : HostMemoryTraits<HostRef> {};
+
+/*
+ * CUDA memory owned elsewhere, passed to the driver by pointer. The driver pins
+ * it on first use, and keeps it pinned in the Device's pin cache.
+ */
+class CudaVaRef {
+public:
+	CudaVaRef(void *data, size_t size) : data_(data), size_(size) {}
+
+	void *data() const { return data_; }
+	size_t size() const { return size_; }
+
+private:
+	void *data_;
+	size_t size_;
+};
+
+template <> struct BufferTraits<CudaVaRef> {
+	static const __u64 h2c_src_flags = PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA_VA;
+	static const __u64 c2h_dst_flags = PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA_VA;
+	static const __u64 h2c2h_src_flags =
+		PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA_VA;
+	static const __u64 h2c2h_dst_flags =
+		PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA_VA;
+
+	static __u64 dma_addr(const CudaVaRef &buf, uint64_t offset)
+	{
+		return (__u64)(uintptr_t)buf.data() + offset;
+	}
+};
+
+namespace detail {
+
+/* Throws if [offset, offset + len) isn't within [0, size) */
+void check_range(uint64_t size, uint64_t offset, uint64_t len,
+	const char *what);
+/* As check_range(), for a 2D region */
+void check_range_2d(uint64_t size, uint64_t offset, uint64_t pitch,
+	uint64_t width, uint64_t height, const char *what);
+
+/* A DMA ioctl argument, followed by space for the optional timing */
+template <class Params> struct TimedParams {
+	Params params;
+	struct picoevb_rdma_dma_timing timing;
+};
+
+}
+
+template <class Src>
+uint64_t Device::h2c(const Src &src, uint64_t src_offset,
+	uint64_t fpga_offset, uint64_t len,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	return h2c_ram(src, src_offset, fpga_offset, 0, fpga_ram_size_,
+		fpga_offset, len, timing);
+}
+
+template <class Src>
+uint64_t Device::h2c(const Src &src, uint64_t src_offset,
+	const RamRegion &region, uint64_t region_offset, uint64_t len,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	return h2c_ram(src, src_offset,
+		PICOEVB_RAM_HANDLE_OFFSET(region.handle(), region_offset),
+		PICOEVB_H2C_DMA_FLAG_DST_IS_RAM, region.size(), region_offset,
+		len, timing);
+}
+
+template <class Src>
+uint64_t Device::h2c_ram(const Src &src, uint64_t src_offset, __u64 ram,
+	__u64 ram_flags, uint64_t ram_size, uint64_t ram_offset, uint64_t len,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	typedef BufferTraits<Src> Traits;
+	detail::TimedParams<struct picoevb_rdma_h2c_dma> arg = {};
+	struct picoevb_rdma_h2c_dma &params = arg.params;
+
+	detail::check_range(src.size(), src_offset, len, "h2c src");
+	detail::check_range(ram_size, ram_offset, len, "h2c dst");
+
+	params.src = Traits::dma_addr(src, src_offset);
+	params.dst = ram;
+	params.len = len;
+	params.flags = Traits::h2c_src_flags | ram_flags;
+	if (timing)
+		params.flags |= PICOEVB_H2C_DMA_FLAG_TIMING;
+	ioctl_checked(PICOEVB_IOC_H2C_DMA, &arg, "ioctl(H2C_DMA)");
+	if (timing)
+		*timing = arg.timing;
+
+	return params.dma_time_ns;
+}
+
+template <class Dst>
+uint64_t Device::c2h(uint64_t fpga_offset, Dst &dst, uint64_t dst_offset,
+	uint64_t len, struct picoevb_rdma_dma_timing *timing)
+{
+	return c2h_ram(fpga_offset, 0, fpga_ram_size_, fpga_offset, dst,
+		dst_offset, len, timing);
+}
+
+template <class Dst>
+uint64_t Device::c2h(const RamRegion &region, uint64_t region_offset,
+	Dst &dst, uint64_t dst_offset, uint64_t len,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	return c2h_ram(
+		PICOEVB_RAM_HANDLE_OFFSET(region.handle(), region_offset),
+		PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM, region.size(), region_offset,
+		dst, dst_offset, len, timing);
+}
+
+template <class Dst>
+uint64_t Device::c2h_ram(__u64 ram, __u64 ram_flags, uint64_t ram_size,
+	uint64_t ram_offset, Dst &dst, uint64_t dst_offset, uint64_t len,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	typedef BufferTraits<Dst> Traits;
+	detail::TimedParams<struct picoevb_rdma_c2h_dma> arg = {};
+	struct picoevb_rdma_c2h_dma &params = arg.params;
+
+	detail::check_range(ram_size, ram_offset, len, "c2h src");
+	detail::check_range(dst.size(), dst_offset, len, "c2h dst");
+
+	params.dst = Traits::dma_addr(dst, dst_offset);
+	params.src = ram;
+	params.len = len;
+	params.flags = Traits::c2h_dst_flags | ram_flags;
+	if (timing)
+		params.flags |= PICOEVB_C2H_DMA_FLAG_TIMING;
+	ioctl_checked(PICOEVB_IOC_C2H_DMA, &arg, "ioctl(C2H_DMA)");
+	if (timing)
+		*timing = arg.timing;
+
+	return params.dma_time_ns;
+}
+
+template <class Src, class Dst>
+uint64_t Device::h2c2h(const Src &src, uint64_t src_offset, Dst &dst,
+	uint64_t dst_offset, uint64_t len,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	typedef BufferTraits<Src> SrcTraits;
+	typedef BufferTraits<Dst> DstTraits;
+	detail::TimedParams<struct picoevb_rdma_h2c2h_dma> arg = {};
+	struct picoevb_rdma_h2c2h_dma &params = arg.params;
+
+	detail::check_range(src.size(), src_offset, len, "h2c2h src");
+	detail::check_range(dst.size(), dst_offset, len, "h2c2h dst");
+
+	params.src = SrcTraits::dma_addr(src, src_offset);
+	params.dst = DstTraits::dma_addr(dst, dst_offset);
+	params.len = len;
+	params.flags = SrcTraits::h2c2h_src_flags | DstTraits::h2c2h_dst_flags;
+	if (timing)
+		params.flags |= PICOEVB_H2C2H_DMA_FLAG_TIMING;
+	ioctl_checked(PICOEVB_IOC_H2C2H_DMA, &arg, "ioctl(H2C2H_DMA)");
+	if (timing)
+		*timing = arg.timing;
+
+	return params.dma_time_ns;
+}
+
+template <class Src>
+uint64_t Device::h2c_2d(const Src &src, uint64_t src_offset,
+	uint64_t src_pitch, uint64_t fpga_offset, uint64_t fpga_pitch,
+	uint64_t width, uint64_t height,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	return h2c_2d_ram(src, src_offset, src_pitch, fpga_offset, 0,
+		fpga_ram_size_, fpga_offset, fpga_pitch, width, height,
+		timing);
+}
+
+template <class Src>
+uint64_t Device::h2c_2d(const Src &src, uint64_t src_offset,
+	uint64_t src_pitch, const RamRegion &region, uint64_t region_offset,
+	uint64_t region_pitch, uint64_t width, uint64_t height,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	return h2c_2d_ram(src, src_offset, src_pitch,
+		PICOEVB_RAM_HANDLE_OFFSET(region.handle(), region_offset),
+		PICOEVB_H2C_DMA_FLAG_DST_IS_RAM, region.size(), region_offset,
+		region_pitch, width, height, timing);
+}
+
+template <class Src>
+uint64_t Device::h2c_2d_ram(const Src &src, uint64_t src_offset,
+	uint64_t src_pitch, __u64 ram, __u64 ram_flags, uint64_t ram_size,
+	uint64_t ram_offset, uint64_t ram_pitch, uint64_t width,
+	uint64_t height, struct picoevb_rdma_dma_timing *timing)
+{
+	typedef BufferTraits<Src> Traits;
+	detail::TimedParams<struct picoevb_rdma_h2c_2d_dma> arg = {};
+	struct picoevb_rdma_h2c_2d_dma &params = arg.params;
+
+	detail::check_range_2d(src.size(), src_offset, src_pitch, width,
+		height, "h2c_2d src");
+	detail::check_range_2d(ram_size, ram_offset, ram_pitch, width,
+		height, "h2c_2d dst");
+
+	params.src = Traits::dma_addr(src, src_offset);
+	params.dst = ram;
+	params.width = width;
+	params.height = height;
+	params.src_pitch = src_pitch;
+	params.dst_pitch = ram_pitch;
+	params.flags = Traits::h2c_src_flags | ram_flags;
+	if (timing)
+		params.flags |= PICOEVB_H2C_DMA_FLAG_TIMING;
+	ioctl_checked(PICOEVB_IOC_H2C_2D_DMA, &arg, "ioctl(H2C_2D_DMA)");
+	if (timing)
+		*timing = arg.timing;
+
+	return params.dma_time_ns;
+}
+
+template <class Dst>
+uint64_t Device::c2h_2d(uint64_t fpga_offset, uint64_t fpga_pitch, Dst &dst,
+	uint64_t dst_offset, uint64_t dst_pitch, uint64_t width,
+	uint64_t height, struct picoevb_rdma_dma_timing *timing)
+{
+	return c2h_2d_ram(fpga_offset, 0, fpga_ram_size_, fpga_offset,
+		fpga_pitch, dst, dst_offset, dst_pitch, width, height, timing);
+}
+
+template <class Dst>
+uint64_t Device::c2h_2d(const RamRegion &region, uint64_t region_offset,
+	uint64_t region_pitch, Dst &dst, uint64_t dst_offset,
+	uint64_t dst_pitch, uint64_t width, uint64_t height,
+	struct picoevb_rdma_dma_timing *timing)
+{
+	return c2h_2d_ram(
+		PICOEVB_RAM_HANDLE_OFFSET(region.handle(), region_offset),
+		PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM, region.size(), region_offset,
+		region_pitch, dst, dst_offset, dst_pitch, width, height,
+		timing);
+}
+
+template <class Dst>
+uint64_t Device::c2h_2d_ram(__u64 ram, __u64 ram_flags, uint64_t ram_size,
+	uint64_t ram_offset, uint64_t ram_pitch, Dst &dst,
+	uint64_t dst_offset, uint64_t dst_pitch, uint64_t width,
+	uint64_t height, struct picoevb_rdma_dma_timing *timing)
+{
+	typedef BufferTraits<Dst> Traits;
+	detail::TimedParams<struct picoevb_rdma_c2h_2d_dma> arg = {};
+	struct picoevb_rdma_c2h_2d_dma &params = arg.params;
+
+	detail::check_range_2d(ram_size, ram_offset, ram_pitch, width,
+		height, "c2h_2d src");
+	detail::check_range_2d(dst.size(), dst_offset, dst_pitch, width,
+		height, "c2h_2d dst");
+
+	params.dst = Traits::dma_addr(dst, dst_offset);
+	params.src = ram;
+	params.width = width;
+	params.height = height;
+	params.dst_pitch = dst_pitch;
+	params.src_pitch = ram_pitch;
+	params.flags = Traits::c2h_dst_flags | ram_flags;
+	if (timing)
+		params.flags |= PICOEVB_C2H_DMA_FLAG_TIMING;
+	ioctl_checked(PICOEVB_IOC_C2H_2D_DMA, &arg, "ioctl(C2H_2D_DMA)");
+	if (timing)
+		*timing = arg.timing;
+
+	return params.dma_time_ns;
+}
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2019, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <exception>
+#include "picoevb.hpp"
+
+#define SURFACE_W	1024
+#define SURFACE_H	1024
+#define SURFACE_SIZE	(SURFACE_W * SURFACE_H)
+
+#define OFFSET(x, y)	(((y) * SURFACE_W) + x)
+#define DATA(x, y)	(((y & 0xffff) << 16) | ((x) & 0xffff))
+
+static const struct {
+	const char *name;
+	picoevb::HostBuffer::Backing backing;
+} backings[] = {
+	{ "malloc", picoevb::HostBuffer::Backing::PAGES },
+	{ "hugepage", picoevb::HostBuffer::Backing::HUGE_PAGES },
+	{ "hugepage-1g", picoevb::HostBuffer::Backing::HUGE_PAGES_1G },
+	{ "memfd-hugepage", picoevb::HostBuffer::Backing::MEMFD_HUGE_PAGES },
+	{ "memfd-hugepage-1g",
+		picoevb::HostBuffer::Backing::MEMFD_HUGE_PAGES_1G },
+};
+
+int main(int argc, char **argv)
+{
+	picoevb::HostBuffer::Backing backing =
+		picoevb::HostBuffer::Backing::PAGES;
+	uint32_t *src, *dst;
+	uint32_t y, x;
+	size_t i;
+	int ret;
+
+	if (argc > 2) {
+		fprintf(stderr, "usage: rdma-malloc [malloc|hugepage|"
+			"hugepage-1g|memfd-hugepage|memfd-hugepage-1g]\n");
+		return 1;
+	}
+	if (argc == 2) {
+		for (i = 0; i < sizeof(backings) / sizeof(backings[0]); i++) {
+			if (!strcmp(argv[1], backings[i].name))
+				break;
+		}
+		if (i == sizeof(backings) / sizeof(backings[0])) {
+			fprintf(stderr, "unknown memory kind: %s\n", argv[1]);
+			return 1;
+		}
+		backing = backings[i].backing;
+	}
+
+	try {
+		picoevb::Device dev;
+		picoevb::HostBuffer src_buf(SURFACE_SIZE * sizeof(*src),
+			backing);
+		picoevb::HostBuffer dst_buf(SURFACE_SIZE * sizeof(*dst),
+			backing);
+
+		src = src_buf.as<uint32_t>();
+		dst = dst_buf.as<uint32_t>();
+
+		for (y = 0; y < SURFACE_H; y++) {
+			for (x = 0; x < SURFACE_W; x++) {
+				uint32_t expected = DATA(x, y);
+				uint32_t offset = OFFSET(x, y);
+				src[offset] = expected;
+				dst[offset] = ~expected;
+			}
+		}
+
+		dev.h2c2h(src_buf, 0, dst_buf, 0, src_buf.size());
+
+		ret = 0;
+		for (y = 0; y < SURFACE_H; y++) {
+			for (x = 0; x < SURFACE_W; x++) {
+				uint32_t expected = DATA(x, y);
+				uint32_t offset = OFFSET(x, y);
+				uint32_t actual = dst[offset];
+				if (actual != expected) {
+					fprintf(stderr,
+						"dst[0x%x] is 0x%x not 0x%x\n",
+						offset, actual, expected);
+					ret = 1;
+				}
+			}
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return ret;
+}
@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Exercises the driver's pin cache via *_IS_CUDA_VA transfers, checking the
+ * transferred data and the PICOEVB_IOC_PIN_CACHE_STATS counters after each
+ * step. Requires a driver built against the nv-p2p stub (see
+ * build-for-any-p2p-stub-native.sh or build-for-any-xdma-sim-native.sh), which
+ * accepts host memory as CUDA memory, and can simulate CUDA freeing it.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <exception>
+#include <string>
+#include "picoevb.hpp"
+
+#define PARAMS_DIR	"/sys/module/picoevb_rdma/parameters/"
+
+/* Several pages, so that sub-ranges of a surface can be transferred */
+#define SURFACE_SIZE	(16 * 1024)
+
+/* Returns 0, or the errno value */
+static int write_param(const char *name, const std::string &value)
+{
+	std::string path = std::string(PARAMS_DIR) + name;
+	int fd, err = 0;
+
+	fd = open(path.c_str(), O_WRONLY);
+	if (fd < 0)
+		return errno;
+	if (write(fd, value.c_str(), value.size()) < 0)
+		err = errno;
+	close(fd);
+
+	return err;
+}
+
+static std::string read_param(const char *name)
+{
+	std::string path = std::string(PARAMS_DIR) + name;
+	char buf[64];
+	ssize_t len;
+	int fd;
+
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw picoevb::Error(errno, path.c_str());
+	len = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0)
+		throw picoevb::Error(errno, path.c_str());
+	buf[len] = '\0';
+
+	return buf;
+}
+
+/* Restores pin_cache_budget when the test ends */
+class BudgetOverride {
+public:
+	explicit BudgetOverride(uint64_t budget) :
+		saved_(read_param("pin_cache_budget"))
+	{
+		int err = write_param("pin_cache_budget",
+			std::to_string(budget));
+		if (err)
+			throw picoevb::Error(err, "write(pin_cache_budget)");
+	}
+
+	~BudgetOverride()
+	{
+		write_param("pin_cache_budget", saved_);
+	}
+
+	BudgetOverride(const BudgetOverride &) = delete;
+	BudgetOverride &operator=(const BudgetOverride &) = delete;
+
+private:
+	std::string saved_;
+};
+
+static void simulate_cuda_free(const picoevb::HostBuffer &buf)
+{
+	int err = write_param("p2p_stub_free_va",
+		std::to_string((uintptr_t)buf.data()));
+	if (err)
+		throw picoevb::Error(err, "write(p2p_stub_free_va)");
+}
+
+static void fill(picoevb::HostBuffer &buf, uint32_t seed)
+{
+	uint32_t *data = buf.as<uint32_t>();
+	size_t i;
+
+	for (i = 0; i < buf.size() / sizeof(*data); i++)
+		data[i] = seed + i;
+}
+
+static int check_data(const char *step, const picoevb::HostBuffer &buf,
+	uint32_t seed)
+{
+	const uint32_t *data = buf.as<uint32_t>();
+	size_t i;
+
+	for (i = 0; i < buf.size() / sizeof(*data); i++) {
+		if (data[i] != seed + i) {
+			fprintf(stderr, "%s: data[0x%zx] is 0x%x not 0x%x\n",
+				step, i, data[i], (uint32_t)(seed + i));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_stats(const char *step, picoevb::Device &dev,
+	uint64_t hits, uint64_t misses, uint64_t evictions,
+	uint64_t invalidations, uint64_t pinned_surfaces)
+{
+	struct picoevb_rdma_pin_cache_stats stats = dev.pin_cache_stats();
+	uint64_t pinned_bytes = pinned_surfaces * SURFACE_SIZE;
+	int ret = 0;
+
+#define CHECK(field)							\
+	if (stats.field != field) {					\
+		fprintf(stderr, "%s: " #field " is %" PRIu64		\
+			" not %" PRIu64 "\n", step,			\
+			(uint64_t)stats.field, field);			\
+		ret = 1;						\
+	}
+	CHECK(hits);
+	CHECK(misses);
+	CHECK(evictions);
+	CHECK(invalidations);
+	CHECK(pinned_bytes);
+	CHECK(pinned_surfaces);
+#undef CHECK
+
+	printf("%-40s %s\n", step, ret ? "FAIL" : "ok");
+
+	return ret;
+}
+
+int main(void)
+{
+	int ret = 0, err;
+
+	try {
+		picoevb::Device dev;
+		/* Room for two surfaces, so the third evicts one */
+		BudgetOverride budget(2 * SURFACE_SIZE);
+		picoevb::HostBuffer a_buf(SURFACE_SIZE);
+		picoevb::HostBuffer b_buf(SURFACE_SIZE);
+		picoevb::HostBuffer c_buf(SURFACE_SIZE);
+		picoevb::CudaVaRef a(a_buf.data(), a_buf.size());
+		picoevb::CudaVaRef b(b_buf.data(), b_buf.size());
+		picoevb::CudaVaRef c(c_buf.data(), c_buf.size());
+
+		fill(a_buf, 0x10000000);
+		fill(c_buf, 0x30000000);
+
+		ret |= check_stats("initial", dev, 0, 0, 0, 0, 0);
+
+		dev.h2c(a, 0, 0, SURFACE_SIZE);
+		ret |= check_stats("first use of a misses", dev,
+			0, 1, 0, 0, 1);
+
+		dev.h2c(a, 0, 0, SURFACE_SIZE);
+		ret |= check_stats("reuse of a hits", dev, 1, 1, 0, 0, 1);
+
+		dev.h2c(a, SURFACE_SIZE / 2, SURFACE_SIZE / 2,
+			SURFACE_SIZE / 4);
+		ret |= check_stats("part of a hits", dev, 2, 1, 0, 0, 1);
+
+		fill(b_buf, 0);
+		dev.c2h(0, b, 0, SURFACE_SIZE);
+		ret |= check_data("a via RAM to b", b_buf, 0x10000000);
+		ret |= check_stats("first use of b misses", dev,
+			2, 2, 0, 0, 2);
+
+		/* a is least recently used */
+		dev.h2c(c, 0, 0, SURFACE_SIZE);
+		ret |= check_stats("c evicts a", dev, 2, 3, 1, 0, 2);
+
+		dev.h2c(a, 0, 0, SURFACE_SIZE);
+		ret |= check_stats("a evicts b", dev, 2, 4, 2, 0, 2);
+
+		simulate_cuda_free(c_buf);
+		ret |= check_stats("freeing c invalidates it", dev,
+			2, 4, 2, 1, 1);
+
+		err = write_param("p2p_stub_free_va",
+			std::to_string((uintptr_t)b_buf.data()));
+		if (err != ENOENT) {
+			fprintf(stderr, "freeing evicted b: %s, not ENOENT\n",
+				strerror(err));
+			ret = 1;
+		}
+		ret |= check_stats("freeing evicted b does nothing", dev,
+			2, 4, 2, 1, 1);
+
+		/* c must be pinned again */
+		fill(c_buf, 0);
+		dev.c2h(0, c, 0, SURFACE_SIZE);
+		ret |= check_data("a via RAM to c", c_buf, 0x10000000);
+		ret |= check_stats("use of c after free misses", dev,
+			2, 5, 2, 1, 2);
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	return ret;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION. All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+/*
+ * Races PICOEVB_IOC_UNPIN_CUDA against transfers using the same handle. Each
+ * transfer must either complete with the right data, or fail with EINVAL
+ * once the handle is gone; the driver must not release the pages while a
+ * transfer is using them. Requires a driver built against the nv-p2p stub
+ * (see build-for-any-p2p-stub-native.sh or build-for-any-xdma-sim-native.sh),
+ * which accepts host memory as CUDA memory. Best run on a kernel with KASAN.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <atomic>
+#include <exception>
+#include <thread>
+#include "picoevb.hpp"
+
+#define SURFACE_SIZE	(16 * 1024)
+#define ITERATIONS	500
+/* Longest delay before unpinning, in microseconds */
+#define MAX_DELAY_US	200
+
+/* CUDA memory pinned by Device::pin_cuda(), but not owned */
+class CudaHandleRef {
+public:
+	CudaHandleRef(uint32_t handle, size_t size) :
+		handle_(handle), size_(size) {}
+
+	uint32_t handle() const { return handle_; }
+	size_t size() const { return size_; }
+
+private:
+	uint32_t handle_;
+	size_t size_;
+};
+
+namespace picoevb {
+
+template <> struct BufferTraits<CudaHandleRef> {
+	static const __u64 h2c_src_flags = PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA;
+	static const __u64 c2h_dst_flags = PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA;
+	static const __u64 h2c2h_src_flags =
+		PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA;
+	static const __u64 h2c2h_dst_flags =
+		PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA;
+
+	static __u64 dma_addr(const CudaHandleRef &buf, uint64_t offset)
+	{
+		return PICOEVB_CUDA_HANDLE_OFFSET(buf.handle(), offset);
+	}
+};
+
+}
+
+/* Copy src via FPGA RAM to dst until src's handle is unpinned */
+static void transfer_until_unpinned(picoevb::Device &dev,
+	const CudaHandleRef &src, picoevb::HostBuffer &dst,
+	const picoevb::HostBuffer &expected, std::atomic<int> &ret,
+	std::atomic<uint64_t> &completed)
+{
+	for (;;) {
+		try {
+			dev.h2c(src, 0, 0, SURFACE_SIZE);
+		} catch (const picoevb::Error &e) {
+			if (e.code().value() != EINVAL) {
+				fprintf(stderr, "%s\n", e.what());
+				ret = 1;
+			}
+			return;
+		} catch (const std::exception &e) {
+			fprintf(stderr, "%s\n", e.what());
+			ret = 1;
+			return;
+		}
+
+		try {
+			memset(dst.data(), 0, dst.size());
+			dev.c2h(0, dst, 0, SURFACE_SIZE);
+		} catch (const std::exception &e) {
+			fprintf(stderr, "%s\n", e.what());
+			ret = 1;
+			return;
+		}
+		if (memcmp(dst.data(), expected.data(), SURFACE_SIZE)) {
+			fprintf(stderr, "h2c copied the wrong data\n");
+			ret = 1;
+			return;
+		}
+		completed++;
+	}
+}
+
+int main(void)
+{
+	std::atomic<int> ret(0);
+	std::atomic<uint64_t> completed(0);
+	uint32_t *data;
+	size_t i;
+
+	try {
+		picoevb::Device dev;
+		picoevb::HostBuffer src_buf(SURFACE_SIZE);
+		picoevb::HostBuffer dst_buf(SURFACE_SIZE);
+
+		data = src_buf.as<uint32_t>();
+		for (i = 0; i < SURFACE_SIZE / sizeof(*data); i++)
+			data[i] = 0x5a000000 + i;
+
+		for (i = 0; i < ITERATIONS && !ret; i++) {
+			uint32_t handle = dev.pin_cuda(
+				(uint64_t)(uintptr_t)src_buf.data(),
+				src_buf.size());
+			CudaHandleRef src(handle, src_buf.size());
+			std::thread thread(transfer_until_unpinned,
+				std::ref(dev), std::cref(src),
+				std::ref(dst_buf), std::cref(src_buf),
+				std::ref(ret), std::ref(completed));
+
+			usleep(rand() % (MAX_DELAY_US + 1));
+			try {
+				dev.unpin_cuda(handle);
+			} catch (...) {
+				thread.join();
+				throw;
+			}
+			thread.join();
+		}
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	printf("%zu unpins, %llu transfers: %s\n", i,
+		(unsigned long long)completed, ret ? "FAIL" : "ok");
+
+	return ret;
+}
@@ -20,39 +20,25 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
+
 #include <stdio.h>
 #include <stdlib.h>
-#include <fcntl.h>
-#include <unistd.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
-#include <sys/types.h>
-#include "../kernel-module/picoevb-rdma-ioctl.h"
+#include <exception>
+#include "picoevb.hpp"
 
 int main(int argc, char **argv)
 {
-	int fd, ret;
-
 	if (argc != 2) {
 		fprintf(stderr, "usage: set-leds value\n");
-		exit(1);
-	}
-
-	fd = open("/dev/picoevb", O_RDWR);
-	if (fd < 0) {
-		perror("open() failed");
-		exit(1);
+		return 1;
 	}
 
-	ret = ioctl(fd, PICOEVB_IOC_LED, strtoul(argv[1], 0, 10));
-	if (ret != 0) {
-		perror("ioctl() failed");
-		exit(1);
-	}
+	try {
+		picoevb::Device dev;
 
-	ret = close(fd);
-	if (ret < 0) {
-		perror("close() failed");
+		dev.set_leds(strtoul(argv[1], 0, 10));
+	} catch (const std::exception &e) {
+		fprintf(stderr, "%s\n", e.what());
 		return 1;
 	}
 
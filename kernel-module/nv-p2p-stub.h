@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * Stand-in for the Jetson/Drive (iGPU) flavor of <linux/nv-p2p.h>, for use on
+ * systems without an NVIDIA GPU driver. "CUDA" virtual addresses are treated
+ * as ordinary user-space virtual addresses, which is also what they are for
+ * cudaHostAlloc() memory on iGPU systems. This allows the driver's CUDA code
+ * paths (pinning, handle management, the pin cache) to be exercised using
+ * malloc()'d memory.
+ *
+ * As with the real implementation, nvidia_p2p_put_pages() invokes the free
+ * callback, which must call nvidia_p2p_free_page_table(). Since there is no
+ * GPU memory allocator to free the memory behind our back, the free callback
+ * is only invoked asynchronously when nvidia_p2p_stub_free() simulates the
+ * CUDA allocation being freed.
+ */
+
+#ifndef __NV_P2P_STUB_H__
+#define __NV_P2P_STUB_H__
+
+#include <linux/dma-mapping.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+
+enum nvidia_p2p_page_size_type {
+	NVIDIA_P2P_PAGE_SIZE_4KB = 0,
+};
+
+struct nvidia_p2p_page_table {
+	u32 page_size;
+	struct page **pages;
+	u32 entries;
+	u64 vaddr;
+	u64 size;
+	void (*free_callback)(void *data);
+	void *data;
+	/* Entry in nvidia_p2p_stub_tables, until the free callback is due */
+	struct list_head stub_entry;
+};
+
+static LIST_HEAD(nvidia_p2p_stub_tables);
+static DEFINE_MUTEX(nvidia_p2p_stub_lock);
+
+struct nvidia_p2p_dma_mapping {
+	dma_addr_t *hw_address;
+	u32 *hw_len;
+	u32 entries;
+	struct device *dev;
+	struct sg_table sgt;
+	enum dma_data_direction direction;
+};
+
+static inline int nvidia_p2p_free_page_table(
+	struct nvidia_p2p_page_table *page_table)
+{
+	u32 i;
+
+	for (i = 0; i < page_table->entries; i++)
+		put_page(page_table->pages[i]);
+	kvfree(page_table->pages);
+	page_table->pages = NULL;
+	page_table->entries = 0;
+
+	return 0;
+}
+
+static inline int nvidia_p2p_get_pages(u64 vaddr, u64 size,
+	struct nvidia_p2p_page_table **page_table,
+	void (*free_callback)(void *data), void *data)
+{
+	struct nvidia_p2p_page_table *pt;
+	int nr_pages, pinned;
+
+	if (!size || offset_in_page(vaddr) || offset_in_page(size) ||
+			(size >> PAGE_SHIFT) > INT_MAX)
+		return -EINVAL;
+	nr_pages = size >> PAGE_SHIFT;
+
+	pt = kzalloc(sizeof(*pt), GFP_KERNEL);
+	if (!pt)
+		return -ENOMEM;
+
+	pt->pages = kvmalloc_array(nr_pages, sizeof(*pt->pages), GFP_KERNEL);
+	if (!pt->pages) {
+		kfree(pt);
+		return -ENOMEM;
+	}
+
+	/* FOLL_WRITE doubles as the "write" argument on older kernels */
+	pinned = get_user_pages_fast(vaddr, nr_pages, FOLL_WRITE, pt->pages);
+	if (pinned > 0)
+		pt->entries = pinned;
+	if (pinned != nr_pages) {
+		nvidia_p2p_free_page_table(pt);
+		kfree(pt);
+		return pinned < 0 ? pinned : -EFAULT;
+	}
+
+	pt->page_size = NVIDIA_P2P_PAGE_SIZE_4KB;
+	pt->vaddr = vaddr;
+	pt->size = size;
+	pt->free_callback = free_callback;
+	pt->data = data;
+
+	mutex_lock(&nvidia_p2p_stub_lock);
+	list_add_tail(&pt->stub_entry, &nvidia_p2p_stub_tables);
+	mutex_unlock(&nvidia_p2p_stub_lock);
+
+	*page_table = pt;
+
+	return 0;
+}
+
+static inline int nvidia_p2p_put_pages(
+	struct nvidia_p2p_page_table *page_table)
+{
+	bool freed;
+
+	/* Whoever removes the page table from the list invokes the callback */
+	mutex_lock(&nvidia_p2p_stub_lock);
+	freed = list_empty(&page_table->stub_entry);
+	list_del_init(&page_table->stub_entry);
+	mutex_unlock(&nvidia_p2p_stub_lock);
+
+	if (!freed)
+		page_table->free_callback(page_table->data);
+
+	return 0;
+}
+
+/*
+ * Simulate freeing the CUDA allocation containing vaddr, by invoking the free
+ * callback of each page table covering it. Returns the number of page tables
+ * invalidated.
+ */
+static inline int nvidia_p2p_stub_free(u64 vaddr)
+{
+	struct nvidia_p2p_page_table *pt;
+	int count = 0;
+
+	for (;;) {
+		bool found = false;
+
+		mutex_lock(&nvidia_p2p_stub_lock);
+		list_for_each_entry(pt, &nvidia_p2p_stub_tables, stub_entry) {
+			if (vaddr >= pt->vaddr &&
+					vaddr - pt->vaddr < pt->size) {
+				list_del_init(&pt->stub_entry);
+				found = true;
+				break;
+			}
+		}
+		mutex_unlock(&nvidia_p2p_stub_lock);
+
+		if (!found)
+			break;
+
+		pt->free_callback(pt->data);
+		count++;
+	}
+
+	return count;
+}
+
+static inline int nvidia_p2p_dma_unmap_pages(
+	struct nvidia_p2p_dma_mapping *map)
+{
+	if (map->entries)
+		dma_unmap_sg(map->dev, map->sgt.sgl, map->sgt.orig_nents,
+			map->direction);
+	sg_free_table(&map->sgt);
+	kfree(map->hw_address);
+	kfree(map->hw_len);
+	kfree(map);
+
+	return 0;
+}
+
+static inline int nvidia_p2p_dma_map_pages(struct device *dev,
+	struct nvidia_p2p_page_table *page_table,
+	struct nvidia_p2p_dma_mapping **dma_mapping,
+	enum dma_data_direction direction)
+{
+	struct nvidia_p2p_dma_mapping *map;
+	struct scatterlist *sg;
+	int ret, nents, i;
+
+	map = kzalloc(sizeof(*map), GFP_KERNEL);
+	if (!map)
+		return -ENOMEM;
+	map->dev = dev;
+	map->direction = direction;
+
+	ret = sg_alloc_table_from_pages(&map->sgt, page_table->pages,
+		page_table->entries, 0, page_table->size, GFP_KERNEL);
+	if (ret) {
+		kfree(map);
+		return ret;
+	}
+
+	nents = dma_map_sg(dev, map->sgt.sgl, map->sgt.orig_nents, direction);
+	if (!nents) {
+		nvidia_p2p_dma_unmap_pages(map);
+		return -EFAULT;
+	}
+	map->entries = nents;
+
+	map->hw_address = kmalloc_array(nents, sizeof(*map->hw_address),
+		GFP_KERNEL);
+	map->hw_len = kmalloc_array(nents, sizeof(*map->hw_len), GFP_KERNEL);
+	if (!map->hw_address || !map->hw_len) {
+		nvidia_p2p_dma_unmap_pages(map);
+		return -ENOMEM;
+	}
+
+	for_each_sg(map->sgt.sgl, sg, nents, i) {
+		map->hw_address[i] = sg_dma_address(sg);
+		map->hw_len[i] = sg_dma_len(sg);
+	}
+
+	*dma_mapping = map;
+
+	return 0;
+}
+
+#endif
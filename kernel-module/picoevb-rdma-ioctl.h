@@ -24,16 +24,104 @@ struct picoevb_rdma_pin_cuda {
 	__u32 handle;
 };
 
+/*
+ * Where the DMA ioctls accept a handle from IOC_PIN_CUDA, the handle occupies
+ * the low PICOEVB_CUDA_HANDLE_BITS bits. The remaining bits hold a byte offset
+ * into the pinned surface at which the transfer starts. This allows a single
+ * large pinned surface to be sub-allocated and used for many transfers.
+ */
+#define PICOEVB_CUDA_HANDLE_BITS	24
+#define PICOEVB_CUDA_HANDLE_MASK	((1ULL << PICOEVB_CUDA_HANDLE_BITS) - 1)
+#define PICOEVB_CUDA_HANDLE_OFFSET(handle, offset) \
+	((__u64)(handle) | ((__u64)(offset) << PICOEVB_CUDA_HANDLE_BITS))
+
 struct picoevb_rdma_unpin_cuda {
 	/* In */
 	__u32 handle;
 };
 
+/*
+ * FPGA RAM regions. The driver allocates regions of FPGA RAM so that
+ * concurrent clients don't overwrite each other's data. A region is freed
+ * once every handle to it has been freed, or its file closed. A region may be
+ * given a name, which other processes can use to open the same region.
+ *
+ * Where the DMA ioctls accept a region handle (with the _IS_RAM flag), the
+ * handle occupies the low PICOEVB_RAM_HANDLE_BITS bits. The remaining bits
+ * hold a byte offset into the region.
+ */
+#define PICOEVB_RAM_HANDLE_BITS	24
+#define PICOEVB_RAM_HANDLE_MASK	((1ULL << PICOEVB_RAM_HANDLE_BITS) - 1)
+#define PICOEVB_RAM_HANDLE_OFFSET(handle, offset) \
+	((__u64)(handle) | ((__u64)(offset) << PICOEVB_RAM_HANDLE_BITS))
+
+/* Including the terminating NUL */
+#define PICOEVB_RAM_NAME_MAX	32
+
+struct picoevb_rdma_ram_alloc {
+	/* In */
+	__u64 len;
+	/* Empty for an anonymous region; otherwise must be unique */
+	char name[PICOEVB_RAM_NAME_MAX];
+	/* Out */
+	__u32 handle;
+	__u32 reserved;
+	/* The region's offset in FPGA RAM, and its (rounded up) length */
+	__u64 offset;
+	__u64 size;
+};
+
+struct picoevb_rdma_ram_open {
+	/* In */
+	char name[PICOEVB_RAM_NAME_MAX];
+	/* Out */
+	__u32 handle;
+	__u32 reserved;
+	__u64 offset;
+	__u64 size;
+};
+
+struct picoevb_rdma_ram_free {
+	/* In */
+	__u32 handle;
+};
+
+/*
+ * Breakdown of the time taken by a DMA ioctl. Requested by setting the
+ * ioctl's _FLAG_TIMING flag, in which case the ioctl's argument must be
+ * immediately followed in memory by this struct, which is filled in if the
+ * transfer succeeds. Times are in nanoseconds, and are summed over all
+ * buffers and DMA operations that make up the transfer.
+ */
+struct picoevb_rdma_dma_timing {
+	/* Out */
+	/*
+	 * Pinning memory, including pin cache lookups, or for small transfers
+	 * copying it to or from a bounce buffer
+	 */
+	__u64 pin_ns;
+	/* Building scatter lists and mapping them for DMA */
+	__u64 map_ns;
+	/* Waiting to be granted the DMA engine */
+	__u64 queue_wait_ns;
+	/* From starting the DMA engine until its completion IRQ */
+	__u64 hw_ns;
+	/* From the completion IRQ until the waiting task runs */
+	__u64 irq_to_wake_ns;
+	/* Unmapping and unpinning memory */
+	__u64 unmap_ns;
+	/*
+	 * DMA descriptors executed. Physically (or IOVA) contiguous memory
+	 * is coalesced, so this is far fewer than one per page for huge pages.
+	 */
+	__u64 descs;
+};
+
 struct picoevb_rdma_h2c2h_dma {
 	/* In */
-	/* Malloc: Pointer, CUDA: Handle from IOC_PIN_CUDA */
+	/* Malloc: Pointer, CUDA: Handle and offset, CUDA_VA: Pointer */
 	__u64 src;
-	/* Malloc: Pointer, CUDA: Handle from IOC_PIN_CUDA */
+	/* Malloc: Pointer, CUDA: Handle and offset, CUDA_VA: Pointer */
 	__u64 dst;
 	__u64 len;
 	__u64 flags;
@@ -42,6 +130,15 @@ struct picoevb_rdma_h2c2h_dma {
 };
 #define PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA (1 << 0)
 #define PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA (1 << 1)
+/*
+ * CUDA_VA: The buffer is a raw CUDA pointer, which the driver pins on demand
+ * and keeps pinned in a per-file cache. Mutually exclusive with the
+ * corresponding _IS_CUDA flag.
+ */
+#define PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA_VA (1 << 2)
+#define PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA_VA (1 << 3)
+/* Followed by struct picoevb_rdma_dma_timing */
+#define PICOEVB_H2C2H_DMA_FLAG_TIMING (1 << 4)
 
 struct picoevb_rdma_card_info {
 	/* Out */
@@ -50,9 +147,9 @@ struct picoevb_rdma_card_info {
 
 struct picoevb_rdma_h2c_dma {
 	/* In */
-	/* Malloc: Pointer, CUDA: Handle from IOC_PIN_CUDA */
+	/* Malloc: Pointer, CUDA: Handle and offset, CUDA_VA: Pointer */
 	__u64 src;
-	/* RAM buffer offset */
+	/* RAM buffer offset, or RAM: Region handle and offset */
 	__u64 dst;
 	__u64 len;
 	__u64 flags;
@@ -60,12 +157,17 @@ struct picoevb_rdma_h2c_dma {
 	__u64 dma_time_ns;
 };
 #define PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA (1 << 0)
+#define PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA_VA (1 << 1)
+/* Followed by struct picoevb_rdma_dma_timing */
+#define PICOEVB_H2C_DMA_FLAG_TIMING (1 << 2)
+/* dst is a handle from IOC_RAM_ALLOC or IOC_RAM_OPEN */
+#define PICOEVB_H2C_DMA_FLAG_DST_IS_RAM (1 << 3)
 
 struct picoevb_rdma_c2h_dma {
 	/* In */
-	/* Malloc: Pointer, CUDA: Handle from IOC_PIN_CUDA */
+	/* Malloc: Pointer, CUDA: Handle and offset, CUDA_VA: Pointer */
 	__u64 dst;
-	/* RAM buffer offset */
+	/* RAM buffer offset, or RAM: Region handle and offset */
 	__u64 src;
 	__u64 len;
 	__u64 flags;
@@ -73,6 +175,204 @@ struct picoevb_rdma_c2h_dma {
 	__u64 dma_time_ns;
 };
 #define PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA (1 << 0)
+#define PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA_VA (1 << 1)
+/* Followed by struct picoevb_rdma_dma_timing */
+#define PICOEVB_C2H_DMA_FLAG_TIMING (1 << 2)
+/* src is a handle from IOC_RAM_ALLOC or IOC_RAM_OPEN */
+#define PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM (1 << 3)
+
+/*
+ * 2D (pitch-linear) variants of H2C_DMA and C2H_DMA. Transfers height rows,
+ * each of width bytes. Consecutive rows start *_pitch bytes apart in the
+ * source and destination; each pitch must be at least width. Flags are the
+ * same as the corresponding 1D transfer.
+ */
+struct picoevb_rdma_h2c_2d_dma {
+	/* In */
+	/* Malloc: Pointer, CUDA: Handle and offset, CUDA_VA: Pointer */
+	__u64 src;
+	/* RAM buffer offset, or RAM: Region handle and offset */
+	__u64 dst;
+	__u64 width;
+	__u64 height;
+	__u64 src_pitch;
+	__u64 dst_pitch;
+	/* PICOEVB_H2C_DMA_FLAG_* */
+	__u64 flags;
+	/* Out */
+	__u64 dma_time_ns;
+};
+
+struct picoevb_rdma_c2h_2d_dma {
+	/* In */
+	/* Malloc: Pointer, CUDA: Handle and offset, CUDA_VA: Pointer */
+	__u64 dst;
+	/* RAM buffer offset, or RAM: Region handle and offset */
+	__u64 src;
+	__u64 width;
+	__u64 height;
+	__u64 dst_pitch;
+	__u64 src_pitch;
+	/* PICOEVB_C2H_DMA_FLAG_* */
+	__u64 flags;
+	/* Out */
+	__u64 dma_time_ns;
+};
+
+/*
+ * Priority classes for DMA engine access. Pending transfers in a higher class
+ * are always dispatched before those in a lower class. Within a class, the
+ * engine is shared between open files in proportion to their weights.
+ */
+#define PICOEVB_PRIO_BULK	0
+#define PICOEVB_PRIO_NORMAL	1
+/* Requires CAP_SYS_NICE */
+#define PICOEVB_PRIO_REALTIME	2
+#define PICOEVB_PRIO_COUNT	3
+
+#define PICOEVB_SCHED_WEIGHT_DEFAULT	100
+#define PICOEVB_SCHED_WEIGHT_MAX	10000
+
+struct picoevb_rdma_set_sched {
+	/* In */
+	/* PICOEVB_PRIO_* */
+	__u32 prio;
+	/* 1..PICOEVB_SCHED_WEIGHT_MAX, or 0 for PICOEVB_SCHED_WEIGHT_DEFAULT */
+	__u32 weight;
+};
+
+struct picoevb_rdma_sched_class_stats {
+	/* Transfers currently waiting for the DMA engine */
+	__u64 queue_depth;
+	__u64 max_queue_depth;
+	/* Transfers granted the DMA engine */
+	__u64 dispatched;
+	/* Time between requesting and being granted the DMA engine */
+	__u64 total_wait_ns;
+	__u64 max_wait_ns;
+};
+
+struct picoevb_rdma_sched_stats {
+	/* Out */
+	/* Indexed by PICOEVB_PRIO_* */
+	struct picoevb_rdma_sched_class_stats classes[PICOEVB_PRIO_COUNT];
+};
+
+/* Per open file; see the pin_cache_budget module parameter */
+struct picoevb_rdma_pin_cache_stats {
+	/* Out */
+	__u64 hits;
+	__u64 misses;
+	/* Surfaces unpinned to stay within the budget */
+	__u64 evictions;
+	/* Surfaces unpinned because the CUDA allocation was freed */
+	__u64 invalidations;
+	__u64 pinned_bytes;
+	__u64 pinned_surfaces;
+};
+
+/*
+ * Kernel-validated user-mode submission. Host memory is registered up front as
+ * DMA windows, each usable for transfers in one direction. Transfers between
+ * windows and FPGA RAM are then posted to a submission ring shared with the
+ * driver via mmap(), and started by PICOEVB_IOC_DOORBELL. Since user-space
+ * names windows rather than bus addresses, it cannot direct the DMA engine
+ * at memory it doesn't own.
+ */
+struct picoevb_rdma_register_window {
+	/* In */
+	/* Malloc: Pointer */
+	__u64 addr;
+	__u64 len;
+	__u64 flags;
+	/* Out */
+	__u32 window;
+};
+/* The FPGA writes to the window; otherwise it reads from it */
+#define PICOEVB_WINDOW_FLAG_C2H (1 << 0)
+
+struct picoevb_rdma_unregister_window {
+	/* In */
+	__u32 window;
+};
+
+#define PICOEVB_RING_ENTRIES_MAX	4096
+
+struct picoevb_rdma_ring_setup {
+	/* In */
+	/* A power of 2, at most PICOEVB_RING_ENTRIES_MAX */
+	__u32 entries;
+	__u32 reserved;
+	/* Out */
+	/* Size of the mapping at offset 0 of the device file */
+	__u64 mmap_size;
+	/* Offsets within the mapping of the SQE and CQE arrays */
+	__u64 sq_offset;
+	__u64 cq_offset;
+};
+
+/*
+ * At offset 0 of the ring mapping. Indices run freely, and are reduced modulo
+ * the ring size to find entries. Entries [sq_head, sq_tail) are waiting for
+ * the driver, and entries [cq_head, cq_tail) are waiting for user-space.
+ */
+struct picoevb_rdma_ring_header {
+	/* Written by the driver */
+	__u32 sq_head;
+	/* Written by user-space */
+	__u32 sq_tail;
+	/* Written by user-space */
+	__u32 cq_head;
+	/* Written by the driver */
+	__u32 cq_tail;
+};
+
+#define PICOEVB_RING_OP_H2C	0
+#define PICOEVB_RING_OP_C2H	1
+
+struct picoevb_rdma_sqe {
+	/* Copied to the CQE */
+	__u64 user_data;
+	/* PICOEVB_RING_OP_* */
+	__u32 opcode;
+	__u32 window;
+	__u64 window_offset;
+	/* RAM buffer offset, or RAM: Region handle and offset */
+	__u64 ram_offset;
+	__u64 len;
+	/* PICOEVB_RING_FLAG_* */
+	__u64 flags;
+};
+/* ram_offset is a handle from IOC_RAM_ALLOC or IOC_RAM_OPEN */
+#define PICOEVB_RING_FLAG_IS_RAM (1 << 0)
+
+struct picoevb_rdma_cqe {
+	__u64 user_data;
+	/* 0, or a negative errno value */
+	__s32 result;
+	__u32 reserved;
+	__u64 dma_time_ns;
+};
+
+/*
+ * Arm the DMA engine's performance counters for the next transfer on each
+ * channel. Counters are otherwise left stopped, to keep them off the
+ * per-transfer path.
+ */
+#define PICOEVB_PERF_FLAG_ARM	(1 << 0)
+
+struct picoevb_rdma_perf_counters {
+	/* In */
+	/* PICOEVB_PERF_FLAG_* */
+	__u32 flags;
+	__u32 reserved;
+	/* Out; counts from the most recent armed transfer on each channel */
+	__u64 h2c_cycles;
+	/* Data beats transferred */
+	__u64 h2c_beats;
+	__u64 c2h_cycles;
+	__u64 c2h_beats;
+};
 
 #define PICOEVB_IOC_LED		_IOW('P', 0, __u32)
 #define PICOEVB_IOC_PIN_CUDA	_IOWR('P', 1, struct picoevb_rdma_pin_cuda)
@@ -81,5 +381,23 @@ struct picoevb_rdma_c2h_dma {
 #define PICOEVB_IOC_CARD_INFO	_IOR('P', 4, struct picoevb_rdma_card_info)
 #define PICOEVB_IOC_H2C_DMA	_IOWR('P', 5, struct picoevb_rdma_h2c_dma)
 #define PICOEVB_IOC_C2H_DMA	_IOWR('P', 6, struct picoevb_rdma_c2h_dma)
+#define PICOEVB_IOC_SET_SCHED	_IOW('P', 7, struct picoevb_rdma_set_sched)
+#define PICOEVB_IOC_SCHED_STATS	_IOR('P', 8, struct picoevb_rdma_sched_stats)
+#define PICOEVB_IOC_PIN_CACHE_STATS \
+	_IOR('P', 9, struct picoevb_rdma_pin_cache_stats)
+#define PICOEVB_IOC_H2C_2D_DMA	_IOWR('P', 10, struct picoevb_rdma_h2c_2d_dma)
+#define PICOEVB_IOC_C2H_2D_DMA	_IOWR('P', 11, struct picoevb_rdma_c2h_2d_dma)
+#define PICOEVB_IOC_REGISTER_WINDOW \
+	_IOWR('P', 12, struct picoevb_rdma_register_window)
+#define PICOEVB_IOC_UNREGISTER_WINDOW \
+	_IOW('P', 13, struct picoevb_rdma_unregister_window)
+#define PICOEVB_IOC_RING_SETUP	_IOWR('P', 14, struct picoevb_rdma_ring_setup)
+/* Processes submitted SQEs; returns the number processed */
+#define PICOEVB_IOC_DOORBELL	_IO('P', 15)
+#define PICOEVB_IOC_PERF_COUNTERS \
+	_IOWR('P', 16, struct picoevb_rdma_perf_counters)
+#define PICOEVB_IOC_RAM_ALLOC	_IOWR('P', 17, struct picoevb_rdma_ram_alloc)
+#define PICOEVB_IOC_RAM_OPEN	_IOWR('P', 18, struct picoevb_rdma_ram_open)
+#define PICOEVB_IOC_RAM_FREE	_IOW('P', 19, struct picoevb_rdma_ram_free)
 
 #endif
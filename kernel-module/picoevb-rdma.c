@@ -11,26 +11,44 @@
  * more details.
  */
 
+#include <linux/capability.h>
 #include <linux/cdev.h>
 #include <linux/idr.h>
 #include <linux/interrupt.h>
+#include <linux/interval_tree_generic.h>
 #include <linux/module.h>
 #include <linux/mm.h>
 #include <linux/pagemap.h>
 #include <linux/pci.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/sizes.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 #include <linux/version.h>
 
 #ifndef NV_BUILD_NO_CUDA
+#if defined(NV_BUILD_P2P_STUB)
 #ifdef NV_BUILD_DGPU
+#error NV_BUILD_P2P_STUB only emulates the iGPU nv-p2p API
+#endif
+#include "nv-p2p-stub.h"
+#elif defined(NV_BUILD_DGPU)
 #include <nv-p2p.h>
 #else
 #include <linux/nv-p2p.h>
 #endif
 #endif
 
+#ifdef NV_BUILD_XDMA_SIM
+#ifdef NV_BUILD_DGPU
+#error NV_BUILD_XDMA_SIM is not supported with NV_BUILD_DGPU
+#endif
+#include <linux/platform_device.h>
+#include "xdma-sim.h"
+#endif
+
 #include "picoevb-rdma-ioctl.h"
 #include "picoevb-rdma.h"
 
@@ -48,11 +66,179 @@
 #define GPU_PAGE_OFFSET	(GPU_PAGE_SIZE - 1)
 #define GPU_PAGE_MASK	(~GPU_PAGE_OFFSET)
 
+/*
+ * Maximum length of a descriptor chain. Longer transfers are submitted as
+ * multiple chains.
+ */
+#define PEVB_DESCS_MAX	4096
+
+/* Bounce buffers per channel, and the size of each */
+#define PEVB_BOUNCE_BUFS	4
+#define PEVB_BOUNCE_SIZE	SZ_64K
+/*
+ * When the bounce threshold is automatic, every this many small transfers
+ * take the path the cost model didn't choose, to keep measuring its cost.
+ */
+#define PEVB_BOUNCE_EXPLORE	16
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 14, 0)
+/* Interval trees are rooted in a plain rb_root before 4.14 */
+#define rb_root_cached	rb_root
+#define RB_ROOT_CACHED	RB_ROOT
+#endif
+
+/*
+ * Large transfers are split into slices, between which higher priority
+ * transfers may take over the DMA engine. A slice is bounded both in bytes
+ * and, using the measured DMA bandwidth, in time. 0 disables either limit.
+ */
+static unsigned long max_slice_bytes = SZ_4M;
+module_param(max_slice_bytes, ulong, 0644);
+MODULE_PARM_DESC(max_slice_bytes, "Maximum bytes per DMA slice (0: unlimited)");
+
+static unsigned int max_slice_us = 1000;
+module_param(max_slice_us, uint, 0644);
+MODULE_PARM_DESC(max_slice_us, "Maximum duration of a DMA slice (0: unlimited)");
+
+/*
+ * Host memory transfers longer than this are pinned and mapped in windows of
+ * this size, overlapped with DMA, rather than all before DMA starts. 0
+ * disables streaming.
+ */
+static unsigned long stream_window_bytes = SZ_8M;
+module_param(stream_window_bytes, ulong, 0644);
+MODULE_PARM_DESC(stream_window_bytes,
+	"Pinning window for large host memory transfers (0: disabled)");
+
+/*
+ * Whether the DMA ioctls accept raw FPGA RAM offsets, rather than only regions
+ * from PICOEVB_IOC_RAM_ALLOC. Raw offsets may overwrite other clients' data.
+ */
+static bool allow_raw_ram_offsets = true;
+module_param(allow_raw_ram_offsets, bool, 0644);
+MODULE_PARM_DESC(allow_raw_ram_offsets,
+	"Allow DMA to FPGA RAM not allocated via PICOEVB_IOC_RAM_ALLOC");
+
+/*
+ * Host memory transfers of at most this many bytes are copied through a
+ * pre-mapped bounce buffer, rather than pinned and mapped. -1 picks the
+ * threshold automatically, from the measured costs of copying and of pinning;
+ * 0 disables bounce buffers. Capped at PEVB_BOUNCE_SIZE.
+ */
+static long bounce_threshold = -1;
+module_param(bounce_threshold, long, 0644);
+MODULE_PARM_DESC(bounce_threshold,
+	"Largest transfer copied via a bounce buffer (-1: automatic, 0: off)");
+
+#ifdef NV_BUILD_XDMA_SIM
+static unsigned long sim_ram_size = SZ_64K;
+module_param(sim_ram_size, ulong, 0444);
+MODULE_PARM_DESC(sim_ram_size, "Simulated FPGA RAM size");
+
+static struct xdma_sim_model sim_model = {
+	.bw_mbps = 400,
+	.latency_ns = 2000,
+	.desc_ns = 100,
+};
+module_param_named(sim_bw_mbps, sim_model.bw_mbps, uint, 0644);
+MODULE_PARM_DESC(sim_bw_mbps, "Simulated DMA bandwidth, MB/s (0: unlimited)");
+module_param_named(sim_latency_ns, sim_model.latency_ns, uint, 0644);
+MODULE_PARM_DESC(sim_latency_ns, "Simulated DMA start latency");
+module_param_named(sim_desc_ns, sim_model.desc_ns, uint, 0644);
+MODULE_PARM_DESC(sim_desc_ns, "Simulated DMA descriptor fetch time");
+#endif
+
+#ifndef NV_BUILD_NO_CUDA
+static unsigned long pin_cache_budget = SZ_1G;
+module_param(pin_cache_budget, ulong, 0644);
+MODULE_PARM_DESC(pin_cache_budget,
+	"Maximum bytes of CUDA memory kept pinned by each file's pin cache");
+#endif
+
+#ifdef NV_BUILD_P2P_STUB
+static int pevb_set_p2p_stub_free_va(const char *val,
+	const struct kernel_param *kp)
+{
+	unsigned long long va;
+	int ret;
+
+	ret = kstrtoull(val, 0, &va);
+	if (ret)
+		return ret;
+
+	return nvidia_p2p_stub_free(va) ? 0 : -ENOENT;
+}
+
+static const struct kernel_param_ops p2p_stub_free_va_ops = {
+	.set = pevb_set_p2p_stub_free_va,
+};
+module_param_cb(p2p_stub_free_va, &p2p_stub_free_va_ops, NULL, 0200);
+MODULE_PARM_DESC(p2p_stub_free_va,
+	"Write a pinned address to simulate CUDA freeing its allocation");
+#endif
+
 struct pevb_drvdata {
 	u32 num_h2c_chans;
 	u64 fpga_ram_size;
 };
 
+/*
+ * A transfer waiting for the DMA engine. Lives on the waiting task's stack.
+ */
+struct pevb_sched_waiter {
+	struct list_head	node;
+	u64			vstart;
+	u64			vfinish;
+	u64			queued_ns;
+	bool			granted;
+};
+
+struct pevb_sched_class {
+	/* Sorted by vfinish */
+	struct list_head	waiters;
+	/* Virtual time; vstart of the most recently dispatched transfer */
+	u64			vtime;
+	u64			depth;
+	u64			max_depth;
+	u64			dispatched;
+	u64			total_wait_ns;
+	u64			max_wait_ns;
+};
+
+/*
+ * A DMA channel's bounce buffers, and the measurements that decide when to use
+ * them. The measurements are updated without locking, since they are only
+ * estimates.
+ */
+struct pevb_bounce_chan {
+	void			*cpu_addr[PEVB_BOUNCE_BUFS];
+	dma_addr_t		dma_addr[PEVB_BOUNCE_BUFS];
+	/* A bit set for each free buffer */
+	unsigned long		free;
+	/* Moving average of pinning, mapping and unpinning a small transfer */
+	u64			pin_ns;
+	/* Moving average of copy bandwidth, in bytes per microsecond */
+	u64			copy_bw;
+	unsigned long		decisions;
+};
+
+/*
+ * Counters for one DMA channel, of a card or of a file. Updated without
+ * locking by concurrent transfers.
+ */
+struct pevb_chan_stats {
+	atomic64_t		transfers;
+	atomic64_t		bytes;
+	/* Transfers that failed, other than by being interrupted */
+	atomic64_t		errors;
+	/* Pinning host memory, or copying it through a bounce buffer */
+	atomic64_t		pin_ns;
+	/* Mapping and unmapping memory for DMA */
+	atomic64_t		map_ns;
+	/* The DMA engine executing the channel's descriptor chains */
+	atomic64_t		busy_ns;
+};
+
 struct pevb {
 	struct pci_dev			*pdev;
 	struct device			*dev;
@@ -62,18 +248,145 @@ struct pevb {
 	dev_t				devt;
 	struct cdev			cdev;
 	void __iomem * const		*iomap;
-	struct semaphore		sem;
-	void				*descs_ptr;
+#ifdef NV_BUILD_XDMA_SIM
+	struct xdma_sim			*sim;
+#endif
+	/* Protects all sched_* fields, and pevb_file sched fields */
+	spinlock_t			sched_lock;
+	wait_queue_head_t		sched_wq;
+	bool				sched_busy;
+	struct pevb_sched_class		sched_classes[PICOEVB_PRIO_COUNT];
+	struct xlnx_dma_desc		*descs_ptr;
 	dma_addr_t			descs_dma_addr;
+	/* The descriptor chain being built; owned by the DMA engine owner */
+	int				n_descs;
+	u64				descs_len;
 	struct completion		dma_xfer_cmpl;
+	/* When the engine owner last started the DMA engine */
+	u64				dma_start_ns;
+	/* When the IRQ handler last signalled dma_xfer_cmpl */
+	u64				dma_irq_ns;
+	/* The engine owner's transfer */
+	struct pevb_xfer		*xfer;
+	/* Moving average of DMA bandwidth, in bytes per microsecond */
+	u64				dma_bw;
 	bool				h2c_error;
 	bool				c2h_error;
+	/*
+	 * Indexed by c2h. Whether the channel's descriptor address and IRQs
+	 * are programmed; owned by the DMA engine owner.
+	 */
+	bool				chan_ready[2];
+	/* Arm the channel's perf counters for its next transfer */
+	bool				perf_arm[2];
+	/* Allocated FPGA RAM regions, by offset; protected by ram_lock */
+	struct mutex			ram_lock;
+	struct list_head		ram_regions;
+	/* Indexed by c2h */
+	struct pevb_bounce_chan		bounce[2];
+	/* Indexed by c2h; counted since stats_start_ns */
+	struct pevb_chan_stats		stats[2];
+	u64				stats_start_ns;
+};
+
+struct pevb_userbuf_dma {
+	dma_addr_t	addr;
+	u64		len;
+};
+
+/* Each DMA ioctl pins at most this many userbufs at once */
+#define PEVB_SCRATCH_SLOTS	2
+
+/*
+ * Arrays used to pin and map a userbuf, kept by a file between ioctls so that
+ * a steady-state transfer does no heap allocation. They grow to the largest
+ * transfer seen, and are freed with the file.
+ */
+struct pevb_scratch {
+	unsigned int		max_pages;
+	struct page		**pages;
+	/* Has max_pages entries, of which the last user used nents */
+	struct sg_table		sgt;
+	/* The entry the last user marked as the end of sgt */
+	struct scatterlist	*sg_end;
+	unsigned int		max_dmas;
+	struct pevb_userbuf_dma	*dmas;
+};
+
+/* Regions are aligned to, and sized in multiples of, this */
+#define PEVB_RAM_ALIGN	64
+
+struct pevb_ram_region {
+	/* All fields are protected by pevb->ram_lock */
+	struct list_head	node;
+	u64			offset;
+	u64			len;
+	/* Handles to the region, across all files */
+	int			refs;
+	char			name[PICOEVB_RAM_NAME_MAX];
 };
 
 struct pevb_file {
 	struct pevb	*pevb;
 	struct mutex	lock;
+	/*
+	 * Pinned CUDA surfaces, by handle. Modified with lock held; looked up
+	 * under RCU.
+	 */
 	struct idr	cuda_surfaces;
+	u32		sched_prio;
+	u32		sched_weight;
+	/* Virtual finish time of this file's most recently queued transfer */
+	u64		sched_vfinish;
+	/* Registered DMA windows; protected by lock */
+	struct idr	windows;
+	/* Handles to FPGA RAM regions; protected by lock */
+	struct idr	ram_handles;
+	/* Bit i is set while scratch[i] is in use */
+	unsigned long		scratch_busy;
+	struct pevb_scratch	scratch[PEVB_SCRATCH_SLOTS];
+	/*
+	 * The user-mapped rings, and the driver's own copies of the indices it
+	 * owns; protected by ring_lock, which doorbells hold while they run.
+	 * The ring lives until the file is released.
+	 */
+	struct mutex	ring_lock;
+	struct picoevb_rdma_ring_header	*ring;
+	u64		ring_size;
+	u32		ring_entries;
+	u32		ring_sq_head;
+	u32		ring_cq_tail;
+	/* Indexed by c2h; counted since open_ns */
+	struct pevb_chan_stats	stats[2];
+	u64		open_ns;
+#ifndef NV_BUILD_NO_CUDA
+	/*
+	 * Surfaces pinned implicitly by transfers using raw CUDA VAs. All
+	 * pin_cache* fields are protected by lock.
+	 */
+	struct rb_root_cached	pin_cache;
+	/* Least recently used first */
+	struct list_head	pin_cache_lru;
+	/* Removed from the cache, but not yet unpinned */
+	struct list_head	pin_cache_evicted;
+	u64			pin_cache_bytes;
+	u64			pin_cache_surfaces;
+	u64			pin_cache_hits;
+	u64			pin_cache_misses;
+	u64			pin_cache_evictions;
+	u64			pin_cache_invalidations;
+	/* Woken when a surface's users count drops to 0 */
+	wait_queue_head_t	cusurf_users_wq;
+#endif
+};
+
+/*
+ * A DMA ioctl in progress. Threads sharing a file may each have one, so state
+ * that belongs to a single transfer lives here rather than in the file.
+ */
+struct pevb_xfer {
+	struct pevb_file		*pevb_file;
+	struct picoevb_rdma_dma_timing	timing;
 };
 
 #ifndef NV_BUILD_NO_CUDA
@@ -84,20 +397,52 @@ struct pevb_cuda_surface {
 	u64				len;
 	int				handle;
 	struct nvidia_p2p_page_table	*page_table;
+	/*
+	 * Transfers currently using the surface, or -1 once the free callback
+	 * has claimed it. The page table is valid while a transfer holds a
+	 * use; see pevb_cuda_surface_use().
+	 */
+	atomic_t			users;
+	/* Freed after an RCU grace period, for lockless handle lookups */
+	struct rcu_head			rcu;
+	/*
+	 * Set by the free callback, with pevb_file->lock held. A surface pinned
+	 * without the lock mustn't be made reachable once it's set.
+	 */
+	bool				freed;
+	/* Pin cache state; protected by pevb_file->lock */
+	bool				cached;
+	struct rb_node			cache_rb;
+	u64				cache_subtree_last;
+	/* Entry in pin_cache_lru or pin_cache_evicted */
+	struct list_head		cache_lru;
 };
-#endif
 
-struct pevb_userbuf_dma {
-	dma_addr_t	addr;
-	u64		len;
-};
+#define PEVB_CUSURF_START(cusurf) ((cusurf)->va + (cusurf)->offset)
+#define PEVB_CUSURF_LAST(cusurf) \
+	((cusurf)->va + (cusurf)->offset + (cusurf)->len - 1)
+
+INTERVAL_TREE_DEFINE(struct pevb_cuda_surface, cache_rb, u64,
+	cache_subtree_last, PEVB_CUSURF_START, PEVB_CUSURF_LAST, static,
+	pevb_pin_cache_it)
+#endif
 
 struct pevb_userbuf {
 #ifndef NV_BUILD_NO_CUDA
 	bool cuda;
 #endif
+	/*
+	 * Set by the caller if the userbuf outlives the ioctl, so may not use
+	 * the file's scratch arrays
+	 */
+	bool persistent;
+	/* The scratch arrays in use, or NULL if the arrays were allocated */
+	struct pevb_scratch *scratch;
 	int n_dmas;
 	struct pevb_userbuf_dma *dmas;
+	/* Time spent by pevb_get_userbuf() pinning, then mapping, the buffer */
+	u64 pin_ns;
+	u64 map_ns;
 
 	union {
 		struct {
@@ -116,989 +461,3310 @@ struct pevb_userbuf {
 	} priv;
 };
 
+struct pevb_window {
+	struct pevb_userbuf	ubuf;
+	u64			len;
+	bool			c2h;
+	/*
+	 * One for the windows table, and one per ring transfer using the
+	 * window; protected by pevb_file->lock
+	 */
+	int			refs;
+};
+
 static struct class *pevb_class;
 
 static u32 pevb_readl(struct pevb *pevb, int bar, u32 reg)
 {
 	u32 val;
 
-	dev_dbg(&pevb->pdev->dev, "readl(0x%08x)\n", reg);
+	dev_dbg(pevb->dev, "readl(0x%08x)\n", reg);
+#ifdef NV_BUILD_XDMA_SIM
+	val = xdma_sim_readl(pevb->sim, bar, reg);
+#else
 	val = readl(pevb->iomap[bar] + reg);
-	dev_dbg(&pevb->pdev->dev, "readl(0x%08x) -> 0x%08x\n", reg, val);
+#endif
+	dev_dbg(pevb->dev, "readl(0x%08x) -> 0x%08x\n", reg, val);
 	return val;
 }
 
 static void pevb_writel(struct pevb *pevb, int bar, u32 val, u32 reg)
 {
-	dev_dbg(&pevb->pdev->dev, "write(0x%08x, 0x%08x)\n", val, reg);
+	dev_dbg(pevb->dev, "write(0x%08x, 0x%08x)\n", val, reg);
+#ifdef NV_BUILD_XDMA_SIM
+	xdma_sim_writel(pevb->sim, bar, val, reg);
+#else
 	writel(val, pevb->iomap[bar] + reg);
+#endif
 }
 
-static int pevb_fops_open(struct inode *inode, struct file *filep)
+/*
+ * FPGA RAM allocator. Regions are allocated first-fit from a list sorted by
+ * offset; clients allocate few, long-lived regions, so a list suffices.
+ */
+
+/* Place region in a free range of len bytes; called with ram_lock held */
+static int pevb_ram_insert(struct pevb *pevb, struct pevb_ram_region *region,
+	u64 len)
 {
-	struct pevb *pevb = container_of(inode->i_cdev, struct pevb, cdev);
-	struct pevb_file *pevb_file;
+	struct pevb_ram_region *pos;
+	u64 start = 0, ram_size = pevb->drvdata->fpga_ram_size;
 
-	pevb_file = kzalloc(sizeof(*pevb_file), GFP_KERNEL);
-	if (!pevb_file)
-		return -ENOMEM;
+	len = ALIGN(len, PEVB_RAM_ALIGN);
 
-	pevb_file->pevb = pevb;
-	mutex_init(&pevb_file->lock);
-	idr_init(&pevb_file->cuda_surfaces);
+	list_for_each_entry(pos, &pevb->ram_regions, node) {
+		if (pos->offset - start >= len)
+			goto found;
+		start = pos->offset + pos->len;
+	}
+	if (start > ram_size || ram_size - start < len)
+		return -ENOSPC;
 
-	filep->private_data = pevb_file;
+found:
+	region->offset = start;
+	region->len = len;
+	region->refs = 1;
+	/* Before pos, or at the end if no gap was found */
+	list_add_tail(&region->node, &pos->node);
 
 	return 0;
 }
 
-#ifndef NV_BUILD_NO_CUDA
-static void pevb_p2p_free_callback(void *data)
+static struct pevb_ram_region *pevb_ram_alloc(struct pevb *pevb, u64 len,
+	const char *name)
 {
-	struct pevb_cuda_surface *cusurf = data;
-	struct pevb_file *pevb_file = cusurf->pevb_file;
+	struct pevb_ram_region *region, *pos;
+	int ret;
 
-	mutex_lock(&pevb_file->lock);
-	if (cusurf->handle >= 0) {
-		idr_remove(&pevb_file->cuda_surfaces, cusurf->handle);
-		cusurf->handle = -1;
+	if (!len || len > pevb->drvdata->fpga_ram_size)
+		return ERR_PTR(-EINVAL);
+
+	region = kzalloc(sizeof(*region), GFP_KERNEL);
+	if (!region)
+		return ERR_PTR(-ENOMEM);
+	strscpy(region->name, name, sizeof(region->name));
+
+	mutex_lock(&pevb->ram_lock);
+
+	if (name[0]) {
+		list_for_each_entry(pos, &pevb->ram_regions, node) {
+			if (!strcmp(pos->name, name)) {
+				mutex_unlock(&pevb->ram_lock);
+				kfree(region);
+				return ERR_PTR(-EEXIST);
+			}
+		}
 	}
-	mutex_unlock(&pevb_file->lock);
 
-	nvidia_p2p_free_page_table(cusurf->page_table);
-#ifndef NV_BUILD_DGPU
-	kfree(cusurf->page_table);
-#endif
-	kfree(cusurf);
+	ret = pevb_ram_insert(pevb, region, len);
+
+	mutex_unlock(&pevb->ram_lock);
+
+	if (ret) {
+		kfree(region);
+		return ERR_PTR(ret);
+	}
+
+	return region;
 }
-#endif
 
-static int pevb_fops_release(struct inode *inode, struct file *filep)
+static struct pevb_ram_region *pevb_ram_open(struct pevb *pevb,
+	const char *name)
 {
-	struct pevb_file *pevb_file = filep->private_data;
+	struct pevb_ram_region *pos;
+
+	mutex_lock(&pevb->ram_lock);
+	list_for_each_entry(pos, &pevb->ram_regions, node) {
+		if (pos->name[0] && !strcmp(pos->name, name)) {
+			pos->refs++;
+			mutex_unlock(&pevb->ram_lock);
+			return pos;
+		}
+	}
+	mutex_unlock(&pevb->ram_lock);
 
-#ifndef NV_BUILD_NO_CUDA
-	for (;;) {
-		int id = 0;
-		struct pevb_cuda_surface *cusurf;
+	return ERR_PTR(-ENOENT);
+}
 
-		mutex_lock(&pevb_file->lock);
+static void pevb_ram_put(struct pevb *pevb, struct pevb_ram_region *region)
+{
+	mutex_lock(&pevb->ram_lock);
+	if (!--region->refs)
+		list_del(&region->node);
+	else
+		region = NULL;
+	mutex_unlock(&pevb->ram_lock);
 
-		cusurf = idr_get_next(&pevb_file->cuda_surfaces, &id);
-		if (!cusurf) {
-			mutex_unlock(&pevb_file->lock);
-			break;
-		}
+	kfree(region);
+}
 
-		idr_remove(&pevb_file->cuda_surfaces, id);
-		cusurf->handle = -1;
+/* The smallest region pevb_ram_alloc_staging() falls back to */
+#define PEVB_RAM_STAGING_MIN	SZ_4K
 
-		mutex_unlock(&pevb_file->lock);
+/*
+ * Place an anonymous staging region, through which to stage an h2c2h transfer
+ * of len bytes. If FPGA RAM is too full or fragmented, a smaller region is
+ * used, and the transfer takes more chunks. The caller provides the region,
+ * e.g. on its stack, so this doesn't allocate memory.
+ */
+static int pevb_ram_alloc_staging(struct pevb *pevb,
+	struct pevb_ram_region *region, u64 len)
+{
+	u64 want;
+	int ret;
 
-		nvidia_p2p_put_pages(
-#ifdef NV_BUILD_DGPU
-			0, 0, cusurf->va,
-#endif
-			cusurf->page_table);
-#ifdef NV_BUILD_DGPU
-		pevb_p2p_free_callback(cusurf);
-#else
-		/*
-		 * nvidia_p2p_put_pages() calls pevb_p2p_free_callback() which
-		 * frees cusurf.
-		 */
-#endif
+	/* region may be uninitialised; no name, so RAM_OPEN can't find it */
+	region->name[0] = '\0';
+	want = clamp_t(u64, len, PEVB_RAM_ALIGN, pevb->drvdata->fpga_ram_size);
+	for (;;) {
+		mutex_lock(&pevb->ram_lock);
+		ret = pevb_ram_insert(pevb, region, want);
+		mutex_unlock(&pevb->ram_lock);
+		if (ret != -ENOSPC || want <= PEVB_RAM_STAGING_MIN)
+			return ret;
+		want = max_t(u64, want / 2, PEVB_RAM_STAGING_MIN);
 	}
-#endif
-
-	kfree(pevb_file);
+}
 
-	return 0;
+static void pevb_ram_free_staging(struct pevb *pevb,
+	struct pevb_ram_region *region)
+{
+	mutex_lock(&pevb->ram_lock);
+	list_del(&region->node);
+	mutex_unlock(&pevb->ram_lock);
 }
 
-static int pevb_ioctl_led(struct pevb_file *pevb_file, unsigned long arg)
+/*
+ * Resolve the FPGA RAM side of a transfer, which covers extent bytes, to an
+ * offset in FPGA RAM. addr is a region handle and offset if is_region is set,
+ * or a raw offset otherwise. Called with pevb_file->lock held.
+ */
+static int pevb_ram_resolve(struct pevb_file *pevb_file, bool is_region,
+	u64 addr, u64 extent, u64 *ram_offset)
 {
-	struct pevb *pevb = pevb_file->pevb;
+	struct pevb_ram_region *region;
+	u64 base, size, offset;
+
+	if (is_region) {
+		region = idr_find(&pevb_file->ram_handles,
+			addr & PICOEVB_RAM_HANDLE_MASK);
+		if (!region)
+			return -EINVAL;
+		/* Stable while this file holds its handle */
+		base = region->offset;
+		size = region->len;
+		offset = addr >> PICOEVB_RAM_HANDLE_BITS;
+	} else {
+		if (!READ_ONCE(allow_raw_ram_offsets))
+			return -EPERM;
+		base = 0;
+		size = pevb_file->pevb->drvdata->fpga_ram_size;
+		offset = addr;
+	}
+
+	if (extent > size || offset > size - extent)
+		return -EINVAL;
+	*ram_offset = base + offset;
 
-	pevb_writel(pevb, BAR_GPIO, arg, 0);
 	return 0;
 }
 
-#ifndef NV_BUILD_NO_CUDA
-static int pevb_ioctl_pin_cuda(struct pevb_file *pevb_file, unsigned long arg)
+/*
+ * As pevb_ram_resolve(), but called without pevb_file->lock held. A region
+ * stays allocated until the caller drops *regionp with pevb_ram_put(), even if
+ * another thread frees its handle meanwhile. *regionp is NULL for a raw offset
+ * or on error.
+ */
+static int pevb_ram_resolve_get(struct pevb_file *pevb_file, bool is_region,
+	u64 addr, u64 extent, u64 *ram_offset,
+	struct pevb_ram_region **regionp)
 {
-	void __user *argp = (void __user *)arg;
-	struct picoevb_rdma_pin_cuda pin_params;
-	struct pevb_cuda_surface *cusurf;
-	u64 aligned_len;
+	struct pevb *pevb = pevb_file->pevb;
+	struct pevb_ram_region *region = NULL;
 	int ret;
 
-	if (copy_from_user(&pin_params, argp, sizeof(pin_params)))
-		return -EFAULT;
+	mutex_lock(&pevb_file->lock);
+	ret = pevb_ram_resolve(pevb_file, is_region, addr, extent,
+		ram_offset);
+	if (!ret && is_region) {
+		region = idr_find(&pevb_file->ram_handles,
+			addr & PICOEVB_RAM_HANDLE_MASK);
+		mutex_lock(&pevb->ram_lock);
+		region->refs++;
+		mutex_unlock(&pevb->ram_lock);
+	}
+	mutex_unlock(&pevb_file->lock);
 
-	cusurf = kzalloc(sizeof(*cusurf), GFP_KERNEL);
-	if (!cusurf)
-		return -ENOMEM;
+	*regionp = region;
 
-	cusurf->pevb_file = pevb_file;
-	cusurf->va = pin_params.va & GPU_PAGE_MASK;
-	cusurf->offset = pin_params.va & GPU_PAGE_OFFSET;
-	cusurf->len = pin_params.size;
-	aligned_len = (cusurf->offset + cusurf->len + GPU_PAGE_SIZE - 1) &
-		GPU_PAGE_MASK;
+	return ret;
+}
 
-	ret = nvidia_p2p_get_pages(
-#ifdef NV_BUILD_DGPU
-		0, 0,
-#endif
-		cusurf->va, aligned_len, &cusurf->page_table,
-		pevb_p2p_free_callback, cusurf);
-	if (ret < 0) {
-		kfree(cusurf);
-		return ret;
-	}
+/* Scratch arrays grow in steps of this many entries */
+#define PEVB_SCRATCH_GROW	64
+/* Pages per scatterlist entry, so that its length fits in 32 bits */
+#define PEVB_SG_MAX_PAGES	(UINT_MAX >> PAGE_SHIFT)
 
-	mutex_lock(&pevb_file->lock);
-	cusurf->handle = idr_alloc(&pevb_file->cuda_surfaces, cusurf, 0, 0,
-		GFP_KERNEL);
-	mutex_unlock(&pevb_file->lock);
+/* Claim a free scratch slot, or return NULL if all are in use */
+static struct pevb_scratch *pevb_scratch_get(struct pevb_file *pevb_file)
+{
+	int i;
 
-	if (cusurf->handle < 0) {
-		ret = cusurf->handle;
-		goto put_pages;
+	for (i = 0; i < PEVB_SCRATCH_SLOTS; i++) {
+		if (!test_and_set_bit_lock(i, &pevb_file->scratch_busy))
+			return &pevb_file->scratch[i];
 	}
 
-	pin_params.handle = cusurf->handle;
-
-	ret = copy_to_user(argp, &pin_params, sizeof(pin_params));
-	if (ret)
-		goto put_pages;
-
-	return 0;
+	return NULL;
+}
 
-put_pages:
-	nvidia_p2p_put_pages(
-#ifdef NV_BUILD_DGPU
-		0, 0, cusurf->va,
-#endif
-		cusurf->page_table);
-#ifdef NV_BUILD_DGPU
-	pevb_p2p_free_callback(cusurf);
-#else
-	/*
-	 * nvidia_p2p_put_pages() calls pevb_p2p_free_callback() which
-	 * frees cusurf.
-	 */
-#endif
+static void pevb_scratch_put(struct pevb_file *pevb_file,
+	struct pevb_scratch *scratch)
+{
+	clear_bit_unlock(scratch - pevb_file->scratch,
+		&pevb_file->scratch_busy);
+}
 
-	return ret;
+static void pevb_scratch_free_pages(struct pevb_scratch *scratch)
+{
+	if (!scratch->max_pages)
+		return;
+	sg_free_table(&scratch->sgt);
+	kfree(scratch->pages);
+	scratch->pages = NULL;
+	scratch->sg_end = NULL;
+	scratch->max_pages = 0;
 }
 
-static int pevb_ioctl_unpin_cuda(struct pevb_file *pevb_file, unsigned long arg)
+/* Grow scratch to hold at least nr_pages pages and scatterlist entries */
+static int pevb_scratch_reserve_pages(struct pevb_scratch *scratch,
+	unsigned int nr_pages)
 {
-	void __user *argp = (void __user *)arg;
-	struct picoevb_rdma_unpin_cuda unpin_params;
-	struct pevb_cuda_surface *cusurf;
+	struct page **pages;
+	struct sg_table sgt;
+	unsigned int max_pages;
+	int ret;
 
-	if (copy_from_user(&unpin_params, argp, sizeof(unpin_params)))
-		return -EFAULT;
+	if (nr_pages <= scratch->max_pages)
+		return 0;
+	max_pages = ALIGN(nr_pages, PEVB_SCRATCH_GROW);
 
-	mutex_lock(&pevb_file->lock);
-	cusurf = idr_find(&pevb_file->cuda_surfaces, unpin_params.handle);
-	if (!cusurf) {
-		mutex_unlock(&pevb_file->lock);
-		return -EINVAL;
+	pages = kmalloc_array(max_pages, sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+	ret = sg_alloc_table(&sgt, max_pages, GFP_KERNEL);
+	if (ret) {
+		kfree(pages);
+		return ret;
 	}
-	idr_remove(&pevb_file->cuda_surfaces, unpin_params.handle);
-	cusurf->handle = -1;
-	mutex_unlock(&pevb_file->lock);
 
-	nvidia_p2p_put_pages(
-#ifdef NV_BUILD_DGPU
-		0, 0, cusurf->va,
-#endif
-		cusurf->page_table);
-#ifdef NV_BUILD_DGPU
-	pevb_p2p_free_callback(cusurf);
-#else
-	/*
-	 * nvidia_p2p_put_pages() calls pevb_p2p_free_callback() which
-	 * frees cusurf.
-	 */
-#endif
+	pevb_scratch_free_pages(scratch);
+	scratch->pages = pages;
+	scratch->sgt = sgt;
+	scratch->max_pages = max_pages;
 
 	return 0;
 }
-#endif
 
-static void pevb_userbuf_add_dma_chunk(struct pevb_userbuf *ubuf,
-	dma_addr_t addr, u64 len)
+/*
+ * Describe len bytes of pages, starting offset bytes into the first, in
+ * scratch's scatterlist. Like sg_alloc_table_from_pages(), physically
+ * contiguous pages share an entry, but the table is reused rather than
+ * allocated. Returns the number of entries used.
+ */
+static int pevb_scratch_fill_sgt(struct pevb_scratch *scratch,
+	struct page **pages, unsigned int nr_pages, unsigned long offset,
+	u64 len)
 {
-	struct pevb_userbuf_dma *dma;
-	dma_addr_t end;
+	struct scatterlist *sg = NULL;
+	unsigned int i, j, nents = 0;
+	u64 seg_len;
 
-	if (ubuf->n_dmas) {
-		dma = &ubuf->dmas[ubuf->n_dmas - 1];
-		end = dma->addr + dma->len;
-		if (addr == end) {
-			dma->len += len;
-			return;
-		}
+	if (!nr_pages || nr_pages > scratch->max_pages)
+		return -EINVAL;
+
+	/* sg_set_page() keeps the end marker, so clear the last user's */
+	if (scratch->sg_end)
+		sg_unmark_end(scratch->sg_end);
+
+	for (i = 0; i < nr_pages; i = j) {
+		for (j = i + 1; j < nr_pages && j - i < PEVB_SG_MAX_PAGES; j++)
+			if (page_to_pfn(pages[j]) !=
+					page_to_pfn(pages[j - 1]) + 1)
+				break;
+		seg_len = min_t(u64, ((u64)(j - i) << PAGE_SHIFT) - offset,
+			len);
+		sg = sg ? sg_next(sg) : scratch->sgt.sgl;
+		sg_set_page(sg, pages[i], seg_len, offset);
+		len -= seg_len;
+		offset = 0;
+		nents++;
 	}
 
-	dma = &ubuf->dmas[ubuf->n_dmas];
-	dma->addr = addr;
-	dma->len = len;
-	ubuf->n_dmas++;
+	sg_mark_end(sg);
+	scratch->sg_end = sg;
+	/* orig_nents stays max_pages, for sg_free_table() */
+	scratch->sgt.nents = nents;
+
+	return nents;
 }
 
-#ifndef NV_BUILD_NO_CUDA
-static int pevb_get_userbuf_cuda(struct pevb_file *pevb_file,
-	struct pevb_userbuf *ubuf, __u64 handle64, __u64 len, int to_dev)
+static void pevb_scratch_free(struct pevb_scratch *scratch)
 {
-	struct pevb *pevb = pevb_file->pevb;
-	int id, ret, i;
-	struct pevb_cuda_surface *cusurf;
-	u64 offset, len_left;
+	pevb_scratch_free_pages(scratch);
+	kfree(scratch->dmas);
+}
 
-	ubuf->cuda = true;
+/* Point ubuf->dmas at room for n chunks, from scratch if ubuf has it */
+static int pevb_userbuf_alloc_dmas(struct pevb_userbuf *ubuf, unsigned int n)
+{
+	struct pevb_scratch *scratch = ubuf->scratch;
+	struct pevb_userbuf_dma *dmas;
+	unsigned int max_dmas;
 
-	if (handle64 & ~0xefffffffU)
-		return -EINVAL;
-	id = handle64 & 0xefffffffU;
+	if (!scratch) {
+		ubuf->dmas = kmalloc_array(n, sizeof(*ubuf->dmas),
+			GFP_KERNEL);
+		return ubuf->dmas ? 0 : -ENOMEM;
+	}
 
-	cusurf = idr_find(&pevb_file->cuda_surfaces, id);
-	if (!cusurf)
-		return -EINVAL;
-	ubuf->priv.cuda.cusurf = cusurf;
+	if (n > scratch->max_dmas) {
+		max_dmas = ALIGN(n, PEVB_SCRATCH_GROW);
+		dmas = kmalloc_array(max_dmas, sizeof(*dmas), GFP_KERNEL);
+		if (!dmas)
+			return -ENOMEM;
+		kfree(scratch->dmas);
+		scratch->dmas = dmas;
+		scratch->max_dmas = max_dmas;
+	}
+	ubuf->dmas = scratch->dmas;
 
-	if (len > cusurf->len)
-		return -EINVAL;
+	return 0;
+}
 
-#ifdef NV_BUILD_DGPU
-	ret = nvidia_p2p_dma_map_pages(pevb->pdev, cusurf->page_table,
-		&ubuf->priv.cuda.map);
-#else
-	ret = nvidia_p2p_dma_map_pages(&pevb->pdev->dev, cusurf->page_table,
-		&ubuf->priv.cuda.map, to_dev ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
-#endif
-	if (ret < 0)
-		return ret;
+static int pevb_fops_open(struct inode *inode, struct file *filep)
+{
+	struct pevb *pevb = container_of(inode->i_cdev, struct pevb, cdev);
+	struct pevb_file *pevb_file;
 
-	ubuf->dmas = kmalloc_array(ubuf->priv.cuda.map->entries,
-		sizeof(*ubuf->dmas), GFP_KERNEL);
-	if (!ubuf->dmas)
+	pevb_file = kzalloc(sizeof(*pevb_file), GFP_KERNEL);
+	if (!pevb_file)
 		return -ENOMEM;
 
-	offset = cusurf->offset;
-	len_left = cusurf->len;
-	for (i = 0; i < ubuf->priv.cuda.map->entries; i++) {
-#ifdef NV_BUILD_DGPU
-		dma_addr_t dma_this = ubuf->priv.cuda.map->dma_addresses[i];
-		u64 len_this = min(GPU_PAGE_SIZE - offset, len_left);
-#else
-		dma_addr_t dma_this = ubuf->priv.cuda.map->hw_address[i];
-		u64 len_this = ubuf->priv.cuda.map->hw_len[i];
+	pevb_file->pevb = pevb;
+	mutex_init(&pevb_file->lock);
+	mutex_init(&pevb_file->ring_lock);
+	idr_init(&pevb_file->cuda_surfaces);
+	idr_init(&pevb_file->windows);
+	idr_init(&pevb_file->ram_handles);
+	pevb_file->sched_prio = PICOEVB_PRIO_NORMAL;
+	pevb_file->sched_weight = PICOEVB_SCHED_WEIGHT_DEFAULT;
+	pevb_file->open_ns = ktime_get_ns();
+#ifndef NV_BUILD_NO_CUDA
+	pevb_file->pin_cache = RB_ROOT_CACHED;
+	INIT_LIST_HEAD(&pevb_file->pin_cache_lru);
+	INIT_LIST_HEAD(&pevb_file->pin_cache_evicted);
+	init_waitqueue_head(&pevb_file->cusurf_users_wq);
 #endif
 
-		dma_this += offset;
-		pevb_userbuf_add_dma_chunk(ubuf, dma_this, len_this);
-
-		if (len_this >= len_left)
-			break;
-		len_left -= len_this;
-		offset = 0;
-	}
+	filep->private_data = pevb_file;
 
 	return 0;
 }
-#endif
 
-static int pevb_get_userbuf_pages(struct pevb *pevb, struct pevb_userbuf *ubuf,
-	__u64 src, __u64 len, int to_dev)
+#ifndef NV_BUILD_NO_CUDA
+static u64 pevb_cuda_surface_pinned_len(struct pevb_cuda_surface *cusurf)
 {
-	unsigned long offset;
-	unsigned long start;
-	unsigned long end;
-	int nr_pages, ret, i;
-	struct scatterlist *sg;
+	return (cusurf->offset + cusurf->len + GPU_PAGE_SIZE - 1) &
+		GPU_PAGE_MASK;
+}
 
-#ifndef NV_BUILD_NO_CUDA
-	ubuf->cuda = false;
-#endif
+/* Called with pevb_file->lock held */
+static void pevb_pin_cache_remove(struct pevb_file *pevb_file,
+	struct pevb_cuda_surface *cusurf)
+{
+	pevb_pin_cache_it_remove(cusurf, &pevb_file->pin_cache);
+	list_del_init(&cusurf->cache_lru);
+	cusurf->cached = false;
+	pevb_file->pin_cache_bytes -= pevb_cuda_surface_pinned_len(cusurf);
+	pevb_file->pin_cache_surfaces--;
+}
 
-	ubuf->priv.pages.to_dev = to_dev;
+/*
+ * Take a use of cusurf for a transfer, which keeps its page table valid until
+ * pevb_cuda_surface_unuse(). Fails once the free callback has claimed the
+ * surface. cusurf must be reachable, either with pevb_file->lock held, or
+ * under rcu_read_lock() after finding it in the handle table.
+ */
+static bool pevb_cuda_surface_use(struct pevb_cuda_surface *cusurf)
+{
+	return atomic_inc_unless_negative(&cusurf->users);
+}
 
-	offset = offset_in_page(src);
-	start = src - offset;
-	end = src + len;
-	nr_pages = (end - start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+static void pevb_cuda_surface_unuse(struct pevb_cuda_surface *cusurf)
+{
+	struct pevb_file *pevb_file = cusurf->pevb_file;
 
-	ubuf->priv.pages.pages = kmalloc_array(nr_pages,
-		sizeof(*ubuf->priv.pages.pages), GFP_KERNEL);
-	if (!ubuf->priv.pages.pages)
-		return -ENOMEM;
+	if (atomic_dec_and_test(&cusurf->users))
+		wake_up_all(&pevb_file->cusurf_users_wq);
+}
 
-	ubuf->priv.pages.pagecount = get_user_pages(
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 6, 0)
-		current, current->mm,
-#endif
-		start, nr_pages,
-		to_dev ? 0 : FOLL_WRITE,
-#if 0 /* CentOS 6 backport; can't be detected via kernel version */
-                0, /* force */
-#endif
-		ubuf->priv.pages.pages, NULL);
-	if (ubuf->priv.pages.pagecount != nr_pages) {
-		if (ubuf->priv.pages.pagecount < 0)
-			return ubuf->priv.pages.pagecount;
-		else
-			return -EFAULT;
+/*
+ * Wait for transfers using cusurf to finish, and stop new ones from taking a
+ * use. Does nothing if the surface is already claimed.
+ */
+static void pevb_cuda_surface_claim(struct pevb_cuda_surface *cusurf)
+{
+	wait_event(cusurf->pevb_file->cusurf_users_wq,
+		atomic_read(&cusurf->users) < 0 ||
+		atomic_cmpxchg(&cusurf->users, 0, -1) == 0);
+}
+
+/*
+ * Called by the NVIDIA driver when the pages are unpinned, either by
+ * pevb_cuda_surface_unpin() or because the CUDA allocation was freed. Once
+ * the surface is unreachable, claims it, so the page table isn't freed
+ * underneath transfers still using it.
+ */
+static void pevb_p2p_free_callback(void *data)
+{
+	struct pevb_cuda_surface *cusurf = data;
+	struct pevb_file *pevb_file = cusurf->pevb_file;
+
+	mutex_lock(&pevb_file->lock);
+	cusurf->freed = true;
+	if (cusurf->handle >= 0) {
+		idr_remove(&pevb_file->cuda_surfaces, cusurf->handle);
+		cusurf->handle = -1;
+	}
+	if (cusurf->cached) {
+		pevb_pin_cache_remove(pevb_file, cusurf);
+		pevb_file->pin_cache_invalidations++;
 	}
+	/* The surface may be awaiting unpinning after eviction */
+	list_del_init(&cusurf->cache_lru);
+	mutex_unlock(&pevb_file->lock);
 
-	ubuf->priv.pages.sgt = kzalloc(sizeof(*ubuf->priv.pages.sgt),
-		GFP_KERNEL);
-	if (!ubuf->priv.pages.sgt)
-		return -ENOMEM;
+	pevb_cuda_surface_claim(cusurf);
 
-	ret = sg_alloc_table_from_pages(ubuf->priv.pages.sgt,
-		ubuf->priv.pages.pages, nr_pages, offset, len, GFP_KERNEL);
-	if (ret)
-		return ret;
+	nvidia_p2p_free_page_table(cusurf->page_table);
+#ifndef NV_BUILD_DGPU
+	kfree(cusurf->page_table);
+#endif
+	kfree_rcu(cusurf, rcu);
+}
 
-	ubuf->priv.pages.map_ret = dma_map_sg(&pevb->pdev->dev,
-		ubuf->priv.pages.sgt->sgl, ubuf->priv.pages.sgt->nents,
-		to_dev ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
-	if (!ubuf->priv.pages.map_ret)
-		return -EFAULT;
+/*
+ * Returns with a use of the surface taken. Must be called without
+ * pevb_file->lock held.
+ */
+static struct pevb_cuda_surface *pevb_cuda_surface_pin(
+	struct pevb_file *pevb_file, u64 va, u64 size)
+{
+	struct pevb_cuda_surface *cusurf;
+	int ret;
 
-	ubuf->dmas = kmalloc_array(ubuf->priv.pages.map_ret,
-		sizeof(*ubuf->dmas), GFP_KERNEL);
-	if (!ubuf->dmas)
-		return -ENOMEM;
+	if (!size || va + size < va)
+		return ERR_PTR(-EINVAL);
 
-	for_each_sg(ubuf->priv.pages.sgt->sgl, sg, ubuf->priv.pages.map_ret, i)
-		pevb_userbuf_add_dma_chunk(ubuf, sg_dma_address(sg),
-			sg_dma_len(sg));
+	cusurf = kzalloc(sizeof(*cusurf), GFP_KERNEL);
+	if (!cusurf)
+		return ERR_PTR(-ENOMEM);
 
-	return 0;
-}
+	cusurf->pevb_file = pevb_file;
+	cusurf->va = va & GPU_PAGE_MASK;
+	cusurf->offset = va & GPU_PAGE_OFFSET;
+	cusurf->len = size;
+	cusurf->handle = -1;
+	/*
+	 * The caller's use, so the free callback can't free the surface before
+	 * the caller has made it reachable
+	 */
+	atomic_set(&cusurf->users, 1);
+	INIT_LIST_HEAD(&cusurf->cache_lru);
 
-static void pevb_put_userbuf_pages(struct pevb *pevb, struct pevb_userbuf *ubuf)
-{
-	if (ubuf->priv.pages.map_ret)
-		dma_unmap_sg(&pevb->pdev->dev, ubuf->priv.pages.sgt->sgl,
-			ubuf->priv.pages.sgt->nents,
-			ubuf->priv.pages.to_dev ?
-				DMA_TO_DEVICE : DMA_FROM_DEVICE);
-	if (ubuf->priv.pages.sgt)
-		sg_free_table(ubuf->priv.pages.sgt);
-	release_pages(ubuf->priv.pages.pages, ubuf->priv.pages.pagecount
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
-		, 0
+	ret = nvidia_p2p_get_pages(
+#ifdef NV_BUILD_DGPU
+		0, 0,
 #endif
-	);
-	kfree(ubuf->priv.pages.pages);
+		cusurf->va, pevb_cuda_surface_pinned_len(cusurf),
+		&cusurf->page_table, pevb_p2p_free_callback, cusurf);
+	if (ret < 0) {
+		kfree(cusurf);
+		return ERR_PTR(ret);
+	}
+
+	return cusurf;
 }
 
-#ifndef NV_BUILD_NO_CUDA
-static void pevb_put_userbuf_cuda(struct pevb *pevb, struct pevb_userbuf *ubuf)
+/*
+ * Must be called without pevb_file->lock held, and after removing cusurf from
+ * the handle table and pin cache.
+ */
+static void pevb_cuda_surface_unpin(struct pevb_cuda_surface *cusurf)
 {
-	if (ubuf->priv.cuda.map)
+	/*
+	 * A transfer that took a use before cusurf was removed may still be
+	 * running; nvidia_p2p_put_pages() mustn't release the pages under it.
+	 */
+	pevb_cuda_surface_claim(cusurf);
+
+	nvidia_p2p_put_pages(
 #ifdef NV_BUILD_DGPU
-		nvidia_p2p_dma_unmap_pages(pevb->pdev,
-			ubuf->priv.cuda.cusurf->page_table,
-			ubuf->priv.cuda.map);
+		0, 0, cusurf->va,
+#endif
+		cusurf->page_table);
+#ifdef NV_BUILD_DGPU
+	pevb_p2p_free_callback(cusurf);
 #else
-		nvidia_p2p_dma_unmap_pages(ubuf->priv.cuda.map);
+	/*
+	 * nvidia_p2p_put_pages() calls pevb_p2p_free_callback() which
+	 * frees cusurf.
+	 */
 #endif
 }
-#endif
 
-static void pevb_put_userbuf(struct pevb *pevb, struct pevb_userbuf *ubuf)
+/*
+ * Evict least recently used, idle, surfaces until needed more bytes fit into
+ * the budget. Evicted surfaces are unpinned by pevb_pin_cache_reap(), since
+ * unpinning can't happen while pevb_file->lock is held.
+ *
+ * Called with pevb_file->lock held.
+ */
+static void pevb_pin_cache_evict(struct pevb_file *pevb_file, u64 needed)
 {
-#ifndef NV_BUILD_NO_CUDA
-	if (ubuf->cuda)
-		pevb_put_userbuf_cuda(pevb, ubuf);
-	else
-#endif
-		pevb_put_userbuf_pages(pevb, ubuf);
-	kfree(ubuf->dmas);
+	u64 budget = READ_ONCE(pin_cache_budget);
+	struct pevb_cuda_surface *cusurf, *tmp;
+
+	list_for_each_entry_safe(cusurf, tmp, &pevb_file->pin_cache_lru,
+			cache_lru) {
+		if (pevb_file->pin_cache_bytes + needed <= budget)
+			break;
+		if (atomic_read(&cusurf->users))
+			continue;
+		pevb_pin_cache_remove(pevb_file, cusurf);
+		list_add_tail(&cusurf->cache_lru, &pevb_file->pin_cache_evicted);
+		pevb_file->pin_cache_evictions++;
+	}
 }
 
-static irqreturn_t pevb_irq_handler(int irq, void *data)
+static void pevb_pin_cache_reap(struct pevb_file *pevb_file)
 {
-	struct pevb *pevb = data;
-	u32 reg, status;
-	irqreturn_t ret = IRQ_NONE;
-	const u32 bad_status =
-		(XLNX_DMA_H2C_STATUS_DESC_ERR_MASK <<
-			XLNX_DMA_H2C_STATUS_DESC_ERR_SHIFT) |
-		(XLNX_DMA_H2C_STATUS_WRITE_ERR_MASK <<
-			XLNX_DMA_H2C_STATUS_WRITE_ERR_SHIFT) |
-		(XLNX_DMA_H2C_STATUS_READ_ERR_MASK <<
-			XLNX_DMA_H2C_STATUS_READ_ERR_SHIFT) |
-		XLNX_DMA_H2C_STATUS_IDLE_STOPPED |
-		XLNX_DMA_H2C_STATUS_INVALID_LEN |
-		XLNX_DMA_H2C_STATUS_MAGIC_STOPPED |
-		XLNX_DMA_H2C_STATUS_ALIGN_MISMATCH;
+	struct pevb_cuda_surface *cusurf;
 
-	dev_dbg(&pevb->pdev->dev, "%s()\n", __func__);
-	reg = XLNX_REG(H2C, 0, H2C_STATUS_RD_CLR);
-	status = pevb_readl(pevb, BAR_DMA, reg);
-	status &= ~XLNX_DMA_H2C_STATUS_BUSY;
-	if (status) {
-		dev_dbg(&pevb->pdev->dev, "H2C status 0x%08x\n", status);
-		pevb->h2c_error = !!(status & bad_status);
-		complete(&pevb->dma_xfer_cmpl);
+	for (;;) {
+		mutex_lock(&pevb_file->lock);
+		cusurf = list_first_entry_or_null(&pevb_file->pin_cache_evicted,
+			struct pevb_cuda_surface, cache_lru);
+		if (cusurf)
+			list_del_init(&cusurf->cache_lru);
+		mutex_unlock(&pevb_file->lock);
+
+		if (!cusurf)
+			break;
+
+		pevb_cuda_surface_unpin(cusurf);
+	}
+}
+
+/*
+ * A cached surface that covers the whole of [va, last], or NULL.
+ *
+ * Called with pevb_file->lock held.
+ */
+static struct pevb_cuda_surface *pevb_pin_cache_find(
+	struct pevb_file *pevb_file, u64 va, u64 last)
+{
+	struct pevb_cuda_surface *cusurf;
+
+	for (cusurf = pevb_pin_cache_it_iter_first(&pevb_file->pin_cache, va,
+				last);
+			cusurf;
+			cusurf = pevb_pin_cache_it_iter_next(cusurf, va, last)) {
+		if (PEVB_CUSURF_START(cusurf) <= va &&
+				PEVB_CUSURF_LAST(cusurf) >= last)
+			break;
+	}
+
+	if (cusurf) {
+		list_move_tail(&cusurf->cache_lru, &pevb_file->pin_cache_lru);
+		/* Can't fail; the free callback removes it from the cache first */
+		pevb_cuda_surface_use(cusurf);
+	}
+
+	return cusurf;
+}
+
+/*
+ * Find a cached surface that covers the whole of [va, va + len), or pin and
+ * cache a new one. Returns with a use of the surface taken.
+ *
+ * Must be called without pevb_file->lock held. Pinning may take mmap_sem, and
+ * the free callback, which takes the lock, may be called with mmap_sem held.
+ */
+static struct pevb_cuda_surface *pevb_pin_cache_get(
+	struct pevb_file *pevb_file, u64 va, u64 len)
+{
+	struct pevb_cuda_surface *cusurf, *pinned;
+	u64 last = va + len - 1;
+	bool freed;
+
+	if (!len || last < va)
+		return ERR_PTR(-EINVAL);
+
+	mutex_lock(&pevb_file->lock);
+	cusurf = pevb_pin_cache_find(pevb_file, va, last);
+	if (cusurf)
+		pevb_file->pin_cache_hits++;
+	else
+		pevb_file->pin_cache_misses++;
+	mutex_unlock(&pevb_file->lock);
+	if (cusurf)
+		return cusurf;
+
+	pinned = pevb_cuda_surface_pin(pevb_file, va, len);
+	if (IS_ERR(pinned))
+		return pinned;
+
+	mutex_lock(&pevb_file->lock);
+	/* Another thread may have cached the same memory meanwhile */
+	cusurf = pevb_pin_cache_find(pevb_file, va, last);
+	freed = pinned->freed;
+	if (!cusurf && !freed) {
+		pevb_pin_cache_evict(pevb_file,
+			pevb_cuda_surface_pinned_len(pinned));
+
+		pevb_pin_cache_it_insert(pinned, &pevb_file->pin_cache);
+		list_add_tail(&pinned->cache_lru, &pevb_file->pin_cache_lru);
+		pinned->cached = true;
+		pevb_file->pin_cache_bytes +=
+			pevb_cuda_surface_pinned_len(pinned);
+		pevb_file->pin_cache_surfaces++;
+		mutex_unlock(&pevb_file->lock);
+
+		/* Keep pevb_cuda_surface_pin()'s use for the caller */
+		return pinned;
+	}
+	/* pevb_pin_cache_reap() unpins the duplicate */
+	if (!freed)
+		list_add_tail(&pinned->cache_lru,
+			&pevb_file->pin_cache_evicted);
+	mutex_unlock(&pevb_file->lock);
+
+	/* If freed, the free callback is waiting for this */
+	pevb_cuda_surface_unuse(pinned);
+
+	if (!cusurf)
+		return ERR_PTR(-EFAULT);
+
+	return cusurf;
+}
+#else
+static void pevb_pin_cache_reap(struct pevb_file *pevb_file)
+{
+}
+#endif
+
+static void pevb_put_userbuf(struct pevb_xfer *xfer,
+	struct pevb_userbuf *ubuf);
+
+static int pevb_fops_release(struct inode *inode, struct file *filep)
+{
+	struct pevb_file *pevb_file = filep->private_data;
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	struct pevb_window *win;
+	struct pevb_ram_region *region;
+	int id, i;
+
+	idr_for_each_entry(&pevb_file->windows, win, id) {
+		pevb_put_userbuf(&xfer, &win->ubuf);
+		kfree(win);
+	}
+	idr_destroy(&pevb_file->windows);
+	idr_for_each_entry(&pevb_file->ram_handles, region, id)
+		pevb_ram_put(pevb_file->pevb, region);
+	idr_destroy(&pevb_file->ram_handles);
+	vfree(pevb_file->ring);
+
+#ifndef NV_BUILD_NO_CUDA
+	for (;;) {
+		int id = 0;
+		struct pevb_cuda_surface *cusurf;
+
+		mutex_lock(&pevb_file->lock);
+
+		cusurf = idr_get_next(&pevb_file->cuda_surfaces, &id);
+		if (!cusurf) {
+			mutex_unlock(&pevb_file->lock);
+			break;
+		}
+
+		idr_remove(&pevb_file->cuda_surfaces, id);
+		cusurf->handle = -1;
+
+		mutex_unlock(&pevb_file->lock);
+
+		pevb_cuda_surface_unpin(cusurf);
+	}
+
+	mutex_lock(&pevb_file->lock);
+	while (!list_empty(&pevb_file->pin_cache_lru)) {
+		struct pevb_cuda_surface *cusurf = list_first_entry(
+			&pevb_file->pin_cache_lru, struct pevb_cuda_surface,
+			cache_lru);
+
+		pevb_pin_cache_remove(pevb_file, cusurf);
+		list_add_tail(&cusurf->cache_lru, &pevb_file->pin_cache_evicted);
+	}
+	mutex_unlock(&pevb_file->lock);
+
+	pevb_pin_cache_reap(pevb_file);
+#endif
+
+	for (i = 0; i < PEVB_SCRATCH_SLOTS; i++)
+		pevb_scratch_free(&pevb_file->scratch[i]);
+	kfree(pevb_file);
+
+	return 0;
+}
+
+static int pevb_ioctl_led(struct pevb_file *pevb_file, unsigned long arg)
+{
+	struct pevb *pevb = pevb_file->pevb;
+
+	pevb_writel(pevb, BAR_GPIO, arg, 0);
+	return 0;
+}
+
+#ifndef NV_BUILD_NO_CUDA
+static int pevb_ioctl_pin_cuda(struct pevb_file *pevb_file, unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_pin_cuda pin_params;
+	struct pevb_cuda_surface *cusurf;
+	int handle = -1;
+	bool unpin;
+	int ret;
+
+	if (copy_from_user(&pin_params, argp, sizeof(pin_params)))
+		return -EFAULT;
+
+	cusurf = pevb_cuda_surface_pin(pevb_file, pin_params.va,
+		pin_params.size);
+	if (IS_ERR(cusurf))
+		return PTR_ERR(cusurf);
+
+	mutex_lock(&pevb_file->lock);
+	/* Handles must fit in the low bits of the DMA ioctls' src/dst */
+	if (cusurf->freed)
+		ret = -EFAULT;
+	else
+		ret = idr_alloc(&pevb_file->cuda_surfaces, cusurf, 0,
+			PICOEVB_CUDA_HANDLE_MASK + 1, GFP_KERNEL);
+	if (ret >= 0)
+		cusurf->handle = ret;
+	mutex_unlock(&pevb_file->lock);
+
+	if (ret < 0)
+		goto put_pages;
+
+	handle = ret;
+	pin_params.handle = handle;
+
+	if (copy_to_user(argp, &pin_params, sizeof(pin_params))) {
+		ret = -EFAULT;
+		goto put_pages;
+	}
+
+	pevb_cuda_surface_unuse(cusurf);
+
+	return 0;
+
+put_pages:
+	mutex_lock(&pevb_file->lock);
+	/* Unless the free callback or UNPIN_CUDA already has it */
+	unpin = !cusurf->freed && cusurf->handle == handle;
+	if (unpin && handle >= 0) {
+		idr_remove(&pevb_file->cuda_surfaces, handle);
+		cusurf->handle = -1;
+	}
+	mutex_unlock(&pevb_file->lock);
+
+	pevb_cuda_surface_unuse(cusurf);
+	if (unpin)
+		pevb_cuda_surface_unpin(cusurf);
+
+	return ret;
+}
+
+static int pevb_ioctl_unpin_cuda(struct pevb_file *pevb_file, unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_unpin_cuda unpin_params;
+	struct pevb_cuda_surface *cusurf;
+
+	if (copy_from_user(&unpin_params, argp, sizeof(unpin_params)))
+		return -EFAULT;
+
+	mutex_lock(&pevb_file->lock);
+	cusurf = idr_find(&pevb_file->cuda_surfaces, unpin_params.handle);
+	if (!cusurf) {
+		mutex_unlock(&pevb_file->lock);
+		return -EINVAL;
+	}
+	idr_remove(&pevb_file->cuda_surfaces, unpin_params.handle);
+	cusurf->handle = -1;
+	mutex_unlock(&pevb_file->lock);
+
+	pevb_cuda_surface_unpin(cusurf);
+
+	return 0;
+}
+
+static int pevb_ioctl_pin_cache_stats(struct pevb_file *pevb_file,
+	unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_pin_cache_stats stats_params = {0};
+
+	mutex_lock(&pevb_file->lock);
+	stats_params.hits = pevb_file->pin_cache_hits;
+	stats_params.misses = pevb_file->pin_cache_misses;
+	stats_params.evictions = pevb_file->pin_cache_evictions;
+	stats_params.invalidations = pevb_file->pin_cache_invalidations;
+	stats_params.pinned_bytes = pevb_file->pin_cache_bytes;
+	stats_params.pinned_surfaces = pevb_file->pin_cache_surfaces;
+	mutex_unlock(&pevb_file->lock);
+
+	if (copy_to_user(argp, &stats_params, sizeof(stats_params)))
+		return -EFAULT;
+
+	return 0;
+}
+#endif
+
+static void pevb_userbuf_add_dma_chunk(struct pevb_userbuf *ubuf,
+	dma_addr_t addr, u64 len)
+{
+	struct pevb_userbuf_dma *dma;
+	dma_addr_t end;
+
+	if (ubuf->n_dmas) {
+		dma = &ubuf->dmas[ubuf->n_dmas - 1];
+		end = dma->addr + dma->len;
+		if (addr == end) {
+			dma->len += len;
+			return;
+		}
+	}
+
+	dma = &ubuf->dmas[ubuf->n_dmas];
+	dma->addr = addr;
+	dma->len = len;
+	ubuf->n_dmas++;
+}
+
+#ifndef NV_BUILD_NO_CUDA
+/*
+ * Map [offset, offset + len) of cusurf, relative to the start of the pinned
+ * CUDA allocation, for DMA. Takes over the caller's use of cusurf, which is
+ * dropped by pevb_put_userbuf().
+ */
+static int pevb_get_userbuf_cuda(struct pevb_file *pevb_file,
+	struct pevb_userbuf *ubuf, struct pevb_cuda_surface *cusurf,
+	__u64 offset, __u64 len, int to_dev)
+{
+	struct pevb *pevb = pevb_file->pevb;
+	struct nvidia_p2p_dma_mapping *map;
+	int ret, i;
+	u64 skip, len_left, ts;
+
+	ubuf->cuda = true;
+	ubuf->priv.cuda.cusurf = cusurf;
+
+	if (offset > cusurf->len || len > cusurf->len - offset)
+		return -EINVAL;
+
+	ts = ktime_get_ns();
+
+#ifdef NV_BUILD_DGPU
+	ret = nvidia_p2p_dma_map_pages(pevb->pdev, cusurf->page_table,
+		&ubuf->priv.cuda.map);
+#else
+	ret = nvidia_p2p_dma_map_pages(pevb->dev, cusurf->page_table,
+		&ubuf->priv.cuda.map, to_dev ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+#endif
+	if (ret < 0)
+		return ret;
+	map = ubuf->priv.cuda.map;
+
+	ret = pevb_userbuf_alloc_dmas(ubuf, map->entries);
+	if (ret)
+		return ret;
+
+	skip = cusurf->offset + offset;
+	len_left = len;
+#ifdef NV_BUILD_DGPU
+	/* Every entry is one GPU page, so the first chunk can be computed */
+	i = skip >> GPU_PAGE_SHIFT;
+	skip &= GPU_PAGE_OFFSET;
+#else
+	i = 0;
+#endif
+	for (; i < map->entries && len_left; i++) {
+#ifdef NV_BUILD_DGPU
+		dma_addr_t dma_this = map->dma_addresses[i];
+		u64 len_this = GPU_PAGE_SIZE;
+#else
+		dma_addr_t dma_this = map->hw_address[i];
+		u64 len_this = map->hw_len[i];
+#endif
+
+		if (skip >= len_this) {
+			skip -= len_this;
+			continue;
+		}
+		dma_this += skip;
+		len_this -= skip;
+		skip = 0;
+
+		len_this = min(len_this, len_left);
+		pevb_userbuf_add_dma_chunk(ubuf, dma_this, len_this);
+		len_left -= len_this;
+	}
+	if (len_left)
+		return -EINVAL;
+
+	ubuf->map_ns = ktime_get_ns() - ts;
+
+	return 0;
+}
+
+static int pevb_get_userbuf_cuda_handle(struct pevb_file *pevb_file,
+	struct pevb_userbuf *ubuf, __u64 handle64, __u64 len, int to_dev)
+{
+	struct pevb_cuda_surface *cusurf;
+	int id;
+	u64 offset;
+
+	ubuf->cuda = true;
+
+	id = handle64 & PICOEVB_CUDA_HANDLE_MASK;
+	offset = handle64 >> PICOEVB_CUDA_HANDLE_BITS;
+
+	rcu_read_lock();
+	cusurf = idr_find(&pevb_file->cuda_surfaces, id);
+	if (cusurf && !pevb_cuda_surface_use(cusurf))
+		cusurf = NULL;
+	rcu_read_unlock();
+	if (!cusurf)
+		return -EINVAL;
+
+	return pevb_get_userbuf_cuda(pevb_file, ubuf, cusurf, offset, len,
+		to_dev);
+}
+
+static int pevb_get_userbuf_cuda_va(struct pevb_file *pevb_file,
+	struct pevb_userbuf *ubuf, __u64 va, __u64 len, int to_dev)
+{
+	struct pevb_cuda_surface *cusurf;
+	u64 ts;
+
+	ubuf->cuda = true;
+
+	ts = ktime_get_ns();
+	cusurf = pevb_pin_cache_get(pevb_file, va, len);
+	if (IS_ERR(cusurf))
+		return PTR_ERR(cusurf);
+	ubuf->pin_ns = ktime_get_ns() - ts;
+
+	return pevb_get_userbuf_cuda(pevb_file, ubuf, cusurf,
+		va - PEVB_CUSURF_START(cusurf), len, to_dev);
+}
+#endif
+
+static int pevb_get_userbuf_pages(struct pevb *pevb, struct pevb_userbuf *ubuf,
+	__u64 src, __u64 len, int to_dev)
+{
+	unsigned long offset;
+	unsigned long start;
+	unsigned long end;
+	int nr_pages, ret, i;
+	struct scatterlist *sg;
+	u64 ts, te;
+
+#ifndef NV_BUILD_NO_CUDA
+	ubuf->cuda = false;
+#endif
+
+	ubuf->priv.pages.to_dev = to_dev;
+	ts = ktime_get_ns();
+
+	offset = offset_in_page(src);
+	start = src - offset;
+	end = src + len;
+	nr_pages = (end - start + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+	if (ubuf->scratch) {
+		ret = pevb_scratch_reserve_pages(ubuf->scratch, nr_pages);
+		if (ret)
+			return ret;
+		ubuf->priv.pages.pages = ubuf->scratch->pages;
+	} else {
+		ubuf->priv.pages.pages = kmalloc_array(nr_pages,
+			sizeof(*ubuf->priv.pages.pages), GFP_KERNEL);
+		if (!ubuf->priv.pages.pages)
+			return -ENOMEM;
+	}
+
+	ubuf->priv.pages.pagecount = get_user_pages(
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 6, 0)
+		current, current->mm,
+#endif
+		start, nr_pages,
+		to_dev ? 0 : FOLL_WRITE,
+#if 0 /* CentOS 6 backport; can't be detected via kernel version */
+                0, /* force */
+#endif
+		ubuf->priv.pages.pages, NULL);
+	if (ubuf->priv.pages.pagecount != nr_pages) {
+		if (ubuf->priv.pages.pagecount < 0)
+			return ubuf->priv.pages.pagecount;
+		else
+			return -EFAULT;
+	}
+	te = ktime_get_ns();
+	ubuf->pin_ns = te - ts;
+
+	if (ubuf->scratch) {
+		ret = pevb_scratch_fill_sgt(ubuf->scratch,
+			ubuf->priv.pages.pages, nr_pages, offset, len);
+		if (ret < 0)
+			return ret;
+		ubuf->priv.pages.sgt = &ubuf->scratch->sgt;
+	} else {
+		ubuf->priv.pages.sgt = kzalloc(sizeof(*ubuf->priv.pages.sgt),
+			GFP_KERNEL);
+		if (!ubuf->priv.pages.sgt)
+			return -ENOMEM;
+
+		ret = sg_alloc_table_from_pages(ubuf->priv.pages.sgt,
+			ubuf->priv.pages.pages, nr_pages, offset, len,
+			GFP_KERNEL);
+		if (ret)
+			return ret;
+	}
+
+	ubuf->priv.pages.map_ret = dma_map_sg(pevb->dev,
+		ubuf->priv.pages.sgt->sgl, ubuf->priv.pages.sgt->nents,
+		to_dev ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	if (!ubuf->priv.pages.map_ret)
+		return -EFAULT;
+
+	ret = pevb_userbuf_alloc_dmas(ubuf, ubuf->priv.pages.map_ret);
+	if (ret)
+		return ret;
+
+	for_each_sg(ubuf->priv.pages.sgt->sgl, sg, ubuf->priv.pages.map_ret, i)
+		pevb_userbuf_add_dma_chunk(ubuf, sg_dma_address(sg),
+			sg_dma_len(sg));
+	ubuf->map_ns = ktime_get_ns() - te;
+
+	return 0;
+}
+
+static void pevb_put_userbuf_pages(struct pevb *pevb, struct pevb_userbuf *ubuf)
+{
+	if (ubuf->priv.pages.map_ret)
+		dma_unmap_sg(pevb->dev, ubuf->priv.pages.sgt->sgl,
+			ubuf->priv.pages.sgt->nents,
+			ubuf->priv.pages.to_dev ?
+				DMA_TO_DEVICE : DMA_FROM_DEVICE);
+	release_pages(ubuf->priv.pages.pages, ubuf->priv.pages.pagecount
+#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 15, 0)
+		, 0
+#endif
+	);
+	/* Scratch arrays are kept for the next userbuf */
+	if (ubuf->scratch)
+		return;
+	if (ubuf->priv.pages.sgt) {
+		sg_free_table(ubuf->priv.pages.sgt);
+		kfree(ubuf->priv.pages.sgt);
+	}
+	kfree(ubuf->priv.pages.pages);
+}
+
+/*
+ * Pass [offset, offset + len) of a host memory userbuf to the device before a
+ * transfer, or back to the CPU after one. Needed only for userbufs that stay
+ * mapped across transfers, such as ring windows, since mapping and unmapping
+ * do the same. Scatterlist entries can span many pages, so only the part of
+ * each entry within the range is synced, via a single-entry copy of it.
+ */
+static void pevb_sync_userbuf_pages(struct pevb *pevb,
+	struct pevb_userbuf *ubuf, u64 offset, u64 len, bool for_cpu)
+{
+	enum dma_data_direction dir = ubuf->priv.pages.to_dev ?
+		DMA_TO_DEVICE : DMA_FROM_DEVICE;
+	struct scatterlist *sg, part;
+	u64 pos = 0, skip, n;
+	int i;
+
+	for_each_sg(ubuf->priv.pages.sgt->sgl, sg, ubuf->priv.pages.sgt->nents,
+			i) {
+		if (pos >= offset + len)
+			break;
+		if (pos + sg->length <= offset) {
+			pos += sg->length;
+			continue;
+		}
+
+		skip = offset > pos ? offset - pos : 0;
+		n = min_t(u64, sg->length - skip, offset + len - pos - skip);
+		skip += sg->offset;
+
+		sg_init_table(&part, 1);
+		sg_set_page(&part, nth_page(sg_page(sg), skip >> PAGE_SHIFT),
+			n, offset_in_page(skip));
+		sg_dma_address(&part) = sg_dma_address(sg) + skip - sg->offset;
+		sg_dma_len(&part) = n;
+
+		if (for_cpu)
+			dma_sync_sg_for_cpu(pevb->dev, &part, 1, dir);
+		else
+			dma_sync_sg_for_device(pevb->dev, &part, 1, dir);
+
+		pos += sg->length;
+	}
+}
+
+#ifndef NV_BUILD_NO_CUDA
+static void pevb_put_userbuf_cuda(struct pevb *pevb, struct pevb_userbuf *ubuf)
+{
+	if (ubuf->priv.cuda.map)
+#ifdef NV_BUILD_DGPU
+		nvidia_p2p_dma_unmap_pages(pevb->pdev,
+			ubuf->priv.cuda.cusurf->page_table,
+			ubuf->priv.cuda.map);
+#else
+		nvidia_p2p_dma_unmap_pages(ubuf->priv.cuda.map);
+#endif
+	if (ubuf->priv.cuda.cusurf)
+		pevb_cuda_surface_unuse(ubuf->priv.cuda.cusurf);
+}
+#endif
+
+static void pevb_put_userbuf(struct pevb_xfer *xfer,
+	struct pevb_userbuf *ubuf)
+{
+	struct pevb_file *pevb_file = xfer->pevb_file;
+	struct pevb *pevb = pevb_file->pevb;
+	u64 ts = ktime_get_ns();
+
+#ifndef NV_BUILD_NO_CUDA
+	if (ubuf->cuda)
+		pevb_put_userbuf_cuda(pevb, ubuf);
+	else
+#endif
+		pevb_put_userbuf_pages(pevb, ubuf);
+	if (ubuf->scratch)
+		pevb_scratch_put(pevb_file, ubuf->scratch);
+	else
+		kfree(ubuf->dmas);
+
+	xfer->timing.unmap_ns += ktime_get_ns() - ts;
+}
+
+enum pevb_mem_kind {
+	PEVB_MEM_INVALID,
+	PEVB_MEM_MALLOC,
+	PEVB_MEM_CUDA_HANDLE,
+	PEVB_MEM_CUDA_VA,
+};
+
+static enum pevb_mem_kind pevb_mem_kind(__u64 flags, __u64 cuda_flag,
+	__u64 cuda_va_flag)
+{
+	__u64 mem_flags = flags & (cuda_flag | cuda_va_flag);
+
+	if (!mem_flags)
+		return PEVB_MEM_MALLOC;
+	if (mem_flags == cuda_flag)
+		return PEVB_MEM_CUDA_HANDLE;
+	if (mem_flags == cuda_va_flag)
+		return PEVB_MEM_CUDA_VA;
+	return PEVB_MEM_INVALID;
+}
+
+/*
+ * Called without pevb_file->lock held, so that threads sharing a file can pin
+ * and map in parallel. On error, the caller must still call
+ * pevb_put_userbuf(). Unless ubuf->persistent is set, the file's scratch
+ * arrays are used if one is free, so that the transfer needn't allocate.
+ */
+static int pevb_get_userbuf(struct pevb_xfer *xfer,
+	struct pevb_userbuf *ubuf, enum pevb_mem_kind kind, __u64 addr,
+	__u64 len, int to_dev)
+{
+	struct pevb_file *pevb_file = xfer->pevb_file;
+	int ret;
+
+	if (!ubuf->persistent)
+		ubuf->scratch = pevb_scratch_get(pevb_file);
+
+	switch (kind) {
+	case PEVB_MEM_MALLOC:
+		ret = pevb_get_userbuf_pages(pevb_file->pevb, ubuf, addr, len,
+			to_dev);
+		break;
+#ifndef NV_BUILD_NO_CUDA
+	case PEVB_MEM_CUDA_HANDLE:
+		ret = pevb_get_userbuf_cuda_handle(pevb_file, ubuf, addr, len,
+			to_dev);
+		break;
+	case PEVB_MEM_CUDA_VA:
+		ret = pevb_get_userbuf_cuda_va(pevb_file, ubuf, addr, len,
+			to_dev);
+		break;
+#endif
+	default:
+		return -EINVAL;
+	}
+
+	xfer->timing.pin_ns += ubuf->pin_ns;
+	xfer->timing.map_ns += ubuf->map_ns;
+
+	return ret;
+}
+
+static irqreturn_t pevb_irq_handler(int irq, void *data)
+{
+	struct pevb *pevb = data;
+	u32 reg, status;
+	irqreturn_t ret = IRQ_NONE;
+	const u32 bad_status =
+		(XLNX_DMA_H2C_STATUS_DESC_ERR_MASK <<
+			XLNX_DMA_H2C_STATUS_DESC_ERR_SHIFT) |
+		(XLNX_DMA_H2C_STATUS_WRITE_ERR_MASK <<
+			XLNX_DMA_H2C_STATUS_WRITE_ERR_SHIFT) |
+		(XLNX_DMA_H2C_STATUS_READ_ERR_MASK <<
+			XLNX_DMA_H2C_STATUS_READ_ERR_SHIFT) |
+		XLNX_DMA_H2C_STATUS_IDLE_STOPPED |
+		XLNX_DMA_H2C_STATUS_INVALID_LEN |
+		XLNX_DMA_H2C_STATUS_MAGIC_STOPPED |
+		XLNX_DMA_H2C_STATUS_ALIGN_MISMATCH;
+
+	dev_dbg(pevb->dev, "%s()\n", __func__);
+	reg = XLNX_REG(H2C, 0, H2C_STATUS_RD_CLR);
+	status = pevb_readl(pevb, BAR_DMA, reg);
+	status &= ~XLNX_DMA_H2C_STATUS_BUSY;
+	if (status) {
+		dev_dbg(pevb->dev, "H2C status 0x%08x\n", status);
+		pevb->h2c_error = !!(status & bad_status);
+		pevb->dma_irq_ns = ktime_get_ns();
+		complete(&pevb->dma_xfer_cmpl);
 		ret = IRQ_HANDLED;
 	}
 
-	reg = XLNX_REG(C2H, 0, H2C_STATUS_RD_CLR);
-	status = pevb_readl(pevb, BAR_DMA, reg);
-	status &= ~XLNX_DMA_H2C_STATUS_BUSY;
-	if (status) {
-		dev_dbg(&pevb->pdev->dev, "C2H status 0x%08x\n", status);
-		pevb->c2h_error = !!(status & bad_status);
-		complete(&pevb->dma_xfer_cmpl);
-		ret = IRQ_HANDLED;
+	reg = XLNX_REG(C2H, 0, H2C_STATUS_RD_CLR);
+	status = pevb_readl(pevb, BAR_DMA, reg);
+	status &= ~XLNX_DMA_H2C_STATUS_BUSY;
+	if (status) {
+		dev_dbg(pevb->dev, "C2H status 0x%08x\n", status);
+		pevb->c2h_error = !!(status & bad_status);
+		pevb->dma_irq_ns = ktime_get_ns();
+		complete(&pevb->dma_xfer_cmpl);
+		ret = IRQ_HANDLED;
+	}
+
+	return ret;
+}
+
+static void pevb_dma_chan_regs(struct pevb *pevb, bool c2h, u32 *chan_offset,
+	u32 *irq_int_en_bit_offset, u32 *sgma_ctrl_bit)
+{
+	if (c2h) {
+		*chan_offset = XLNX_REG(C2H, 0, H2C_CTRL) -
+			XLNX_REG(H2C, 0, H2C_CTRL);
+		*irq_int_en_bit_offset =
+			XLNX_DMA_IRQ_CH_C2H_BIT(0, pevb->drvdata->num_h2c_chans) -
+			XLNX_DMA_IRQ_CH_H2C_BIT(0);
+		*sgma_ctrl_bit = XLNX_DMA_SGDMA_CTRL_C2H_DSC_HALT_SHIFT;
+	} else {
+		*chan_offset = 0;
+		*irq_int_en_bit_offset = 0;
+		*sgma_ctrl_bit = XLNX_DMA_SGDMA_CTRL_H2C_DSC_HALT_SHIFT;
+	}
+}
+
+/*
+ * The descriptor chain always starts at descs_dma_addr, so a channel is
+ * programmed once, and left ready between transfers. Each transfer then only
+ * needs to set and clear the channel's RUN bit.
+ */
+static void pevb_dma_chan_setup(struct pevb *pevb, bool c2h)
+{
+	u32 chan_offset, irq_int_en_bit_offset, sgma_ctrl_bit;
+	u32 reg, val;
+
+	pevb_dma_chan_regs(pevb, c2h, &chan_offset, &irq_int_en_bit_offset,
+		&sgma_ctrl_bit);
+
+	/* Program descriptor location */
+	reg = XLNX_REG(H2C_SGDMA, 0, H2C_SGDMA_DESC_LOW_ADDR) + chan_offset;
+	val = pevb->descs_dma_addr & 0xffffffffU;
+	pevb_writel(pevb, BAR_DMA, val, reg);
+	reg = XLNX_REG(H2C_SGDMA, 0, H2C_SGDMA_DESC_HIGH_ADDR) + chan_offset;
+	val = pevb->descs_dma_addr >> 32;
+	pevb_writel(pevb, BAR_DMA, val, reg);
+	reg = XLNX_REG(H2C_SGDMA, 0, H2C_SGDMA_DESC_ADJACENT) + chan_offset;
+	pevb_writel(pevb, BAR_DMA, 0, reg);
+	/* Clear any pending status */
+	reg = XLNX_REG(H2C, 0, H2C_STATUS_RD_CLR) + chan_offset;
+	pevb_readl(pevb, BAR_DMA, reg);
+	/* Enable all IRQs in channel */
+	reg = XLNX_REG(H2C, 0, H2C_INT_EN) + chan_offset;
+	pevb_writel(pevb, BAR_DMA, 0xffffffffU, reg);
+	/* Enable channel IRQ at top level */
+	reg = XLNX_REG(IRQ, 0, IRQ_CH_INT_EN_W1S);
+	val = XLNX_DMA_IRQ_CH_H2C_BIT(irq_int_en_bit_offset);
+	pevb_writel(pevb, BAR_DMA, val, reg);
+
+	pevb->chan_ready[c2h] = true;
+}
+
+/* Stops the channel, and undoes pevb_dma_chan_setup() */
+static void pevb_dma_chan_reset(struct pevb *pevb, bool c2h)
+{
+	u32 chan_offset, irq_int_en_bit_offset, sgma_ctrl_bit;
+	u32 reg, val;
+
+	pevb_dma_chan_regs(pevb, c2h, &chan_offset, &irq_int_en_bit_offset,
+		&sgma_ctrl_bit);
+
+	/* Disable channel IRQ at top level */
+	reg = XLNX_REG(IRQ, 0, IRQ_CH_INT_EN_W1C);
+	val = XLNX_DMA_IRQ_CH_H2C_BIT(irq_int_en_bit_offset);
+	pevb_writel(pevb, BAR_DMA, val, reg);
+	/* Disable all IRQs in channel */
+	reg = XLNX_REG(H2C, 0, H2C_INT_EN) + chan_offset;
+	pevb_writel(pevb, BAR_DMA, 0, reg);
+	/* Cancel descriptor fetches */
+	reg = XLNX_REG(SGDMA, 0, SGDMA_CTRL_W1S);
+	val = BIT(sgma_ctrl_bit);
+	pevb_writel(pevb, BAR_DMA, val, reg);
+	reg = XLNX_REG(SGDMA, 0, SGDMA_CTRL_W1C);
+	pevb_writel(pevb, BAR_DMA, val, reg);
+	/* Cancel channel operation */
+	reg = XLNX_REG(H2C, 0, H2C_CTRL) + chan_offset;
+	pevb_writel(pevb, BAR_DMA, 0, reg);
+
+	pevb->chan_ready[c2h] = false;
+}
+
+/*
+ * Start the DMA engine on the descriptor chain. Only the engine owner may
+ * start a transfer, and it must then call pevb_dma_wait() before starting
+ * another, but may do other work in between.
+ */
+static void pevb_dma_start(struct pevb *pevb, bool c2h)
+{
+	u32 chan_offset, irq_int_en_bit_offset, sgma_ctrl_bit;
+	u32 reg, val;
+
+	pevb_dma_chan_regs(pevb, c2h, &chan_offset, &irq_int_en_bit_offset,
+		&sgma_ctrl_bit);
+
+	if (!pevb->chan_ready[c2h])
+		pevb_dma_chan_setup(pevb, c2h);
+
+	reinit_completion(&pevb->dma_xfer_cmpl);
+
+	if (READ_ONCE(pevb->perf_arm[c2h])) {
+		WRITE_ONCE(pevb->perf_arm[c2h], false);
+		reg = XLNX_REG(H2C, 0, H2C_PERF_CTRL) + chan_offset;
+		val = XLNX_DMA_H2C_PERF_CTRL_RUN |
+			XLNX_DMA_H2C_PERF_CTRL_AUTO_STOP;
+		pevb_writel(pevb, BAR_DMA, val, reg);
+	}
+	/* Start DMA */
+	reg = XLNX_REG(H2C, 0, H2C_CTRL) + chan_offset;
+	val = (XLNX_DMA_H2C_CTRL_IE_DESC_ERR_MASK <<
+			XLNX_DMA_H2C_CTRL_IE_DESC_ERR_SHIFT) |
+		(XLNX_DMA_H2C_CTRL_IE_WRITE_ERR_MASK <<
+			XLNX_DMA_H2C_CTRL_IE_WRITE_ERR_SHIFT) |
+		(XLNX_DMA_H2C_CTRL_IE_READ_ERR_MASK <<
+			XLNX_DMA_H2C_CTRL_IE_READ_ERR_SHIFT) |
+		XLNX_DMA_H2C_CTRL_IE_IDLE_STOPPED |
+		XLNX_DMA_H2C_CTRL_IE_INVALID_LEN |
+		XLNX_DMA_H2C_CTRL_IE_MAGIC_STOPPED |
+		XLNX_DMA_H2C_CTRL_IE_ALIGN_MISMATCH |
+		XLNX_DMA_H2C_CTRL_IE_DESC_COMPLETED |
+		XLNX_DMA_H2C_CTRL_IE_DESC_STOPPED |
+		XLNX_DMA_H2C_CTRL_RUN;
+	/*
+	 * Ensure all memory writes for descriptor and configuration registers
+	 * have completed before triggering the DMA operation.
+	 */
+	wmb();
+	pevb->dma_start_ns = ktime_get_ns();
+	pevb_writel(pevb, BAR_DMA, val, reg);
+}
+
+static int pevb_dma_wait(struct pevb *pevb, bool c2h)
+{
+	u32 chan_offset, irq_int_en_bit_offset, sgma_ctrl_bit;
+	u32 reg;
+	int ret;
+	u64 te, hw_ns;
+
+	pevb_dma_chan_regs(pevb, c2h, &chan_offset, &irq_int_en_bit_offset,
+		&sgma_ctrl_bit);
+
+	/* Wait for DMA completion (via IRQ) */
+	ret = wait_for_completion_interruptible(&pevb->dma_xfer_cmpl);
+	te = ktime_get_ns();
+	if (ret)
+		dev_err(pevb->dev, "DMA interrupted\n");
+	else {
+		hw_ns = pevb->dma_irq_ns - pevb->dma_start_ns;
+		pevb->xfer->timing.hw_ns += hw_ns;
+		pevb->xfer->timing.irq_to_wake_ns += te - pevb->dma_irq_ns;
+		atomic64_add(hw_ns, &pevb->stats[c2h].busy_ns);
+		atomic64_add(hw_ns,
+			&pevb->xfer->pevb_file->stats[c2h].busy_ns);
+		if (c2h ? pevb->c2h_error : pevb->h2c_error) {
+			dev_err(pevb->dev, "DMA failed\n");
+			ret = -EIO;
+		}
+	}
+
+	/*
+	 * After a failure, the engine's state is unknown, so fully stop the
+	 * channel; it's re-programmed by the next transfer.
+	 */
+	if (ret) {
+		pevb_dma_chan_reset(pevb, c2h);
+	} else {
+		reg = XLNX_REG(H2C, 0, H2C_CTRL_W1C) + chan_offset;
+		pevb_writel(pevb, BAR_DMA, XLNX_DMA_H2C_CTRL_RUN, reg);
+	}
+
+	return ret;
+}
+
+/*
+ * Only transfers long enough for setup and IRQ latency not to dominate are
+ * representative of DMA bandwidth.
+ */
+#define PEVB_DMA_BW_MIN_SAMPLE	SZ_16K
+
+/*
+ * Update the DMA bandwidth estimate from the transfer that just completed.
+ * The transfer is timed from start until the completion IRQ, since the owner
+ * may not wait for it immediately.
+ */
+static void pevb_dma_sample_bw(struct pevb *pevb, unsigned long len)
+{
+	u64 bw;
+
+	if (len < PEVB_DMA_BW_MIN_SAMPLE)
+		return;
+
+	bw = div64_u64((u64)len * NSEC_PER_USEC,
+		max_t(u64, pevb->dma_irq_ns - pevb->dma_start_ns, 1));
+	if (pevb->dma_bw)
+		bw = (pevb->dma_bw * 7 + bw) / 8;
+	pevb->dma_bw = max_t(u64, bw, 1);
+}
+
+/*
+ * Descriptor chains. Descriptors are appended to the chain in descs_ptr, and
+ * the whole chain is then submitted to the H2C or C2H engine at once. This
+ * avoids IRQ and setup latency between the parts of a transfer that isn't
+ * physically contiguous, or that is strided. Only the last descriptor in the
+ * chain stops the engine and raises the completion IRQ.
+ */
+
+static void pevb_descs_reset(struct pevb *pevb)
+{
+	pevb->n_descs = 0;
+	pevb->descs_len = 0;
+}
+
+static void pevb_descs_add(struct pevb *pevb, u64 src_adr, u64 dst_adr,
+	u64 len)
+{
+	struct xlnx_dma_desc *desc = &pevb->descs_ptr[pevb->n_descs];
+	dma_addr_t desc_dma_addr = pevb->descs_dma_addr +
+		pevb->n_descs * sizeof(*desc);
+
+	desc->control = XLNX_DMA_DESC_CONTROL_MAGIC;
+	desc->len = len;
+	desc->src_adr = src_adr & 0xffffffffU;
+	desc->src_adr_hi = src_adr >> 32;
+	desc->dst_adr = dst_adr & 0xffffffffU;
+	desc->dst_adr_hi = dst_adr >> 32;
+	desc->nxt_adr = 0;
+	desc->nxt_adr_hi = 0;
+
+	if (pevb->n_descs) {
+		desc--;
+		desc->nxt_adr = desc_dma_addr & 0xffffffffU;
+		desc->nxt_adr_hi = desc_dma_addr >> 32;
+	}
+
+	pevb->n_descs++;
+	pevb->descs_len += len;
+}
+
+static bool pevb_descs_full(struct pevb *pevb)
+{
+	return pevb->n_descs >= PEVB_DESCS_MAX;
+}
+
+/*
+ * Start the DMA engine on the chain. The chain must not be modified until
+ * pevb_descs_wait() returns.
+ */
+static void pevb_descs_start(struct pevb *pevb, bool c2h)
+{
+	struct xlnx_dma_desc *desc = &pevb->descs_ptr[pevb->n_descs - 1];
+
+	desc->control |= XLNX_DMA_DESC_CONTROL_EOP |
+		XLNX_DMA_DESC_CONTROL_COMPLETED |
+		XLNX_DMA_DESC_CONTROL_STOP;
+
+	dev_dbg(pevb->dev, "DMA %s %d descriptors +0x%llx\n",
+		c2h ? "C2H" : "H2C", pevb->n_descs, pevb->descs_len);
+	pevb->xfer->timing.descs += pevb->n_descs;
+
+	pevb_dma_start(pevb, c2h);
+}
+
+static int pevb_descs_wait(struct pevb *pevb, bool c2h)
+{
+	int ret;
+
+	ret = pevb_dma_wait(pevb, c2h);
+	if (!ret)
+		pevb_dma_sample_bw(pevb, pevb->descs_len);
+	pevb_descs_reset(pevb);
+
+	return ret;
+}
+
+static int pevb_descs_submit(struct pevb *pevb, bool c2h)
+{
+	pevb_descs_start(pevb, c2h);
+
+	return pevb_descs_wait(pevb, c2h);
+}
+
+static int pevb_dma_h2c_single(struct pevb *pevb, dma_addr_t pcie_addr,
+	unsigned long ram_offset, unsigned long len)
+{
+	dev_dbg(pevb->dev, "DMA H2C PCI:0x%llx -> BUF:0%04lx +0x%lx\n",
+		pcie_addr, ram_offset, len);
+
+	pevb_descs_reset(pevb);
+	pevb_descs_add(pevb, pcie_addr, ram_offset, len);
+
+	return pevb_descs_submit(pevb, false);
+}
+
+static int pevb_dma_c2h_single(struct pevb *pevb, dma_addr_t pcie_addr,
+	unsigned long ram_offset, unsigned long len)
+{
+	dev_dbg(pevb->dev, "DMA C2H BUF:0x%04lx -> PCI:0x%llx +0x%lx\n",
+		ram_offset, pcie_addr, len);
+
+	pevb_descs_reset(pevb);
+	pevb_descs_add(pevb, ram_offset, pcie_addr, len);
+
+	return pevb_descs_submit(pevb, true);
+}
+
+/*
+ * DMA engine scheduler.
+ *
+ * The DMA engine is owned by one transfer at a time. Waiting transfers are
+ * queued per priority class, and the engine is handed directly to the next
+ * waiter when released; the highest non-empty class always wins. Within a
+ * class, open files share the engine via weighted fair queueing: each
+ * transfer is tagged with a virtual finish time that advances by its length
+ * scaled inversely to the file's weight, and the smallest tag runs first.
+ */
+
+static void pevb_sched_dispatch(struct pevb_sched_class *cls,
+	struct pevb_sched_waiter *waiter, u64 now)
+{
+	u64 wait_ns = now - waiter->queued_ns;
+
+	cls->vtime = waiter->vstart;
+	cls->dispatched++;
+	cls->total_wait_ns += wait_ns;
+	if (wait_ns > cls->max_wait_ns)
+		cls->max_wait_ns = wait_ns;
+}
+
+static void pevb_sched_release(struct pevb *pevb)
+{
+	struct pevb_sched_class *cls;
+	struct pevb_sched_waiter *next = NULL;
+	int prio;
+
+	spin_lock(&pevb->sched_lock);
+
+	for (prio = PICOEVB_PRIO_COUNT - 1; prio >= 0; prio--) {
+		cls = &pevb->sched_classes[prio];
+		next = list_first_entry_or_null(&cls->waiters,
+			struct pevb_sched_waiter, node);
+		if (next)
+			break;
+	}
+
+	if (next) {
+		list_del(&next->node);
+		cls->depth--;
+		pevb_sched_dispatch(cls, next, ktime_get_ns());
+		/* Ownership of the engine passes directly to next */
+		WRITE_ONCE(next->granted, true);
+	} else {
+		pevb->sched_busy = false;
+	}
+
+	spin_unlock(&pevb->sched_lock);
+
+	if (next)
+		wake_up_all(&pevb->sched_wq);
+}
+
+static int pevb_sched_acquire(struct pevb_xfer *xfer, u64 len)
+{
+	struct pevb_file *pevb_file = xfer->pevb_file;
+	struct pevb *pevb = pevb_file->pevb;
+	struct pevb_sched_class *cls;
+	struct pevb_sched_waiter waiter, *pos;
+	int ret;
+
+	waiter.queued_ns = ktime_get_ns();
+	waiter.granted = false;
+
+	spin_lock(&pevb->sched_lock);
+
+	cls = &pevb->sched_classes[pevb_file->sched_prio];
+	waiter.vstart = max(cls->vtime, pevb_file->sched_vfinish);
+	waiter.vfinish = waiter.vstart + div_u64(
+		max_t(u64, len, 1) * PICOEVB_SCHED_WEIGHT_DEFAULT,
+		pevb_file->sched_weight);
+	pevb_file->sched_vfinish = waiter.vfinish;
+
+	/* Waiters are only ever queued while the engine is busy */
+	if (!pevb->sched_busy) {
+		pevb->sched_busy = true;
+		pevb_sched_dispatch(cls, &waiter, waiter.queued_ns);
+		spin_unlock(&pevb->sched_lock);
+		pevb->xfer = xfer;
+		return 0;
+	}
+
+	list_for_each_entry_reverse(pos, &cls->waiters, node) {
+		if (pos->vfinish <= waiter.vfinish)
+			break;
+	}
+	list_add(&waiter.node, &pos->node);
+	cls->depth++;
+	if (cls->depth > cls->max_depth)
+		cls->max_depth = cls->depth;
+
+	spin_unlock(&pevb->sched_lock);
+
+	ret = wait_event_interruptible(pevb->sched_wq, READ_ONCE(waiter.granted));
+	if (!ret) {
+		xfer->timing.queue_wait_ns += ktime_get_ns() -
+			waiter.queued_ns;
+		pevb->xfer = xfer;
+		return 0;
+	}
+
+	spin_lock(&pevb->sched_lock);
+	if (!waiter.granted) {
+		list_del(&waiter.node);
+		cls->depth--;
+		spin_unlock(&pevb->sched_lock);
+		return -ERESTARTSYS;
+	}
+	spin_unlock(&pevb->sched_lock);
+
+	/* Granted concurrently with the signal; pass the engine on */
+	pevb_sched_release(pevb);
+	return -ERESTARTSYS;
+}
+
+/*
+ * Returns true if another transfer should be given the DMA engine before the
+ * engine owner continues with its next slice.
+ */
+static bool pevb_sched_should_yield(struct pevb_file *pevb_file)
+{
+	struct pevb *pevb = pevb_file->pevb;
+	struct pevb_sched_waiter *first;
+	bool yield = false;
+	int prio;
+
+	spin_lock(&pevb->sched_lock);
+	for (prio = PICOEVB_PRIO_COUNT - 1; prio >= (int)pevb_file->sched_prio;
+			prio--) {
+		first = list_first_entry_or_null(
+			&pevb->sched_classes[prio].waiters,
+			struct pevb_sched_waiter, node);
+		if (!first)
+			continue;
+		if (prio > pevb_file->sched_prio ||
+				first->vfinish < pevb_file->sched_vfinish)
+			yield = true;
+		break;
+	}
+	spin_unlock(&pevb->sched_lock);
+
+	return yield;
+}
+
+/*
+ * Called by the DMA engine owner between slices. On error, the engine is no
+ * longer owned.
+ */
+static int pevb_sched_yield(struct pevb_xfer *xfer)
+{
+	struct pevb_file *pevb_file = xfer->pevb_file;
+	if (!pevb_sched_should_yield(pevb_file))
+		return 0;
+
+	pevb_sched_release(pevb_file->pevb);
+	/* The whole transfer was already charged on first acquisition */
+	return pevb_sched_acquire(xfer, 0);
+}
+
+static u64 pevb_sched_slice_len(struct pevb *pevb)
+{
+	unsigned long slice_bytes = READ_ONCE(max_slice_bytes);
+	unsigned int slice_us = READ_ONCE(max_slice_us);
+	u64 len = XLNX_DMA_DESC_LEN_MAX_WORD_ALIGNED;
+
+	if (slice_bytes)
+		len = min_t(u64, len, slice_bytes);
+	if (slice_us && pevb->dma_bw)
+		len = min_t(u64, len, (u64)slice_us * pevb->dma_bw);
+
+	return max_t(u64, round_down(len, SZ_4K), SZ_4K);
+}
+
+/*
+ * The FPGA RAM through which an h2c2h transfer is staged, ram_len bytes at
+ * ram_offset, is re-used by each chunk of the transfer.
+ */
+static int pevb_dma_h2c2h_multi(struct pevb_xfer *xfer,
+	struct pevb_userbuf *src, struct pevb_userbuf *dst, u64 len,
+	u64 ram_offset, u64 ram_len)
+{
+	struct pevb *pevb = xfer->pevb_file->pevb;
+	int ret;
+	u64 overall_len_remaining = len;
+	int src_idx = -1, dst_idx = -1;
+	dma_addr_t src_addr, dst_addr;
+	u64 src_len_remaining = 0, dst_len_remaining = 0;
+	u64 len_chunk, len_slice;
+
+	ret = pevb_sched_acquire(xfer, len);
+	if (ret)
+		return ret;
+
+	/* Each chunk is transferred twice; once in each direction */
+	len_slice = max_t(u64, round_down(pevb_sched_slice_len(pevb) / 2, 4),
+		4);
+
+	while (overall_len_remaining) {
+		if (!src_len_remaining) {
+			src_idx++;
+			if (src_idx >= src->n_dmas) {
+				ret = -EINVAL;
+				goto unlock;
+			}
+			src_addr = src->dmas[src_idx].addr;
+			src_len_remaining = src->dmas[src_idx].len;
+		}
+		if (!dst_len_remaining) {
+			dst_idx++;
+			if (dst_idx >= dst->n_dmas) {
+				ret = -EINVAL;
+				goto unlock;
+			}
+			dst_addr = dst->dmas[dst_idx].addr;
+			dst_len_remaining = dst->dmas[dst_idx].len;
+		}
+
+		len_chunk = min_t(u64, src_len_remaining, dst_len_remaining);
+		len_chunk = min_t(u64, len_chunk, ram_len);
+		len_chunk = min_t(u64, len_chunk, len_slice);
+		len_chunk = min_t(u64, len_chunk, overall_len_remaining);
+
+		ret = pevb_dma_h2c_single(pevb, src_addr, ram_offset,
+			len_chunk);
+		if (ret)
+			goto unlock;
+
+		ret = pevb_dma_c2h_single(pevb, dst_addr, ram_offset,
+			len_chunk);
+		if (ret)
+			goto unlock;
+
+		overall_len_remaining -= len_chunk;
+		src_len_remaining -= len_chunk;
+		dst_len_remaining -= len_chunk;
+		src_addr += len_chunk;
+		dst_addr += len_chunk;
+
+		if (overall_len_remaining) {
+			ret = pevb_sched_yield(xfer);
+			if (ret)
+				return ret;
+		}
+	}
+
+	ret = 0;
+
+unlock:
+	pevb_sched_release(pevb);
+
+	return ret;
+}
+
+/*
+ * Walks forward through a userbuf's DMA chunks, by offset into the buffer.
+ */
+struct pevb_userbuf_cursor {
+	struct pevb_userbuf *ubuf;
+	int idx;
+	/* Offset into the buffer of the start of dmas[idx] */
+	u64 idx_offset;
+};
+
+/*
+ * Find the DMA address of offset within the buffer, and how many bytes from
+ * there are contiguous. The offset must not decrease between calls.
+ */
+static int pevb_userbuf_cursor_seek(struct pevb_userbuf_cursor *cursor,
+	u64 offset, dma_addr_t *addr, u64 *len)
+{
+	struct pevb_userbuf *ubuf = cursor->ubuf;
+
+	while (cursor->idx < ubuf->n_dmas && offset >=
+			cursor->idx_offset + ubuf->dmas[cursor->idx].len) {
+		cursor->idx_offset += ubuf->dmas[cursor->idx].len;
+		cursor->idx++;
+	}
+	if (cursor->idx >= ubuf->n_dmas)
+		return -EINVAL;
+
+	*addr = ubuf->dmas[cursor->idx].addr + (offset - cursor->idx_offset);
+	*len = cursor->idx_offset + ubuf->dmas[cursor->idx].len - offset;
+
+	return 0;
+}
+
+/*
+ * A transfer between a userbuf and FPGA RAM, of height rows each of width
+ * bytes. Each row starts *_pitch bytes after the previous. A 1D transfer is a
+ * single row.
+ */
+struct pevb_dma_rect {
+	u64 width;
+	u64 height;
+	/* Offset into the userbuf of the first row */
+	u64 ubuf_offset;
+	u64 ubuf_pitch;
+	u64 ram_offset;
+	u64 ram_pitch;
+};
+
+/*
+ * Unlike h2c2h transfers, where each chunk re-uses the same FPGA RAM, the
+ * chunks of an h2c or c2h transfer don't contend for FPGA RAM locations. So,
+ * they're all described in a single descriptor chain (per slice).
+ */
+static int pevb_dma_rect(struct pevb_xfer *xfer, bool c2h,
+	struct pevb_userbuf *ubuf, const struct pevb_dma_rect *rect)
+{
+	struct pevb *pevb = xfer->pevb_file->pevb;
+	struct pevb_userbuf_cursor cursor = { .ubuf = ubuf };
+	int ret;
+	u64 row, col, ubuf_offset, ram_offset;
+	dma_addr_t ubuf_addr;
+	u64 len_chunk, len_slice;
+
+	ret = pevb_sched_acquire(xfer, rect->width * rect->height);
+	if (ret)
+		return ret;
+
+	len_slice = pevb_sched_slice_len(pevb);
+	pevb_descs_reset(pevb);
+
+	for (row = 0; row < rect->height; row++) {
+		for (col = 0; col < rect->width; col += len_chunk) {
+			ubuf_offset = rect->ubuf_offset +
+				row * rect->ubuf_pitch + col;
+			ret = pevb_userbuf_cursor_seek(&cursor, ubuf_offset,
+				&ubuf_addr, &len_chunk);
+			if (ret)
+				goto unlock;
+
+			/*
+			 * We assume the caller has verified that the RAM
+			 * side of the transfer doesn't exceed FPGA RAM
+			 * capacity.
+			 */
+			ram_offset = rect->ram_offset + row * rect->ram_pitch +
+				col;
+			len_chunk = min_t(u64, len_chunk, rect->width - col);
+			len_chunk = min_t(u64, len_chunk,
+				len_slice - pevb->descs_len);
+
+			if (c2h)
+				pevb_descs_add(pevb, ram_offset, ubuf_addr,
+					len_chunk);
+			else
+				pevb_descs_add(pevb, ubuf_addr, ram_offset,
+					len_chunk);
+
+			if (pevb->descs_len < len_slice &&
+					!pevb_descs_full(pevb))
+				continue;
+
+			ret = pevb_descs_submit(pevb, c2h);
+			if (ret)
+				goto unlock;
+
+			if (row + 1 < rect->height ||
+					col + len_chunk < rect->width) {
+				ret = pevb_sched_yield(xfer);
+				if (ret)
+					return ret;
+			}
+		}
+	}
+
+	if (pevb->n_descs)
+		ret = pevb_descs_submit(pevb, c2h);
+	else
+		ret = 0;
+
+unlock:
+	pevb_sched_release(pevb);
+
+	return ret;
+}
+
+static int pevb_dma_h2c_multi(struct pevb_xfer *xfer,
+	struct pevb_userbuf *src, u64 dst_offset, u64 len)
+{
+	struct pevb_dma_rect rect = {
+		.width = len,
+		.height = 1,
+		.ubuf_pitch = len,
+		.ram_offset = dst_offset,
+		.ram_pitch = len,
+	};
+
+	return pevb_dma_rect(xfer, false, src, &rect);
+}
+
+static int pevb_dma_c2h_multi(struct pevb_xfer *xfer, u64 src_offset,
+	struct pevb_userbuf *dst, u64 len)
+{
+	struct pevb_dma_rect rect = {
+		.width = len,
+		.height = 1,
+		.ubuf_pitch = len,
+		.ram_offset = src_offset,
+		.ram_pitch = len,
+	};
+
+	return pevb_dma_rect(xfer, true, dst, &rect);
+}
+
+static u64 pevb_stream_window(enum pevb_mem_kind kind, u64 len)
+{
+	unsigned long window = READ_ONCE(stream_window_bytes);
+
+	if (kind != PEVB_MEM_MALLOC || !window || len <= window)
+		return 0;
+
+	return max_t(u64, round_down(window, PAGE_SIZE), PAGE_SIZE);
+}
+
+/*
+ * A 1D transfer between host memory at addr and FPGA RAM, which pins and maps
+ * the host memory one window at a time. While the DMA engine works on one
+ * window, the next is pinned and mapped, and each window is released as soon
+ * as its DMA completes. So DMA starts sooner, and the memory pinned at once is
+ * bounded, compared to preparing the whole buffer up front.
+ */
+static int pevb_dma_stream(struct pevb_xfer *xfer, bool c2h, u64 addr,
+	u64 ram_offset, u64 len, u64 window)
+{
+	struct pevb *pevb = xfer->pevb_file->pevb;
+	struct pevb_userbuf ubufs[2] = {{0}};
+	struct pevb_userbuf *cur = &ubufs[0], *next = &ubufs[1];
+	struct pevb_userbuf_cursor cursor;
+	int ret, pin_ret;
+	u64 win_offset, win_len, next_offset, offset, ram_addr;
+	u64 len_chunk, len_slice;
+	dma_addr_t ubuf_addr;
+	bool next_pinned = false;
+
+	win_offset = 0;
+	win_len = min(window, len);
+	ret = pevb_get_userbuf(xfer, cur, PEVB_MEM_MALLOC, addr, win_len,
+		!c2h);
+	if (ret)
+		goto put_userbufs;
+
+	ret = pevb_sched_acquire(xfer, len);
+	if (ret)
+		goto put_userbufs;
+
+	len_slice = pevb_sched_slice_len(pevb);
+
+	for (;;) {
+		cursor.ubuf = cur;
+		cursor.idx = 0;
+		cursor.idx_offset = 0;
+		next_offset = win_offset + win_len;
+
+		for (offset = 0; offset < win_len; ) {
+			pevb_descs_reset(pevb);
+			while (offset < win_len &&
+					pevb->descs_len < len_slice &&
+					!pevb_descs_full(pevb)) {
+				ret = pevb_userbuf_cursor_seek(&cursor, offset,
+					&ubuf_addr, &len_chunk);
+				if (ret)
+					goto unlock;
+				len_chunk = min_t(u64, len_chunk,
+					win_len - offset);
+				len_chunk = min_t(u64, len_chunk,
+					len_slice - pevb->descs_len);
+				ram_addr = ram_offset + win_offset + offset;
+				if (c2h)
+					pevb_descs_add(pevb, ram_addr,
+						ubuf_addr, len_chunk);
+				else
+					pevb_descs_add(pevb, ubuf_addr,
+						ram_addr, len_chunk);
+				offset += len_chunk;
+			}
+
+			pevb_descs_start(pevb, c2h);
+			pin_ret = 0;
+			if (!next_pinned && next_offset < len) {
+				next_pinned = true;
+				pin_ret = pevb_get_userbuf(xfer, next,
+					PEVB_MEM_MALLOC, addr + next_offset,
+					min(window, len - next_offset), !c2h);
+			}
+			ret = pevb_descs_wait(pevb, c2h);
+			if (!ret)
+				ret = pin_ret;
+			if (ret)
+				goto unlock;
+
+			if (next_offset < len || offset < win_len) {
+				ret = pevb_sched_yield(xfer);
+				if (ret)
+					goto put_userbufs;
+			}
+		}
+
+		pevb_put_userbuf(xfer, cur);
+		memset(cur, 0, sizeof(*cur));
+		if (next_offset >= len)
+			break;
+
+		swap(cur, next);
+		next_pinned = false;
+		win_offset = next_offset;
+		win_len = min(window, len - win_offset);
+	}
+
+	ret = 0;
+
+unlock:
+	pevb_sched_release(pevb);
+put_userbufs:
+	pevb_put_userbuf(xfer, next);
+	pevb_put_userbuf(xfer, cur);
+
+	return ret;
+}
+
+static void pevb_bounce_sample(u64 *avg, u64 sample)
+{
+	u64 old = READ_ONCE(*avg);
+
+	WRITE_ONCE(*avg, old ? (old * 7 + sample) / 8 : sample);
+}
+
+/*
+ * Whether a transfer of len bytes of host memory should be copied through a
+ * bounce buffer. Copying costs time in proportion to len, whereas pinning,
+ * mapping and unpinning a small buffer costs roughly a fixed amount, so
+ * bouncing wins below the length at which the two are equal.
+ */
+static bool pevb_bounce_wanted(struct pevb *pevb, bool c2h, u64 len)
+{
+	struct pevb_bounce_chan *chan = &pevb->bounce[c2h];
+	long threshold = READ_ONCE(bounce_threshold);
+	u64 pin_ns, copy_bw;
+	bool wanted;
+
+	if (!len || len > PEVB_BOUNCE_SIZE || !threshold || !chan->free)
+		return false;
+	if (threshold > 0)
+		return len <= threshold;
+
+	/* Measure each path at least once */
+	pin_ns = READ_ONCE(chan->pin_ns);
+	copy_bw = READ_ONCE(chan->copy_bw);
+	if (!pin_ns)
+		return false;
+	if (!copy_bw)
+		return true;
+
+	wanted = len * 1000 < pin_ns * copy_bw;
+	if (!(++chan->decisions % PEVB_BOUNCE_EXPLORE))
+		wanted = !wanted;
+
+	return wanted;
+}
+
+/*
+ * Record the cost of a small transfer that was pinned, from the timing of the
+ * current ioctl.
+ */
+static void pevb_bounce_sample_pin(struct pevb_xfer *xfer, bool c2h,
+	u64 len)
+{
+	struct picoevb_rdma_dma_timing *timing = &xfer->timing;
+
+	if (len > PEVB_BOUNCE_SIZE)
+		return;
+
+	pevb_bounce_sample(&xfer->pevb_file->pevb->bounce[c2h].pin_ns,
+		timing->pin_ns + timing->map_ns + timing->unmap_ns);
+}
+
+static int pevb_bounce_get(struct pevb_bounce_chan *chan)
+{
+	unsigned long free;
+	int i;
+
+	for (;;) {
+		free = READ_ONCE(chan->free);
+		if (!free)
+			return -1;
+		i = __ffs(free);
+		if (test_and_clear_bit(i, &chan->free))
+			return i;
+	}
+}
+
+static void pevb_bounce_put(struct pevb_bounce_chan *chan, int i)
+{
+	set_bit(i, &chan->free);
+}
+
+/*
+ * A small 1D transfer between host memory at addr and FPGA RAM, copied
+ * through one of the channel's bounce buffers. The copy is done while not
+ * holding the DMA engine. Returns -EBUSY, having done nothing, if all of the
+ * channel's bounce buffers are in use.
+ */
+static int pevb_dma_bounce(struct pevb_xfer *xfer, bool c2h, u64 addr,
+	u64 ram_offset, u64 len)
+{
+	struct pevb *pevb = xfer->pevb_file->pevb;
+	struct pevb_bounce_chan *chan = &pevb->bounce[c2h];
+	void __user *uaddr = (void __user *)(uintptr_t)addr;
+	int i, ret;
+	u64 ts, copy_ns = 0;
+
+	i = pevb_bounce_get(chan);
+	if (i < 0)
+		return -EBUSY;
+
+	if (!c2h) {
+		ts = ktime_get_ns();
+		if (copy_from_user(chan->cpu_addr[i], uaddr, len)) {
+			ret = -EFAULT;
+			goto put_bounce;
+		}
+		copy_ns = ktime_get_ns() - ts;
+	}
+
+	ret = pevb_sched_acquire(xfer, len);
+	if (ret)
+		goto put_bounce;
+	if (c2h)
+		ret = pevb_dma_c2h_single(pevb, chan->dma_addr[i], ram_offset,
+			len);
+	else
+		ret = pevb_dma_h2c_single(pevb, chan->dma_addr[i], ram_offset,
+			len);
+	pevb_sched_release(pevb);
+	if (ret)
+		goto put_bounce;
+
+	if (c2h) {
+		ts = ktime_get_ns();
+		if (copy_to_user(uaddr, chan->cpu_addr[i], len)) {
+			ret = -EFAULT;
+			goto put_bounce;
+		}
+		copy_ns = ktime_get_ns() - ts;
+	}
+
+	xfer->timing.pin_ns += copy_ns;
+	pevb_bounce_sample(&chan->copy_bw,
+		div64_u64(len * 1000, max_t(u64, copy_ns, 1)));
+
+put_bounce:
+	pevb_bounce_put(chan, i);
+
+	return ret;
+}
+
+/*
+ * Copy a DMA ioctl's parameters back to user-space, followed by the transfer's
+ * timing if it was requested.
+ */
+static int pevb_dma_copy_to_user(struct pevb_xfer *xfer,
+	void __user *argp, const void *params, size_t size, bool timing)
+{
+	if (copy_to_user(argp, params, size))
+		return -EFAULT;
+	if (timing && copy_to_user(argp + size, &xfer->timing,
+			sizeof(xfer->timing)))
+		return -EFAULT;
+
+	return 0;
+}
+
+static void pevb_stats_count(struct pevb_chan_stats *stats, u64 len, int ret,
+	u64 pin_ns, u64 map_ns)
+{
+	if (ret) {
+		if (ret != -ERESTARTSYS)
+			atomic64_inc(&stats->errors);
+		return;
+	}
+
+	atomic64_inc(&stats->transfers);
+	atomic64_add(len, &stats->bytes);
+	atomic64_add(pin_ns, &stats->pin_ns);
+	atomic64_add(map_ns, &stats->map_ns);
+}
+
+/*
+ * Count a finished transfer of len bytes, whose result was ret, in the card's
+ * and the file's stats for each channel it used. Pinning and mapping time is
+ * counted once, on the first of those channels.
+ */
+static void pevb_xfer_account(struct pevb_xfer *xfer, bool h2c, bool c2h,
+	u64 len, int ret)
+{
+	struct pevb_file *pevb_file = xfer->pevb_file;
+	struct pevb *pevb = pevb_file->pevb;
+	u64 pin_ns = xfer->timing.pin_ns;
+	u64 map_ns = xfer->timing.map_ns + xfer->timing.unmap_ns;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		if (!(i ? c2h : h2c))
+			continue;
+		pevb_stats_count(&pevb->stats[i], len, ret, pin_ns, map_ns);
+		pevb_stats_count(&pevb_file->stats[i], len, ret, pin_ns,
+			map_ns);
+		pin_ns = 0;
+		map_ns = 0;
 	}
+}
+
+#define H2C2H_VALID_FLAGS ( \
+	PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA | \
+	PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA | \
+	PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA_VA | \
+	PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA_VA | \
+	PICOEVB_H2C2H_DMA_FLAG_TIMING \
+)
+
+static int pevb_ioctl_h2c2h_dma(struct pevb_file *pevb_file, unsigned long arg)
+{
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	struct pevb *pevb = pevb_file->pevb;
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_h2c2h_dma dma_params;
+	struct pevb_userbuf src_ubuf = {0}, dst_ubuf = {0};
+	struct pevb_ram_region staging;
+	enum pevb_mem_kind src_kind, dst_kind;
+	int ret;
+	u64 ts, te;
+
+	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
+		return -EFAULT;
+
+	if (dma_params.flags & ~H2C2H_VALID_FLAGS)
+		return -EINVAL;
+
+	src_kind = pevb_mem_kind(dma_params.flags,
+		PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA,
+		PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA_VA);
+	dst_kind = pevb_mem_kind(dma_params.flags,
+		PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA,
+		PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA_VA);
+	if (src_kind == PEVB_MEM_INVALID || dst_kind == PEVB_MEM_INVALID)
+		return -EINVAL;
+
+	ret = pevb_get_userbuf(&xfer, &src_ubuf, src_kind, dma_params.src,
+		dma_params.len, 1);
+	if (ret)
+		goto put_userbuf_src;
+
+	ret = pevb_get_userbuf(&xfer, &dst_ubuf, dst_kind, dma_params.dst,
+		dma_params.len, 0);
+	if (ret)
+		goto put_userbuf_dst;
+
+	ret = pevb_ram_alloc_staging(pevb, &staging, dma_params.len);
+	if (ret)
+		goto put_userbuf_dst;
+
+	ts = ktime_get_ns();
+	ret = pevb_dma_h2c2h_multi(&xfer, &src_ubuf, &dst_ubuf,
+		dma_params.len, staging.offset, staging.len);
+	te = ktime_get_ns();
+	if (!ret)
+		dma_params.dma_time_ns = te - ts;
+
+	pevb_ram_free_staging(pevb, &staging);
+
+put_userbuf_dst:
+	pevb_put_userbuf(&xfer, &dst_ubuf);
+put_userbuf_src:
+	pevb_put_userbuf(&xfer, &src_ubuf);
+	pevb_xfer_account(&xfer, true, true, dma_params.len, ret);
+	if (!ret)
+		ret = pevb_dma_copy_to_user(&xfer, argp, &dma_params,
+			sizeof(dma_params),
+			dma_params.flags & PICOEVB_H2C2H_DMA_FLAG_TIMING);
+	pevb_pin_cache_reap(pevb_file);
 
 	return ret;
 }
 
-static int pevb_dma(struct pevb *pevb, bool c2h)
+static int pevb_ioctl_card_info(struct pevb_file *pevb_file, unsigned long arg)
 {
-	u32 chan_offset, irq_int_en_bit_offset, sgma_ctrl_bit;
-	u32 reg, val;
+	struct pevb *pevb = pevb_file->pevb;
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_card_info card_info_params = {0};
 	int ret;
 
-	if (c2h) {
-		chan_offset = XLNX_REG(C2H, 0, H2C_CTRL) -
-			XLNX_REG(H2C, 0, H2C_CTRL);
-		irq_int_en_bit_offset =
-			XLNX_DMA_IRQ_CH_C2H_BIT(0, pevb->drvdata->num_h2c_chans) -
-			XLNX_DMA_IRQ_CH_H2C_BIT(0);
-		sgma_ctrl_bit = XLNX_DMA_SGDMA_CTRL_C2H_DSC_HALT_SHIFT;
-	} else {
-		chan_offset = 0;
-		irq_int_en_bit_offset = 0;
-		sgma_ctrl_bit = XLNX_DMA_SGDMA_CTRL_H2C_DSC_HALT_SHIFT;
+	card_info_params.fpga_ram_size = pevb->drvdata->fpga_ram_size;
+
+	ret = copy_to_user(argp, &card_info_params, sizeof(card_info_params));
+	if (ret)
+		return ret;
+
+	return 0;
+}
+
+#define H2C_VALID_FLAGS ( \
+	PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA | \
+	PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA_VA | \
+	PICOEVB_H2C_DMA_FLAG_TIMING | \
+	PICOEVB_H2C_DMA_FLAG_DST_IS_RAM \
+)
+
+static int pevb_ioctl_h2c_dma(struct pevb_file *pevb_file, unsigned long arg)
+{
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	struct pevb *pevb = pevb_file->pevb;
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_h2c_dma dma_params;
+	struct pevb_userbuf src_ubuf = {0};
+	struct pevb_ram_region *ram_region;
+	enum pevb_mem_kind src_kind;
+	int ret;
+	u64 ts, te, window, ram_offset;
+
+	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
+		return -EFAULT;
+
+	if (dma_params.flags & ~H2C_VALID_FLAGS)
+		return -EINVAL;
+
+	src_kind = pevb_mem_kind(dma_params.flags,
+		PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA,
+		PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA_VA);
+	if (src_kind == PEVB_MEM_INVALID)
+		return -EINVAL;
+
+	ret = pevb_ram_resolve_get(pevb_file,
+		dma_params.flags & PICOEVB_H2C_DMA_FLAG_DST_IS_RAM,
+		dma_params.dst, dma_params.len, &ram_offset, &ram_region);
+	if (ret)
+		goto put_userbuf_src;
+
+	if (src_kind == PEVB_MEM_MALLOC &&
+			pevb_bounce_wanted(pevb, false, dma_params.len)) {
+		ts = ktime_get_ns();
+		ret = pevb_dma_bounce(&xfer, false, dma_params.src,
+			ram_offset, dma_params.len);
+		te = ktime_get_ns();
+		if (ret != -EBUSY) {
+			if (!ret)
+				dma_params.dma_time_ns = te - ts;
+			goto put_userbuf_src;
+		}
 	}
 
-	reinit_completion(&pevb->dma_xfer_cmpl);
+	window = pevb_stream_window(src_kind, dma_params.len);
+	if (window) {
+		ts = ktime_get_ns();
+		ret = pevb_dma_stream(&xfer, false, dma_params.src,
+			ram_offset, dma_params.len, window);
+		te = ktime_get_ns();
+		if (!ret)
+			dma_params.dma_time_ns = te - ts;
+		goto put_userbuf_src;
+	}
 
-	/* Program descriptor location */
-	reg = XLNX_REG(H2C_SGDMA, 0, H2C_SGDMA_DESC_LOW_ADDR) + chan_offset;
-	val = pevb->descs_dma_addr & 0xffffffffU;
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	reg = XLNX_REG(H2C_SGDMA, 0, H2C_SGDMA_DESC_HIGH_ADDR) + chan_offset;
-	val = pevb->descs_dma_addr >> 32;
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	reg = XLNX_REG(H2C_SGDMA, 0, H2C_SGDMA_DESC_ADJACENT) + chan_offset;
-	pevb_writel(pevb, BAR_DMA, 0, reg);
-	/* Clear any pending status */
-	reg = XLNX_REG(H2C, 0, H2C_STATUS_RD_CLR) + chan_offset;
-	pevb_readl(pevb, BAR_DMA, reg);
-	/* Enable all IRQs in channel */
-	reg = XLNX_REG(H2C, 0, H2C_INT_EN) + chan_offset;
-	pevb_writel(pevb, BAR_DMA, 0xffffffffU, reg);
-	/* Enable channel IRQ at top level */
-	reg = XLNX_REG(IRQ, 0, IRQ_CH_INT_EN_W1S);
-	val = XLNX_DMA_IRQ_CH_H2C_BIT(irq_int_en_bit_offset);
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	/* Arm perf counters */
-	reg = XLNX_REG(H2C, 0, H2C_PERF_CTRL) + chan_offset;
-	val = XLNX_DMA_H2C_PERF_CTRL_RUN | XLNX_DMA_H2C_PERF_CTRL_AUTO_STOP;
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	/* Start DMA */
-	reg = XLNX_REG(H2C, 0, H2C_CTRL) + chan_offset;
-	val = (XLNX_DMA_H2C_CTRL_IE_DESC_ERR_MASK <<
-			XLNX_DMA_H2C_CTRL_IE_DESC_ERR_SHIFT) |
-		(XLNX_DMA_H2C_CTRL_IE_WRITE_ERR_MASK <<
-			XLNX_DMA_H2C_CTRL_IE_WRITE_ERR_SHIFT) |
-		(XLNX_DMA_H2C_CTRL_IE_READ_ERR_MASK <<
-			XLNX_DMA_H2C_CTRL_IE_READ_ERR_SHIFT) |
-		XLNX_DMA_H2C_CTRL_IE_IDLE_STOPPED |
-		XLNX_DMA_H2C_CTRL_IE_INVALID_LEN |
-		XLNX_DMA_H2C_CTRL_IE_MAGIC_STOPPED |
-		XLNX_DMA_H2C_CTRL_IE_ALIGN_MISMATCH |
-		XLNX_DMA_H2C_CTRL_IE_DESC_COMPLETED |
-		XLNX_DMA_H2C_CTRL_IE_DESC_STOPPED |
-		XLNX_DMA_H2C_CTRL_RUN;
-	/*
-	 * Ensure all memory writes for descriptor and configuration registers
-	 * have completed before triggering the DMA operation.
-	 */
-	wmb();
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	/* Wait for DMA completion (via IRQ) */
-	ret = wait_for_completion_interruptible(&pevb->dma_xfer_cmpl);
+	ret = pevb_get_userbuf(&xfer, &src_ubuf, src_kind, dma_params.src,
+		dma_params.len, 1);
 	if (ret)
-		dev_err(&pevb->pdev->dev, "DMA interrupted\n");
-	else {
-		val = c2h ? pevb->c2h_error : pevb->h2c_error;
-		if (val) {
-			dev_err(&pevb->pdev->dev, "DMA failed\n");
-			ret = -EIO;
+		goto put_userbuf_src;
+
+	ts = ktime_get_ns();
+	ret = pevb_dma_h2c_multi(&xfer, &src_ubuf, ram_offset,
+		dma_params.len);
+	te = ktime_get_ns();
+	if (!ret)
+		dma_params.dma_time_ns = te - ts;
+
+put_userbuf_src:
+	pevb_put_userbuf(&xfer, &src_ubuf);
+	if (ram_region)
+		pevb_ram_put(pevb, ram_region);
+	pevb_xfer_account(&xfer, true, false, dma_params.len, ret);
+	/* n_dmas is only set if src_ubuf was pinned */
+	if (!ret && src_kind == PEVB_MEM_MALLOC && src_ubuf.n_dmas)
+		pevb_bounce_sample_pin(&xfer, false, dma_params.len);
+	if (!ret)
+		ret = pevb_dma_copy_to_user(&xfer, argp, &dma_params,
+			sizeof(dma_params),
+			dma_params.flags & PICOEVB_H2C_DMA_FLAG_TIMING);
+	pevb_pin_cache_reap(pevb_file);
+
+	return ret;
+}
+
+#define C2H_VALID_FLAGS ( \
+	PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA | \
+	PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA_VA | \
+	PICOEVB_C2H_DMA_FLAG_TIMING | \
+	PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM \
+)
+
+static int pevb_ioctl_c2h_dma(struct pevb_file *pevb_file, unsigned long arg)
+{
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	struct pevb *pevb = pevb_file->pevb;
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_c2h_dma dma_params;
+	struct pevb_userbuf dst_ubuf = {0};
+	struct pevb_ram_region *ram_region;
+	enum pevb_mem_kind dst_kind;
+	int ret;
+	u64 ts, te, window, ram_offset;
+
+	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
+		return -EFAULT;
+
+	if (dma_params.flags & ~C2H_VALID_FLAGS)
+		return -EINVAL;
+
+	dst_kind = pevb_mem_kind(dma_params.flags,
+		PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA,
+		PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA_VA);
+	if (dst_kind == PEVB_MEM_INVALID)
+		return -EINVAL;
+
+	ret = pevb_ram_resolve_get(pevb_file,
+		dma_params.flags & PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM,
+		dma_params.src, dma_params.len, &ram_offset, &ram_region);
+	if (ret)
+		goto put_userbuf_dst;
+
+	if (dst_kind == PEVB_MEM_MALLOC &&
+			pevb_bounce_wanted(pevb, true, dma_params.len)) {
+		ts = ktime_get_ns();
+		ret = pevb_dma_bounce(&xfer, true, dma_params.dst,
+			ram_offset, dma_params.len);
+		te = ktime_get_ns();
+		if (ret != -EBUSY) {
+			if (!ret)
+				dma_params.dma_time_ns = te - ts;
+			goto put_userbuf_dst;
 		}
 	}
-	/* Disable channel IRQ at top level */
-	reg = XLNX_REG(IRQ, 0, IRQ_CH_INT_EN_W1C);
-	val = XLNX_DMA_IRQ_CH_H2C_BIT(irq_int_en_bit_offset);
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	/* Disable all IRQs in channel */
-	reg = XLNX_REG(H2C, 0, H2C_INT_EN) + chan_offset;
-	pevb_writel(pevb, BAR_DMA, 0, reg);
-	/* Cancel descriptor fetches */
-	reg = XLNX_REG(SGDMA, 0, SGDMA_CTRL_W1S);
-	val = BIT(sgma_ctrl_bit);
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	reg = XLNX_REG(SGDMA, 0, SGDMA_CTRL_W1C);
-	pevb_writel(pevb, BAR_DMA, val, reg);
-	/* Cancel channel operation */
-	reg = XLNX_REG(H2C, 0, H2C_CTRL) + chan_offset;
-	pevb_writel(pevb, BAR_DMA, 0, reg);
-	/* Dump performance counters */
-	reg = XLNX_REG(H2C, 0, H2C_PERF_CYC_HIGH) + chan_offset;
-	val = pevb_readl(pevb, BAR_DMA, reg);
-	dev_dbg(&pevb->pdev->dev, "CYC_HIGH 0x%08x\n", val);
-	reg = XLNX_REG(H2C, 0, H2C_PERF_CYC_LOW) + chan_offset;
-	val = pevb_readl(pevb, BAR_DMA, reg);
-	dev_dbg(&pevb->pdev->dev, "CYC_LOW  0x%08x\n", val);
-	reg = XLNX_REG(H2C, 0, H2C_PERF_DAT_HIGH) + chan_offset;
-	val = pevb_readl(pevb, BAR_DMA, reg);
-	dev_dbg(&pevb->pdev->dev, "DAT_HIGH 0x%08x\n", val);
-	reg = XLNX_REG(H2C, 0, H2C_PERF_DAT_LOW) + chan_offset;
-	val = pevb_readl(pevb, BAR_DMA, reg);
-	dev_dbg(&pevb->pdev->dev, "DAT_LOW  0x%08x\n", val);
+
+	window = pevb_stream_window(dst_kind, dma_params.len);
+	if (window) {
+		ts = ktime_get_ns();
+		ret = pevb_dma_stream(&xfer, true, dma_params.dst,
+			ram_offset, dma_params.len, window);
+		te = ktime_get_ns();
+		if (!ret)
+			dma_params.dma_time_ns = te - ts;
+		goto put_userbuf_dst;
+	}
+
+	ret = pevb_get_userbuf(&xfer, &dst_ubuf, dst_kind, dma_params.dst,
+		dma_params.len, 0);
+	if (ret)
+		goto put_userbuf_dst;
+
+	ts = ktime_get_ns();
+	ret = pevb_dma_c2h_multi(&xfer, ram_offset, &dst_ubuf,
+		dma_params.len);
+	te = ktime_get_ns();
+	if (!ret)
+		dma_params.dma_time_ns = te - ts;
+
+put_userbuf_dst:
+	pevb_put_userbuf(&xfer, &dst_ubuf);
+	if (ram_region)
+		pevb_ram_put(pevb, ram_region);
+	pevb_xfer_account(&xfer, false, true, dma_params.len, ret);
+	/* n_dmas is only set if dst_ubuf was pinned */
+	if (!ret && dst_kind == PEVB_MEM_MALLOC && dst_ubuf.n_dmas)
+		pevb_bounce_sample_pin(&xfer, true, dma_params.len);
+	if (!ret)
+		ret = pevb_dma_copy_to_user(&xfer, argp, &dma_params,
+			sizeof(dma_params),
+			dma_params.flags & PICOEVB_C2H_DMA_FLAG_TIMING);
+	pevb_pin_cache_reap(pevb_file);
+
+	return ret;
+}
+
+/*
+ * Calculate the span of memory covered by a 2D transfer, from the start of the
+ * first row to the end of the last.
+ */
+static int pevb_rect_extent(u64 width, u64 height, u64 pitch, u64 *extent)
+{
+	if (!width || !height || pitch < width)
+		return -EINVAL;
+
+	if (height - 1 > div64_u64(U64_MAX - width, pitch))
+		return -EINVAL;
+
+	*extent = (height - 1) * pitch + width;
+
+	return 0;
+}
+
+static int pevb_ioctl_h2c_2d_dma(struct pevb_file *pevb_file,
+	unsigned long arg)
+{
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_h2c_2d_dma dma_params;
+	struct pevb_userbuf src_ubuf = {0};
+	struct pevb_dma_rect rect = {0};
+	struct pevb_ram_region *ram_region;
+	enum pevb_mem_kind src_kind;
+	u64 src_extent, dst_extent;
+	int ret;
+	u64 ts, te;
+
+	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
+		return -EFAULT;
+
+	if (dma_params.flags & ~H2C_VALID_FLAGS)
+		return -EINVAL;
+
+	src_kind = pevb_mem_kind(dma_params.flags,
+		PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA,
+		PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA_VA);
+	if (src_kind == PEVB_MEM_INVALID)
+		return -EINVAL;
+
+	ret = pevb_rect_extent(dma_params.width, dma_params.height,
+		dma_params.src_pitch, &src_extent);
+	if (ret)
+		return ret;
+	ret = pevb_rect_extent(dma_params.width, dma_params.height,
+		dma_params.dst_pitch, &dst_extent);
+	if (ret)
+		return ret;
+
+	rect.width = dma_params.width;
+	rect.height = dma_params.height;
+	rect.ubuf_pitch = dma_params.src_pitch;
+	rect.ram_pitch = dma_params.dst_pitch;
+
+	ret = pevb_ram_resolve_get(pevb_file,
+		dma_params.flags & PICOEVB_H2C_DMA_FLAG_DST_IS_RAM,
+		dma_params.dst, dst_extent, &rect.ram_offset, &ram_region);
+	if (ret)
+		goto put_userbuf_src;
+
+	ret = pevb_get_userbuf(&xfer, &src_ubuf, src_kind, dma_params.src,
+		src_extent, 1);
+	if (ret)
+		goto put_userbuf_src;
+
+	ts = ktime_get_ns();
+	ret = pevb_dma_rect(&xfer, false, &src_ubuf, &rect);
+	te = ktime_get_ns();
+	if (!ret)
+		dma_params.dma_time_ns = te - ts;
+
+put_userbuf_src:
+	pevb_put_userbuf(&xfer, &src_ubuf);
+	if (ram_region)
+		pevb_ram_put(pevb_file->pevb, ram_region);
+	pevb_xfer_account(&xfer, true, false, rect.width * rect.height, ret);
+	if (!ret)
+		ret = pevb_dma_copy_to_user(&xfer, argp, &dma_params,
+			sizeof(dma_params),
+			dma_params.flags & PICOEVB_H2C_DMA_FLAG_TIMING);
+	pevb_pin_cache_reap(pevb_file);
 
 	return ret;
 }
 
-static int pevb_dma_h2c_single(struct pevb *pevb, dma_addr_t pcie_addr,
-	unsigned long ram_offset, unsigned long len)
+static int pevb_ioctl_c2h_2d_dma(struct pevb_file *pevb_file,
+	unsigned long arg)
 {
-	struct xlnx_dma_desc *desc;
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_c2h_2d_dma dma_params;
+	struct pevb_userbuf dst_ubuf = {0};
+	struct pevb_dma_rect rect = {0};
+	struct pevb_ram_region *ram_region;
+	enum pevb_mem_kind dst_kind;
+	u64 src_extent, dst_extent;
+	int ret;
+	u64 ts, te;
 
-	dev_dbg(&pevb->pdev->dev, "DMA H2C PCI:0x%llx -> BUF:0%04lx +0x%lx\n",
-		pcie_addr, ram_offset, len);
+	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
+		return -EFAULT;
 
-	/* Create descriptor */
-	desc = pevb->descs_ptr;
-	desc->control = XLNX_DMA_DESC_CONTROL_MAGIC |
-		XLNX_DMA_DESC_CONTROL_EOP |
-		XLNX_DMA_DESC_CONTROL_COMPLETED |
-		XLNX_DMA_DESC_CONTROL_STOP;
-	desc->len = len;
-	desc->src_adr = pcie_addr & 0xffffffffU;
-	desc->src_adr_hi = pcie_addr >> 32;
-	desc->dst_adr = ram_offset & 0xffffffffU;
-	desc->dst_adr_hi = ram_offset >> 32;
-	desc->nxt_adr = 0;
-	desc->nxt_adr_hi = 0;
+	if (dma_params.flags & ~C2H_VALID_FLAGS)
+		return -EINVAL;
+
+	dst_kind = pevb_mem_kind(dma_params.flags,
+		PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA,
+		PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA_VA);
+	if (dst_kind == PEVB_MEM_INVALID)
+		return -EINVAL;
+
+	ret = pevb_rect_extent(dma_params.width, dma_params.height,
+		dma_params.src_pitch, &src_extent);
+	if (ret)
+		return ret;
+	ret = pevb_rect_extent(dma_params.width, dma_params.height,
+		dma_params.dst_pitch, &dst_extent);
+	if (ret)
+		return ret;
 
-	return pevb_dma(pevb, false);
+	rect.width = dma_params.width;
+	rect.height = dma_params.height;
+	rect.ubuf_pitch = dma_params.dst_pitch;
+	rect.ram_pitch = dma_params.src_pitch;
+
+	ret = pevb_ram_resolve_get(pevb_file,
+		dma_params.flags & PICOEVB_C2H_DMA_FLAG_SRC_IS_RAM,
+		dma_params.src, src_extent, &rect.ram_offset, &ram_region);
+	if (ret)
+		goto put_userbuf_dst;
+
+	ret = pevb_get_userbuf(&xfer, &dst_ubuf, dst_kind, dma_params.dst,
+		dst_extent, 0);
+	if (ret)
+		goto put_userbuf_dst;
+
+	ts = ktime_get_ns();
+	ret = pevb_dma_rect(&xfer, true, &dst_ubuf, &rect);
+	te = ktime_get_ns();
+	if (!ret)
+		dma_params.dma_time_ns = te - ts;
+
+put_userbuf_dst:
+	pevb_put_userbuf(&xfer, &dst_ubuf);
+	if (ram_region)
+		pevb_ram_put(pevb_file->pevb, ram_region);
+	pevb_xfer_account(&xfer, false, true, rect.width * rect.height, ret);
+	if (!ret)
+		ret = pevb_dma_copy_to_user(&xfer, argp, &dma_params,
+			sizeof(dma_params),
+			dma_params.flags & PICOEVB_C2H_DMA_FLAG_TIMING);
+	pevb_pin_cache_reap(pevb_file);
+
+	return ret;
 }
 
-static int pevb_dma_c2h_single(struct pevb *pevb, dma_addr_t pcie_addr,
-	unsigned long ram_offset, unsigned long len)
+/* Drop a reference to win, freeing it with the last */
+static void pevb_window_put(struct pevb_file *pevb_file,
+	struct pevb_window *win)
 {
-	struct xlnx_dma_desc *desc;
-
-	dev_dbg(&pevb->pdev->dev, "DMA C2H BUF:0x%04lx -> PCI:0x%llx +0x%lx\n",
-		ram_offset, pcie_addr, len);
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	bool last;
 
-	/* Create descriptor */
-	desc = pevb->descs_ptr;
-	desc->control = XLNX_DMA_DESC_CONTROL_MAGIC |
-		XLNX_DMA_DESC_CONTROL_EOP |
-		XLNX_DMA_DESC_CONTROL_COMPLETED |
-		XLNX_DMA_DESC_CONTROL_STOP;
-	desc->len = len;
-	desc->src_adr = ram_offset & 0xffffffffU;
-	desc->src_adr_hi = ram_offset >> 32;
-	desc->dst_adr = pcie_addr & 0xffffffffU;
-	desc->dst_adr_hi = pcie_addr >> 32;
-	desc->nxt_adr = 0;
-	desc->nxt_adr_hi = 0;
+	mutex_lock(&pevb_file->lock);
+	last = !--win->refs;
+	mutex_unlock(&pevb_file->lock);
 
-	return pevb_dma(pevb, true);
+	if (!last)
+		return;
+	pevb_put_userbuf(&xfer, &win->ubuf);
+	kfree(win);
 }
 
-static int pevb_dma_h2c2h_multi(struct pevb *pevb, struct pevb_userbuf *src,
-	struct pevb_userbuf *dst, u64 len)
+static int pevb_ioctl_register_window(struct pevb_file *pevb_file,
+	unsigned long arg)
 {
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_register_window window_params;
+	struct pevb_window *win;
 	int ret;
-	u64 overall_len_remaining = len;
-	int src_idx = -1, dst_idx = -1;
-	dma_addr_t src_addr, dst_addr;
-	u64 src_len_remaining = 0, dst_len_remaining = 0;
-	u64 len_chunk;
 
-	if (down_interruptible(&pevb->sem))
-		return -ERESTARTSYS;
+	if (copy_from_user(&window_params, argp, sizeof(window_params)))
+		return -EFAULT;
 
-	while (overall_len_remaining) {
-		if (!src_len_remaining) {
-			src_idx++;
-			if (src_idx >= src->n_dmas) {
-				ret = -EINVAL;
-				goto unlock;
-			}
-			src_addr = src->dmas[src_idx].addr;
-			src_len_remaining = src->dmas[src_idx].len;
-		}
-		if (!dst_len_remaining) {
-			dst_idx++;
-			if (dst_idx >= dst->n_dmas) {
-				ret = -EINVAL;
-				goto unlock;
-			}
-			dst_addr = dst->dmas[dst_idx].addr;
-			dst_len_remaining = dst->dmas[dst_idx].len;
-		}
+	if (window_params.flags & ~PICOEVB_WINDOW_FLAG_C2H)
+		return -EINVAL;
+	if (!window_params.len)
+		return -EINVAL;
 
-		len_chunk = min_t(u64, src_len_remaining, dst_len_remaining);
-		len_chunk = min_t(u64, len_chunk, pevb->drvdata->fpga_ram_size);
-		len_chunk = min_t(u64, len_chunk, XLNX_DMA_DESC_LEN_MAX_WORD_ALIGNED);
-		len_chunk = min_t(u64, len_chunk, overall_len_remaining);
+	win = kzalloc(sizeof(*win), GFP_KERNEL);
+	if (!win)
+		return -ENOMEM;
+	win->len = window_params.len;
+	win->c2h = window_params.flags & PICOEVB_WINDOW_FLAG_C2H;
+	win->ubuf.persistent = true;
+	win->refs = 1;
 
-		ret = pevb_dma_h2c_single(pevb, src_addr, 0, len_chunk);
-		if (ret)
-			goto unlock;
+	ret = pevb_get_userbuf(&xfer, &win->ubuf, PEVB_MEM_MALLOC,
+		window_params.addr, window_params.len, !win->c2h);
+	if (ret)
+		goto put_userbuf;
 
-		ret = pevb_dma_c2h_single(pevb, dst_addr, 0, len_chunk);
-		if (ret)
-			goto unlock;
+	mutex_lock(&pevb_file->lock);
+	ret = idr_alloc(&pevb_file->windows, win, 0, 0, GFP_KERNEL);
+	mutex_unlock(&pevb_file->lock);
+	if (ret < 0)
+		goto put_userbuf;
+	window_params.window = ret;
 
-		overall_len_remaining -= len_chunk;
-		src_len_remaining -= len_chunk;
-		dst_len_remaining -= len_chunk;
-		src_addr += len_chunk;
-		dst_addr += len_chunk;
+	if (copy_to_user(argp, &window_params, sizeof(window_params))) {
+		ret = -EFAULT;
+		goto remove_window;
 	}
 
-	ret = 0;
+	return 0;
 
-unlock:
-	up(&pevb->sem);
+remove_window:
+	mutex_lock(&pevb_file->lock);
+	idr_remove(&pevb_file->windows, window_params.window);
+	mutex_unlock(&pevb_file->lock);
+	pevb_window_put(pevb_file, win);
 
 	return ret;
-}
 
-static int pevb_dma_h2c_multi(struct pevb *pevb, struct pevb_userbuf *src,
-	u64 dst_offset, u64 len)
-{
-	int ret;
-	u64 overall_len_remaining = len;
-	int src_idx = -1;
-	dma_addr_t src_addr;
-	u64 src_len_remaining = 0;
-	u64 len_chunk;
+put_userbuf:
+	pevb_put_userbuf(&xfer, &win->ubuf);
+	kfree(win);
 
-	if (down_interruptible(&pevb->sem))
-		return -ERESTARTSYS;
+	return ret;
+}
 
-	while (overall_len_remaining) {
-		if (!src_len_remaining) {
-			src_idx++;
-			if (src_idx >= src->n_dmas) {
-				ret = -EINVAL;
-				goto unlock;
-			}
-			src_addr = src->dmas[src_idx].addr;
-			src_len_remaining = src->dmas[src_idx].len;
-		}
+static int pevb_ioctl_unregister_window(struct pevb_file *pevb_file,
+	unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_unregister_window window_params;
+	struct pevb_window *win;
 
-		/*
-		 * We assume the caller has verified that dst_offset/len don't
-		 * exceed FPGA RAM capacity.
-		 */
-		len_chunk = min_t(u64, src_len_remaining,
-			XLNX_DMA_DESC_LEN_MAX_WORD_ALIGNED);
-		len_chunk = min_t(u64, len_chunk, overall_len_remaining);
+	if (copy_from_user(&window_params, argp, sizeof(window_params)))
+		return -EFAULT;
 
-		/*
-		 * FIXME: We should really generate a list of descriptors, and
-		 * send them to the HW all at once, to avoid IRQ latency
-		 * between transfers, when mulitple are needed. This is
-		 * possible for h2c or c2h transfers, since there's no
-		 * contention for FPGA RAM locations, unlike h2c2h transfers
-		 * where each separate transfer re-uses the RAM. However, this
-		 * makes no difference if the host has an IOMMU and hence
-		 * always presents a large contiguous mapping of the buffer.
-		 */
-		ret = pevb_dma_h2c_single(pevb, src_addr, dst_offset, len_chunk);
-		if (ret)
-			goto unlock;
+	/*
+	 * Ring transfers still using the window hold references to it.
+	 * idr_remove() only returns the entry from 4.11, so look it up first.
+	 */
+	mutex_lock(&pevb_file->lock);
+	win = idr_find(&pevb_file->windows, window_params.window);
+	if (win)
+		idr_remove(&pevb_file->windows, window_params.window);
+	mutex_unlock(&pevb_file->lock);
 
-		overall_len_remaining -= len_chunk;
-		src_len_remaining -= len_chunk;
-		src_addr += len_chunk;
-		dst_offset += len_chunk;
-	}
+	if (!win)
+		return -EINVAL;
+	pevb_window_put(pevb_file, win);
 
-	ret = 0;
+	return 0;
+}
 
-unlock:
-	up(&pevb->sem);
+static u64 pevb_ring_sq_offset(void)
+{
+	return ALIGN(sizeof(struct picoevb_rdma_ring_header), SMP_CACHE_BYTES);
+}
 
-	return ret;
+static u64 pevb_ring_cq_offset(u32 entries)
+{
+	return ALIGN(pevb_ring_sq_offset() +
+		entries * sizeof(struct picoevb_rdma_sqe), SMP_CACHE_BYTES);
 }
 
-static int pevb_dma_c2h_multi(struct pevb *pevb, u64 src_offset,
-	struct pevb_userbuf *dst, u64 len)
+static int pevb_ioctl_ring_setup(struct pevb_file *pevb_file,
+	unsigned long arg)
 {
-	int ret;
-	u64 overall_len_remaining = len;
-	int dst_idx = -1;
-	dma_addr_t dst_addr;
-	u64 dst_len_remaining = 0;
-	u64 len_chunk;
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_ring_setup ring_params;
+	struct picoevb_rdma_ring_header *ring;
+	u64 size;
 
-	if (down_interruptible(&pevb->sem))
-		return -ERESTARTSYS;
+	if (copy_from_user(&ring_params, argp, sizeof(ring_params)))
+		return -EFAULT;
 
-	while (overall_len_remaining) {
-		if (!dst_len_remaining) {
-			dst_idx++;
-			if (dst_idx >= dst->n_dmas) {
-				ret = -EINVAL;
-				goto unlock;
-			}
-			dst_addr = dst->dmas[dst_idx].addr;
-			dst_len_remaining = dst->dmas[dst_idx].len;
-		}
+	if (ring_params.reserved)
+		return -EINVAL;
+	if (!is_power_of_2(ring_params.entries) ||
+			ring_params.entries > PICOEVB_RING_ENTRIES_MAX)
+		return -EINVAL;
 
-		/*
-		 * We assume the caller has verified that dst_offset/len don't
-		 * exceed FPGA RAM capacity.
-		 */
-		len_chunk = min_t(u64, dst_len_remaining,
-			XLNX_DMA_DESC_LEN_MAX_WORD_ALIGNED);
-		len_chunk = min_t(u64, len_chunk, overall_len_remaining);
+	ring_params.sq_offset = pevb_ring_sq_offset();
+	ring_params.cq_offset = pevb_ring_cq_offset(ring_params.entries);
+	size = PAGE_ALIGN(ring_params.cq_offset +
+		ring_params.entries * sizeof(struct picoevb_rdma_cqe));
+	ring_params.mmap_size = size;
 
-		/*
-		 * FIXME: We should really generate a list of descriptors, and
-		 * send them to the HW all at once, to avoid IRQ latency
-		 * between transfers, when mulitple are needed. This is
-		 * possible for h2c or c2h transfers, since there's no
-		 * contention for FPGA RAM locations, unlike h2c2h transfers
-		 * where each separate transfer re-uses the RAM. However, this
-		 * makes no difference if the host has an IOMMU and hence
-		 * always presents a large contiguous mapping of the buffer.
-		 */
-		ret = pevb_dma_c2h_single(pevb, dst_addr, src_offset, len_chunk);
-		if (ret)
-			goto unlock;
+	ring = vmalloc_user(size);
+	if (!ring)
+		return -ENOMEM;
 
-		overall_len_remaining -= len_chunk;
-		dst_len_remaining -= len_chunk;
-		src_offset += len_chunk;
-		dst_addr += len_chunk;
+	mutex_lock(&pevb_file->ring_lock);
+	if (pevb_file->ring) {
+		mutex_unlock(&pevb_file->ring_lock);
+		vfree(ring);
+		return -EBUSY;
 	}
+	pevb_file->ring = ring;
+	pevb_file->ring_size = size;
+	pevb_file->ring_entries = ring_params.entries;
+	mutex_unlock(&pevb_file->ring_lock);
 
-	ret = 0;
-
-unlock:
-	up(&pevb->sem);
+	if (copy_to_user(argp, &ring_params, sizeof(ring_params)))
+		return -EFAULT;
 
-	return ret;
+	return 0;
 }
 
-#define H2C2H_VALID_FLAGS ( \
-	PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA | \
-	PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA \
-)
-
-static int pevb_ioctl_h2c2h_dma(struct pevb_file *pevb_file, unsigned long arg)
+/*
+ * Validate and execute one SQE. Called with pevb_file->ring_lock held, but
+ * not pevb_file->lock, which is only taken to look up the window and RAM.
+ */
+static int pevb_ring_run_sqe(struct pevb_file *pevb_file,
+	const struct picoevb_rdma_sqe *sqe, u64 *dma_time_ns)
 {
-	struct pevb *pevb = pevb_file->pevb;
-	void __user *argp = (void __user *)arg;
-	struct picoevb_rdma_h2c2h_dma dma_params;
-	struct pevb_userbuf src_ubuf = {0}, dst_ubuf = {0};
+	struct pevb_xfer xfer = { .pevb_file = pevb_file };
+	struct pevb_ram_region *ram_region;
+	struct pevb_window *win;
+	struct pevb_dma_rect rect = {0};
+	bool c2h;
 	int ret;
-	u64 ts, te;
+	u64 ts;
 
-	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
-		return -EFAULT;
+	if (sqe->flags & ~PICOEVB_RING_FLAG_IS_RAM)
+		return -EINVAL;
 
-	if (dma_params.flags & ~H2C2H_VALID_FLAGS)
+	switch (sqe->opcode) {
+	case PICOEVB_RING_OP_H2C:
+		c2h = false;
+		break;
+	case PICOEVB_RING_OP_C2H:
+		c2h = true;
+		break;
+	default:
 		return -EINVAL;
+	}
 
 	mutex_lock(&pevb_file->lock);
+	win = idr_find(&pevb_file->windows, sqe->window);
+	if (win)
+		win->refs++;
+	mutex_unlock(&pevb_file->lock);
+	if (!win)
+		return -EINVAL;
 
-	if (dma_params.flags & PICOEVB_H2C2H_DMA_FLAG_SRC_IS_CUDA)
-#ifndef NV_BUILD_NO_CUDA
-		ret = pevb_get_userbuf_cuda(pevb_file, &src_ubuf,
-			dma_params.src, dma_params.len, 1);
-#else
+	if (win->c2h != c2h || !sqe->len || sqe->window_offset > win->len ||
+			sqe->len > win->len - sqe->window_offset) {
 		ret = -EINVAL;
-#endif
-	else
-		ret = pevb_get_userbuf_pages(pevb, &src_ubuf, dma_params.src,
-			dma_params.len, 1);
-	if (ret)
-		goto put_userbuf_src;
+		goto put_window;
+	}
 
-	if (dma_params.flags & PICOEVB_H2C2H_DMA_FLAG_DST_IS_CUDA)
-#ifndef NV_BUILD_NO_CUDA
-		ret = pevb_get_userbuf_cuda(pevb_file, &dst_ubuf,
-			dma_params.dst, dma_params.len, 0);
-#else
-		ret = -EINVAL;
-#endif
-	else
-		ret = pevb_get_userbuf_pages(pevb, &dst_ubuf, dma_params.dst,
-			dma_params.len, 0);
+	ret = pevb_ram_resolve_get(pevb_file,
+		sqe->flags & PICOEVB_RING_FLAG_IS_RAM, sqe->ram_offset,
+		sqe->len, &rect.ram_offset, &ram_region);
 	if (ret)
-		goto put_userbuf_dst;
+		goto put_window;
+
+	rect.width = sqe->len;
+	rect.height = 1;
+	rect.ubuf_offset = sqe->window_offset;
+	rect.ubuf_pitch = sqe->len;
+	rect.ram_pitch = sqe->len;
 
+	/*
+	 * The window stays mapped between transfers, which on non-coherent
+	 * systems leaves cache maintenance to us: write back (H2C) or discard
+	 * (C2H) the CPU's view of the range first, and discard it again once
+	 * a C2H has written the range, in case it was speculatively refetched.
+	 */
+	pevb_sync_userbuf_pages(pevb_file->pevb, &win->ubuf,
+		sqe->window_offset, sqe->len, false);
 	ts = ktime_get_ns();
-	ret = pevb_dma_h2c2h_multi(pevb, &src_ubuf, &dst_ubuf, dma_params.len);
-	te = ktime_get_ns();
-	if (ret)
-		goto put_userbuf_dst;
+	ret = pevb_dma_rect(&xfer, c2h, &win->ubuf, &rect);
+	*dma_time_ns = ktime_get_ns() - ts;
+	if (c2h)
+		pevb_sync_userbuf_pages(pevb_file->pevb, &win->ubuf,
+			sqe->window_offset, sqe->len, true);
+	pevb_xfer_account(&xfer, !c2h, c2h, sqe->len, ret);
+	if (ram_region)
+		pevb_ram_put(pevb_file->pevb, ram_region);
+
+put_window:
+	pevb_window_put(pevb_file, win);
+
+	return ret;
+}
+
+/*
+ * Execute SQEs until the submission ring is empty or the completion ring is
+ * full. Only the driver's copies of the indices it owns are trusted, and each
+ * SQE is copied before being validated, so user-space can't change it once it
+ * has been checked.
+ */
+static int pevb_ioctl_doorbell(struct pevb_file *pevb_file)
+{
+	struct picoevb_rdma_ring_header *ring;
+	struct picoevb_rdma_sqe *sqes, sqe;
+	struct picoevb_rdma_cqe *cqes, cqe;
+	u32 mask, sq_tail, cq_head;
+	int ret, done = 0;
+
+	mutex_lock(&pevb_file->ring_lock);
+
+	ring = pevb_file->ring;
+	if (!ring) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+	mask = pevb_file->ring_entries - 1;
+	sqes = (void *)ring + pevb_ring_sq_offset();
+	cqes = (void *)ring + pevb_ring_cq_offset(pevb_file->ring_entries);
+
+	sq_tail = smp_load_acquire(&ring->sq_tail);
+	if (sq_tail - pevb_file->ring_sq_head > pevb_file->ring_entries) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	while (pevb_file->ring_sq_head != sq_tail) {
+		cq_head = smp_load_acquire(&ring->cq_head);
+		if (pevb_file->ring_cq_tail - cq_head >=
+				pevb_file->ring_entries)
+			break;
+
+		memcpy(&sqe, &sqes[pevb_file->ring_sq_head & mask],
+			sizeof(sqe));
+		pevb_file->ring_sq_head++;
+		smp_store_release(&ring->sq_head, pevb_file->ring_sq_head);
+
+		memset(&cqe, 0, sizeof(cqe));
+		cqe.user_data = sqe.user_data;
+		ret = pevb_ring_run_sqe(pevb_file, &sqe, &cqe.dma_time_ns);
+		cqe.result = ret == -ERESTARTSYS ? -EINTR : ret;
+
+		cqes[pevb_file->ring_cq_tail & mask] = cqe;
+		pevb_file->ring_cq_tail++;
+		smp_store_release(&ring->cq_tail, pevb_file->ring_cq_tail);
+		done++;
+
+		if (ret == -ERESTARTSYS)
+			break;
+	}
+	ret = done;
+
+unlock:
+	mutex_unlock(&pevb_file->ring_lock);
+
+	return ret;
+}
+
+/* Add a handle to region, consuming the caller's reference to it */
+static int pevb_ram_add_handle(struct pevb_file *pevb_file,
+	struct pevb_ram_region *region, u32 *handle)
+{
+	int ret;
+
+	mutex_lock(&pevb_file->lock);
+	ret = idr_alloc(&pevb_file->ram_handles, region, 0,
+		PICOEVB_RAM_HANDLE_MASK + 1, GFP_KERNEL);
+	mutex_unlock(&pevb_file->lock);
+	if (ret < 0) {
+		pevb_ram_put(pevb_file->pevb, region);
+		return ret;
+	}
+	*handle = ret;
 
-	dma_params.dma_time_ns = te - ts;
-	ret = copy_to_user(argp, &dma_params, sizeof(dma_params));
+	return 0;
+}
 
-	/* fall-through for cleanup */
+/*
+ * Remove a handle, returning its reference to the region, or NULL if there is
+ * no such handle. idr_remove() only returns the entry from 4.11, so look it up
+ * first.
+ */
+static struct pevb_ram_region *pevb_ram_remove_handle(
+	struct pevb_file *pevb_file, u32 handle)
+{
+	struct pevb_ram_region *region;
 
-put_userbuf_dst:
-	pevb_put_userbuf(pevb, &dst_ubuf);
-put_userbuf_src:
-	pevb_put_userbuf(pevb, &src_ubuf);
+	mutex_lock(&pevb_file->lock);
+	region = idr_find(&pevb_file->ram_handles, handle);
+	if (region)
+		idr_remove(&pevb_file->ram_handles, handle);
 	mutex_unlock(&pevb_file->lock);
 
-	return ret;
+	return region;
 }
 
-static int pevb_ioctl_card_info(struct pevb_file *pevb_file, unsigned long arg)
+static int pevb_ioctl_ram_alloc(struct pevb_file *pevb_file,
+	unsigned long arg)
 {
 	struct pevb *pevb = pevb_file->pevb;
 	void __user *argp = (void __user *)arg;
-	struct picoevb_rdma_card_info card_info_params = {0};
+	struct picoevb_rdma_ram_alloc alloc_params;
+	struct pevb_ram_region *region;
 	int ret;
 
-	card_info_params.fpga_ram_size = pevb->drvdata->fpga_ram_size;
+	if (copy_from_user(&alloc_params, argp, sizeof(alloc_params)))
+		return -EFAULT;
 
-	ret = copy_to_user(argp, &card_info_params, sizeof(card_info_params));
+	if (strnlen(alloc_params.name, sizeof(alloc_params.name)) ==
+			sizeof(alloc_params.name))
+		return -EINVAL;
+
+	region = pevb_ram_alloc(pevb, alloc_params.len, alloc_params.name);
+	if (IS_ERR(region))
+		return PTR_ERR(region);
+	alloc_params.offset = region->offset;
+	alloc_params.size = region->len;
+
+	ret = pevb_ram_add_handle(pevb_file, region, &alloc_params.handle);
 	if (ret)
 		return ret;
 
+	if (copy_to_user(argp, &alloc_params, sizeof(alloc_params))) {
+		/* User space can't free a handle it never learned */
+		region = pevb_ram_remove_handle(pevb_file, alloc_params.handle);
+		if (region)
+			pevb_ram_put(pevb, region);
+		return -EFAULT;
+	}
+
 	return 0;
 }
 
-#define H2C_VALID_FLAGS ( \
-	PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA \
-)
-
-static int pevb_ioctl_h2c_dma(struct pevb_file *pevb_file, unsigned long arg)
+static int pevb_ioctl_ram_open(struct pevb_file *pevb_file,
+	unsigned long arg)
 {
 	struct pevb *pevb = pevb_file->pevb;
 	void __user *argp = (void __user *)arg;
-	struct picoevb_rdma_h2c_dma dma_params;
-	struct pevb_userbuf src_ubuf = {0};
+	struct picoevb_rdma_ram_open open_params;
+	struct pevb_ram_region *region;
 	int ret;
-	u64 ts, te;
 
-	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
+	if (copy_from_user(&open_params, argp, sizeof(open_params)))
 		return -EFAULT;
 
-	if (dma_params.flags & ~H2C_VALID_FLAGS)
-		return -EINVAL;
-
-	if (dma_params.dst + dma_params.len > pevb->drvdata->fpga_ram_size)
+	if (!open_params.name[0] || strnlen(open_params.name,
+			sizeof(open_params.name)) == sizeof(open_params.name))
 		return -EINVAL;
 
-	mutex_lock(&pevb_file->lock);
+	region = pevb_ram_open(pevb, open_params.name);
+	if (IS_ERR(region))
+		return PTR_ERR(region);
+	open_params.offset = region->offset;
+	open_params.size = region->len;
 
-	if (dma_params.flags & PICOEVB_H2C_DMA_FLAG_SRC_IS_CUDA)
-#ifndef NV_BUILD_NO_CUDA
-		ret = pevb_get_userbuf_cuda(pevb_file, &src_ubuf,
-			dma_params.src, dma_params.len, 1);
-#else
-		ret = -EINVAL;
-#endif
-	else
-		ret = pevb_get_userbuf_pages(pevb, &src_ubuf, dma_params.src,
-			dma_params.len, 1);
+	ret = pevb_ram_add_handle(pevb_file, region, &open_params.handle);
 	if (ret)
-		goto put_userbuf_src;
+		return ret;
 
-	ts = ktime_get_ns();
-	ret = pevb_dma_h2c_multi(pevb, &src_ubuf, dma_params.dst, dma_params.len);
-	te = ktime_get_ns();
-	if (ret)
-		goto put_userbuf_src;
+	if (copy_to_user(argp, &open_params, sizeof(open_params))) {
+		/* User space can't free a handle it never learned */
+		region = pevb_ram_remove_handle(pevb_file, open_params.handle);
+		if (region)
+			pevb_ram_put(pevb, region);
+		return -EFAULT;
+	}
+
+	return 0;
+}
 
-	dma_params.dma_time_ns = te - ts;
-	ret = copy_to_user(argp, &dma_params, sizeof(dma_params));
+static int pevb_ioctl_ram_free(struct pevb_file *pevb_file,
+	unsigned long arg)
+{
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_ram_free free_params;
+	struct pevb_ram_region *region;
 
-	/* fall-through for cleanup */
+	if (copy_from_user(&free_params, argp, sizeof(free_params)))
+		return -EFAULT;
 
-put_userbuf_src:
-	pevb_put_userbuf(pevb, &src_ubuf);
-	mutex_unlock(&pevb_file->lock);
+	region = pevb_ram_remove_handle(pevb_file, free_params.handle);
+	if (!region)
+		return -EINVAL;
 
-	return ret;
-}
+	pevb_ram_put(pevb_file->pevb, region);
 
-#define C2H_VALID_FLAGS ( \
-	PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA \
-)
+	return 0;
+}
 
-static int pevb_ioctl_c2h_dma(struct pevb_file *pevb_file, unsigned long arg)
+static int pevb_ioctl_set_sched(struct pevb_file *pevb_file, unsigned long arg)
 {
 	struct pevb *pevb = pevb_file->pevb;
 	void __user *argp = (void __user *)arg;
-	struct picoevb_rdma_c2h_dma dma_params;
-	struct pevb_userbuf dst_ubuf = {0};
-	int ret;
-	u64 ts, te;
+	struct picoevb_rdma_set_sched sched_params;
 
-	if (copy_from_user(&dma_params, argp, sizeof(dma_params)))
+	if (copy_from_user(&sched_params, argp, sizeof(sched_params)))
 		return -EFAULT;
 
-	if (dma_params.flags & ~C2H_VALID_FLAGS)
+	if (sched_params.prio >= PICOEVB_PRIO_COUNT)
 		return -EINVAL;
+	if (sched_params.prio == PICOEVB_PRIO_REALTIME &&
+			!capable(CAP_SYS_NICE))
+		return -EPERM;
 
-	if (dma_params.src + dma_params.len > pevb->drvdata->fpga_ram_size)
+	if (!sched_params.weight)
+		sched_params.weight = PICOEVB_SCHED_WEIGHT_DEFAULT;
+	if (sched_params.weight > PICOEVB_SCHED_WEIGHT_MAX)
 		return -EINVAL;
 
-	mutex_lock(&pevb_file->lock);
+	spin_lock(&pevb->sched_lock);
+	pevb_file->sched_prio = sched_params.prio;
+	pevb_file->sched_weight = sched_params.weight;
+	spin_unlock(&pevb->sched_lock);
 
-	if (dma_params.flags & PICOEVB_C2H_DMA_FLAG_DST_IS_CUDA)
-#ifndef NV_BUILD_NO_CUDA
-		ret = pevb_get_userbuf_cuda(pevb_file, &dst_ubuf,
-			dma_params.dst, dma_params.len, 0);
-#else
-		ret = -EINVAL;
-#endif
-	else
-		ret = pevb_get_userbuf_pages(pevb, &dst_ubuf, dma_params.dst,
-			dma_params.len, 0);
-	if (ret)
-		goto put_userbuf_dst;
+	return 0;
+}
 
-	ts = ktime_get_ns();
-	ret = pevb_dma_c2h_multi(pevb, dma_params.src, &dst_ubuf, dma_params.len);
-	te = ktime_get_ns();
-	if (ret)
-		goto put_userbuf_dst;
+static int pevb_ioctl_sched_stats(struct pevb_file *pevb_file,
+	unsigned long arg)
+{
+	struct pevb *pevb = pevb_file->pevb;
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_sched_stats stats_params = {0};
+	struct picoevb_rdma_sched_class_stats *out;
+	struct pevb_sched_class *cls;
+	int prio;
+
+	spin_lock(&pevb->sched_lock);
+	for (prio = 0; prio < PICOEVB_PRIO_COUNT; prio++) {
+		cls = &pevb->sched_classes[prio];
+		out = &stats_params.classes[prio];
+		out->queue_depth = cls->depth;
+		out->max_queue_depth = cls->max_depth;
+		out->dispatched = cls->dispatched;
+		out->total_wait_ns = cls->total_wait_ns;
+		out->max_wait_ns = cls->max_wait_ns;
+	}
+	spin_unlock(&pevb->sched_lock);
 
-	dma_params.dma_time_ns = te - ts;
-	ret = copy_to_user(argp, &dma_params, sizeof(dma_params));
+	if (copy_to_user(argp, &stats_params, sizeof(stats_params)))
+		return -EFAULT;
 
-	/* fall-through for cleanup */
+	return 0;
+}
 
-put_userbuf_dst:
-	pevb_put_userbuf(pevb, &dst_ubuf);
-	mutex_unlock(&pevb_file->lock);
+static u64 pevb_read_perf_counter(struct pevb *pevb, u32 reg_high,
+	u32 reg_low)
+{
+	u64 val;
 
-	return ret;
+	val = (u64)pevb_readl(pevb, BAR_DMA, reg_high) << 32;
+	val |= pevb_readl(pevb, BAR_DMA, reg_low);
+
+	return val;
+}
+
+static int pevb_ioctl_perf_counters(struct pevb_file *pevb_file,
+	unsigned long arg)
+{
+	struct pevb *pevb = pevb_file->pevb;
+	void __user *argp = (void __user *)arg;
+	struct picoevb_rdma_perf_counters perf_params;
+	u32 c2h_offset;
+
+	if (copy_from_user(&perf_params, argp, sizeof(perf_params)))
+		return -EFAULT;
+
+	if (perf_params.flags & ~PICOEVB_PERF_FLAG_ARM)
+		return -EINVAL;
+	if (perf_params.reserved)
+		return -EINVAL;
+
+	c2h_offset = XLNX_REG(C2H, 0, H2C_CTRL) - XLNX_REG(H2C, 0, H2C_CTRL);
+	perf_params.h2c_cycles = pevb_read_perf_counter(pevb,
+		XLNX_REG(H2C, 0, H2C_PERF_CYC_HIGH),
+		XLNX_REG(H2C, 0, H2C_PERF_CYC_LOW));
+	perf_params.h2c_beats = pevb_read_perf_counter(pevb,
+		XLNX_REG(H2C, 0, H2C_PERF_DAT_HIGH),
+		XLNX_REG(H2C, 0, H2C_PERF_DAT_LOW));
+	perf_params.c2h_cycles = pevb_read_perf_counter(pevb,
+		XLNX_REG(H2C, 0, H2C_PERF_CYC_HIGH) + c2h_offset,
+		XLNX_REG(H2C, 0, H2C_PERF_CYC_LOW) + c2h_offset);
+	perf_params.c2h_beats = pevb_read_perf_counter(pevb,
+		XLNX_REG(H2C, 0, H2C_PERF_DAT_HIGH) + c2h_offset,
+		XLNX_REG(H2C, 0, H2C_PERF_DAT_LOW) + c2h_offset);
+
+	if (perf_params.flags & PICOEVB_PERF_FLAG_ARM) {
+		WRITE_ONCE(pevb->perf_arm[0], true);
+		WRITE_ONCE(pevb->perf_arm[1], true);
+	}
+
+	if (copy_to_user(argp, &perf_params, sizeof(perf_params)))
+		return -EFAULT;
+
+	return 0;
 }
 
 static long pevb_fops_unlocked_ioctl(struct file *filep, unsigned int cmd,
@@ -1114,6 +3780,8 @@ static long pevb_fops_unlocked_ioctl(struct file *filep, unsigned int cmd,
 		return pevb_ioctl_pin_cuda(pevb_file, arg);
 	case PICOEVB_IOC_UNPIN_CUDA:
 		return pevb_ioctl_unpin_cuda(pevb_file, arg);
+	case PICOEVB_IOC_PIN_CACHE_STATS:
+		return pevb_ioctl_pin_cache_stats(pevb_file, arg);
 #endif
 	case PICOEVB_IOC_H2C2H_DMA:
 		return pevb_ioctl_h2c2h_dma(pevb_file, arg);
@@ -1123,29 +3791,200 @@ static long pevb_fops_unlocked_ioctl(struct file *filep, unsigned int cmd,
 		return pevb_ioctl_h2c_dma(pevb_file, arg);
 	case PICOEVB_IOC_C2H_DMA:
 		return pevb_ioctl_c2h_dma(pevb_file, arg);
+	case PICOEVB_IOC_SET_SCHED:
+		return pevb_ioctl_set_sched(pevb_file, arg);
+	case PICOEVB_IOC_SCHED_STATS:
+		return pevb_ioctl_sched_stats(pevb_file, arg);
+	case PICOEVB_IOC_H2C_2D_DMA:
+		return pevb_ioctl_h2c_2d_dma(pevb_file, arg);
+	case PICOEVB_IOC_C2H_2D_DMA:
+		return pevb_ioctl_c2h_2d_dma(pevb_file, arg);
+	case PICOEVB_IOC_REGISTER_WINDOW:
+		return pevb_ioctl_register_window(pevb_file, arg);
+	case PICOEVB_IOC_UNREGISTER_WINDOW:
+		return pevb_ioctl_unregister_window(pevb_file, arg);
+	case PICOEVB_IOC_RING_SETUP:
+		return pevb_ioctl_ring_setup(pevb_file, arg);
+	case PICOEVB_IOC_DOORBELL:
+		return pevb_ioctl_doorbell(pevb_file);
+	case PICOEVB_IOC_PERF_COUNTERS:
+		return pevb_ioctl_perf_counters(pevb_file, arg);
+	case PICOEVB_IOC_RAM_ALLOC:
+		return pevb_ioctl_ram_alloc(pevb_file, arg);
+	case PICOEVB_IOC_RAM_OPEN:
+		return pevb_ioctl_ram_open(pevb_file, arg);
+	case PICOEVB_IOC_RAM_FREE:
+		return pevb_ioctl_ram_free(pevb_file, arg);
 	default:
 		return -EINVAL;
 	}
 }
 
+/* Maps the rings set up by PICOEVB_IOC_RING_SETUP */
+static int pevb_fops_mmap(struct file *filep, struct vm_area_struct *vma)
+{
+	struct pevb_file *pevb_file = filep->private_data;
+	int ret;
+
+	mutex_lock(&pevb_file->ring_lock);
+	if (!pevb_file->ring)
+		ret = -ENODEV;
+	else if (vma->vm_pgoff || vma->vm_end - vma->vm_start >
+			pevb_file->ring_size)
+		ret = -EINVAL;
+	else
+		ret = remap_vmalloc_range(vma, pevb_file->ring, 0);
+	mutex_unlock(&pevb_file->ring_lock);
+
+	return ret;
+}
+
+static const char * const pevb_chan_names[2] = { "h2c", "c2h" };
+
+static u64 pevb_stat_read(atomic64_t *stat)
+{
+	return atomic64_read(stat);
+}
+
+/* Percentage of the time since since_ns that the DMA engine spent on stats */
+static u64 pevb_stats_utilisation(struct pevb_chan_stats *stats, u64 since_ns)
+{
+	u64 busy_ns = pevb_stat_read(&stats[0].busy_ns) +
+		pevb_stat_read(&stats[1].busy_ns);
+	u64 elapsed_ns = ktime_get_ns() - since_ns;
+
+	return elapsed_ns ? div64_u64(busy_ns * 100, elapsed_ns) : 0;
+}
+
+/* The file's counters, in the style of DRM's fdinfo keys */
+static void pevb_fops_show_fdinfo(struct seq_file *m, struct file *filep)
+{
+	struct pevb_file *pevb_file = filep->private_data;
+	struct pevb_chan_stats *stats;
+	const char *name;
+	int c2h;
+
+	seq_printf(m, "picoevb-prio:\t%u\n", READ_ONCE(pevb_file->sched_prio));
+	seq_printf(m, "picoevb-weight:\t%u\n",
+		READ_ONCE(pevb_file->sched_weight));
+	for (c2h = 0; c2h < 2; c2h++) {
+		stats = &pevb_file->stats[c2h];
+		name = pevb_chan_names[c2h];
+		seq_printf(m, "picoevb-%s-transfers:\t%llu\n", name,
+			pevb_stat_read(&stats->transfers));
+		seq_printf(m, "picoevb-%s-bytes:\t%llu\n", name,
+			pevb_stat_read(&stats->bytes));
+		seq_printf(m, "picoevb-%s-errors:\t%llu\n", name,
+			pevb_stat_read(&stats->errors));
+		seq_printf(m, "picoevb-%s-pin:\t%llu ns\n", name,
+			pevb_stat_read(&stats->pin_ns));
+		seq_printf(m, "picoevb-%s-map:\t%llu ns\n", name,
+			pevb_stat_read(&stats->map_ns));
+		seq_printf(m, "picoevb-%s-busy:\t%llu ns\n", name,
+			pevb_stat_read(&stats->busy_ns));
+	}
+	seq_printf(m, "picoevb-utilisation:\t%llu %%\n",
+		pevb_stats_utilisation(pevb_file->stats, pevb_file->open_ns));
+}
+
 static const struct file_operations pevb_fops = {
 	.owner		= THIS_MODULE,
 	.open		= pevb_fops_open,
 	.release	= pevb_fops_release,
 	.unlocked_ioctl	= pevb_fops_unlocked_ioctl,
+	.mmap		= pevb_fops_mmap,
+	.show_fdinfo	= pevb_fops_show_fdinfo,
 };
 
-static int pevb_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
+/*
+ * The card's counters, one per file in the device node's stats directory,
+ * e.g. /sys/class/picoevb/picoevb/stats/h2c_bytes.
+ */
+#define PEVB_STATS_ATTR(chan, c2h, field) \
+static ssize_t chan##_##field##_show(struct device *dev, \
+	struct device_attribute *attr, char *buf) \
+{ \
+	struct pevb *pevb = dev_get_drvdata(dev); \
+\
+	return sprintf(buf, "%llu\n", \
+		pevb_stat_read(&pevb->stats[c2h].field)); \
+} \
+static DEVICE_ATTR_RO(chan##_##field)
+
+#define PEVB_STATS_ATTRS(chan, c2h) \
+	PEVB_STATS_ATTR(chan, c2h, transfers); \
+	PEVB_STATS_ATTR(chan, c2h, bytes); \
+	PEVB_STATS_ATTR(chan, c2h, errors); \
+	PEVB_STATS_ATTR(chan, c2h, pin_ns); \
+	PEVB_STATS_ATTR(chan, c2h, map_ns); \
+	PEVB_STATS_ATTR(chan, c2h, busy_ns)
+
+PEVB_STATS_ATTRS(h2c, 0);
+PEVB_STATS_ATTRS(c2h, 1);
+
+static ssize_t utilisation_show(struct device *dev,
+	struct device_attribute *attr, char *buf)
 {
-	struct pevb *pevb;
-	int ret;
+	struct pevb *pevb = dev_get_drvdata(dev);
 
-	pevb = devm_kzalloc(&pdev->dev, sizeof(*pevb), GFP_KERNEL);
-	if (!pevb)
-		return -ENOMEM;
-	pci_set_drvdata(pdev, pevb);
-	pevb->pdev = pdev;
-	pevb->drvdata = (const struct pevb_drvdata *)ent->driver_data;
+	return sprintf(buf, "%llu\n",
+		pevb_stats_utilisation(pevb->stats, pevb->stats_start_ns));
+}
+static DEVICE_ATTR_RO(utilisation);
+
+#define PEVB_STATS_ATTR_PTRS(chan) \
+	&dev_attr_##chan##_transfers.attr, \
+	&dev_attr_##chan##_bytes.attr, \
+	&dev_attr_##chan##_errors.attr, \
+	&dev_attr_##chan##_pin_ns.attr, \
+	&dev_attr_##chan##_map_ns.attr, \
+	&dev_attr_##chan##_busy_ns.attr
+
+static struct attribute *pevb_stats_attrs[] = {
+	PEVB_STATS_ATTR_PTRS(h2c),
+	PEVB_STATS_ATTR_PTRS(c2h),
+	&dev_attr_utilisation.attr,
+	NULL
+};
+
+static const struct attribute_group pevb_stats_group = {
+	.name	= "stats",
+	.attrs	= pevb_stats_attrs,
+};
+
+static const struct attribute_group *pevb_devnode_groups[] = {
+	&pevb_stats_group,
+	NULL
+};
+
+/*
+ * Bounce buffers are optional; if they can't all be allocated, the channel
+ * just doesn't use them. They're freed along with the device.
+ */
+static void pevb_bounce_alloc(struct pevb *pevb, struct pevb_bounce_chan *chan)
+{
+	int i;
+
+	for (i = 0; i < PEVB_BOUNCE_BUFS; i++) {
+		chan->cpu_addr[i] = dmam_alloc_coherent(pevb->dev,
+			PEVB_BOUNCE_SIZE, &chan->dma_addr[i], GFP_KERNEL);
+		if (!chan->cpu_addr[i]) {
+			dev_warn(pevb->dev,
+				"dma_alloc_coherent(bounce): failed\n");
+			return;
+		}
+	}
+	chan->free = (1UL << PEVB_BOUNCE_BUFS) - 1;
+}
+
+/*
+ * Set up the parts of pevb common to all devices, and create the device node.
+ * pevb->dev and pevb->drvdata must already be set.
+ */
+static int pevb_add(struct pevb *pevb)
+{
+	struct device *dev = pevb->dev;
+	int ret, i;
 
 	/*
 	 * In practice, there is a limit of FPGA_RAM_SIZE. However, since every
@@ -1159,50 +3998,180 @@ static int pevb_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 	 * so can accept arbitrarily long IOVA chunks in sg lists.
 	 */
 	pevb->dma_params.max_segment_size = UINT_MAX;
-	pdev->dev.dma_parms = &pevb->dma_params;
-
-	sema_init(&pevb->sem, 1);
+	dev->dma_parms = &pevb->dma_params;
+
+	spin_lock_init(&pevb->sched_lock);
+	mutex_init(&pevb->ram_lock);
+	INIT_LIST_HEAD(&pevb->ram_regions);
+	init_waitqueue_head(&pevb->sched_wq);
+	for (i = 0; i < PICOEVB_PRIO_COUNT; i++)
+		INIT_LIST_HEAD(&pevb->sched_classes[i].waiters);
 	init_completion(&pevb->dma_xfer_cmpl);
 
-	pevb->descs_ptr = dmam_alloc_coherent(&pdev->dev, SZ_4K,
+	pevb->descs_ptr = dmam_alloc_coherent(dev,
+		PEVB_DESCS_MAX * sizeof(*pevb->descs_ptr),
 		&pevb->descs_dma_addr, GFP_KERNEL);
 	if (!pevb->descs_ptr) {
-		dev_err(&pdev->dev,
-			"dma_alloc_coherent(descriptors): failed\n");
-		return -ENOMEM;
+		dev_err(dev, "dma_alloc_coherent(descriptors): failed\n");
+		ret = -ENOMEM;
+		goto err_clear_dma_parms;
 	}
 
+	pevb_bounce_alloc(pevb, &pevb->bounce[0]);
+	pevb_bounce_alloc(pevb, &pevb->bounce[1]);
+
 	ret = alloc_chrdev_region(&pevb->devt, 0, 1, MODULENAME);
 	if (ret < 0) {
-		dev_err(&pdev->dev, "alloc_chrdev_region(): %d\n", ret);
-		return ret;
+		dev_err(dev, "alloc_chrdev_region(): %d\n", ret);
+		goto err_clear_dma_parms;
 	}
 
 	cdev_init(&pevb->cdev, &pevb_fops);
 	ret = cdev_add(&pevb->cdev, pevb->devt, 1);
 	if (ret < 0) {
-		dev_err(&pdev->dev, "cdev_add(): %d\n", ret);
+		dev_err(dev, "cdev_add(): %d\n", ret);
 		goto err_unregister_chrdev_region;
 	}
 
-	pevb->devnode = device_create(pevb_class, &pevb->pdev->dev, pevb->devt,
-		NULL, "picoevb");
+	pevb->stats_start_ns = ktime_get_ns();
+	pevb->devnode = device_create_with_groups(pevb_class, dev, pevb->devt,
+		pevb, pevb_devnode_groups, "picoevb");
 	if (!pevb->devnode) {
 		ret = -ENOMEM;
 		goto err_cdev_del;
 	}
 
+	return 0;
+
+err_cdev_del:
+	cdev_del(&pevb->cdev);
+err_unregister_chrdev_region:
+	unregister_chrdev_region(pevb->devt, 1);
+err_clear_dma_parms:
+	dev->dma_parms = NULL;
+	return ret;
+}
+
+static void pevb_del(struct pevb *pevb)
+{
+	if (pevb->chan_ready[0])
+		pevb_dma_chan_reset(pevb, false);
+	if (pevb->chan_ready[1])
+		pevb_dma_chan_reset(pevb, true);
+	device_destroy(pevb_class, pevb->devt);
+	cdev_del(&pevb->cdev);
+	unregister_chrdev_region(pevb->devt, 1);
+	pevb->dev->dma_parms = NULL;
+}
+
+#ifdef NV_BUILD_XDMA_SIM
+static struct pevb_drvdata drvdata_sim = {
+	.num_h2c_chans = 1,
+};
+
+static struct platform_device *pevb_sim_pdev;
+
+static int pevb_sim_probe(struct platform_device *pdev)
+{
+	struct pevb *pevb;
+	int ret;
+
+	pevb = devm_kzalloc(&pdev->dev, sizeof(*pevb), GFP_KERNEL);
+	if (!pevb)
+		return -ENOMEM;
+	platform_set_drvdata(pdev, pevb);
+	pevb->dev = &pdev->dev;
+	pevb->drvdata = &drvdata_sim;
+
+	pevb->sim = xdma_sim_create(drvdata_sim.fpga_ram_size, &sim_model,
+		pevb_irq_handler, pevb);
+	if (!pevb->sim)
+		return -ENOMEM;
+
+	ret = pevb_add(pevb);
+	if (ret)
+		xdma_sim_destroy(pevb->sim);
+
+	return ret;
+}
+
+static int pevb_sim_remove(struct platform_device *pdev)
+{
+	struct pevb *pevb = platform_get_drvdata(pdev);
+
+	pevb_del(pevb);
+	xdma_sim_destroy(pevb->sim);
+
+	return 0;
+}
+
+static struct platform_driver pevb_sim_driver = {
+	.probe		= pevb_sim_probe,
+	.remove		= pevb_sim_remove,
+	.driver		= {
+		.name	= MODULENAME "-sim",
+	},
+};
+
+static int pevb_sim_register(void)
+{
+	struct platform_device_info info = {
+		.name		= MODULENAME "-sim",
+		.id		= PLATFORM_DEVID_NONE,
+		.dma_mask	= DMA_BIT_MASK(64),
+	};
+	int ret;
+
+	drvdata_sim.fpga_ram_size = sim_ram_size;
+
+	ret = platform_driver_register(&pevb_sim_driver);
+	if (ret)
+		return ret;
+
+	pevb_sim_pdev = platform_device_register_full(&info);
+	if (IS_ERR(pevb_sim_pdev)) {
+		platform_driver_unregister(&pevb_sim_driver);
+		return PTR_ERR(pevb_sim_pdev);
+	}
+
+	return 0;
+}
+
+static void pevb_sim_unregister(void)
+{
+	platform_device_unregister(pevb_sim_pdev);
+	platform_driver_unregister(&pevb_sim_driver);
+}
+#endif
+
+static int pevb_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
+{
+	struct pevb *pevb;
+	int ret;
+
+	pevb = devm_kzalloc(&pdev->dev, sizeof(*pevb), GFP_KERNEL);
+	if (!pevb)
+		return -ENOMEM;
+	pci_set_drvdata(pdev, pevb);
+	pevb->pdev = pdev;
+	pevb->dev = &pdev->dev;
+	pevb->drvdata = (const struct pevb_drvdata *)ent->driver_data;
+
+	ret = pevb_add(pevb);
+	if (ret)
+		return ret;
+
 	ret = pcim_enable_device(pdev);
 	if (ret < 0) {
 		dev_err(&pdev->dev, "pci_enable_device(): %d\n", ret);
-		goto err_device_destroy;
+		goto err_del;
 	}
 
 	ret = pcim_iomap_regions(pdev, BIT(BAR_GPIO) | BIT(BAR_DMA),
 		MODULENAME);
 	if (ret < 0) {
 		dev_err(&pdev->dev, "pcim_iomap_regions(): %d\n", ret);
-		goto err_device_destroy;
+		goto err_del;
 	}
 	pevb->iomap = pcim_iomap_table(pdev);
 
@@ -1220,12 +4189,8 @@ static int pevb_probe(struct pci_dev *pdev, const struct pci_device_id *ent)
 
 err_clear_master:
 	pci_clear_master(pdev);
-err_device_destroy:
-	device_destroy(pevb_class, pevb->devt);
-err_cdev_del:
-	cdev_del(&pevb->cdev);
-err_unregister_chrdev_region:
-	unregister_chrdev_region(pevb->devt, 1);
+err_del:
+	pevb_del(pevb);
 	return ret;
 }
 
@@ -1235,10 +4200,7 @@ static void pevb_remove(struct pci_dev *pdev)
 
 	free_irq(pdev->irq, pevb);
 	pci_clear_master(pdev);
-	device_destroy(pevb_class, pevb->devt);
-	cdev_del(&pevb->cdev);
-	unregister_chrdev_region(pevb->devt, 1);
-	pdev->dev.dma_parms = NULL;
+	pevb_del(pevb);
 }
 
 static void pevb_shutdown(struct pci_dev *pdev)
@@ -1286,7 +4248,11 @@ static int __init pevb_init(void)
 	if (!pevb_class)
 		return -ENOMEM;
 
+#ifdef NV_BUILD_XDMA_SIM
+	ret = pevb_sim_register();
+#else
 	ret = pci_register_driver(&pevb_driver);
+#endif
 	if (ret)
 		class_destroy(pevb_class);
 
@@ -1296,7 +4262,11 @@ module_init(pevb_init);
 
 static void __exit pevb_exit(void)
 {
+#ifdef NV_BUILD_XDMA_SIM
+	pevb_sim_unregister();
+#else
 	pci_unregister_driver(&pevb_driver);
+#endif
 	class_destroy(pevb_class);
 }
 module_exit(pevb_exit);
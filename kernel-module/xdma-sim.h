@@ -0,0 +1,490 @@
+/*
+ * Copyright (c) 2026, NVIDIA CORPORATION.  All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ */
+
+/*
+ * Software model of the FPGA: the GPIO register, and the XDMA register block
+ * and descriptor engines for H2C and C2H channel 0, with FPGA RAM in vmalloc()
+ * memory. This allows the driver to be exercised, and its submission path to
+ * be benchmarked, on systems without a PicoEVB or HTG-K800.
+ *
+ * When a channel's RUN bit is set, a work item walks the descriptor chain and
+ * copies the data between host memory and FPGA RAM. Completion is then
+ * signalled from an hrtimer, at the time the transfer would have completed
+ * according to struct xdma_sim_model. Register accesses made from the
+ * simulated IRQ are handled the same as those from any other context.
+ *
+ * Bus addresses in descriptors are treated as physical addresses. This holds
+ * for DMA mappings of a device with no IOMMU and no DMA offset, such as a
+ * platform device on x86.
+ */
+
+#ifndef __XDMA_SIM_H__
+#define __XDMA_SIM_H__
+
+#include <linux/highmem.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/sizes.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+
+#include "picoevb-rdma.h"
+
+/* Guards against descriptor chains that don't terminate */
+#define XDMA_SIM_DESCS_MAX	SZ_64K
+/* For the performance counters; the core runs at 250MHz with a 64-bit bus */
+#define XDMA_SIM_AXI_MHZ	250
+#define XDMA_SIM_AXI_BYTES	8
+
+/* May be modified while the model is in use */
+struct xdma_sim_model {
+	/* Data transfer rate in MB/s; 0 for unlimited */
+	unsigned int bw_mbps;
+	/* Time from setting RUN until the first descriptor starts */
+	unsigned int latency_ns;
+	/* Time to fetch each descriptor */
+	unsigned int desc_ns;
+};
+
+struct xdma_sim;
+
+struct xdma_sim_chan {
+	struct xdma_sim		*sim;
+	bool			c2h;
+	u64			desc_addr;
+	u32			ctrl;
+	u32			status;
+	u32			int_en;
+	u32			completed_desc_count;
+	u32			perf_ctrl;
+	u64			perf_cyc;
+	u64			perf_dat;
+	/* When RUN was set */
+	u64			start_ns;
+	/* Results of running the descriptor chain, reported on completion */
+	u32			run_status;
+	u32			run_descs;
+	u64			run_len;
+	struct work_struct	work;
+	struct hrtimer		timer;
+};
+
+struct xdma_sim {
+	/* Protects all register state */
+	spinlock_t			lock;
+	const struct xdma_sim_model	*model;
+	irq_handler_t			irq_handler;
+	void				*irq_data;
+	u32				gpio;
+	u32				irq_ch_int_en;
+	void				*ram;
+	u64				ram_size;
+	struct xdma_sim_chan		h2c;
+	struct xdma_sim_chan		c2h;
+};
+
+static u32 xdma_sim_irq_bit(struct xdma_sim_chan *chan)
+{
+	/* The simulated core has a single H2C channel */
+	return chan->c2h ? XLNX_DMA_IRQ_CH_C2H_BIT(0, 1) :
+		XLNX_DMA_IRQ_CH_H2C_BIT(0);
+}
+
+/*
+ * Copy between a kernel buffer and host physical memory. Returns false if
+ * any of the physical range isn't RAM.
+ */
+static bool xdma_sim_copy_phys(void *buf, u64 phys, u64 len, bool to_phys)
+{
+	struct page *page;
+	u64 chunk;
+	void *va;
+
+	while (len) {
+		if (!pfn_valid(PHYS_PFN(phys)))
+			return false;
+		page = pfn_to_page(PHYS_PFN(phys));
+		chunk = min_t(u64, len, PAGE_SIZE - offset_in_page(phys));
+
+		va = kmap(page) + offset_in_page(phys);
+		if (to_phys)
+			memcpy(va, buf, chunk);
+		else
+			memcpy(buf, va, chunk);
+		kunmap(page);
+
+		buf += chunk;
+		phys += chunk;
+		len -= chunk;
+	}
+
+	return true;
+}
+
+/* Returns status bits describing the outcome */
+static u32 xdma_sim_run_desc(struct xdma_sim_chan *chan,
+	struct xlnx_dma_desc *desc)
+{
+	struct xdma_sim *sim = chan->sim;
+	u64 src = ((u64)desc->src_adr_hi << 32) | desc->src_adr;
+	u64 dst = ((u64)desc->dst_adr_hi << 32) | desc->dst_adr;
+	u64 ram_offset = chan->c2h ? src : dst;
+	u64 host_addr = chan->c2h ? dst : src;
+
+	if ((desc->control & 0xffff0000U) != XLNX_DMA_DESC_CONTROL_MAGIC)
+		return XLNX_DMA_H2C_STATUS_MAGIC_STOPPED;
+	if (desc->len > XLNX_DMA_DESC_LEN_MAX)
+		return XLNX_DMA_H2C_STATUS_INVALID_LEN;
+
+	/* Card-side errors are reported as write errors for H2C, and so on */
+	if (ram_offset > sim->ram_size ||
+			desc->len > sim->ram_size - ram_offset)
+		return chan->c2h ?
+			BIT(XLNX_DMA_H2C_STATUS_READ_ERR_SHIFT) :
+			BIT(XLNX_DMA_H2C_STATUS_WRITE_ERR_SHIFT);
+	if (!xdma_sim_copy_phys(sim->ram + ram_offset, host_addr, desc->len,
+			chan->c2h))
+		return chan->c2h ?
+			BIT(XLNX_DMA_H2C_STATUS_WRITE_ERR_SHIFT) :
+			BIT(XLNX_DMA_H2C_STATUS_READ_ERR_SHIFT);
+
+	return 0;
+}
+
+static void xdma_sim_work(struct work_struct *work)
+{
+	struct xdma_sim_chan *chan =
+		container_of(work, struct xdma_sim_chan, work);
+	struct xdma_sim *sim = chan->sim;
+	const struct xdma_sim_model *model = sim->model;
+	struct xlnx_dma_desc desc;
+	unsigned long flags;
+	u64 desc_addr, len = 0, duration;
+	u32 status = 0, n_descs = 0;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	desc_addr = chan->desc_addr;
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	for (;;) {
+		if (n_descs >= XDMA_SIM_DESCS_MAX ||
+				!xdma_sim_copy_phys(&desc, desc_addr,
+					sizeof(desc), false)) {
+			status = BIT(XLNX_DMA_H2C_STATUS_DESC_ERR_SHIFT);
+			break;
+		}
+		n_descs++;
+
+		status = xdma_sim_run_desc(chan, &desc);
+		if (status)
+			break;
+		len += desc.len;
+
+		if (desc.control & XLNX_DMA_DESC_CONTROL_STOP) {
+			status = XLNX_DMA_H2C_STATUS_DESC_STOPPED;
+			if (desc.control & XLNX_DMA_DESC_CONTROL_COMPLETED)
+				status |= XLNX_DMA_H2C_STATUS_DESC_COMPLETED;
+			break;
+		}
+		desc_addr = ((u64)desc.nxt_adr_hi << 32) | desc.nxt_adr;
+	}
+
+	duration = model->latency_ns + (u64)n_descs * model->desc_ns;
+	if (model->bw_mbps)
+		duration += div_u64(len * NSEC_PER_USEC, model->bw_mbps);
+
+	spin_lock_irqsave(&sim->lock, flags);
+	if (chan->ctrl & XLNX_DMA_H2C_CTRL_RUN) {
+		chan->run_status = status;
+		chan->run_descs = n_descs;
+		chan->run_len = len;
+		hrtimer_start(&chan->timer,
+			ns_to_ktime(chan->start_ns + duration),
+			HRTIMER_MODE_ABS);
+	}
+	spin_unlock_irqrestore(&sim->lock, flags);
+}
+
+static enum hrtimer_restart xdma_sim_timer(struct hrtimer *timer)
+{
+	struct xdma_sim_chan *chan =
+		container_of(timer, struct xdma_sim_chan, timer);
+	struct xdma_sim *sim = chan->sim;
+	unsigned long flags;
+	bool irq;
+
+	spin_lock_irqsave(&sim->lock, flags);
+	chan->status &= ~XLNX_DMA_H2C_STATUS_BUSY;
+	chan->status |= chan->run_status;
+	chan->completed_desc_count += chan->run_descs;
+	if (chan->perf_ctrl & XLNX_DMA_H2C_PERF_CTRL_RUN) {
+		chan->perf_cyc += div_u64((ktime_get_ns() - chan->start_ns) *
+			XDMA_SIM_AXI_MHZ, NSEC_PER_USEC);
+		chan->perf_dat += DIV_ROUND_UP_ULL(chan->run_len,
+			XDMA_SIM_AXI_BYTES);
+		if (chan->perf_ctrl & XLNX_DMA_H2C_PERF_CTRL_AUTO_STOP)
+			chan->perf_ctrl &= ~XLNX_DMA_H2C_PERF_CTRL_RUN;
+	}
+	irq = (sim->irq_ch_int_en & xdma_sim_irq_bit(chan)) &&
+		(chan->int_en & chan->status);
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	if (irq)
+		sim->irq_handler(0, sim->irq_data);
+
+	return HRTIMER_NORESTART;
+}
+
+static void xdma_sim_chan_init(struct xdma_sim *sim,
+	struct xdma_sim_chan *chan, bool c2h)
+{
+	chan->sim = sim;
+	chan->c2h = c2h;
+	INIT_WORK(&chan->work, xdma_sim_work);
+	hrtimer_init(&chan->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	chan->timer.function = xdma_sim_timer;
+}
+
+/* Stop any transfer in progress. May sleep */
+static void xdma_sim_chan_stop(struct xdma_sim_chan *chan)
+{
+	cancel_work_sync(&chan->work);
+	hrtimer_cancel(&chan->timer);
+}
+
+static struct xdma_sim *xdma_sim_create(u64 ram_size,
+	const struct xdma_sim_model *model, irq_handler_t irq_handler,
+	void *irq_data)
+{
+	struct xdma_sim *sim;
+
+	sim = kzalloc(sizeof(*sim), GFP_KERNEL);
+	if (!sim)
+		return NULL;
+
+	sim->ram = vzalloc(ram_size);
+	if (!sim->ram) {
+		kfree(sim);
+		return NULL;
+	}
+
+	spin_lock_init(&sim->lock);
+	sim->model = model;
+	sim->irq_handler = irq_handler;
+	sim->irq_data = irq_data;
+	sim->ram_size = ram_size;
+	xdma_sim_chan_init(sim, &sim->h2c, false);
+	xdma_sim_chan_init(sim, &sim->c2h, true);
+
+	return sim;
+}
+
+static void xdma_sim_destroy(struct xdma_sim *sim)
+{
+	xdma_sim_chan_stop(&sim->h2c);
+	xdma_sim_chan_stop(&sim->c2h);
+	vfree(sim->ram);
+	kfree(sim);
+}
+
+static struct xdma_sim_chan *xdma_sim_reg_chan(struct xdma_sim *sim, u32 reg)
+{
+	u32 target = reg >> 12;
+
+	/* Only channel 0 exists */
+	if (reg & 0xf00)
+		return NULL;
+
+	switch (target) {
+	case XLNX_DMA_TARGET_H2C:
+	case XLNX_DMA_TARGET_H2C_SGDMA:
+		return &sim->h2c;
+	case XLNX_DMA_TARGET_C2H:
+	case XLNX_DMA_TARGET_C2H_SGDMA:
+		return &sim->c2h;
+	default:
+		return NULL;
+	}
+}
+
+static u32 xdma_sim_readl(struct xdma_sim *sim, int bar, u32 reg)
+{
+	struct xdma_sim_chan *chan;
+	unsigned long flags;
+	u32 val = 0;
+
+	spin_lock_irqsave(&sim->lock, flags);
+
+	if (bar == 0) {
+		if (!reg)
+			val = sim->gpio;
+		goto unlock;
+	}
+
+	chan = xdma_sim_reg_chan(sim, reg);
+	if (!chan) {
+		if (reg == XLNX_REG(IRQ, 0, IRQ_CH_INT_EN))
+			val = sim->irq_ch_int_en;
+		goto unlock;
+	}
+
+	if ((reg >> 12) == XLNX_DMA_TARGET_H2C_SGDMA ||
+			(reg >> 12) == XLNX_DMA_TARGET_C2H_SGDMA) {
+		switch (reg & 0xff) {
+		case XLNX_DMA_H2C_SGDMA_DESC_LOW_ADDR:
+			val = chan->desc_addr & 0xffffffffU;
+			break;
+		case XLNX_DMA_H2C_SGDMA_DESC_HIGH_ADDR:
+			val = chan->desc_addr >> 32;
+			break;
+		}
+		goto unlock;
+	}
+
+	switch (reg & 0xff) {
+	case XLNX_DMA_H2C_CTRL:
+		val = chan->ctrl;
+		break;
+	case XLNX_DMA_H2C_STATUS:
+		val = chan->status;
+		break;
+	case XLNX_DMA_H2C_STATUS_RD_CLR:
+		val = chan->status;
+		chan->status &= XLNX_DMA_H2C_STATUS_BUSY;
+		break;
+	case XLNX_DMA_H2C_COMPLETED_DESC_COUNT:
+		val = chan->completed_desc_count;
+		break;
+	case XLNX_DMA_H2C_INT_EN:
+		val = chan->int_en;
+		break;
+	case XLNX_DMA_H2C_PERF_CTRL:
+		val = chan->perf_ctrl;
+		break;
+	case XLNX_DMA_H2C_PERF_CYC_LOW:
+		val = chan->perf_cyc & 0xffffffffU;
+		break;
+	case XLNX_DMA_H2C_PERF_CYC_HIGH:
+		val = chan->perf_cyc >> 32;
+		break;
+	case XLNX_DMA_H2C_PERF_DAT_LOW:
+		val = chan->perf_dat & 0xffffffffU;
+		break;
+	case XLNX_DMA_H2C_PERF_DAT_HIGH:
+		val = chan->perf_dat >> 32;
+		break;
+	}
+
+unlock:
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	return val;
+}
+
+/* May sleep, if it stops a channel */
+static void xdma_sim_writel(struct xdma_sim *sim, int bar, u32 val, u32 reg)
+{
+	struct xdma_sim_chan *chan = NULL;
+	unsigned long flags;
+	u32 ctrl;
+	bool stop = false;
+
+	spin_lock_irqsave(&sim->lock, flags);
+
+	if (bar == 0) {
+		if (!reg)
+			sim->gpio = val;
+		goto unlock;
+	}
+
+	chan = xdma_sim_reg_chan(sim, reg);
+	if (!chan) {
+		if (reg == XLNX_REG(IRQ, 0, IRQ_CH_INT_EN))
+			sim->irq_ch_int_en = val;
+		else if (reg == XLNX_REG(IRQ, 0, IRQ_CH_INT_EN_W1S))
+			sim->irq_ch_int_en |= val;
+		else if (reg == XLNX_REG(IRQ, 0, IRQ_CH_INT_EN_W1C))
+			sim->irq_ch_int_en &= ~val;
+		/* SGDMA_CTRL descriptor halts take effect immediately */
+		goto unlock;
+	}
+
+	if ((reg >> 12) == XLNX_DMA_TARGET_H2C_SGDMA ||
+			(reg >> 12) == XLNX_DMA_TARGET_C2H_SGDMA) {
+		switch (reg & 0xff) {
+		case XLNX_DMA_H2C_SGDMA_DESC_LOW_ADDR:
+			chan->desc_addr &= ~0xffffffffULL;
+			chan->desc_addr |= val;
+			break;
+		case XLNX_DMA_H2C_SGDMA_DESC_HIGH_ADDR:
+			chan->desc_addr &= 0xffffffffULL;
+			chan->desc_addr |= (u64)val << 32;
+			break;
+		}
+		goto unlock;
+	}
+
+	ctrl = chan->ctrl;
+	switch (reg & 0xff) {
+	case XLNX_DMA_H2C_CTRL:
+		ctrl = val;
+		break;
+	case XLNX_DMA_H2C_CTRL_W1S:
+		ctrl |= val;
+		break;
+	case XLNX_DMA_H2C_CTRL_W1C:
+		ctrl &= ~val;
+		break;
+	case XLNX_DMA_H2C_INT_EN:
+		chan->int_en = val;
+		break;
+	case XLNX_DMA_H2C_INT_EN_W1S:
+		chan->int_en |= val;
+		break;
+	case XLNX_DMA_H2C_INT_EN_W1C:
+		chan->int_en &= ~val;
+		break;
+	case XLNX_DMA_H2C_PERF_CTRL:
+		chan->perf_ctrl = val;
+		if (val & XLNX_DMA_H2C_PERF_CTRL_RUN) {
+			chan->perf_cyc = 0;
+			chan->perf_dat = 0;
+		}
+		break;
+	}
+
+	if ((ctrl & XLNX_DMA_H2C_CTRL_RUN) &&
+			!(chan->ctrl & XLNX_DMA_H2C_CTRL_RUN)) {
+		chan->status |= XLNX_DMA_H2C_STATUS_BUSY;
+		chan->start_ns = ktime_get_ns();
+		queue_work(system_unbound_wq, &chan->work);
+	} else if (!(ctrl & XLNX_DMA_H2C_CTRL_RUN) &&
+			(chan->ctrl & XLNX_DMA_H2C_CTRL_RUN)) {
+		chan->status &= ~XLNX_DMA_H2C_STATUS_BUSY;
+		stop = true;
+	}
+	chan->ctrl = ctrl;
+
+unlock:
+	spin_unlock_irqrestore(&sim->lock, flags);
+
+	if (stop)
+		xdma_sim_chan_stop(chan);
+}
+
+#endif